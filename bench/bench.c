@@ -0,0 +1,572 @@
+// bench.c
+// Reproducible benchmarks for vmc's hot paths, run against the mock backend
+
+#define _DEFAULT_SOURCE     // mkdtemp and setenv under -std=c99
+
+#include "vmc.h"
+
+#include <sys/wait.h>
+
+// Every scenario is timed BENCH_RUNS times (default below), and reported as
+// one JSON object with its p50/p95, on stdout. Progress goes to stderr.
+//   BENCH_RUNS=N       Repetitions per scenario
+//   BENCH_COPY_MB=N    Size of the copyFile() test file
+//   BENCH_PROV_VMS=N   VMs provisioned per 'prov apply' run
+//   BENCH_VMC=path     vmc binary linked against the mock (default ./vmc-mock)
+// Boot-to-SSH times need real VirtualBox, so they only run when all of these are set:
+//   BENCH_BOOT_VMC=path    vmc binary linked against VirtualBox
+//   BENCH_BOOT_IMAGE=path  OVA of a Linux guest with sshd enabled
+//   BENCH_BOOT_IP=ip       Free HostOnly IP for the scratch VM
+
+#define BENCH_MAXRUNS 1000
+#define BENCH_BOOTVM  "vmcbench-boot"   // Scratch VM for boot-to-SSH runs
+#define BENCH_BOOTSECS 300              // Longest wait for a booting VM's SSH port
+
+static char benchHome[256] = "";    // Scratch HOME for all scenarios
+static char benchWork[512] = "";    // Scratch working dir for vmconf files
+static char benchVmc[1024] = "";    // Absolute path to the mock vmc binary
+static char benchRealHome[256] = "";  // HOME of the user, for the real vmc binary
+static bool benchFirst = true;      // JSON comma handling
+
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static int EnvInt(const char *name, int defValue)
+{
+    char *value = getenv(name);
+    if (!value || atoi(value) < 1) { return defValue; }
+    return atoi(value);
+}
+
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+// Nearest-rank percentile of an already sorted list
+static double Percentile(double *sorted, int count, int pct)
+{
+    int rank = (pct * count + 99) / 100;
+    if (rank < 1) { rank = 1; }
+    return sorted[rank - 1];
+}
+
+
+static void Report(const char *name, double *ms, int runs, const char *error)
+{
+    printf("%s\n    {\"name\": \"%s\", ", benchFirst ? "" : ",", name);
+    benchFirst = false;
+    if (error) {
+        printf("\"error\": \"%s\"}", error);
+        fprintf(stderr, "%-28s ERROR %s\n", name, error);
+        return;
+    }
+    qsort(ms, runs, sizeof(double), CompareDouble);
+    double p50 = Percentile(ms, runs, 50), p95 = Percentile(ms, runs, 95);
+    printf("\"unit\": \"ms\", \"runs\": %d, \"p50\": %.3f, \"p95\": %.3f, "
+        "\"min\": %.3f, \"max\": %.3f}", runs, p50, p95, ms[0], ms[runs - 1]);
+    fprintf(stderr, "%-28s p50 %10.3f ms   p95 %10.3f ms\n", name, p50, p95);
+}
+
+
+// A count rather than a timing, e.g. of API string conversions
+static void ReportCount(const char *name, long count, const char *unit, const char *error)
+{
+    printf("%s\n    {\"name\": \"%s\", ", benchFirst ? "" : ",", name);
+    benchFirst = false;
+    if (error) {
+        printf("\"error\": \"%s\"}", error);
+        fprintf(stderr, "%-28s ERROR %s\n", name, error);
+        return;
+    }
+    printf("\"unit\": \"%s\", \"count\": %ld}", unit, count);
+    fprintf(stderr, "%-28s %10ld %s\n", name, count, unit);
+}
+
+
+// Start the mock vmc binary in the work dir, with the given mock VM count.
+// With statsFd set, the mock's call counts go to it instead of stderr
+static pid_t StartVmc(char *const args[], int vmCount, int running, int statsFd)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        char value[16];
+        sprintf(value, "%d", vmCount);
+        setenv("VMC_MOCK_VMS", value, 1);
+        sprintf(value, "%d", running);
+        setenv("VMC_MOCK_RUNNING", value, 1);
+        setenv("HOME", benchHome, 1);
+        unsetenv("VMC_TRACE");
+        if (statsFd >= 0) { setenv("VMC_MOCK_STATS", "1", 1); }
+        else { unsetenv("VMC_MOCK_STATS"); }
+        if (chdir(benchWork) != 0) { _exit(127); }
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(statsFd >= 0 ? statsFd : null, STDERR_FILENO);
+        execv(benchVmc, args);
+        _exit(127);
+    }
+    return pid;
+}
+
+
+// Run the mock vmc binary once, and wait for it to finish
+static int RunVmc(char *const args[], int vmCount, int running)
+{
+    pid_t pid = StartVmc(args, vmCount, running, -1);
+    if (pid < 0) { return -1; }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+// Run the real vmc binary once, as the user, and wait for it to finish
+static int RunRealVmc(const char *vmc, char *const args[])
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("HOME", benchRealHome, 1);
+        unsetenv("VMC_TRACE");
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(vmc, args);
+        _exit(127);
+    }
+    if (pid < 0) { return -1; }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+// Time a full vmc process, from exec to exit
+static void BenchVmc(const char *name, char *const args[], int vmCount, int running, int runs)
+{
+    double ms[BENCH_MAXRUNS];
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        int rc = RunVmc(args, vmCount, running);
+        ms[i] = NowMs() - start;
+        if (rc != 0) {
+            char error[64];
+            sprintf(error, "exit status %d", rc);
+            Report(name, ms, i, error);
+            return;
+        }
+    }
+    Report(name, ms, runs, NULL);
+}
+
+
+// Count the UTF8/UTF16 conversions, each an allocation, that one vmc process
+// has the API do, as the mock reports them on exit
+static void CountVmc(const char *name, char *const args[], int vmCount, int running)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        ReportCount(name, 0, NULL, "pipe failed");
+        return;
+    }
+    pid_t pid = StartVmc(args, vmCount, running, fds[1]);
+    close(fds[1]);
+    long count = -1;
+    char line[512];
+    FILE *fp = fdopen(fds[0], "r");
+    while (fp && fgets(line, sizeof(line), fp)) {
+        char *field = strstr(line, " conversions=");
+        if (strncmp(line, "vboxmock:", 9) == 0 && field) { count = atol(field + 13); }
+    }
+    if (fp) { fclose(fp); }
+    int status = 0;
+    if (pid > 0) { waitpid(pid, &status, 0); }
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ReportCount(name, 0, NULL, "vmc failed");
+        return;
+    }
+    ReportCount(name, count, "conversions", count < 0 ? "no mock stats" : NULL);
+}
+
+
+static void BenchColdStart(int runs)
+{
+    // Each command with arguments that succeed against a fresh 10 VM mock host
+    char *const list[]    = { "vmc", "list", NULL };
+    char *const info[]    = { "vmc", "info", "vm1", NULL };
+    char *const netlist[] = { "vmc", "netlist", NULL };
+    char *const imglist[] = { "vmc", "imglist", NULL };
+    char *const create[]  = { "vmc", "create", "new1", "bench.ova", NULL };
+    char *const start[]   = { "vmc", "start", "vm3", NULL };
+    char *const mod[]     = { "vmc", "mod", "vm3", "2", "2048", NULL };
+    char *const ip[]      = { "vmc", "ip", "vm3", "10.11.12.200", NULL };
+    char *const nettype[] = { "vmc", "nettype", "vm3", "bri", NULL };
+    char *const del[]     = { "vmc", "del", "vm3", "f", NULL };
+    char *const plan[]    = { "vmc", "prov", "plan", "small.conf", NULL };
+    char *const netadd[]  = { "vmc", "netadd", "10.11.99.1", NULL };
+
+    BenchVmc("coldstart/list", list, 10, 0, runs);
+    BenchVmc("coldstart/info", info, 10, 0, runs);
+    BenchVmc("coldstart/netlist", netlist, 10, 0, runs);
+    BenchVmc("coldstart/imglist", imglist, 10, 0, runs);
+    BenchVmc("coldstart/create", create, 10, 0, runs);
+    BenchVmc("coldstart/start", start, 10, 0, runs);
+    BenchVmc("coldstart/mod", mod, 10, 0, runs);
+    BenchVmc("coldstart/ip", ip, 10, 0, runs);
+    BenchVmc("coldstart/nettype", nettype, 10, 0, runs);
+    BenchVmc("coldstart/del", del, 10, 0, runs);
+    BenchVmc("coldstart/prov-plan", plan, 10, 0, runs);
+    BenchVmc("coldstart/netadd", netadd, 10, 0, runs);
+}
+
+
+static void BenchList(int runs)
+{
+    char *const list[] = { "vmc", "list", NULL };
+    BenchVmc("list/10", list, 10, 5, runs);
+    BenchVmc("list/100", list, 100, 50, runs);
+    BenchVmc("list/1000", list, 1000, 500, runs);
+    CountVmc("list/1000/conversions", list, 1000, 500);
+}
+
+
+// vmc info of one VM, on a host with many, and the conversions it takes
+static void BenchInfo(int runs)
+{
+    char *const info[] = { "vmc", "info", "vm1", NULL };
+    BenchVmc("info/1000", info, 1000, 500, runs);
+    CountVmc("info/conversions", info, 1000, 500);
+}
+
+
+// Same 1000 VM list, answered from the inventory while 'vmc inv watch' runs
+static void BenchListInventory(int runs)
+{
+    char *const watch[] = { "vmc", "inv", "watch", NULL };
+    char *const list[]  = { "vmc", "list", NULL };
+    char path[600];
+    sprintf(path, "%s%c%s%cinventory", benchHome, PATHCHAR, vmdir, PATHCHAR);
+
+    pid_t watcher = StartVmc(watch, 1000, 500, -1);
+    for (int i = 0; i < 500 && !isFile(path); ++i) { usleep(10000); }
+    if (!isFile(path)) {
+        double none[1];
+        Report("list/1000/inventory", none, 0, "watcher did not start");
+    }
+    else {
+        BenchVmc("list/1000/inventory", list, 1000, 500, runs);
+    }
+    if (watcher > 0) {
+        kill(watcher, SIGTERM);
+        waitpid(watcher, NULL, 0);
+    }
+    unlink(path);
+}
+
+
+// Write a vmconf file in the work dir, provisioning count new VMs
+static void WriteProvConf(const char *file, int count)
+{
+    char path[1024];
+    sprintf(path, "%s%c%s", benchWork, PATHCHAR, file);
+    FILE *fp = fopen(path, "w");
+    ExitIfNull(fp, __FILE__, __LINE__);
+    for (int i = 0; i < count; ++i) {
+        fprintf(fp, "[prov%d]\nimage = bench.ova\nnetip = 10.11.20.%d\ncpus = 2\n\n",
+            i + 1, i + 2);
+    }
+    fclose(fp);
+}
+
+
+static void BenchProv(int runs)
+{
+    int count = EnvInt("BENCH_PROV_VMS", 10);
+    char name[64], file[] = "prov.conf";
+    WriteProvConf(file, count);
+    char *const apply[] = { "vmc", "prov", "apply", file, NULL };
+    sprintf(name, "prov/apply/%d", count);
+    BenchVmc(name, apply, 0, 0, runs);
+}
+
+
+// NextUniqueIP() on a subnet where every address but the last is taken
+static void BenchNextUniqueIP(int runs)
+{
+    double ms[BENCH_MAXRUNS];
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        char *ip = NextUniqueIP(vmdefip);
+        ms[i] = NowMs() - start;
+        if (!Equal(ip, "10.11.12.254")) {
+            free(ip);
+            Report("NextUniqueIP/252-used", ms, i, "unexpected IP");
+            return;
+        }
+        free(ip);
+    }
+    Report("NextUniqueIP/252-used", ms, runs, NULL);
+}
+
+
+// UTF16 to UTF8 conversion of typical API strings: VM names, UUIDs and disk
+// paths. Through the API's converter, which allocates each one, and through
+// the scratch arena, which allocates nothing once it has grown
+static void BenchUtf16To8(int runs, int count)
+{
+    BSTR *strs = malloc(count * sizeof(BSTR));
+    ExitIfNull(strs, __FILE__, __LINE__);
+    for (int s = 0; s < count; ++s) {
+        char str[128];
+        if (s % 3 == 0) { sprintf(str, "ubuntu-build-node-%d", s); }
+        else if (s % 3 == 1) { sprintf(str, "5f0c%04x-8a3e-4c1d-9b7e-0242ac1100%02x", s, s % 100); }
+        else { sprintf(str, "/home/vmc/VirtualBox VMs/node%d/node%d-disk001.vdi", s, s); }
+        Convert8to16(str, &strs[s]);
+    }
+
+    double ms[BENCH_MAXRUNS];
+    char name[64];
+    size_t total = 0, check = 0;
+    sprintf(name, "utf16to8/api/%d", count);
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        for (int s = 0; s < count; ++s) {
+            char *str = NULL;
+            Convert16to8(strs[s], &str);
+            total += strlen(str);
+            free(str);
+        }
+        ms[i] = NowMs() - start;
+    }
+    Report(name, ms, runs, NULL);
+
+    sprintf(name, "utf16to8/scratch/%d", count);
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        for (int s = 0; s < count; ++s) { check += strlen(Scratch8(strs[s])); }
+        ScratchReset();
+        ms[i] = NowMs() - start;
+    }
+    Report(name, ms, runs, check == total ? NULL : "conversions differ");
+
+    for (int s = 0; s < count; ++s) { FreeBSTR(strs[s]); }
+    free(strs);
+}
+
+
+// GetVMName() of every VM, as listing and lookups do
+static void BenchGetVMName(int runs)
+{
+    double ms[BENCH_MAXRUNS];
+    char name[64];
+    sprintf(name, "GetVMName/%u", (unsigned)VMListCount);
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        for (ULONG v = 0; v < VMListCount; ++v) { free(GetVMName(VMList[v])); }
+        ms[i] = NowMs() - start;
+    }
+    Report(name, ms, runs, NULL);
+}
+
+
+// ini_load plus an ini_get of every key, on a config with many sections
+static void BenchIni(int runs, int sections)
+{
+    char path[1024], name[64];
+    sprintf(path, "%s%cbig%d.conf", benchWork, PATHCHAR, sections);
+    FILE *fp = fopen(path, "w");
+    ExitIfNull(fp, __FILE__, __LINE__);
+    for (int s = 0; s < sections; ++s) {
+        fprintf(fp, "# VM number %d\n[vm%d]\nimage   = ubuntu1804.ova\n"
+            "netip   = 10.%d.%d.%d\ncpus    = 2\nmemory  = 2048\nnettype = ho\n"
+            "vmcopy  = \"./bootstrap.sh /tmp/bootstrap.sh\"\nvmrun   = \"/tmp/bootstrap.sh\"\n\n",
+            s, s, 11 + s / 65536, (s / 256) % 256, s % 256);
+    }
+    fclose(fp);
+
+    const char *keys[] = { "image", "netip", "cpus", "memory", "nettype", "vmcopy", "vmrun" };
+    double ms[BENCH_MAXRUNS];
+    sprintf(name, "ini/load+get/%d-sections", sections);
+    for (int i = 0; i < runs; ++i) {
+        double start = NowMs();
+        ini_t *cfg = ini_load(path);
+        int found = 0;
+        for (int s = 0; cfg && s < sections; ++s) {
+            char section[32];
+            sprintf(section, "vm%d", s);
+            for (int k = 0; k < 7; ++k) {
+                if (ini_get(cfg, section, keys[k])) { ++found; }
+            }
+        }
+        ms[i] = NowMs() - start;
+        if (cfg) { ini_free(cfg); }
+        if (found != sections * 7) {
+            Report(name, ms, i, "missing keys");
+            return;
+        }
+    }
+    Report(name, ms, runs, NULL);
+}
+
+
+// copyFile() on a large, sparse-free file
+static void BenchCopyFile(int runs)
+{
+    long sizeMB = EnvInt("BENCH_COPY_MB", 2560);
+    char src[1024], dst[1024], name[64];
+    sprintf(src, "%s%ccopy.src", benchWork, PATHCHAR);
+    sprintf(dst, "%s%ccopy.dst", benchWork, PATHCHAR);
+    sprintf(name, "copyFile/%ldMB", sizeMB);
+
+    // Fill with non-zero data, so filesystems can't shortcut it
+    FILE *fp = fopen(src, "w");
+    ExitIfNull(fp, __FILE__, __LINE__);
+    char *block = malloc(1024 * 1024);
+    ExitIfNull(block, __FILE__, __LINE__);
+    for (int i = 0; i < 1024 * 1024; ++i) { block[i] = (char)(i * 31 + 7); }
+    for (long i = 0; i < sizeMB; ++i) { fwrite(block, 1, 1024 * 1024, fp); }
+    fclose(fp);
+    free(block);
+
+    double ms[BENCH_MAXRUNS];
+    const char *error = NULL;
+    int i;
+    for (i = 0; i < runs; ++i) {
+        unlink(dst);
+        double start = NowMs();
+        int rc = copyFile(src, dst);
+        ms[i] = NowMs() - start;
+        struct stat info;
+        if (rc != 0 || stat(dst, &info) != 0 || info.st_size != sizeMB * 1024 * 1024) {
+            error = "copy failed or incomplete";
+            break;
+        }
+    }
+    unlink(src);
+    unlink(dst);
+    Report(name, ms, error ? i : runs, error);
+}
+
+
+// Boot-to-SSH time of a real VM created with the given hardware profile: from
+// 'vmc start' until its SSH port opens. A fresh VM is created for every run,
+// so the profile is always the one applied at creation
+static void BenchBootToSSH(int runs, const char *profile)
+{
+    char name[64];
+    sprintf(name, "boot-to-ssh/%s", profile);
+    char *vmc = getenv("BENCH_BOOT_VMC"), *image = getenv("BENCH_BOOT_IMAGE");
+    char *ip = getenv("BENCH_BOOT_IP");
+    if (!vmc || !image || !ip) {
+        fprintf(stderr, "%-28s skipped, needs BENCH_BOOT_VMC, BENCH_BOOT_IMAGE and "
+            "BENCH_BOOT_IP\n", name);
+        return;
+    }
+
+    char *const create[] = { "vmc", "create", BENCH_BOOTVM, image, (char *)profile, NULL };
+    char *const setip[]  = { "vmc", "ip", BENCH_BOOTVM, ip, NULL };
+    char *const start[]  = { "vmc", "start", BENCH_BOOTVM, NULL };
+    char *const stop[]   = { "vmc", "stop", BENCH_BOOTVM, "f", NULL };
+    char *const del[]    = { "vmc", "del", BENCH_BOOTVM, "f", NULL };
+    double ms[BENCH_MAXRUNS];
+    const char *error = NULL;
+    int i;
+    for (i = 0; i < runs && !error; ++i) {
+        if (RunRealVmc(vmc, create) != 0 || RunRealVmc(vmc, setip) != 0) {
+            error = "cannot create VM";
+            RunRealVmc(vmc, del);
+            break;
+        }
+        double begin = NowMs();
+        if (RunRealVmc(vmc, start) != 0) { error = "cannot start VM"; }
+        while (!error && !SSHPortOpen(ip)) {
+            if (NowMs() - begin > BENCH_BOOTSECS * 1000.0) { error = "SSH port never opened"; }
+            usleep(100000);
+        }
+        ms[i] = NowMs() - begin;
+        RunRealVmc(vmc, stop);
+        RunRealVmc(vmc, del);
+    }
+    Report(name, ms, error ? i : runs, error);
+}
+
+
+// Create scratch HOME and work dirs, with a registered image to create VMs from
+static void SetUp(void)
+{
+    char *vmc = getenv("BENCH_VMC");
+    if (!realpath(vmc ? vmc : "./vmc-mock", benchVmc)) {
+        fprintf(stderr, "Cannot find mock vmc binary. Run 'make mock' or set BENCH_VMC\n");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(benchHome, "/tmp/vmcbench.XXXXXX");
+    if (!mkdtemp(benchHome)) {
+        fprintf(stderr, "Error creating scratch dir\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(benchWork, "%s%cwork", benchHome, PATHCHAR);
+    char cmd[1100];
+    sprintf(cmd, "mkdir -p %s %s%c%s && tar cf %s%c%s%cbench.ova -T /dev/null",
+        benchWork, benchHome, PATHCHAR, vmdir, benchHome, PATHCHAR, vmdir, PATHCHAR);
+    if (RunCmd(cmd) != 0) {
+        fprintf(stderr, "Error setting up '%s'\n", benchHome);
+        exit(EXIT_FAILURE);
+    }
+    WriteProvConf("small.conf", 3);
+
+    // In-process benchmarks use the mock directly, with a nearly full subnet
+    char *home = getenv("HOME");
+    snprintf(benchRealHome, sizeof(benchRealHome), "%s", home ? home : "");
+    setenv("HOME", benchHome, 1);
+    setenv("VMC_MOCK_VMS", "252", 1);
+    unsetenv("VMC_TRACE");
+    InitGlobalObjects();
+    UpdateVMList();
+}
+
+
+static void TearDown(void)
+{
+    char cmd[300];
+    sprintf(cmd, "rm -rf %s", benchHome);
+    RunCmd(cmd);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int runs = EnvInt("BENCH_RUNS", 20);
+    if (runs > BENCH_MAXRUNS) { runs = BENCH_MAXRUNS; }
+    int slowRuns = runs < 5 ? runs : 5;   // For the multi-second scenarios
+
+    SetUp();
+
+    printf("{\n  \"version\": \"%s\",\n  \"benchmarks\": [", prgver);
+    BenchColdStart(runs);
+    BenchList(runs);
+    BenchInfo(runs);
+    BenchListInventory(runs);
+    BenchNextUniqueIP(runs);
+    BenchUtf16To8(runs, 100000);
+    BenchGetVMName(runs);
+    BenchIni(runs, 100);
+    BenchIni(slowRuns, 500);   // ini_get scans the whole file, so this is ~25x the above
+    BenchProv(slowRuns);
+    BenchCopyFile(slowRuns < 3 ? slowRuns : 3);
+    BenchBootToSSH(slowRuns < 3 ? slowRuns : 3, "default");
+    BenchBootToSSH(slowRuns < 3 ? slowRuns : 3, "fast");
+    printf("\n  ]\n}\n");
+
+    TearDown();
+    return 0;
+}
@@ -0,0 +1,3292 @@
+// vboxmock.c
+
+// In-memory stand-in for the VirtualBox C API glue (VBoxCAPIGlue.c), so vmc
+// can be built and exercised on hosts without VirtualBox. It is linked in
+// place of VBoxCAPIGlue.o by 'make mock', which produces 'vmc-mock'.
+//
+// Only the calls vmc actually makes are implemented. Every other vtable slot
+// returns E_NOTIMPL. The fake host is shaped by these environment variables:
+//   VMC_MOCK_VMS=N         Number of pre-registered VMs (default 0)
+//   VMC_MOCK_RUNNING=N     How many of those are in Running state (default 0)
+//   VMC_MOCK_SAVED=N       How many of the next ones are in Saved state (default 0)
+//   VMC_MOCK_SNAPSHOT=S    Give each of those a snapshot named S (default none)
+//   VMC_MOCK_LATENCY_US=N  Delay added to every API call (default 0)
+//   VMC_MOCK_PROGRESS_MS=N Time each IProgress takes to complete (default 0)
+//   VMC_MOCK_EVENTS_MS=N   Flip the state of one VM every N ms, as if someone
+//                          else were starting and stopping them (default 0)
+//   VMC_MOCK_STATS=1       Print call counters to stderr on exit
+// Each process starts from the same state; nothing is persisted.
+
+#define _DEFAULT_SOURCE     // usleep, strdup and strtok_r under -std=c99
+
+#include "VBoxCAPIGlue.h"
+
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MOCK_NICS      4     // Network adapters per VM
+#define MOCK_CTLS      4     // Max storage controllers per VM
+#define MOCK_HOSTNICS  64    // Max host network interfaces
+#define MOCK_VSDMAX    16    // Max entries in a system description
+#define MOCK_LISTENERS 8     // Max registered event listeners
+#define MOCK_EVENTQ    1024  // Max events queued per listener, further ones are dropped
+#define MOCK_EVTYPES   16    // Max event types one listener registers for
+#define MOCK_SHARES    8     // Max shared folders per VM, of each kind
+
+// Glue globals normally defined in VBoxCAPIGlue.c
+void *g_hVBoxCAPI = NULL;
+char g_szVBoxErrMsg[256] = "";
+PCVBOXCAPI g_pVBoxFuncs = NULL;
+PFNVBOXGETCAPIFUNCTIONS g_pfnGetFunctions = NULL;
+
+
+// ===== Mock object types =====
+// Each one starts with the public interface struct, so its pointer can be
+// handed out as the API object and cast back inside the vtable functions.
+
+typedef struct MockNAT {
+    INATEngine base;
+    PRBool dnsPassDomain;
+    PRBool dnsUseHostResolver;
+} MockNAT;
+
+typedef struct MockNIC {
+    INetworkAdapter base;
+    PRBool enabled;
+    PRUint32 adapterType;
+    PRUint32 attachmentType;
+    char bridged[64];
+    char hostOnly[64];
+    char mac[16];
+    MockNAT nat;
+} MockNIC;
+
+// Each VM comes with one boot disk, on a SATA controller
+typedef struct MockMedium {
+    IMedium base;
+    char id[40];
+    char location[128];
+} MockMedium;
+
+typedef struct MockAttachment {
+    IMediumAttachment base;
+    char controller[32];   // Empty when detached
+    PRInt32 port;
+    PRInt32 device;
+    MockMedium medium;
+} MockAttachment;
+
+typedef struct MockCtl {
+    IStorageController base;
+    char name[32];
+    PRUint32 bus;
+    PRUint32 type;
+    PRBool hostIOCache;
+} MockCtl;
+
+typedef struct MockBIOS {
+    IBIOSSettings base;
+    struct MockVM *vm;
+    PRBool logoFadeIn;
+    PRBool logoFadeOut;
+    PRUint32 logoDisplayTime;
+    PRUint32 bootMenuMode;
+    PRBool ioapic;
+} MockBIOS;
+
+typedef struct MockVRDE {
+    IVRDEServer base;
+    struct MockVM *vm;
+    PRBool enabled;
+} MockVRDE;
+
+typedef struct MockShare {
+    ISharedFolder base;
+    char name[64];
+    char hostPath[1024];
+    char mountPoint[256];
+    PRBool writable;
+    PRBool autoMount;
+} MockShare;
+
+// Snapshots form a tree. Each one keeps the settings it restores
+typedef struct MockSnapshot {
+    ISnapshot base;
+    char name[64];
+    char id[40];
+    PRInt64 timeStamp;     // Milliseconds since the epoch
+    PRBool online;         // Taken while running, so restoring leaves it saved
+    PRUint32 cpus;
+    PRUint32 memory;
+    struct MockSnapshot *parent;
+    int childCount;
+    struct MockSnapshot **children;
+} MockSnapshot;
+
+typedef struct MockVM {
+    IMachine base;
+    char name[64];
+    char id[40];
+    char osType[32];
+    PRUint32 cpus;
+    PRUint32 memory;
+    PRUint32 state;
+    PRUint32 locked;       // LockType_Null when no session holds it
+    PRUint32 balloon;      // MB
+    PRBool pageFusion;
+    PRUint32 cpuCap;       // Percent
+    PRUint32 priority;     // VMProcPriority
+    PRUint32 statsInterval; // Guest only reports statistics once this is set
+    bool registered;
+    int propCount;
+    int propCap;
+    char **propName;
+    char **propValue;
+    PRInt64 *propTime;
+    MockNIC nic[MOCK_NICS];
+    PRUint32 paravirt;
+    MockBIOS bios;
+    MockVRDE vrde;
+    int ctlCount;
+    MockCtl ctl[MOCK_CTLS];
+    MockAttachment disk;
+    MockSnapshot *snapshot;    // Current one, or NULL
+    int snapshotCount;
+    MockSnapshot **snapshots;
+    int shareCount;            // Permanent shared folders
+    MockShare share[MOCK_SHARES];
+    int transientCount;        // Shared folders that only last while running
+    MockShare transient[MOCK_SHARES];
+} MockVM;
+
+typedef struct MockGuest {
+    IGuest base;
+    MockVM *vm;
+} MockGuest;
+
+// Guest control. Logons only fail with an empty password. Processes end as
+// soon as they're waited on, their only output is an echo of their command
+// line, and 'false' is the only command that fails
+typedef struct MockGuestSession {
+    IGuestSession base;
+    MockVM *vm;
+    bool loggedOn;
+} MockGuestSession;
+
+typedef struct MockGuestProcess {
+    IGuestProcess base;
+    char output[256];
+    bool outputRead;
+    PRUint32 status;
+    PRInt32 exitCode;
+} MockGuestProcess;
+
+typedef struct MockConsole {
+    IConsole base;
+    MockVM *vm;
+    MockGuest guest;
+} MockConsole;
+
+typedef struct MockSession {
+    ISession base;
+    MockVM *vm;
+    MockConsole console;
+} MockSession;
+
+typedef struct MockProgress {
+    IProgress base;
+    long long doneAt;      // Milliseconds timestamp of completion
+    char id[40];
+} MockProgress;
+
+typedef struct MockHostNIC {
+    IHostNetworkInterface base;
+    char name[32];
+    char id[40];
+    char ip[16];
+    char mask[16];
+    PRUint32 type;
+    PRBool dhcp;
+} MockHostNIC;
+
+typedef struct MockVSD {
+    IVirtualSystemDescription base;
+    PRUint32 count;
+    PRUint32 type[MOCK_VSDMAX];
+    char *value[MOCK_VSDMAX];
+    char *extra[MOCK_VSDMAX];
+    PRBool enabled[MOCK_VSDMAX];
+} MockVSD;
+
+typedef struct MockAppliance {
+    IAppliance base;
+    char file[1024];
+    MockVSD *vsd;
+} MockAppliance;
+
+// One struct for every event type. Its vtable is the one of the concrete type,
+// and only the fields that type reports are set
+typedef struct MockEvent {
+    IEvent base;
+    int refs;
+    PRUint32 type;
+    char machineId[40];
+    PRUint32 state;
+    PRBool registered;
+    char name[64];
+    char value[128];
+} MockEvent;
+
+typedef struct MockListener {
+    IEventListener base;
+    bool registered;
+    PRUint32 typeCount;
+    PRUint32 types[MOCK_EVTYPES];
+    ULONG head, tail;          // Queue is empty when equal
+    MockEvent *queue[MOCK_EVENTQ];
+} MockListener;
+
+
+// ===== Mock state =====
+
+static pthread_mutex_t mockLock = PTHREAD_MUTEX_INITIALIZER;
+static MockVM **mockVMs = NULL;
+static ULONG mockVMCount = 0;
+static ULONG mockVMCap = 0;
+static MockHostNIC *mockHostNICs[MOCK_HOSTNICS];
+static ULONG mockHostNICCount = 0;
+static unsigned long mockSeq = 0;
+
+static pthread_mutex_t eventLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eventCond = PTHREAD_COND_INITIALIZER;
+static MockListener *mockListeners[MOCK_LISTENERS];
+static long long mockEventsMs = 0;
+static long long nextChurnAt = 0;
+static unsigned long churnSeq = 0;
+
+static useconds_t mockLatency = 0;
+static long long mockProgressMs = 0;
+static bool mockStats = false;
+
+// Counters printed with VMC_MOCK_STATS
+static unsigned long statCalls = 0, statConv = 0, statPropGet = 0;
+static unsigned long statPropSet = 0, statEnum = 0, statSave = 0, statNotImpl = 0;
+static unsigned long statEvents = 0;
+
+static IVirtualBoxClient mockClient;
+static IVirtualBox mockVBox;
+static ISystemProperties mockSysProp;
+static IHost mockHost;
+static IVirtualBoxErrorInfo mockErrorInfo;
+static IEventSource mockEventSource;
+static IPerformanceCollector mockCollector;
+static struct IProgressVtbl progressVtbl;
+static struct IGuestVtbl guestVtbl;
+
+
+// ===== Helpers =====
+
+// Account for one API call, and simulate its round-trip cost
+static void Tick(void)
+{
+    __sync_fetch_and_add(&statCalls, 1);
+    if (mockLatency) { usleep(mockLatency); }
+}
+
+
+static long long NowMs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+static unsigned long NextSeq(void)
+{
+    return __sync_add_and_fetch(&mockSeq, 1);
+}
+
+
+static char * Dup(const char *str)
+{
+    char *copy = strdup(str ? str : "");
+    if (!copy) { fprintf(stderr, "vboxmock: out of memory\n"); exit(EXIT_FAILURE); }
+    return copy;
+}
+
+
+static void * Alloc(size_t count, size_t size)
+{
+    void *ptr = calloc(count ? count : 1, size);
+    if (!ptr) { fprintf(stderr, "vboxmock: out of memory\n"); exit(EXIT_FAILURE); }
+    return ptr;
+}
+
+
+// Decode UTF-16 into newly allocated UTF-8
+static char * ToUtf8(CBSTR src)
+{
+    size_t len = 0;
+    if (src) { while (src[len]) { ++len; } }
+    char *dst = Alloc(len * 3 + 1, 1);
+    char *d = dst;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned long c = src[i];
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < len &&
+            src[i+1] >= 0xDC00 && src[i+1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (src[i+1] - 0xDC00);
+            ++i;
+        }
+        if (c < 0x80) {
+            *d++ = (char)c;
+        }
+        else if (c < 0x800) {
+            *d++ = (char)(0xC0 | (c >> 6));
+            *d++ = (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000) {
+            *d++ = (char)(0xE0 | (c >> 12));
+            *d++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *d++ = (char)(0x80 | (c & 0x3F));
+        }
+        else {
+            *d++ = (char)(0xF0 | (c >> 18));
+            *d++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *d++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *d++ = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    *d = '\0';
+    return dst;
+}
+
+
+// Decode UTF-8 into newly allocated UTF-16
+static BSTR ToUtf16(const char *src)
+{
+    const unsigned char *s = (const unsigned char *)(src ? src : "");
+    size_t len = strlen((const char *)s);
+    BSTR dst = Alloc(len * 2 + 1, sizeof(PRUnichar));
+    BSTR d = dst;
+    while (*s) {
+        unsigned long c = *s++;
+        int more = 0;
+        if (c >= 0xF0)      { c &= 0x07; more = 3; }
+        else if (c >= 0xE0) { c &= 0x0F; more = 2; }
+        else if (c >= 0xC0) { c &= 0x1F; more = 1; }
+        while (more-- > 0 && (*s & 0xC0) == 0x80) { c = (c << 6) | (*s++ & 0x3F); }
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            *d++ = (PRUnichar)(0xD800 + (c >> 10));
+            *d++ = (PRUnichar)(0xDC00 + (c & 0x3FF));
+        }
+        else {
+            *d++ = (PRUnichar)c;
+        }
+    }
+    *d = 0;
+    return dst;
+}
+
+
+// Fill every unset vtable slot with a stub, so unmocked calls fail cleanly
+static nsresult NotImpl(void)
+{
+    __sync_fetch_and_add(&statNotImpl, 1);
+    return NS_ERROR_NOT_IMPLEMENTED;
+}
+
+static void FillVtbl(void *vtbl, size_t size)
+{
+    void (**slot)(void) = vtbl;
+    for (size_t i = 0; i < size / sizeof(*slot); ++i) {
+        if (!slot[i]) { slot[i] = (void (*)(void))NotImpl; }
+    }
+}
+
+
+// Objects live for the whole process, so reference counting is a no-op
+static nsrefcnt AddRefAny(void *pThis) { return 1; }
+static nsrefcnt ReleaseAny(void *pThis) { return 1; }
+
+
+// Match VirtualBox guest property patterns, which are '|' separated globs
+static bool MatchPattern(const char *patterns, const char *name)
+{
+    if (!patterns || !patterns[0]) { return true; }
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", patterns);
+    char *save = NULL;
+    for (char *p = strtok_r(buf, "|", &save); p; p = strtok_r(NULL, "|", &save)) {
+        if (fnmatch(p, name, 0) == 0) { return true; }
+    }
+    return false;
+}
+
+
+static MockProgress * NewProgress(void)
+{
+    MockProgress *progress = Alloc(1, sizeof(MockProgress));
+    progress->base.lpVtbl = &progressVtbl;
+    progress->doneAt = NowMs() + mockProgressMs;
+    snprintf(progress->id, sizeof(progress->id), "progress-%lu", NextSeq());
+    return progress;
+}
+
+
+// ===== VM guest properties =====
+
+static int FindProp(MockVM *vm, const char *name)
+{
+    for (int i = 0; i < vm->propCount; ++i) {
+        if (strcmp(vm->propName[i], name) == 0) { return i; }
+    }
+    return -1;
+}
+
+
+// Set a property. An empty value deletes it, as VirtualBox does
+static void PutProp(MockVM *vm, const char *name, const char *value)
+{
+    int i = FindProp(vm, name);
+    if (!value || !value[0]) {
+        if (i < 0) { return; }
+        free(vm->propName[i]);
+        free(vm->propValue[i]);
+        --vm->propCount;
+        vm->propName[i] = vm->propName[vm->propCount];
+        vm->propValue[i] = vm->propValue[vm->propCount];
+        vm->propTime[i] = vm->propTime[vm->propCount];
+        return;
+    }
+    if (i >= 0) {
+        free(vm->propValue[i]);
+        vm->propValue[i] = Dup(value);
+        vm->propTime[i] = NowMs() * 1000000;
+        return;
+    }
+    if (vm->propCount == vm->propCap) {
+        vm->propCap = vm->propCap ? vm->propCap * 2 : 8;
+        vm->propName = realloc(vm->propName, vm->propCap * sizeof(char *));
+        vm->propValue = realloc(vm->propValue, vm->propCap * sizeof(char *));
+        vm->propTime = realloc(vm->propTime, vm->propCap * sizeof(PRInt64));
+        if (!vm->propName || !vm->propValue || !vm->propTime) {
+            fprintf(stderr, "vboxmock: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    vm->propName[vm->propCount] = Dup(name);
+    vm->propValue[vm->propCount] = Dup(value);
+    vm->propTime[vm->propCount] = NowMs() * 1000000;
+    ++vm->propCount;
+}
+
+
+// ===== Events =====
+// A single event source, the IVirtualBox one. Each registered listener has
+// its own queue, filled by the mock calls that change VM state, guest
+// properties, settings or registration, and drained with GetEvent.
+
+static nsresult eventQueryInterface(void *pThis, const nsID *iid, void **result)
+{
+    MockEvent *event = pThis;
+    const nsID *own = NULL;
+    switch (event->type) {
+        case VBoxEventType_OnMachineStateChanged: own = &IID_IMachineStateChangedEvent; break;
+        case VBoxEventType_OnMachineDataChanged:  own = &IID_IMachineDataChangedEvent; break;
+        case VBoxEventType_OnMachineRegistered:   own = &IID_IMachineRegisteredEvent; break;
+        case VBoxEventType_OnGuestPropertyChanged: own = &IID_IGuestPropertyChangedEvent; break;
+        case VBoxEventType_OnSessionStateChanged: own = &IID_ISessionStateChangedEvent; break;
+    }
+    if (memcmp(iid, &IID_IEvent, sizeof(nsID)) && memcmp(iid, &IID_IMachineEvent, sizeof(nsID)) &&
+        (!own || memcmp(iid, own, sizeof(nsID)))) {
+        *result = NULL;
+        return NS_NOINTERFACE;
+    }
+    __sync_fetch_and_add(&event->refs, 1);
+    *result = pThis;
+    return NS_OK;
+}
+
+static nsrefcnt eventAddRef(void *pThis)
+{
+    return __sync_add_and_fetch(&((MockEvent *)pThis)->refs, 1);
+}
+
+static nsrefcnt eventRelease(void *pThis)
+{
+    int refs = __sync_sub_and_fetch(&((MockEvent *)pThis)->refs, 1);
+    if (refs == 0) { free(pThis); }
+    return refs;
+}
+
+static nsresult eventGetType(void *pThis, PRUint32 *type)
+{
+    Tick(); *type = ((MockEvent *)pThis)->type; return NS_OK;
+}
+
+static nsresult eventGetMachineId(void *pThis, PRUnichar **id)
+{
+    Tick(); *id = ToUtf16(((MockEvent *)pThis)->machineId); return NS_OK;
+}
+
+static nsresult eventGetState(IMachineStateChangedEvent *pThis, PRUint32 *state)
+{
+    Tick(); *state = ((MockEvent *)pThis)->state; return NS_OK;
+}
+
+static nsresult eventGetRegistered(IMachineRegisteredEvent *pThis, PRBool *registered)
+{
+    Tick(); *registered = ((MockEvent *)pThis)->registered; return NS_OK;
+}
+
+static nsresult eventGetTemporary(IMachineDataChangedEvent *pThis, PRBool *temporary)
+{
+    Tick(); *temporary = FALSE; return NS_OK;
+}
+
+static nsresult eventGetName(IGuestPropertyChangedEvent *pThis, PRUnichar **name)
+{
+    Tick(); *name = ToUtf16(((MockEvent *)pThis)->name); return NS_OK;
+}
+
+static nsresult eventGetValue(IGuestPropertyChangedEvent *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockEvent *)pThis)->value); return NS_OK;
+}
+
+static nsresult eventGetFlags(IGuestPropertyChangedEvent *pThis, PRUnichar **flags)
+{
+    Tick(); *flags = ToUtf16(""); return NS_OK;
+}
+
+static struct IEventListenerVtbl listenerVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+};
+
+static struct IMachineStateChangedEventVtbl stateEventVtbl = {
+    .QueryInterface = (void *)eventQueryInterface,
+    .AddRef = (void *)eventAddRef,
+    .Release = (void *)eventRelease,
+    .GetType = (void *)eventGetType,
+    .GetMachineId = (void *)eventGetMachineId,
+    .GetState = eventGetState,
+};
+
+static struct IMachineDataChangedEventVtbl dataEventVtbl = {
+    .QueryInterface = (void *)eventQueryInterface,
+    .AddRef = (void *)eventAddRef,
+    .Release = (void *)eventRelease,
+    .GetType = (void *)eventGetType,
+    .GetMachineId = (void *)eventGetMachineId,
+    .GetTemporary = eventGetTemporary,
+};
+
+static struct IMachineRegisteredEventVtbl regEventVtbl = {
+    .QueryInterface = (void *)eventQueryInterface,
+    .AddRef = (void *)eventAddRef,
+    .Release = (void *)eventRelease,
+    .GetType = (void *)eventGetType,
+    .GetMachineId = (void *)eventGetMachineId,
+    .GetRegistered = eventGetRegistered,
+};
+
+static struct IGuestPropertyChangedEventVtbl propEventVtbl = {
+    .QueryInterface = (void *)eventQueryInterface,
+    .AddRef = (void *)eventAddRef,
+    .Release = (void *)eventRelease,
+    .GetType = (void *)eventGetType,
+    .GetMachineId = (void *)eventGetMachineId,
+    .GetName = eventGetName,
+    .GetValue = eventGetValue,
+    .GetFlags = eventGetFlags,
+};
+
+
+static struct ISessionStateChangedEventVtbl sessionEventVtbl = {
+    .QueryInterface = (void *)eventQueryInterface,
+    .AddRef = (void *)eventAddRef,
+    .Release = (void *)eventRelease,
+    .GetType = (void *)eventGetType,
+    .GetMachineId = (void *)eventGetMachineId,
+    .GetState = (void *)eventGetState,
+};
+
+
+static bool Interested(MockListener *listener, PRUint32 type)
+{
+    for (PRUint32 i = 0; i < listener->typeCount; ++i) {
+        PRUint32 t = listener->types[i];
+        // Every event we fire is a machine event
+        if (t == type || t == VBoxEventType_Any || t == VBoxEventType_MachineEvent) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Queue a copy of event for every interested listener, then free it
+static void PostEvent(MockEvent *event)
+{
+    pthread_mutex_lock(&eventLock);
+    for (int i = 0; i < MOCK_LISTENERS; ++i) {
+        MockListener *listener = mockListeners[i];
+        if (!listener || !listener->registered || !Interested(listener, event->type)) {
+            continue;
+        }
+        if (listener->tail - listener->head == MOCK_EVENTQ) { continue; }
+        MockEvent *copy = Alloc(1, sizeof(MockEvent));
+        *copy = *event;
+        copy->refs = 1;
+        listener->queue[listener->tail++ % MOCK_EVENTQ] = copy;
+        __sync_fetch_and_add(&statEvents, 1);
+    }
+    pthread_cond_broadcast(&eventCond);
+    pthread_mutex_unlock(&eventLock);
+    free(event);
+}
+
+
+static MockEvent * NewEvent(PRUint32 type, void *vtbl, MockVM *vm)
+{
+    MockEvent *event = Alloc(1, sizeof(MockEvent));
+    event->base.lpVtbl = vtbl;
+    event->type = type;
+    snprintf(event->machineId, sizeof(event->machineId), "%s", vm->id);
+    return event;
+}
+
+
+static void FireStateChanged(MockVM *vm)
+{
+    MockEvent *event = NewEvent(VBoxEventType_OnMachineStateChanged, &stateEventVtbl, vm);
+    event->state = vm->state;
+    PostEvent(event);
+}
+
+
+static void FireDataChanged(MockVM *vm)
+{
+    PostEvent(NewEvent(VBoxEventType_OnMachineDataChanged, &dataEventVtbl, vm));
+}
+
+
+static void FireRegistered(MockVM *vm, PRBool registered)
+{
+    MockEvent *event = NewEvent(VBoxEventType_OnMachineRegistered, &regEventVtbl, vm);
+    event->registered = registered;
+    PostEvent(event);
+}
+
+
+static void FirePropChanged(MockVM *vm, const char *name, const char *value)
+{
+    MockEvent *event = NewEvent(VBoxEventType_OnGuestPropertyChanged, &propEventVtbl, vm);
+    snprintf(event->name, sizeof(event->name), "%s", name);
+    snprintf(event->value, sizeof(event->value), "%s", value);
+    PostEvent(event);
+}
+
+
+static void FireSessionChanged(MockVM *vm, PRUint32 state)
+{
+    MockEvent *event = NewEvent(VBoxEventType_OnSessionStateChanged, &sessionEventVtbl, vm);
+    event->state = state;
+    PostEvent(event);
+}
+
+
+// Simulate outside activity when VMC_MOCK_EVENTS_MS is set, by flipping
+// the next VM in turn between Running and PoweredOff once it's due
+static void Churn(void)
+{
+    if (!mockEventsMs) { return; }
+    long long now = NowMs();
+    pthread_mutex_lock(&mockLock);
+    if (now < nextChurnAt || !mockVMCount) {
+        pthread_mutex_unlock(&mockLock);
+        return;
+    }
+    nextChurnAt = now + mockEventsMs;
+    MockVM *vm = mockVMs[churnSeq++ % mockVMCount];
+    vm->state = vm->state == MachineState_Running ? MachineState_PoweredOff : MachineState_Running;
+    pthread_mutex_unlock(&mockLock);
+    FireStateChanged(vm);
+}
+
+
+static nsresult esCreateListener(IEventSource *pThis, IEventListener **listener)
+{
+    Tick();
+    MockListener *l = Alloc(1, sizeof(MockListener));
+    l->base.lpVtbl = (void *)&listenerVtbl;
+    *listener = &l->base;
+    return NS_OK;
+}
+
+static nsresult esRegisterListener(IEventSource *pThis, IEventListener *listener,
+    PRUint32 interestingSize, PRUint32 *interesting, PRBool active)
+{
+    Tick();
+    MockListener *l = (MockListener *)listener;
+    if (active || interestingSize > MOCK_EVTYPES) { return NS_ERROR_INVALID_ARG; }
+    pthread_mutex_lock(&eventLock);
+    int slot = -1;
+    for (int i = 0; i < MOCK_LISTENERS && slot < 0; ++i) {
+        if (!mockListeners[i]) { slot = i; }
+    }
+    if (slot >= 0) {
+        memcpy(l->types, interesting, interestingSize * sizeof(PRUint32));
+        l->typeCount = interestingSize;
+        l->registered = true;
+        mockListeners[slot] = l;
+    }
+    pthread_mutex_unlock(&eventLock);
+    return slot >= 0 ? NS_OK : NS_ERROR_FAILURE;
+}
+
+static nsresult esUnregisterListener(IEventSource *pThis, IEventListener *listener)
+{
+    Tick();
+    MockListener *l = (MockListener *)listener;
+    pthread_mutex_lock(&eventLock);
+    for (int i = 0; i < MOCK_LISTENERS; ++i) {
+        if (mockListeners[i] == l) { mockListeners[i] = NULL; }
+    }
+    l->registered = false;
+    while (l->head != l->tail) {
+        eventRelease(l->queue[l->head++ % MOCK_EVENTQ]);
+    }
+    pthread_mutex_unlock(&eventLock);
+    return NS_OK;
+}
+
+// Wait up to timeout ms (forever if negative) for an event. None is no error
+static nsresult esGetEvent(IEventSource *pThis, IEventListener *listener, PRInt32 timeout,
+    IEvent **event)
+{
+    Tick();
+    MockListener *l = (MockListener *)listener;
+    if (!l->registered) { return VBOX_E_OBJECT_NOT_FOUND; }
+    long long deadline = timeout < 0 ? -1 : NowMs() + timeout;
+    *event = NULL;
+    for (;;) {
+        Churn();
+        pthread_mutex_lock(&eventLock);
+        if (l->head != l->tail) {
+            *event = &l->queue[l->head++ % MOCK_EVENTQ]->base;
+            pthread_mutex_unlock(&eventLock);
+            return NS_OK;
+        }
+        long long now = NowMs();
+        if (deadline >= 0 && now >= deadline) {
+            pthread_mutex_unlock(&eventLock);
+            return NS_OK;
+        }
+        // Sleep until the deadline, the next churn, or a new event
+        long long until = deadline;
+        if (mockEventsMs && (until < 0 || nextChurnAt < until)) { until = nextChurnAt; }
+        if (until < 0) {
+            pthread_cond_wait(&eventCond, &eventLock);
+        }
+        else {
+            struct timespec ts = { until / 1000, (until % 1000) * 1000000 };
+            pthread_cond_timedwait(&eventCond, &eventLock, &ts);
+        }
+        pthread_mutex_unlock(&eventLock);
+    }
+}
+
+static nsresult esEventProcessed(IEventSource *pThis, IEventListener *listener, IEvent *event)
+{
+    Tick(); return NS_OK;
+}
+
+static struct IEventSourceVtbl eventSourceVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .CreateListener = esCreateListener,
+    .RegisterListener = esRegisterListener,
+    .UnregisterListener = esUnregisterListener,
+    .GetEvent = esGetEvent,
+    .EventProcessed = esEventProcessed,
+};
+
+
+// ===== INATEngine =====
+
+static nsresult natSetDNSPassDomain(INATEngine *pThis, PRBool value)
+{
+    Tick(); ((MockNAT *)pThis)->dnsPassDomain = value; return NS_OK;
+}
+
+static nsresult natGetDNSPassDomain(INATEngine *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockNAT *)pThis)->dnsPassDomain; return NS_OK;
+}
+
+static nsresult natSetDNSUseHostResolver(INATEngine *pThis, PRBool value)
+{
+    Tick(); ((MockNAT *)pThis)->dnsUseHostResolver = value; return NS_OK;
+}
+
+static nsresult natGetDNSUseHostResolver(INATEngine *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockNAT *)pThis)->dnsUseHostResolver; return NS_OK;
+}
+
+static nsresult natGetDNSProxy(INATEngine *pThis, PRBool *value)
+{
+    Tick(); *value = FALSE; return NS_OK;
+}
+
+static nsresult natGetRedirects(INATEngine *pThis, PRUint32 *size, PRUnichar ***list)
+{
+    Tick(); *size = 0; *list = Alloc(1, sizeof(BSTR)); return NS_OK;
+}
+
+static struct INATEngineVtbl natVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .SetDNSPassDomain = natSetDNSPassDomain,
+    .GetDNSPassDomain = natGetDNSPassDomain,
+    .SetDNSUseHostResolver = natSetDNSUseHostResolver,
+    .GetDNSUseHostResolver = natGetDNSUseHostResolver,
+    .GetDNSProxy = natGetDNSProxy,
+    .GetRedirects = natGetRedirects,
+};
+
+
+// ===== INetworkAdapter =====
+
+static nsresult nicSetEnabled(INetworkAdapter *pThis, PRBool value)
+{
+    Tick(); ((MockNIC *)pThis)->enabled = value; return NS_OK;
+}
+
+static nsresult nicGetEnabled(INetworkAdapter *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockNIC *)pThis)->enabled; return NS_OK;
+}
+
+static nsresult nicSetAdapterType(INetworkAdapter *pThis, PRUint32 value)
+{
+    Tick(); ((MockNIC *)pThis)->adapterType = value; return NS_OK;
+}
+
+static nsresult nicGetAdapterType(INetworkAdapter *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockNIC *)pThis)->adapterType; return NS_OK;
+}
+
+static nsresult nicSetAttachmentType(INetworkAdapter *pThis, PRUint32 value)
+{
+    Tick(); ((MockNIC *)pThis)->attachmentType = value; return NS_OK;
+}
+
+static nsresult nicGetAttachmentType(INetworkAdapter *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockNIC *)pThis)->attachmentType; return NS_OK;
+}
+
+static nsresult nicSetBridgedInterface(INetworkAdapter *pThis, PRUnichar *value)
+{
+    Tick();
+    char *name = ToUtf8(value);
+    snprintf(((MockNIC *)pThis)->bridged, 64, "%s", name);
+    free(name);
+    return NS_OK;
+}
+
+static nsresult nicGetBridgedInterface(INetworkAdapter *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockNIC *)pThis)->bridged); return NS_OK;
+}
+
+static nsresult nicSetHostOnlyInterface(INetworkAdapter *pThis, PRUnichar *value)
+{
+    Tick();
+    char *name = ToUtf8(value);
+    snprintf(((MockNIC *)pThis)->hostOnly, 64, "%s", name);
+    free(name);
+    return NS_OK;
+}
+
+static nsresult nicGetHostOnlyInterface(INetworkAdapter *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockNIC *)pThis)->hostOnly); return NS_OK;
+}
+
+static nsresult nicGetNATEngine(INetworkAdapter *pThis, INATEngine **value)
+{
+    Tick(); *value = &((MockNIC *)pThis)->nat.base; return NS_OK;
+}
+
+static nsresult nicGetMACAddress(INetworkAdapter *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockNIC *)pThis)->mac); return NS_OK;
+}
+
+static nsresult nicGetCableConnected(INetworkAdapter *pThis, PRBool *value)
+{
+    Tick(); *value = TRUE; return NS_OK;
+}
+
+static nsresult nicGetPromiscModePolicy(INetworkAdapter *pThis, PRUint32 *value)
+{
+    Tick(); *value = NetworkAdapterPromiscModePolicy_Deny; return NS_OK;
+}
+
+static struct INetworkAdapterVtbl nicVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .SetEnabled = nicSetEnabled,
+    .GetEnabled = nicGetEnabled,
+    .SetAdapterType = nicSetAdapterType,
+    .GetAdapterType = nicGetAdapterType,
+    .SetAttachmentType = nicSetAttachmentType,
+    .GetAttachmentType = nicGetAttachmentType,
+    .SetBridgedInterface = nicSetBridgedInterface,
+    .GetBridgedInterface = nicGetBridgedInterface,
+    .SetHostOnlyInterface = nicSetHostOnlyInterface,
+    .GetHostOnlyInterface = nicGetHostOnlyInterface,
+    .GetNATEngine = nicGetNATEngine,
+    .GetMACAddress = nicGetMACAddress,
+    .GetCableConnected = nicGetCableConnected,
+    .GetPromiscModePolicy = nicGetPromiscModePolicy,
+};
+
+
+// ===== IProgress =====
+
+static nsresult progressWaitForCompletion(IProgress *pThis, PRInt32 timeout)
+{
+    Tick();
+    long long wait = ((MockProgress *)pThis)->doneAt - NowMs();
+    if (timeout >= 0 && wait > timeout) { wait = timeout; }
+    if (wait > 0) { usleep(wait * 1000); }
+    return NS_OK;
+}
+
+static nsresult progressGetCompleted(IProgress *pThis, PRBool *value)
+{
+    Tick(); *value = (NowMs() >= ((MockProgress *)pThis)->doneAt); return NS_OK;
+}
+
+static nsresult progressGetResultCode(IProgress *pThis, PRInt32 *value)
+{
+    Tick(); *value = NS_OK; return NS_OK;
+}
+
+static nsresult progressGetErrorInfo(IProgress *pThis, IVirtualBoxErrorInfo **value)
+{
+    Tick(); *value = &mockErrorInfo; return NS_OK;
+}
+
+static nsresult progressGetId(IProgress *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockProgress *)pThis)->id); return NS_OK;
+}
+
+static struct IProgressVtbl progressVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .WaitForCompletion = progressWaitForCompletion,
+    .GetCompleted = progressGetCompleted,
+    .GetResultCode = progressGetResultCode,
+    .GetErrorInfo = progressGetErrorInfo,
+    .GetId = progressGetId,
+};
+
+
+// ===== IVirtualBoxErrorInfo =====
+
+static nsresult errorGetText(IVirtualBoxErrorInfo *pThis, PRUnichar **value)
+{
+    *value = ToUtf16("Mock VirtualBox error"); return NS_OK;
+}
+
+static nsresult errorGetNext(IVirtualBoxErrorInfo *pThis, IVirtualBoxErrorInfo **value)
+{
+    *value = NULL; return NS_OK;
+}
+
+static struct IVirtualBoxErrorInfoVtbl errorVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetText = errorGetText,
+    .GetNext = errorGetNext,
+};
+
+
+// ===== ISharedFolder =====
+// Host paths are always accessible, whether they exist or not
+
+static nsresult sfGetName(ISharedFolder *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockShare *)pThis)->name); return NS_OK;
+}
+
+static nsresult sfGetHostPath(ISharedFolder *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockShare *)pThis)->hostPath); return NS_OK;
+}
+
+static nsresult sfGetAutoMountPoint(ISharedFolder *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockShare *)pThis)->mountPoint); return NS_OK;
+}
+
+static nsresult sfGetWritable(ISharedFolder *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockShare *)pThis)->writable; return NS_OK;
+}
+
+static nsresult sfGetAutoMount(ISharedFolder *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockShare *)pThis)->autoMount; return NS_OK;
+}
+
+static nsresult sfGetAccessible(ISharedFolder *pThis, PRBool *value)
+{
+    Tick(); *value = TRUE; return NS_OK;
+}
+
+static nsresult sfGetLastAccessError(ISharedFolder *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(""); return NS_OK;
+}
+
+static struct ISharedFolderVtbl sfVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetName = sfGetName,
+    .GetHostPath = sfGetHostPath,
+    .GetAutoMountPoint = sfGetAutoMountPoint,
+    .GetWritable = sfGetWritable,
+    .GetAutoMount = sfGetAutoMount,
+    .GetAccessible = sfGetAccessible,
+    .GetLastAccessError = sfGetLastAccessError,
+};
+
+// Copy of shared folder list, for a getter
+static void ListShares(MockShare *shares, int count, PRUint32 *size, ISharedFolder ***list)
+{
+    *list = Alloc(count + 1, sizeof(ISharedFolder *));
+    for (int i = 0; i < count; ++i) { (*list)[i] = &shares[i].base; }
+    *size = count;
+}
+
+// Add a shared folder to list, unless one has the same name already
+static nsresult AddShare(MockShare *shares, int *count, PRUnichar *name, PRUnichar *hostPath,
+    PRBool writable, PRBool autoMount, PRUnichar *mountPoint)
+{
+    char *name8 = ToUtf8(name);
+    for (int i = 0; i < *count; ++i) {
+        if (strcmp(shares[i].name, name8) == 0) {
+            free(name8);
+            return VBOX_E_OBJECT_IN_USE;
+        }
+    }
+    if (*count == MOCK_SHARES || !name8[0] || strlen(name8) >= sizeof(shares[0].name)) {
+        free(name8);
+        return E_INVALIDARG;
+    }
+    MockShare *sf = &shares[(*count)++];
+    memset(sf, 0, sizeof(*sf));
+    sf->base.lpVtbl = &sfVtbl;
+    strcpy(sf->name, name8);
+    free(name8);
+    char *path8 = ToUtf8(hostPath);
+    snprintf(sf->hostPath, sizeof(sf->hostPath), "%s", path8);
+    free(path8);
+    char *mount8 = ToUtf8(mountPoint);
+    snprintf(sf->mountPoint, sizeof(sf->mountPoint), "%s", mount8);
+    free(mount8);
+    sf->writable = writable;
+    sf->autoMount = autoMount;
+    return NS_OK;
+}
+
+// Remove the shared folder with given name from list
+static nsresult RemoveShare(MockShare *shares, int *count, PRUnichar *name)
+{
+    char *name8 = ToUtf8(name);
+    int i = 0;
+    while (i < *count && strcmp(shares[i].name, name8) != 0) { ++i; }
+    free(name8);
+    if (i == *count) { return VBOX_E_OBJECT_NOT_FOUND; }
+    memmove(&shares[i], &shares[i + 1], (*count - i - 1) * sizeof(MockShare));
+    (*count)--;
+    return NS_OK;
+}
+
+
+// ===== IConsole =====
+
+static nsresult consolePowerDown(IConsole *pThis, IProgress **progress)
+{
+    Tick();
+    MockVM *vm = ((MockConsole *)pThis)->vm;
+    if (!vm) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->state = MachineState_PoweredOff;
+    vm->transientCount = 0;
+    FireStateChanged(vm);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+// The guest always obeys the ACPI power button, at once
+static nsresult consolePowerButton(IConsole *pThis)
+{
+    Tick();
+    MockVM *vm = ((MockConsole *)pThis)->vm;
+    if (!vm || vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    vm->state = MachineState_PoweredOff;
+    vm->transientCount = 0;
+    FireStateChanged(vm);
+    return NS_OK;
+}
+
+static nsresult consoleGetGuest(IConsole *pThis, IGuest **guest)
+{
+    Tick();
+    MockConsole *console = (MockConsole *)pThis;
+    if (!console->vm || console->vm->state != MachineState_Running) {
+        return VBOX_E_INVALID_VM_STATE;
+    }
+    console->guest.base.lpVtbl = &guestVtbl;
+    console->guest.vm = console->vm;
+    *guest = &console->guest.base;
+    return NS_OK;
+}
+
+static nsresult consoleGetSharedFolders(IConsole *pThis, PRUint32 *size, ISharedFolder ***list)
+{
+    Tick();
+    MockVM *vm = ((MockConsole *)pThis)->vm;
+    if (!vm || vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    ListShares(vm->transient, vm->transientCount, size, list);
+    return NS_OK;
+}
+
+static nsresult consoleCreateSharedFolder(IConsole *pThis, PRUnichar *name, PRUnichar *hostPath,
+    PRBool writable, PRBool autoMount, PRUnichar *mountPoint)
+{
+    Tick();
+    MockVM *vm = ((MockConsole *)pThis)->vm;
+    if (!vm || vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    return AddShare(vm->transient, &vm->transientCount, name, hostPath, writable, autoMount,
+        mountPoint);
+}
+
+static nsresult consoleRemoveSharedFolder(IConsole *pThis, PRUnichar *name)
+{
+    Tick();
+    MockVM *vm = ((MockConsole *)pThis)->vm;
+    if (!vm || vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    return RemoveShare(vm->transient, &vm->transientCount, name);
+}
+
+static struct IConsoleVtbl consoleVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .PowerDown = consolePowerDown,
+    .PowerButton = consolePowerButton,
+    .GetGuest = consoleGetGuest,
+    .GetSharedFolders = consoleGetSharedFolders,
+    .CreateSharedFolder = consoleCreateSharedFolder,
+    .RemoveSharedFolder = consoleRemoveSharedFolder,
+};
+
+
+// ===== IGuest =====
+// Every guest reports statistics as if it had the additions installed. About
+// two in three are idle, and page fusion shares an eighth of their memory
+
+static nsresult guestGetMemoryBalloonSize(IGuest *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockGuest *)pThis)->vm->balloon; return NS_OK;
+}
+
+static nsresult guestSetMemoryBalloonSize(IGuest *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = ((MockGuest *)pThis)->vm;
+    if (value > vm->memory) { return E_INVALIDARG; }
+    vm->balloon = value;
+    return NS_OK;
+}
+
+static nsresult guestGetStatisticsUpdateInterval(IGuest *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockGuest *)pThis)->vm->statsInterval; return NS_OK;
+}
+
+static nsresult guestSetStatisticsUpdateInterval(IGuest *pThis, PRUint32 value)
+{
+    Tick(); ((MockGuest *)pThis)->vm->statsInterval = value; return NS_OK;
+}
+
+static nsresult guestInternalGetStatistics(IGuest *pThis, PRUint32 *cpuUser,
+    PRUint32 *cpuKernel, PRUint32 *cpuIdle, PRUint32 *memTotal, PRUint32 *memFree,
+    PRUint32 *memBalloon, PRUint32 *memShared, PRUint32 *memCache, PRUint32 *pagedTotal,
+    PRUint32 *memAllocTotal, PRUint32 *memFreeTotal, PRUint32 *memBalloonTotal,
+    PRUint32 *memSharedTotal)
+{
+    Tick();
+    MockVM *vm = ((MockGuest *)pThis)->vm;
+    *cpuUser = *cpuKernel = *cpuIdle = *memTotal = *memFree = *memBalloon = 0;
+    *memShared = *memCache = *pagedTotal = 0;
+    *memAllocTotal = *memFreeTotal = *memBalloonTotal = *memSharedTotal = 0;
+    if (!vm->statsInterval) { return NS_OK; }
+
+    bool idle = strtoul(vm->id + 24, NULL, 16) % 3 != 0;
+    *cpuUser = idle ? 2 : 55;
+    *cpuKernel = idle ? 1 : 5;
+    *cpuIdle = 100 - *cpuUser - *cpuKernel;
+    *memTotal = vm->memory * 1024;
+    *memBalloon = vm->balloon * 1024;
+    *memShared = vm->pageFusion ? vm->memory * 1024 / 8 : 0;
+    *memFree = (*memTotal - *memBalloon) / 3;
+    return NS_OK;
+}
+
+static nsresult guestGetAdditionsRunLevel(IGuest *pThis, PRUint32 *value)
+{
+    Tick();
+    MockVM *vm = ((MockGuest *)pThis)->vm;
+    *value = vm->state == MachineState_Running ? AdditionsRunLevelType_Userland : AdditionsRunLevelType_None;
+    return NS_OK;
+}
+
+static nsresult gpWaitForArray(IGuestProcess *pThis, PRUint32 size, PRUint32 *waitFor,
+    PRUint32 timeoutMS, PRUint32 *reason)
+{
+    Tick();
+    MockGuestProcess *process = (MockGuestProcess *)pThis;
+    for (PRUint32 i = 0; i < size; ++i) {
+        if (waitFor[i] == ProcessWaitForFlag_StdOut && !process->outputRead) {
+            *reason = ProcessWaitResult_StdOut;
+            return NS_OK;
+        }
+    }
+    process->status = ProcessStatus_TerminatedNormally;
+    *reason = ProcessWaitResult_Terminate;
+    return NS_OK;
+}
+
+static nsresult gpRead(IGuestProcess *pThis, PRUint32 handle, PRUint32 toRead, PRUint32 timeoutMS,
+    PRUint32 *size, PRUint8 **data)
+{
+    Tick();
+    MockGuestProcess *process = (MockGuestProcess *)pThis;
+    *size = 0;
+    *data = Alloc(1, 1);
+    if (handle == 1 && !process->outputRead) {
+        free(*data);
+        *size = strlen(process->output);
+        *data = Alloc(*size + 1, 1);
+        memcpy(*data, process->output, *size);
+        process->outputRead = true;
+    }
+    return NS_OK;
+}
+
+static nsresult gpGetStatus(IGuestProcess *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockGuestProcess *)pThis)->status; return NS_OK;
+}
+
+static nsresult gpGetExitCode(IGuestProcess *pThis, PRInt32 *value)
+{
+    Tick(); *value = ((MockGuestProcess *)pThis)->exitCode; return NS_OK;
+}
+
+static nsresult ReleaseFree(void *pThis) { free(pThis); return 0; }
+
+static struct IGuestProcessVtbl gpVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseFree,
+    .WaitForArray = gpWaitForArray,
+    .Read = gpRead,
+    .GetStatus = gpGetStatus,
+    .GetExitCode = gpGetExitCode,
+};
+
+static nsresult gsWaitForArray(IGuestSession *pThis, PRUint32 size, PRUint32 *waitFor,
+    PRUint32 timeoutMS, PRUint32 *reason)
+{
+    Tick();
+    *reason = ((MockGuestSession *)pThis)->loggedOn ? GuestSessionWaitResult_Start : GuestSessionWaitResult_Error;
+    return NS_OK;
+}
+
+static nsresult gsProcessCreate(IGuestSession *pThis, PRUnichar *executable, PRUint32 argCount,
+    PRUnichar **args, PRUint32 envCount, PRUnichar **env, PRUint32 flagCount, PRUint32 *flags,
+    PRUint32 timeoutMS, IGuestProcess **process)
+{
+    Tick();
+    MockGuestSession *gs = (MockGuestSession *)pThis;
+    if (!gs->loggedOn || gs->vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    MockGuestProcess *p = Alloc(1, sizeof(MockGuestProcess));
+    p->base.lpVtbl = &gpVtbl;
+    p->status = ProcessStatus_Started;
+    char *cmd = ToUtf8(argCount ? args[argCount - 1] : executable);
+    snprintf(p->output, sizeof(p->output), "%s: %s\n", gs->vm->name, cmd);
+    p->exitCode = strcmp(cmd, "false") == 0 ? 1 : 0;
+    free(cmd);
+    *process = &p->base;
+    return NS_OK;
+}
+
+static nsresult gsFileCopyToGuest(IGuestSession *pThis, PRUnichar *source, PRUnichar *destination,
+    PRUint32 flagCount, PRUint32 *flags, IProgress **progress)
+{
+    Tick();
+    MockGuestSession *gs = (MockGuestSession *)pThis;
+    if (!gs->loggedOn || gs->vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    char *path = ToUtf8(source);
+    struct stat st;
+    int missing = stat(path, &st);
+    free(path);
+    if (missing) { return VBOX_E_FILE_ERROR; }
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult gsClose(IGuestSession *pThis)
+{
+    Tick(); ((MockGuestSession *)pThis)->loggedOn = false; return NS_OK;
+}
+
+static struct IGuestSessionVtbl gsVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseFree,
+    .WaitForArray = gsWaitForArray,
+    .ProcessCreate = gsProcessCreate,
+    .FileCopyToGuest = gsFileCopyToGuest,
+    .Close = gsClose,
+};
+
+static nsresult guestCreateSession(IGuest *pThis, PRUnichar *user, PRUnichar *password,
+    PRUnichar *domain, PRUnichar *name, IGuestSession **session)
+{
+    Tick();
+    MockVM *vm = ((MockGuest *)pThis)->vm;
+    if (vm->state != MachineState_Running) { return VBOX_E_INVALID_VM_STATE; }
+    MockGuestSession *gs = Alloc(1, sizeof(MockGuestSession));
+    gs->base.lpVtbl = &gsVtbl;
+    gs->vm = vm;
+    gs->loggedOn = password && password[0];
+    *session = &gs->base;
+    return NS_OK;
+}
+
+static struct IGuestVtbl guestVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetMemoryBalloonSize = guestGetMemoryBalloonSize,
+    .SetMemoryBalloonSize = guestSetMemoryBalloonSize,
+    .GetStatisticsUpdateInterval = guestGetStatisticsUpdateInterval,
+    .SetStatisticsUpdateInterval = guestSetStatisticsUpdateInterval,
+    .InternalGetStatistics = guestInternalGetStatistics,
+    .GetAdditionsRunLevel = guestGetAdditionsRunLevel,
+    .CreateSession = guestCreateSession,
+};
+
+
+// ===== ISession =====
+
+static nsresult sessionGetMachine(ISession *pThis, IMachine **machine)
+{
+    Tick();
+    MockVM *vm = ((MockSession *)pThis)->vm;
+    // The session machine is the registered object itself, so there is no
+    // separate copy to roll back: DiscardSettings only drops the lock state
+    *machine = vm ? &vm->base : NULL;
+    return NS_OK;
+}
+
+static nsresult sessionGetConsole(ISession *pThis, IConsole **console)
+{
+    Tick();
+    MockSession *session = (MockSession *)pThis;
+    session->console.vm = session->vm;
+    *console = &session->console.base;
+    return NS_OK;
+}
+
+static nsresult sessionUnlockMachine(ISession *pThis)
+{
+    Tick();
+    MockSession *session = (MockSession *)pThis;
+    if (session->vm && session->vm->locked != LockType_Null) {
+        session->vm->locked = LockType_Null;
+        FireSessionChanged(session->vm, SessionState_Unlocked);
+    }
+    session->vm = NULL;
+    return NS_OK;
+}
+
+static nsresult sessionGetState(ISession *pThis, PRUint32 *state)
+{
+    Tick();
+    *state = ((MockSession *)pThis)->vm ? SessionState_Locked : SessionState_Unlocked;
+    return NS_OK;
+}
+
+static struct ISessionVtbl sessionVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetMachine = sessionGetMachine,
+    .GetConsole = sessionGetConsole,
+    .UnlockMachine = sessionUnlockMachine,
+    .GetState = sessionGetState,
+};
+
+
+// ===== IBIOSSettings =====
+
+// Setters need the VM write-locked, like all other offline settings
+#define BIOS_SETTER(Name, field, T) \
+    static nsresult biosSet##Name(IBIOSSettings *pThis, T value) \
+    { \
+        Tick(); \
+        MockBIOS *bios = (MockBIOS *)pThis; \
+        if (bios->vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; } \
+        bios->field = value; \
+        return NS_OK; \
+    } \
+    static nsresult biosGet##Name(IBIOSSettings *pThis, T *value) \
+    { \
+        Tick(); *value = ((MockBIOS *)pThis)->field; return NS_OK; \
+    }
+
+BIOS_SETTER(LogoFadeIn, logoFadeIn, PRBool)
+BIOS_SETTER(LogoFadeOut, logoFadeOut, PRBool)
+BIOS_SETTER(LogoDisplayTime, logoDisplayTime, PRUint32)
+BIOS_SETTER(BootMenuMode, bootMenuMode, PRUint32)
+BIOS_SETTER(IOAPICEnabled, ioapic, PRBool)
+
+static struct IBIOSSettingsVtbl biosVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .SetLogoFadeIn = biosSetLogoFadeIn,
+    .GetLogoFadeIn = biosGetLogoFadeIn,
+    .SetLogoFadeOut = biosSetLogoFadeOut,
+    .GetLogoFadeOut = biosGetLogoFadeOut,
+    .SetLogoDisplayTime = biosSetLogoDisplayTime,
+    .GetLogoDisplayTime = biosGetLogoDisplayTime,
+    .SetBootMenuMode = biosSetBootMenuMode,
+    .GetBootMenuMode = biosGetBootMenuMode,
+    .SetIOAPICEnabled = biosSetIOAPICEnabled,
+    .GetIOAPICEnabled = biosGetIOAPICEnabled,
+};
+
+
+// ===== IVRDEServer =====
+
+static nsresult vrdeGetEnabled(IVRDEServer *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockVRDE *)pThis)->enabled; return NS_OK;
+}
+
+static nsresult vrdeSetEnabled(IVRDEServer *pThis, PRBool value)
+{
+    Tick();
+    MockVRDE *vrde = (MockVRDE *)pThis;
+    if (vrde->vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vrde->enabled = value;
+    return NS_OK;
+}
+
+static struct IVRDEServerVtbl vrdeVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetEnabled = vrdeGetEnabled,
+    .SetEnabled = vrdeSetEnabled,
+};
+
+
+// ===== IStorageController, IMediumAttachment, IMedium =====
+
+static nsresult ctlGetName(IStorageController *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockCtl *)pThis)->name); return NS_OK;
+}
+
+static nsresult ctlGetBus(IStorageController *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockCtl *)pThis)->bus; return NS_OK;
+}
+
+static nsresult ctlGetControllerType(IStorageController *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockCtl *)pThis)->type; return NS_OK;
+}
+
+static nsresult ctlGetUseHostIOCache(IStorageController *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockCtl *)pThis)->hostIOCache; return NS_OK;
+}
+
+static nsresult ctlSetUseHostIOCache(IStorageController *pThis, PRBool value)
+{
+    Tick(); ((MockCtl *)pThis)->hostIOCache = value; return NS_OK;
+}
+
+static struct IStorageControllerVtbl ctlVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetName = ctlGetName,
+    .GetBus = ctlGetBus,
+    .GetControllerType = ctlGetControllerType,
+    .GetUseHostIOCache = ctlGetUseHostIOCache,
+    .SetUseHostIOCache = ctlSetUseHostIOCache,
+};
+
+static nsresult maGetController(IMediumAttachment *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockAttachment *)pThis)->controller); return NS_OK;
+}
+
+static nsresult maGetPort(IMediumAttachment *pThis, PRInt32 *value)
+{
+    Tick(); *value = ((MockAttachment *)pThis)->port; return NS_OK;
+}
+
+static nsresult maGetDevice(IMediumAttachment *pThis, PRInt32 *value)
+{
+    Tick(); *value = ((MockAttachment *)pThis)->device; return NS_OK;
+}
+
+static nsresult maGetType(IMediumAttachment *pThis, PRUint32 *value)
+{
+    Tick(); *value = DeviceType_HardDisk; return NS_OK;
+}
+
+static nsresult maGetPassthrough(IMediumAttachment *pThis, PRBool *value)
+{
+    Tick(); *value = FALSE; return NS_OK;
+}
+
+static nsresult maGetMedium(IMediumAttachment *pThis, IMedium **value)
+{
+    Tick(); *value = &((MockAttachment *)pThis)->medium.base; return NS_OK;
+}
+
+static struct IMediumAttachmentVtbl maVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetController = maGetController,
+    .GetPort = maGetPort,
+    .GetDevice = maGetDevice,
+    .GetType = maGetType,
+    .GetPassthrough = maGetPassthrough,
+    .GetMedium = maGetMedium,
+};
+
+static nsresult mediumGetId(IMedium *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockMedium *)pThis)->id); return NS_OK;
+}
+
+static nsresult mediumGetLocation(IMedium *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockMedium *)pThis)->location); return NS_OK;
+}
+
+static nsresult mediumGetHostDrive(IMedium *pThis, PRBool *value)
+{
+    Tick(); *value = FALSE; return NS_OK;
+}
+
+static nsresult mediumGetDeviceType(IMedium *pThis, PRUint32 *value)
+{
+    Tick(); *value = DeviceType_HardDisk; return NS_OK;
+}
+
+// Every disk takes up 1.5GB of host disk
+static nsresult mediumGetSize(IMedium *pThis, PRInt64 *value)
+{
+    Tick(); *value = (PRInt64)1536 * 1024 * 1024; return NS_OK;
+}
+
+static struct IMediumVtbl mediumVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetId = mediumGetId,
+    .GetLocation = mediumGetLocation,
+    .GetHostDrive = mediumGetHostDrive,
+    .GetDeviceType = mediumGetDeviceType,
+    .GetSize = mediumGetSize,
+};
+
+
+// ===== ISnapshot =====
+
+static nsresult snapshotGetName(ISnapshot *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockSnapshot *)pThis)->name); return NS_OK;
+}
+
+static nsresult snapshotGetId(ISnapshot *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockSnapshot *)pThis)->id); return NS_OK;
+}
+
+static nsresult snapshotGetTimeStamp(ISnapshot *pThis, PRInt64 *value)
+{
+    Tick(); *value = ((MockSnapshot *)pThis)->timeStamp; return NS_OK;
+}
+
+static nsresult snapshotGetOnline(ISnapshot *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockSnapshot *)pThis)->online; return NS_OK;
+}
+
+static nsresult snapshotGetParent(ISnapshot *pThis, ISnapshot **value)
+{
+    Tick();
+    MockSnapshot *parent = ((MockSnapshot *)pThis)->parent;
+    *value = parent ? &parent->base : NULL;
+    return NS_OK;
+}
+
+static nsresult snapshotGetChildren(ISnapshot *pThis, PRUint32 *size, ISnapshot ***list)
+{
+    Tick();
+    MockSnapshot *snapshot = (MockSnapshot *)pThis;
+    *list = Alloc(snapshot->childCount + 1, sizeof(ISnapshot *));
+    for (int i = 0; i < snapshot->childCount; ++i) { (*list)[i] = &snapshot->children[i]->base; }
+    *size = snapshot->childCount;
+    return NS_OK;
+}
+
+static struct ISnapshotVtbl snapshotVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetName = snapshotGetName,
+    .GetId = snapshotGetId,
+    .GetTimeStamp = snapshotGetTimeStamp,
+    .GetOnline = snapshotGetOnline,
+    .GetParent = snapshotGetParent,
+    .GetChildren = snapshotGetChildren,
+};
+
+
+// ===== IMachine =====
+
+static nsresult vmGetAccessible(IMachine *pThis, PRBool *value)
+{
+    Tick(); *value = TRUE; return NS_OK;
+}
+
+static nsresult vmGetName(IMachine *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockVM *)pThis)->name); return NS_OK;
+}
+
+static nsresult vmGetId(IMachine *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockVM *)pThis)->id); return NS_OK;
+}
+
+static nsresult vmGetOSTypeId(IMachine *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockVM *)pThis)->osType); return NS_OK;
+}
+
+static nsresult vmGetCPUCount(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->cpus; return NS_OK;
+}
+
+static nsresult vmSetCPUCount(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->cpus = value;
+    return NS_OK;
+}
+
+static nsresult vmGetMemorySize(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->memory; return NS_OK;
+}
+
+static nsresult vmSetMemorySize(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->memory = value;
+    return NS_OK;
+}
+
+static nsresult vmGetMemoryBalloonSize(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->balloon; return NS_OK;
+}
+
+static nsresult vmSetMemoryBalloonSize(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->balloon = value;
+    return NS_OK;
+}
+
+static nsresult vmGetPageFusionEnabled(IMachine *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->pageFusion; return NS_OK;
+}
+
+static nsresult vmSetPageFusionEnabled(IMachine *pThis, PRBool value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->pageFusion = value;
+    return NS_OK;
+}
+
+// Both of these are runtime settings, so a shared lock is enough
+static nsresult vmGetCPUExecutionCap(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->cpuCap; return NS_OK;
+}
+
+static nsresult vmSetCPUExecutionCap(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null) { return VBOX_E_INVALID_OBJECT_STATE; }
+    if (value < 1 || value > 100) { return NS_ERROR_INVALID_ARG; }
+    vm->cpuCap = value;
+    return NS_OK;
+}
+
+static nsresult vmGetVMProcessPriority(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->priority; return NS_OK;
+}
+
+static nsresult vmSetVMProcessPriority(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->priority = value;
+    return NS_OK;
+}
+
+static nsresult vmGetState(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->state; return NS_OK;
+}
+
+static nsresult vmGetSessionState(IMachine *pThis, PRUint32 *value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    bool locked = vm->locked != LockType_Null || vm->state == MachineState_Running;
+    *value = locked ? SessionState_Locked : SessionState_Unlocked;
+    return NS_OK;
+}
+
+static nsresult vmGetGuestPropertyValue(IMachine *pThis, PRUnichar *property, PRUnichar **value)
+{
+    Tick();
+    __sync_fetch_and_add(&statPropGet, 1);
+    MockVM *vm = (MockVM *)pThis;
+    char *name = ToUtf8(property);
+    pthread_mutex_lock(&mockLock);
+    int i = FindProp(vm, name);
+    *value = ToUtf16(i >= 0 ? vm->propValue[i] : "");
+    pthread_mutex_unlock(&mockLock);
+    free(name);
+    return NS_OK;
+}
+
+static nsresult vmSetGuestPropertyValue(IMachine *pThis, PRUnichar *property, PRUnichar *value)
+{
+    Tick();
+    __sync_fetch_and_add(&statPropSet, 1);
+    MockVM *vm = (MockVM *)pThis;
+    char *name = ToUtf8(property);
+    char *val = ToUtf8(value);
+    pthread_mutex_lock(&mockLock);
+    PutProp(vm, name, val);
+    pthread_mutex_unlock(&mockLock);
+    FirePropChanged(vm, name, val);
+    free(name);
+    free(val);
+    return NS_OK;
+}
+
+static nsresult vmEnumerateGuestProperties(IMachine *pThis, PRUnichar *patterns,
+    PRUint32 *namesSize, PRUnichar ***names, PRUint32 *valuesSize, PRUnichar ***values,
+    PRUint32 *timestampsSize, PRInt64 **timestamps, PRUint32 *flagsSize, PRUnichar ***flags)
+{
+    Tick();
+    __sync_fetch_and_add(&statEnum, 1);
+    MockVM *vm = (MockVM *)pThis;
+    char *pattern = ToUtf8(patterns);
+    pthread_mutex_lock(&mockLock);
+    BSTR *n = Alloc(vm->propCount, sizeof(BSTR));
+    BSTR *v = Alloc(vm->propCount, sizeof(BSTR));
+    BSTR *f = Alloc(vm->propCount, sizeof(BSTR));
+    PRInt64 *t = Alloc(vm->propCount, sizeof(PRInt64));
+    PRUint32 count = 0;
+    for (int i = 0; i < vm->propCount; ++i) {
+        if (!MatchPattern(pattern, vm->propName[i])) { continue; }
+        n[count] = ToUtf16(vm->propName[i]);
+        v[count] = ToUtf16(vm->propValue[i]);
+        f[count] = ToUtf16("");
+        t[count] = vm->propTime[i];
+        ++count;
+    }
+    pthread_mutex_unlock(&mockLock);
+    free(pattern);
+    *namesSize = *valuesSize = *timestampsSize = *flagsSize = count;
+    *names = n; *values = v; *timestamps = t; *flags = f;
+    return NS_OK;
+}
+
+static nsresult vmLockMachine(IMachine *pThis, ISession *session, PRUint32 lockType)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    // Like VirtualBox, a write lock needs the VM powered off and unlocked
+    if (lockType == LockType_Write &&
+        (vm->locked != LockType_Null || vm->state == MachineState_Running)) {
+        return VBOX_E_INVALID_OBJECT_STATE;
+    }
+    if (vm->locked == LockType_Null) { FireSessionChanged(vm, SessionState_Locked); }
+    if (lockType == LockType_Write || vm->locked == LockType_Null) {
+        vm->locked = lockType;
+    }
+    ((MockSession *)session)->vm = vm;
+    return NS_OK;
+}
+
+static nsresult vmLaunchVMProcess(IMachine *pThis, ISession *session, PRUnichar *name,
+    PRUint32 envSize, PRUnichar **env, IProgress **progress)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Null || vm->state == MachineState_Running) {
+        return VBOX_E_INVALID_OBJECT_STATE;
+    }
+    vm->state = MachineState_Running;
+    FireStateChanged(vm);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+// Saving state goes through a shared lock on the running VM, like in VirtualBox
+static nsresult vmSaveState(IMachine *pThis, IProgress **progress)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null || vm->state != MachineState_Running) {
+        return VBOX_E_INVALID_VM_STATE;
+    }
+    vm->state = MachineState_Saved;
+    FireStateChanged(vm);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult vmDiscardSavedState(IMachine *pThis, PRBool removeFile)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write || vm->state != MachineState_Saved) {
+        return VBOX_E_INVALID_VM_STATE;
+    }
+    vm->state = MachineState_PoweredOff;
+    FireStateChanged(vm);
+    return NS_OK;
+}
+
+// Snapshot of VM as it is now, made its current one
+static MockSnapshot * NewSnapshot(MockVM *vm, const char *name)
+{
+    MockSnapshot *snapshot = Alloc(1, sizeof(MockSnapshot));
+    snapshot->base.lpVtbl = &snapshotVtbl;
+    snprintf(snapshot->name, sizeof(snapshot->name), "%s", name);
+    snprintf(snapshot->id, sizeof(snapshot->id), "00000000-0000-4000-a000-%012lx", NextSeq());
+    snapshot->timeStamp = (PRInt64)time(NULL) * 1000;
+    snapshot->online = vm->state == MachineState_Running;
+    snapshot->cpus = vm->cpus;
+    snapshot->memory = vm->memory;
+    snapshot->parent = vm->snapshot;
+
+    pthread_mutex_lock(&mockLock);
+    if (snapshot->parent) {
+        MockSnapshot *parent = snapshot->parent;
+        parent->children = realloc(parent->children, (parent->childCount + 1) * sizeof(void *));
+        parent->children[parent->childCount++] = snapshot;
+    }
+    vm->snapshots = realloc(vm->snapshots, (vm->snapshotCount + 1) * sizeof(void *));
+    vm->snapshots[vm->snapshotCount++] = snapshot;
+    vm->snapshot = snapshot;
+    pthread_mutex_unlock(&mockLock);
+    return snapshot;
+}
+
+static nsresult vmTakeSnapshot(IMachine *pThis, PRUnichar *name, PRUnichar *description,
+    PRBool pause, PRUnichar **id, IProgress **progress)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null) { return VBOX_E_INVALID_OBJECT_STATE; }
+    char *name8 = ToUtf8(name);
+    MockSnapshot *snapshot = NewSnapshot(vm, name8);
+    free(name8);
+    *id = ToUtf16(snapshot->id);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult vmFindSnapshot(IMachine *pThis, PRUnichar *nameOrId, ISnapshot **snapshot)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    char *name = ToUtf8(nameOrId);
+    *snapshot = NULL;
+    for (int i = 0; i < vm->snapshotCount; ++i) {
+        if (strcmp(vm->snapshots[i]->name, name) == 0 || strcmp(vm->snapshots[i]->id, name) == 0) {
+            *snapshot = &vm->snapshots[i]->base;
+            break;
+        }
+    }
+    free(name);
+    return *snapshot ? NS_OK : VBOX_E_OBJECT_NOT_FOUND;
+}
+
+static nsresult vmGetCurrentSnapshot(IMachine *pThis, ISnapshot **snapshot)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    *snapshot = vm->snapshot ? &vm->snapshot->base : NULL;
+    return NS_OK;
+}
+
+static nsresult vmGetSnapshotCount(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->snapshotCount; return NS_OK;
+}
+
+// Like VirtualBox, restoring needs the VM write-locked and not running
+static nsresult vmRestoreSnapshot(IMachine *pThis, ISnapshot *value, IProgress **progress)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write || vm->state == MachineState_Running) {
+        return VBOX_E_INVALID_VM_STATE;
+    }
+    MockSnapshot *snapshot = (MockSnapshot *)value;
+    vm->cpus = snapshot->cpus;
+    vm->memory = snapshot->memory;
+    vm->snapshot = snapshot;
+    vm->state = snapshot->online ? MachineState_Saved : MachineState_PoweredOff;
+    FireStateChanged(vm);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult vmSaveSettings(IMachine *pThis)
+{
+    Tick();
+    __sync_fetch_and_add(&statSave, 1);
+    FireDataChanged((MockVM *)pThis);
+    return NS_OK;
+}
+
+static nsresult vmDiscardSettings(IMachine *pThis)
+{
+    Tick(); return NS_OK;
+}
+
+static nsresult vmGetNetworkAdapter(IMachine *pThis, PRUint32 slot, INetworkAdapter **adapter)
+{
+    Tick();
+    if (slot >= MOCK_NICS) { return NS_ERROR_INVALID_ARG; }
+    *adapter = &((MockVM *)pThis)->nic[slot].base;
+    return NS_OK;
+}
+
+static nsresult vmSetBootOrder(IMachine *pThis, PRUint32 position, PRUint32 device)
+{
+    Tick(); return NS_OK;
+}
+
+static nsresult vmUnregister(IMachine *pThis, PRUint32 cleanupMode, PRUint32 *mediaSize, IMedium ***media)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    pthread_mutex_lock(&mockLock);
+    for (ULONG i = 0; i < mockVMCount; ++i) {
+        if (mockVMs[i] == vm) {
+            mockVMs[i] = mockVMs[--mockVMCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mockLock);
+    vm->registered = false;
+    FireRegistered(vm, FALSE);
+    // Every mode but UnregisterOnly detaches the disk, and all but
+    // DetachAllReturnNone hand it back for DeleteConfig
+    *mediaSize = 0;
+    *media = Alloc(1, sizeof(IMedium *));
+    if (cleanupMode != CleanupMode_UnregisterOnly) { vm->disk.controller[0] = '\0'; }
+    if (cleanupMode == CleanupMode_DetachAllReturnHardDisksOnly || cleanupMode == CleanupMode_Full) {
+        (*media)[0] = &vm->disk.medium.base;
+        *mediaSize = 1;
+    }
+    return NS_OK;
+}
+
+static nsresult vmDeleteConfig(IMachine *pThis, PRUint32 mediaSize, IMedium **media, IProgress **progress)
+{
+    Tick(); *progress = &NewProgress()->base; return NS_OK;
+}
+
+static nsresult vmGetStorageControllers(IMachine *pThis, PRUint32 *size, IStorageController ***list)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    *list = Alloc(vm->ctlCount + 1, sizeof(void *));
+    for (int i = 0; i < vm->ctlCount; ++i) { (*list)[i] = &vm->ctl[i].base; }
+    *size = vm->ctlCount;
+    return NS_OK;
+}
+
+static nsresult vmGetMediumAttachments(IMachine *pThis, PRUint32 *size, IMediumAttachment ***list)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    *list = Alloc(1, sizeof(void *));
+    *size = 0;
+    if (vm->disk.controller[0]) {
+        (*list)[0] = &vm->disk.base;
+        *size = 1;
+    }
+    return NS_OK;
+}
+
+static int FindCtl(MockVM *vm, const char *name)
+{
+    for (int i = 0; i < vm->ctlCount; ++i) {
+        if (strcmp(vm->ctl[i].name, name) == 0) { return i; }
+    }
+    return -1;
+}
+
+static nsresult vmAddStorageController(IMachine *pThis, PRUnichar *name, PRUint32 bus,
+    IStorageController **controller)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    char *name8 = ToUtf8(name);
+    nsresult rc = NS_OK;
+    if (FindCtl(vm, name8) >= 0 || vm->ctlCount == MOCK_CTLS) { rc = VBOX_E_OBJECT_IN_USE; }
+    else {
+        MockCtl *ctl = &vm->ctl[vm->ctlCount++];
+        ctl->base.lpVtbl = &ctlVtbl;
+        snprintf(ctl->name, sizeof(ctl->name), "%s", name8);
+        ctl->bus = bus;
+        ctl->type = bus == StorageBus_VirtioSCSI ? StorageControllerType_VirtioSCSI :
+            StorageControllerType_IntelAhci;
+        ctl->hostIOCache = FALSE;
+        *controller = &ctl->base;
+    }
+    free(name8);
+    return rc;
+}
+
+static nsresult vmRemoveStorageController(IMachine *pThis, PRUnichar *name)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    char *name8 = ToUtf8(name);
+    int i = FindCtl(vm, name8);
+    bool inUse = strcmp(vm->disk.controller, name8) == 0;
+    free(name8);
+    if (i < 0) { return VBOX_E_OBJECT_NOT_FOUND; }
+    if (inUse) { return VBOX_E_OBJECT_IN_USE; }
+    for (; i < vm->ctlCount - 1; ++i) { vm->ctl[i] = vm->ctl[i + 1]; }
+    vm->ctlCount--;
+    return NS_OK;
+}
+
+static nsresult vmDetachDevice(IMachine *pThis, PRUnichar *name, PRInt32 port, PRInt32 device)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    char *name8 = ToUtf8(name);
+    bool found = strcmp(vm->disk.controller, name8) == 0 &&
+        vm->disk.port == port && vm->disk.device == device;
+    free(name8);
+    if (!found) { return VBOX_E_OBJECT_NOT_FOUND; }
+    vm->disk.controller[0] = '\0';
+    return NS_OK;
+}
+
+static nsresult vmAttachDevice(IMachine *pThis, PRUnichar *name, PRInt32 port, PRInt32 device,
+    PRUint32 type, IMedium *medium)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    if (medium != &vm->disk.medium.base || vm->disk.controller[0]) { return VBOX_E_OBJECT_IN_USE; }
+    char *name8 = ToUtf8(name);
+    nsresult rc = FindCtl(vm, name8) < 0 ? VBOX_E_OBJECT_NOT_FOUND : NS_OK;
+    if (rc == NS_OK) {
+        snprintf(vm->disk.controller, sizeof(vm->disk.controller), "%s", name8);
+        vm->disk.port = port;
+        vm->disk.device = device;
+    }
+    free(name8);
+    return rc;
+}
+
+static nsresult vmGetParavirtProvider(IMachine *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockVM *)pThis)->paravirt; return NS_OK;
+}
+
+static nsresult vmSetParavirtProvider(IMachine *pThis, PRUint32 value)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked != LockType_Write) { return VBOX_E_INVALID_OBJECT_STATE; }
+    vm->paravirt = value;
+    return NS_OK;
+}
+
+static nsresult vmGetBIOSSettings(IMachine *pThis, IBIOSSettings **value)
+{
+    Tick(); *value = &((MockVM *)pThis)->bios.base; return NS_OK;
+}
+
+static nsresult vmGetVRDEServer(IMachine *pThis, IVRDEServer **value)
+{
+    Tick(); *value = &((MockVM *)pThis)->vrde.base; return NS_OK;
+}
+
+static nsresult vmGetSharedFolders(IMachine *pThis, PRUint32 *size, ISharedFolder ***list)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    ListShares(vm->share, vm->shareCount, size, list);
+    return NS_OK;
+}
+
+static nsresult vmCreateSharedFolder(IMachine *pThis, PRUnichar *name, PRUnichar *hostPath,
+    PRBool writable, PRBool autoMount, PRUnichar *mountPoint)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null) { return VBOX_E_INVALID_OBJECT_STATE; }
+    return AddShare(vm->share, &vm->shareCount, name, hostPath, writable, autoMount, mountPoint);
+}
+
+static nsresult vmRemoveSharedFolder(IMachine *pThis, PRUnichar *name)
+{
+    Tick();
+    MockVM *vm = (MockVM *)pThis;
+    if (vm->locked == LockType_Null) { return VBOX_E_INVALID_OBJECT_STATE; }
+    return RemoveShare(vm->share, &vm->shareCount, name);
+}
+
+static MockVSD * NewVSD(void);
+
+static nsresult vmExportTo(IMachine *pThis, IAppliance *appliance, PRUnichar *location,
+    IVirtualSystemDescription **description)
+{
+    Tick();
+    MockAppliance *app = (MockAppliance *)appliance;
+    app->vsd = NewVSD();
+    *description = &app->vsd->base;
+    return NS_OK;
+}
+
+static nsresult vmGetSettingsFilePath(IMachine *pThis, PRUnichar **value)
+{
+    Tick();
+    char path[256];
+    snprintf(path, sizeof(path), "/mock/%s/%s.vbox", ((MockVM *)pThis)->name,
+        ((MockVM *)pThis)->name);
+    *value = ToUtf16(path);
+    return NS_OK;
+}
+
+static struct IMachineVtbl vmVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetAccessible = vmGetAccessible,
+    .GetName = vmGetName,
+    .GetId = vmGetId,
+    .GetOSTypeId = vmGetOSTypeId,
+    .GetCPUCount = vmGetCPUCount,
+    .SetCPUCount = vmSetCPUCount,
+    .GetMemorySize = vmGetMemorySize,
+    .SetMemorySize = vmSetMemorySize,
+    .GetMemoryBalloonSize = vmGetMemoryBalloonSize,
+    .SetMemoryBalloonSize = vmSetMemoryBalloonSize,
+    .GetPageFusionEnabled = vmGetPageFusionEnabled,
+    .SetPageFusionEnabled = vmSetPageFusionEnabled,
+    .GetCPUExecutionCap = vmGetCPUExecutionCap,
+    .SetCPUExecutionCap = vmSetCPUExecutionCap,
+    .GetVMProcessPriority = vmGetVMProcessPriority,
+    .SetVMProcessPriority = vmSetVMProcessPriority,
+    .GetState = vmGetState,
+    .GetSessionState = vmGetSessionState,
+    .GetGuestPropertyValue = vmGetGuestPropertyValue,
+    .SetGuestPropertyValue = vmSetGuestPropertyValue,
+    .EnumerateGuestProperties = vmEnumerateGuestProperties,
+    .LockMachine = vmLockMachine,
+    .LaunchVMProcess = vmLaunchVMProcess,
+    .SaveSettings = vmSaveSettings,
+    .SaveState = vmSaveState,
+    .DiscardSavedState = vmDiscardSavedState,
+    .TakeSnapshot = vmTakeSnapshot,
+    .FindSnapshot = vmFindSnapshot,
+    .GetCurrentSnapshot = vmGetCurrentSnapshot,
+    .GetSnapshotCount = vmGetSnapshotCount,
+    .RestoreSnapshot = vmRestoreSnapshot,
+    .DiscardSettings = vmDiscardSettings,
+    .GetNetworkAdapter = vmGetNetworkAdapter,
+    .SetBootOrder = vmSetBootOrder,
+    .Unregister = vmUnregister,
+    .DeleteConfig = vmDeleteConfig,
+    .GetStorageControllers = vmGetStorageControllers,
+    .GetMediumAttachments = vmGetMediumAttachments,
+    .AddStorageController = vmAddStorageController,
+    .RemoveStorageController = vmRemoveStorageController,
+    .DetachDevice = vmDetachDevice,
+    .AttachDevice = vmAttachDevice,
+    .GetParavirtProvider = vmGetParavirtProvider,
+    .SetParavirtProvider = vmSetParavirtProvider,
+    .GetBIOSSettings = vmGetBIOSSettings,
+    .GetVRDEServer = vmGetVRDEServer,
+    .GetSharedFolders = vmGetSharedFolders,
+    .CreateSharedFolder = vmCreateSharedFolder,
+    .RemoveSharedFolder = vmRemoveSharedFolder,
+    .ExportTo = vmExportTo,
+    .GetSettingsFilePath = vmGetSettingsFilePath,
+};
+
+
+// Create and register a new powered off VM
+static MockVM * NewVM(const char *name, PRUint32 cpus, PRUint32 memory)
+{
+    MockVM *vm = Alloc(1, sizeof(MockVM));
+    vm->base.lpVtbl = &vmVtbl;
+    unsigned long seq = NextSeq();
+    snprintf(vm->name, sizeof(vm->name), "%s", name);
+    snprintf(vm->id, sizeof(vm->id), "00000000-0000-4000-8000-%012lx", seq);
+    strcpy(vm->osType, "Ubuntu_64");
+    vm->cpus = cpus;
+    vm->memory = memory;
+    vm->cpuCap = 100;
+    vm->priority = VMProcPriority_Default;
+    vm->paravirt = ParavirtProvider_Default;
+    vm->bios.base.lpVtbl = &biosVtbl;
+    vm->bios.vm = vm;
+    vm->bios.logoFadeIn = vm->bios.logoFadeOut = TRUE;
+    vm->bios.logoDisplayTime = 0;
+    vm->bios.bootMenuMode = BIOSBootMenuMode_MessageAndMenu;
+    vm->vrde.base.lpVtbl = &vrdeVtbl;
+    vm->vrde.vm = vm;
+    vm->vrde.enabled = TRUE;
+    vm->ctlCount = 1;
+    vm->ctl[0].base.lpVtbl = &ctlVtbl;
+    strcpy(vm->ctl[0].name, "SATA");
+    vm->ctl[0].bus = StorageBus_SATA;
+    vm->ctl[0].type = StorageControllerType_IntelAhci;
+    vm->disk.base.lpVtbl = &maVtbl;
+    strcpy(vm->disk.controller, "SATA");
+    vm->disk.medium.base.lpVtbl = &mediumVtbl;
+    snprintf(vm->disk.medium.id, sizeof(vm->disk.medium.id), "00000000-0000-4000-9000-%012lx", seq);
+    snprintf(vm->disk.medium.location, sizeof(vm->disk.medium.location), "/mock/%s/hd1.vmdk", name);
+    vm->state = MachineState_PoweredOff;
+    vm->locked = LockType_Null;
+    vm->registered = true;
+    for (int i = 0; i < MOCK_NICS; ++i) {
+        vm->nic[i].base.lpVtbl = &nicVtbl;
+        vm->nic[i].nat.base.lpVtbl = &natVtbl;
+        vm->nic[i].attachmentType = NetworkAttachmentType_Null;
+        snprintf(vm->nic[i].mac, sizeof(vm->nic[i].mac), "080027%02X%04lX",
+            i, seq & 0xFFFF);
+    }
+
+    pthread_mutex_lock(&mockLock);
+    if (mockVMCount == mockVMCap) {
+        mockVMCap = mockVMCap ? mockVMCap * 2 : 16;
+        mockVMs = realloc(mockVMs, mockVMCap * sizeof(MockVM *));
+        if (!mockVMs) { fprintf(stderr, "vboxmock: out of memory\n"); exit(EXIT_FAILURE); }
+    }
+    mockVMs[mockVMCount++] = vm;
+    pthread_mutex_unlock(&mockLock);
+    return vm;
+}
+
+
+static MockVM * FindVM(const char *name)
+{
+    MockVM *found = NULL;
+    pthread_mutex_lock(&mockLock);
+    for (ULONG i = 0; i < mockVMCount; ++i) {
+        if (strcmp(mockVMs[i]->name, name) == 0 || strcmp(mockVMs[i]->id, name) == 0) {
+            found = mockVMs[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mockLock);
+    return found;
+}
+
+
+// ===== IVirtualSystemDescription =====
+
+static nsresult vsdRemoveDescriptionByType(IVirtualSystemDescription *pThis, PRUint32 type)
+{
+    Tick();
+    MockVSD *vsd = (MockVSD *)pThis;
+    PRUint32 j = 0;
+    for (PRUint32 i = 0; i < vsd->count; ++i) {
+        if (vsd->type[i] == type) {
+            free(vsd->value[i]);
+            free(vsd->extra[i]);
+            continue;
+        }
+        vsd->type[j] = vsd->type[i];
+        vsd->value[j] = vsd->value[i];
+        vsd->extra[j] = vsd->extra[i];
+        vsd->enabled[j] = vsd->enabled[i];
+        ++j;
+    }
+    vsd->count = j;
+    return NS_OK;
+}
+
+static nsresult vsdGetCount(IVirtualSystemDescription *pThis, PRUint32 *count)
+{
+    Tick(); *count = ((MockVSD *)pThis)->count; return NS_OK;
+}
+
+static nsresult vsdGetDescription(IVirtualSystemDescription *pThis,
+    PRUint32 *typesSize, PRUint32 **types, PRUint32 *refsSize, PRUnichar ***refs,
+    PRUint32 *ovfSize, PRUnichar ***ovf, PRUint32 *vboxSize, PRUnichar ***vbox,
+    PRUint32 *extraSize, PRUnichar ***extra)
+{
+    Tick();
+    MockVSD *vsd = (MockVSD *)pThis;
+    PRUint32 n = vsd->count;
+    *types = Alloc(n, sizeof(PRUint32));
+    *refs = Alloc(n, sizeof(BSTR));
+    *ovf = Alloc(n, sizeof(BSTR));
+    *vbox = Alloc(n, sizeof(BSTR));
+    *extra = Alloc(n, sizeof(BSTR));
+    for (PRUint32 i = 0; i < n; ++i) {
+        (*types)[i] = vsd->type[i];
+        (*refs)[i] = ToUtf16("");
+        (*ovf)[i] = ToUtf16(vsd->value[i]);
+        (*vbox)[i] = ToUtf16(vsd->value[i]);
+        (*extra)[i] = ToUtf16(vsd->extra[i]);
+    }
+    *typesSize = *refsSize = *ovfSize = *vboxSize = *extraSize = n;
+    return NS_OK;
+}
+
+static nsresult vsdSetFinalValues(IVirtualSystemDescription *pThis,
+    PRUint32 enabledSize, PRBool *enabled, PRUint32 vboxSize, PRUnichar **vbox,
+    PRUint32 extraSize, PRUnichar **extra)
+{
+    Tick();
+    MockVSD *vsd = (MockVSD *)pThis;
+    if (enabledSize != vsd->count || vboxSize != vsd->count || extraSize != vsd->count) {
+        return NS_ERROR_INVALID_ARG;
+    }
+    for (PRUint32 i = 0; i < vsd->count; ++i) {
+        vsd->enabled[i] = enabled[i];
+        free(vsd->value[i]);
+        free(vsd->extra[i]);
+        vsd->value[i] = ToUtf8(vbox[i]);
+        vsd->extra[i] = ToUtf8(extra[i]);
+    }
+    return NS_OK;
+}
+
+static struct IVirtualSystemDescriptionVtbl vsdVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .RemoveDescriptionByType = vsdRemoveDescriptionByType,
+    .GetCount = vsdGetCount,
+    .GetDescription = vsdGetDescription,
+    .SetFinalValues = vsdSetFinalValues,
+};
+
+
+static void AddVSD(MockVSD *vsd, PRUint32 type, const char *value)
+{
+    vsd->type[vsd->count] = type;
+    vsd->value[vsd->count] = Dup(value);
+    vsd->extra[vsd->count] = Dup("");
+    vsd->enabled[vsd->count] = TRUE;
+    ++vsd->count;
+}
+
+
+// A description resembling what a typical single-VM OVA interprets to
+static MockVSD * NewVSD(void)
+{
+    MockVSD *vsd = Alloc(1, sizeof(MockVSD));
+    vsd->base.lpVtbl = &vsdVtbl;
+    AddVSD(vsd, VirtualSystemDescriptionType_OS, "Ubuntu_64");
+    AddVSD(vsd, VirtualSystemDescriptionType_Name, "vm1");
+    AddVSD(vsd, VirtualSystemDescriptionType_CPU, "1");
+    AddVSD(vsd, VirtualSystemDescriptionType_Memory, "1024");
+    AddVSD(vsd, VirtualSystemDescriptionType_HardDiskControllerIDE, "PIIX4");
+    AddVSD(vsd, VirtualSystemDescriptionType_HardDiskControllerSATA, "AHCI");
+    AddVSD(vsd, VirtualSystemDescriptionType_HardDiskImage, "disk1.vmdk");
+    AddVSD(vsd, VirtualSystemDescriptionType_NetworkAdapter, "NAT");
+    AddVSD(vsd, VirtualSystemDescriptionType_SettingsFile, "");
+    return vsd;
+}
+
+
+static const char * VSDValue(MockVSD *vsd, PRUint32 type)
+{
+    for (PRUint32 i = 0; i < vsd->count; ++i) {
+        if (vsd->type[i] == type) { return vsd->value[i]; }
+    }
+    return "";
+}
+
+
+// ===== IAppliance =====
+
+static nsresult appRead(IAppliance *pThis, PRUnichar *file, IProgress **progress)
+{
+    Tick();
+    char *path = ToUtf8(file);
+    snprintf(((MockAppliance *)pThis)->file, 1024, "%s", path);
+    free(path);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult appInterpret(IAppliance *pThis)
+{
+    Tick();
+    MockAppliance *app = (MockAppliance *)pThis;
+    if (access(app->file, R_OK) != 0) { return VBOX_E_OBJECT_NOT_FOUND; }
+    app->vsd = NewVSD();
+    return NS_OK;
+}
+
+static nsresult appGetWarnings(IAppliance *pThis, PRUint32 *size, PRUnichar ***list)
+{
+    Tick(); *size = 0; *list = Alloc(1, sizeof(BSTR)); return NS_OK;
+}
+
+static nsresult appGetVirtualSystemDescriptions(IAppliance *pThis, PRUint32 *size,
+    IVirtualSystemDescription ***list)
+{
+    Tick();
+    MockAppliance *app = (MockAppliance *)pThis;
+    *list = Alloc(1, sizeof(IVirtualSystemDescription *));
+    *size = 0;
+    if (app->vsd) { (*list)[0] = &app->vsd->base; *size = 1; }
+    return NS_OK;
+}
+
+static nsresult appImportMachines(IAppliance *pThis, PRUint32 optionsSize, PRUint32 *options,
+    IProgress **progress)
+{
+    Tick();
+    MockVSD *vsd = ((MockAppliance *)pThis)->vsd;
+    if (!vsd) { return VBOX_E_INVALID_OBJECT_STATE; }
+    const char *name = VSDValue(vsd, VirtualSystemDescriptionType_Name);
+    if (FindVM(name)) { return VBOX_E_OBJECT_IN_USE; }
+    MockVM *vm = NewVM(name, atoi(VSDValue(vsd, VirtualSystemDescriptionType_CPU)),
+        atoi(VSDValue(vsd, VirtualSystemDescriptionType_Memory)));
+    FireRegistered(vm, TRUE);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+// Append a file with given content to a tar archive
+static void TarAdd(FILE *fp, const char *name, const char *data, size_t size)
+{
+    char header[512];
+    memset(header, 0, sizeof(header));
+    snprintf(header, 100, "%s", name);
+    snprintf(header + 100, 8, "%07o", 0644);
+    snprintf(header + 108, 8, "%07o", 0);
+    snprintf(header + 116, 8, "%07o", 0);
+    snprintf(header + 124, 12, "%011zo", size);
+    snprintf(header + 136, 12, "%011o", 0);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < 512; ++i) { sum += (unsigned char)header[i]; }
+    snprintf(header + 148, 8, "%06o", sum);
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(data, 1, size, fp);
+    static const char pad[512];
+    if (size % 512) { fwrite(pad, 1, 512 - size % 512, fp); }
+}
+
+
+// Stand-in for a SHA256 hex digest: FNV-1a of data, four times over
+static void FakeSHA256(const char *data, size_t size, char *hex)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) { h = (h ^ (unsigned char)data[i]) * 0x100000001b3ULL; }
+    sprintf(hex, "%016llx%016llx%016llx%016llx", h, h, h, h);
+}
+
+
+static nsresult appWrite(IAppliance *pThis, PRUnichar *format, PRUint32 optionsSize,
+    PRUint32 *options, PRUnichar *path, IProgress **progress)
+{
+    Tick();
+    // Leave a small, but valid, OVA where it would go: the descriptor, the
+    // manifest if asked for, and one disk
+    char *file = ToUtf8(path);
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        free(file);
+        return NS_ERROR_FAILURE;
+    }
+    char base[256];
+    const char *slash = strrchr(file, '/');
+    snprintf(base, sizeof(base), "%s", slash ? slash + 1 : file);
+    free(file);
+    char *dot = strrchr(base, '.');
+    if (dot) { *dot = '\0'; }
+
+    char ovfName[300], diskName[300], ovf[1024], disk[4096];
+    snprintf(ovfName, sizeof(ovfName), "%s.ovf", base);
+    snprintf(diskName, sizeof(diskName), "%s-disk001.vmdk", base);
+    snprintf(ovf, sizeof(ovf), "<?xml version=\"1.0\"?>\n<Envelope><References>"
+        "<File ovf:href=\"%s\" ovf:id=\"file1\"/></References></Envelope>\n", diskName);
+    for (size_t i = 0; i < sizeof(disk); ++i) { disk[i] = (char)(i * 7); }
+    TarAdd(fp, ovfName, ovf, strlen(ovf));
+
+    bool manifest = false;
+    for (PRUint32 i = 0; i < optionsSize; ++i) {
+        if (options[i] == ExportOptions_CreateManifest) { manifest = true; }
+    }
+    if (manifest) {
+        char mf[1024], ovfSum[65], diskSum[65];
+        FakeSHA256(ovf, strlen(ovf), ovfSum);
+        FakeSHA256(disk, sizeof(disk), diskSum);
+        snprintf(mf, sizeof(mf), "SHA256(%s)= %s\nSHA256(%s)= %s\n",
+            ovfName, ovfSum, diskName, diskSum);
+        char mfName[300];
+        snprintf(mfName, sizeof(mfName), "%s.mf", base);
+        TarAdd(fp, mfName, mf, strlen(mf));
+    }
+    TarAdd(fp, diskName, disk, sizeof(disk));
+
+    static const char zeros[1024];   // End of archive
+    fwrite(zeros, 1, sizeof(zeros), fp);
+    fclose(fp);
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static struct IApplianceVtbl applianceVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .Read = appRead,
+    .Interpret = appInterpret,
+    .GetWarnings = appGetWarnings,
+    .GetVirtualSystemDescriptions = appGetVirtualSystemDescriptions,
+    .ImportMachines = appImportMachines,
+    .Write = appWrite,
+};
+
+
+// ===== IHostNetworkInterface =====
+
+static nsresult hnicGetName(IHostNetworkInterface *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockHostNIC *)pThis)->name); return NS_OK;
+}
+
+static nsresult hnicGetId(IHostNetworkInterface *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockHostNIC *)pThis)->id); return NS_OK;
+}
+
+static nsresult hnicGetInterfaceType(IHostNetworkInterface *pThis, PRUint32 *value)
+{
+    Tick(); *value = ((MockHostNIC *)pThis)->type; return NS_OK;
+}
+
+static nsresult hnicGetIPAddress(IHostNetworkInterface *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockHostNIC *)pThis)->ip); return NS_OK;
+}
+
+static nsresult hnicGetNetworkMask(IHostNetworkInterface *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16(((MockHostNIC *)pThis)->mask); return NS_OK;
+}
+
+static nsresult hnicGetDHCPEnabled(IHostNetworkInterface *pThis, PRBool *value)
+{
+    Tick(); *value = ((MockHostNIC *)pThis)->dhcp; return NS_OK;
+}
+
+static nsresult hnicGetStatus(IHostNetworkInterface *pThis, PRUint32 *value)
+{
+    Tick(); *value = HostNetworkInterfaceStatus_Up; return NS_OK;
+}
+
+static nsresult hnicEnableStaticIPConfig(IHostNetworkInterface *pThis, PRUnichar *ip, PRUnichar *mask)
+{
+    Tick();
+    MockHostNIC *nic = (MockHostNIC *)pThis;
+    char *ip8 = ToUtf8(ip);
+    char *mask8 = ToUtf8(mask);
+    snprintf(nic->ip, sizeof(nic->ip), "%s", ip8);
+    snprintf(nic->mask, sizeof(nic->mask), "%s", mask8);
+    free(ip8);
+    free(mask8);
+    return NS_OK;
+}
+
+static struct IHostNetworkInterfaceVtbl hnicVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetName = hnicGetName,
+    .GetId = hnicGetId,
+    .GetInterfaceType = hnicGetInterfaceType,
+    .GetIPAddress = hnicGetIPAddress,
+    .GetNetworkMask = hnicGetNetworkMask,
+    .GetDHCPEnabled = hnicGetDHCPEnabled,
+    .GetStatus = hnicGetStatus,
+    .EnableStaticIPConfig = hnicEnableStaticIPConfig,
+};
+
+
+static MockHostNIC * NewHostNIC(const char *name, PRUint32 type, const char *ip)
+{
+    if (mockHostNICCount == MOCK_HOSTNICS) { return NULL; }
+    MockHostNIC *nic = Alloc(1, sizeof(MockHostNIC));
+    nic->base.lpVtbl = &hnicVtbl;
+    snprintf(nic->name, sizeof(nic->name), "%s", name);
+    snprintf(nic->id, sizeof(nic->id), "00000000-0000-4000-9000-%012lx", NextSeq());
+    snprintf(nic->ip, sizeof(nic->ip), "%s", ip);
+    strcpy(nic->mask, "255.255.255.0");
+    nic->type = type;
+    mockHostNICs[mockHostNICCount++] = nic;
+    return nic;
+}
+
+
+// ===== IHost =====
+
+static nsresult hostGetProcessorOnlineCount(IHost *pThis, PRUint32 *value)
+{
+    Tick(); *value = 16; return NS_OK;
+}
+
+static nsresult hostGetMemorySize(IHost *pThis, PRUint32 *value)
+{
+    Tick(); *value = 65536; return NS_OK;
+}
+
+// What running VMs keep resident comes off the 49152 MB left by the host itself
+static nsresult hostGetMemoryAvailable(IHost *pThis, PRUint32 *value)
+{
+    Tick();
+    long avail = 49152;
+    pthread_mutex_lock(&mockLock);
+    for (ULONG i = 0; i < mockVMCount; ++i) {
+        MockVM *vm = mockVMs[i];
+        if (vm->state != MachineState_Running) { continue; }
+        avail -= vm->memory - vm->balloon - (vm->pageFusion ? vm->memory / 8 : 0);
+    }
+    pthread_mutex_unlock(&mockLock);
+    *value = avail > 0 ? (PRUint32)avail : 0;
+    return NS_OK;
+}
+
+static nsresult hostGetNetworkInterfaces(IHost *pThis, PRUint32 *size, IHostNetworkInterface ***list)
+{
+    Tick();
+    *list = Alloc(mockHostNICCount, sizeof(IHostNetworkInterface *));
+    for (ULONG i = 0; i < mockHostNICCount; ++i) { (*list)[i] = &mockHostNICs[i]->base; }
+    *size = mockHostNICCount;
+    return NS_OK;
+}
+
+static nsresult hostCreateHostOnlyNetworkInterface(IHost *pThis, IHostNetworkInterface **nic,
+    IProgress **progress)
+{
+    Tick();
+    int n = 0;
+    for (ULONG i = 0; i < mockHostNICCount; ++i) {
+        if (mockHostNICs[i]->type == HostNetworkInterfaceType_HostOnly) { ++n; }
+    }
+    char name[32];
+    sprintf(name, "vboxnet%d", n);
+    MockHostNIC *newNIC = NewHostNIC(name, HostNetworkInterfaceType_HostOnly, "");
+    if (!newNIC) { return NS_ERROR_FAILURE; }
+    *nic = &newNIC->base;
+    *progress = &NewProgress()->base;
+    return NS_OK;
+}
+
+static nsresult hostRemoveHostOnlyNetworkInterface(IHost *pThis, PRUnichar *id, IProgress **progress)
+{
+    Tick();
+    char *id8 = ToUtf8(id);
+    nsresult rc = VBOX_E_OBJECT_NOT_FOUND;
+    for (ULONG i = 0; i < mockHostNICCount; ++i) {
+        if (strcmp(mockHostNICs[i]->id, id8) == 0) {
+            memmove(&mockHostNICs[i], &mockHostNICs[i+1],
+                (mockHostNICCount - i - 1) * sizeof(MockHostNIC *));
+            --mockHostNICCount;
+            rc = NS_OK;
+            break;
+        }
+    }
+    free(id8);
+    if (rc == NS_OK) { *progress = &NewProgress()->base; }
+    return rc;
+}
+
+static nsresult hostFindHostNetworkInterfaceByName(IHost *pThis, PRUnichar *name,
+    IHostNetworkInterface **nic)
+{
+    Tick();
+    char *name8 = ToUtf8(name);
+    *nic = NULL;
+    for (ULONG i = 0; i < mockHostNICCount; ++i) {
+        if (strcmp(mockHostNICs[i]->name, name8) == 0) { *nic = &mockHostNICs[i]->base; }
+    }
+    free(name8);
+    return *nic ? NS_OK : VBOX_E_OBJECT_NOT_FOUND;
+}
+
+static struct IHostVtbl hostVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetProcessorOnlineCount = hostGetProcessorOnlineCount,
+    .GetMemorySize = hostGetMemorySize,
+    .GetMemoryAvailable = hostGetMemoryAvailable,
+    .GetNetworkInterfaces = hostGetNetworkInterfaces,
+    .CreateHostOnlyNetworkInterface = hostCreateHostOnlyNetworkInterface,
+    .RemoveHostOnlyNetworkInterface = hostRemoveHostOnlyNetworkInterface,
+    .FindHostNetworkInterfaceByName = hostFindHostNetworkInterfaceByName,
+};
+
+
+// ===== ISystemProperties =====
+
+static nsresult sysGetDefaultMachineFolder(ISystemProperties *pThis, PRUnichar **value)
+{
+    Tick();
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/VirtualBox VMs", getenv("HOME") ? getenv("HOME") : "");
+    *value = ToUtf16(path);
+    return NS_OK;
+}
+
+static nsresult sysGetDefaultAdditionsISO(ISystemProperties *pThis, PRUnichar **value)
+{
+    Tick(); *value = ToUtf16("/mock/VBoxGuestAdditions.iso"); return NS_OK;
+}
+
+static struct ISystemPropertiesVtbl sysVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetDefaultMachineFolder = sysGetDefaultMachineFolder,
+    .GetDefaultAdditionsISO = sysGetDefaultAdditionsISO,
+};
+
+
+// ===== IPerformanceCollector =====
+// Metrics are made up on every query, from the VM settings and the time, so
+// they move around a little. Only the host and running VMs report any.
+
+// Synthetic sample of one metric of one object, or -1 if it has none
+static PRInt32 MetricSample(const char *metric, nsISupports *obj, PRUint32 *scale)
+{
+    long long now = NowMs() / 1000;
+    *scale = 1;
+    if (obj == (nsISupports *)&mockHost) {
+        if (strcmp(metric, "CPU/Load/User") == 0) { *scale = 1000; return 5000 + now % 7 * 1000; }
+        if (strcmp(metric, "CPU/Load/Kernel") == 0) { *scale = 1000; return 2000; }
+        if (strcmp(metric, "RAM/Usage/Total") == 0) { return 65536 * 1024; }
+        if (strcmp(metric, "RAM/Usage/Used") == 0) { return (65536 - 49152) * 1024; }
+        return -1;
+    }
+
+    MockVM *vm = (MockVM *)obj;
+    if (vm->state != MachineState_Running) { return -1; }
+    unsigned long h = 5381;
+    for (const char *c = vm->id; *c; ++c) { h = h * 33 + *c; }
+    h += now;
+    if (strcmp(metric, "CPU/Load/User") == 0) { *scale = 1000; return h % 60 * 1000; }
+    if (strcmp(metric, "CPU/Load/Kernel") == 0) { *scale = 1000; return h % 5 * 1000; }
+    if (strcmp(metric, "RAM/Usage/Used") == 0) { return (vm->memory + 64) * 1024; }
+    if (strcmp(metric, "Guest/RAM/Usage/Total") == 0) { return vm->memory * 1024; }
+    if (strcmp(metric, "Guest/RAM/Usage/Free") == 0) { return vm->memory * 1024 / (2 + h % 3); }
+    if (strcmp(metric, "Net/Rate/Rx") == 0) { return h % 200 * 1024; }
+    if (strcmp(metric, "Net/Rate/Tx") == 0) { return h % 50 * 1024; }
+    return -1;
+}
+
+static nsresult pcSetupMetrics(IPerformanceCollector *pThis,
+    PRUint32 namesSize, PRUnichar **names, PRUint32 objectsSize, nsISupports **objects,
+    PRUint32 period, PRUint32 count, PRUint32 *affectedSize, IPerformanceMetric ***affected)
+{
+    Tick();
+    *affected = Alloc(1, sizeof(IPerformanceMetric *));
+    *affectedSize = 0;
+    return NS_OK;
+}
+
+// One single-value series for every requested metric and object that has it
+static nsresult pcQueryMetricsData(IPerformanceCollector *pThis,
+    PRUint32 namesSize, PRUnichar **names, PRUint32 objectsSize, nsISupports **objects,
+    PRUint32 *retNamesSize, PRUnichar ***retNames, PRUint32 *retObjectsSize, nsISupports ***retObjects,
+    PRUint32 *unitsSize, PRUnichar ***units, PRUint32 *scalesSize, PRUint32 **scales,
+    PRUint32 *seqsSize, PRUint32 **seqs, PRUint32 *indicesSize, PRUint32 **indices,
+    PRUint32 *lengthsSize, PRUint32 **lengths, PRUint32 *dataSize, PRInt32 **data)
+{
+    Tick();
+    PRUint32 max = namesSize * objectsSize;
+    *retNames = Alloc(max, sizeof(BSTR));
+    *retObjects = Alloc(max, sizeof(nsISupports *));
+    *units = Alloc(max, sizeof(BSTR));
+    *scales = Alloc(max, sizeof(PRUint32));
+    *seqs = Alloc(max, sizeof(PRUint32));
+    *indices = Alloc(max, sizeof(PRUint32));
+    *lengths = Alloc(max, sizeof(PRUint32));
+    *data = Alloc(max, sizeof(PRInt32));
+
+    PRUint32 n = 0;
+    pthread_mutex_lock(&mockLock);
+    for (PRUint32 i = 0; i < namesSize; ++i) {
+        char *metric = ToUtf8(names[i]);
+        for (PRUint32 j = 0; j < objectsSize; ++j) {
+            PRUint32 scale = 1;
+            PRInt32 value = MetricSample(metric, objects[j], &scale);
+            if (value < 0) { continue; }
+            (*retNames)[n] = ToUtf16(metric);
+            (*retObjects)[n] = objects[j];
+            (*units)[n] = ToUtf16(scale > 1 ? "%" : strncmp(metric, "Net/", 4) == 0 ? "B/s" : "kB");
+            (*scales)[n] = scale;
+            (*seqs)[n] = (PRUint32)NextSeq();
+            (*indices)[n] = n;
+            (*lengths)[n] = 1;
+            (*data)[n] = value;
+            ++n;
+        }
+        free(metric);
+    }
+    pthread_mutex_unlock(&mockLock);
+
+    *retNamesSize = *retObjectsSize = *unitsSize = *scalesSize = n;
+    *seqsSize = *indicesSize = *lengthsSize = *dataSize = n;
+    return NS_OK;
+}
+
+static struct IPerformanceCollectorVtbl collectorVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .SetupMetrics = pcSetupMetrics,
+    .QueryMetricsData = pcQueryMetricsData,
+};
+
+
+// ===== IVirtualBox =====
+
+static nsresult vboxGetSystemProperties(IVirtualBox *pThis, ISystemProperties **value)
+{
+    Tick(); *value = &mockSysProp; return NS_OK;
+}
+
+static nsresult vboxGetHost(IVirtualBox *pThis, IHost **value)
+{
+    Tick(); *value = &mockHost; return NS_OK;
+}
+
+static nsresult vboxGetMachines(IVirtualBox *pThis, PRUint32 *size, IMachine ***list)
+{
+    Tick();
+    pthread_mutex_lock(&mockLock);
+    *list = Alloc(mockVMCount, sizeof(IMachine *));
+    for (ULONG i = 0; i < mockVMCount; ++i) { (*list)[i] = &mockVMs[i]->base; }
+    *size = mockVMCount;
+    pthread_mutex_unlock(&mockLock);
+    return NS_OK;
+}
+
+static nsresult vboxFindMachine(IVirtualBox *pThis, PRUnichar *nameOrId, IMachine **machine)
+{
+    Tick();
+    char *name = ToUtf8(nameOrId);
+    MockVM *vm = FindVM(name);
+    free(name);
+    *machine = vm ? &vm->base : NULL;
+    return vm ? NS_OK : VBOX_E_OBJECT_NOT_FOUND;
+}
+
+static nsresult vboxGetEventSource(IVirtualBox *pThis, IEventSource **value)
+{
+    Tick(); *value = &mockEventSource; return NS_OK;
+}
+
+static nsresult vboxGetPerformanceCollector(IVirtualBox *pThis, IPerformanceCollector **value)
+{
+    Tick(); *value = &mockCollector; return NS_OK;
+}
+
+static nsresult vboxCreateAppliance(IVirtualBox *pThis, IAppliance **appliance)
+{
+    Tick();
+    MockAppliance *app = Alloc(1, sizeof(MockAppliance));
+    app->base.lpVtbl = &applianceVtbl;
+    *appliance = &app->base;
+    return NS_OK;
+}
+
+static struct IVirtualBoxVtbl vboxVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetSystemProperties = vboxGetSystemProperties,
+    .GetHost = vboxGetHost,
+    .GetMachines = vboxGetMachines,
+    .FindMachine = vboxFindMachine,
+    .GetEventSource = vboxGetEventSource,
+    .GetPerformanceCollector = vboxGetPerformanceCollector,
+    .CreateAppliance = vboxCreateAppliance,
+};
+
+
+// ===== IVirtualBoxClient =====
+
+static nsresult clientGetVirtualBox(IVirtualBoxClient *pThis, IVirtualBox **value)
+{
+    Tick(); *value = &mockVBox; return NS_OK;
+}
+
+static nsresult clientGetSession(IVirtualBoxClient *pThis, ISession **value)
+{
+    Tick();
+    MockSession *session = Alloc(1, sizeof(MockSession));
+    session->base.lpVtbl = &sessionVtbl;
+    session->console.base.lpVtbl = &consoleVtbl;
+    *value = &session->base;
+    return NS_OK;
+}
+
+static struct IVirtualBoxClientVtbl clientVtbl = {
+    .AddRef = (void *)AddRefAny,
+    .Release = (void *)ReleaseAny,
+    .GetVirtualBox = clientGetVirtualBox,
+    .GetSession = clientGetSession,
+};
+
+
+// ===== VBOXCAPI function table =====
+
+static unsigned int capiGetVersion(void) { return 6001050; }
+static unsigned int capiGetAPIVersion(void) { return 6001; }
+
+static HRESULT capiClientInitialize(const char *iid, IVirtualBoxClient **client)
+{
+    Tick(); *client = &mockClient; return NS_OK;
+}
+
+static HRESULT capiClientThreadInitialize(void) { return NS_OK; }
+static HRESULT capiClientThreadUninitialize(void) { return NS_OK; }
+static void capiClientUninitialize(void) { }
+
+static void capiComInitialize(const char *vboxIID, IVirtualBox **vbox,
+    const char *sessionIID, ISession **session)
+{
+    *vbox = &mockVBox;
+    clientGetSession(&mockClient, session);
+}
+
+static void capiComUninitialize(void) { }
+static void capiComUnallocString(BSTR str) { free(str); }
+
+static int capiUtf16ToUtf8(CBSTR src, char **dst)
+{
+    __sync_fetch_and_add(&statConv, 1);
+    *dst = ToUtf8(src);
+    return 0;
+}
+
+static int capiUtf8ToUtf16(const char *src, BSTR *dst)
+{
+    __sync_fetch_and_add(&statConv, 1);
+    *dst = ToUtf16(src);
+    return 0;
+}
+
+static void capiUtf8Free(char *str) { free(str); }
+static void capiUtf16Free(BSTR str) { free(str); }
+
+static size_t ElementSize(VARTYPE vt)
+{
+    switch (vt) {
+        case VT_I1: case VT_UI1:                  return 1;
+        case VT_I2: case VT_UI2:                  return 2;
+        case VT_I4: case VT_UI4: case VT_HRESULT: return 4;
+        case VT_I8: case VT_UI8:                  return 8;
+        default:                                  return sizeof(void *);
+    }
+}
+
+static SAFEARRAY * capiSafeArrayCreateVector(VARTYPE vt, LONG lbound, ULONG count)
+{
+    SAFEARRAY *sa = Alloc(1, sizeof(SAFEARRAY));
+    sa->pv = Alloc(count, ElementSize(vt));
+    sa->c = count;
+    return sa;
+}
+
+static SAFEARRAY * capiSafeArrayOutParamAlloc(void)
+{
+    return Alloc(1, sizeof(SAFEARRAY));
+}
+
+static HRESULT capiSafeArrayCopyInParamHelper(SAFEARRAY *sa, const void *pv, ULONG cb)
+{
+    if (!sa || !sa->pv) { return NS_ERROR_INVALID_ARG; }
+    memcpy(sa->pv, pv, cb);
+    return NS_OK;
+}
+
+// Hands over the array, reporting its size in bytes
+static HRESULT capiSafeArrayCopyOutParamHelper(void **ppv, ULONG *pcb, VARTYPE vt, SAFEARRAY *sa)
+{
+    if (!sa) { return NS_ERROR_INVALID_ARG; }
+    *ppv = sa->pv;
+    *pcb = sa->c * ElementSize(vt);
+    sa->pv = NULL;
+    sa->c = 0;
+    return NS_OK;
+}
+
+// Hands over the array, reporting its element count
+static HRESULT capiSafeArrayCopyOutIfaceParamHelper(IUnknown ***ppaObj, ULONG *pcObj, SAFEARRAY *sa)
+{
+    if (!sa) { return NS_ERROR_INVALID_ARG; }
+    *ppaObj = sa->pv;
+    *pcObj = sa->c;
+    sa->pv = NULL;
+    sa->c = 0;
+    return NS_OK;
+}
+
+static HRESULT capiSafeArrayDestroy(SAFEARRAY *sa)
+{
+    if (sa) { free(sa->pv); free(sa); }
+    return NS_OK;
+}
+
+static HRESULT capiArrayOutFree(void *pv) { free(pv); return NS_OK; }
+static void capiGetEventQueue(nsIEventQueue **queue) { *queue = NULL; }
+static HRESULT capiGetException(IErrorInfo **ex) { *ex = NULL; return NS_OK; }
+static HRESULT capiClearException(void) { return NS_OK; }
+
+static int capiProcessEventQueue(LONG64 timeoutMs)
+{
+    if (timeoutMs > 0) { usleep(timeoutMs * 1000); }
+    return 0;
+}
+
+static int capiInterruptEventQueueProcessing(void) { return 0; }
+
+static void capiUtf8Clear(char *str) { if (str) { memset(str, 0, strlen(str)); } }
+
+static void capiUtf16Clear(BSTR str)
+{
+    while (str && *str) { *str++ = 0; }
+}
+
+static VBOXCAPI mockFuncs = {
+    .cb = sizeof(VBOXCAPI),
+    .uVersion = VBOX_CAPI_VERSION,
+    .pfnGetVersion = capiGetVersion,
+    .pfnGetAPIVersion = capiGetAPIVersion,
+    .pfnClientInitialize = capiClientInitialize,
+    .pfnClientThreadInitialize = capiClientThreadInitialize,
+    .pfnClientThreadUninitialize = capiClientThreadUninitialize,
+    .pfnClientUninitialize = capiClientUninitialize,
+    .pfnComInitialize = capiComInitialize,
+    .pfnComUninitialize = capiComUninitialize,
+    .pfnComUnallocString = capiComUnallocString,
+    .pfnUtf16ToUtf8 = capiUtf16ToUtf8,
+    .pfnUtf8ToUtf16 = capiUtf8ToUtf16,
+    .pfnUtf8Free = capiUtf8Free,
+    .pfnUtf16Free = capiUtf16Free,
+    .pfnSafeArrayCreateVector = capiSafeArrayCreateVector,
+    .pfnSafeArrayOutParamAlloc = capiSafeArrayOutParamAlloc,
+    .pfnSafeArrayCopyInParamHelper = capiSafeArrayCopyInParamHelper,
+    .pfnSafeArrayCopyOutParamHelper = capiSafeArrayCopyOutParamHelper,
+    .pfnSafeArrayCopyOutIfaceParamHelper = capiSafeArrayCopyOutIfaceParamHelper,
+    .pfnSafeArrayDestroy = capiSafeArrayDestroy,
+    .pfnArrayOutFree = capiArrayOutFree,
+    .pfnGetEventQueue = capiGetEventQueue,
+    .pfnGetException = capiGetException,
+    .pfnClearException = capiClearException,
+    .pfnProcessEventQueue = capiProcessEventQueue,
+    .pfnInterruptEventQueueProcessing = capiInterruptEventQueueProcessing,
+    .pfnUtf8Clear = capiUtf8Clear,
+    .pfnUtf16Clear = capiUtf16Clear,
+    .uEndVersion = VBOX_CAPI_VERSION,
+};
+
+static PCVBOXCAPI GetFunctions(unsigned version) { return &mockFuncs; }
+
+
+// ===== Glue entry points =====
+
+static long EnvNum(const char *name)
+{
+    char *value = getenv(name);
+    return value ? atol(value) : 0;
+}
+
+
+int VBoxCGlueInit(void)
+{
+    FillVtbl(&natVtbl, sizeof(natVtbl));
+    FillVtbl(&nicVtbl, sizeof(nicVtbl));
+    FillVtbl(&progressVtbl, sizeof(progressVtbl));
+    FillVtbl(&errorVtbl, sizeof(errorVtbl));
+    FillVtbl(&sfVtbl, sizeof(sfVtbl));
+    FillVtbl(&consoleVtbl, sizeof(consoleVtbl));
+    FillVtbl(&guestVtbl, sizeof(guestVtbl));
+    FillVtbl(&gsVtbl, sizeof(gsVtbl));
+    FillVtbl(&gpVtbl, sizeof(gpVtbl));
+    FillVtbl(&sessionVtbl, sizeof(sessionVtbl));
+    FillVtbl(&vmVtbl, sizeof(vmVtbl));
+    FillVtbl(&biosVtbl, sizeof(biosVtbl));
+    FillVtbl(&vrdeVtbl, sizeof(vrdeVtbl));
+    FillVtbl(&ctlVtbl, sizeof(ctlVtbl));
+    FillVtbl(&maVtbl, sizeof(maVtbl));
+    FillVtbl(&mediumVtbl, sizeof(mediumVtbl));
+    FillVtbl(&snapshotVtbl, sizeof(snapshotVtbl));
+    FillVtbl(&vsdVtbl, sizeof(vsdVtbl));
+    FillVtbl(&applianceVtbl, sizeof(applianceVtbl));
+    FillVtbl(&hnicVtbl, sizeof(hnicVtbl));
+    FillVtbl(&hostVtbl, sizeof(hostVtbl));
+    FillVtbl(&sysVtbl, sizeof(sysVtbl));
+    FillVtbl(&vboxVtbl, sizeof(vboxVtbl));
+    FillVtbl(&clientVtbl, sizeof(clientVtbl));
+    FillVtbl(&eventSourceVtbl, sizeof(eventSourceVtbl));
+    FillVtbl(&listenerVtbl, sizeof(listenerVtbl));
+    FillVtbl(&stateEventVtbl, sizeof(stateEventVtbl));
+    FillVtbl(&dataEventVtbl, sizeof(dataEventVtbl));
+    FillVtbl(&regEventVtbl, sizeof(regEventVtbl));
+    FillVtbl(&propEventVtbl, sizeof(propEventVtbl));
+    FillVtbl(&collectorVtbl, sizeof(collectorVtbl));
+
+    mockClient.lpVtbl = &clientVtbl;
+    mockVBox.lpVtbl = &vboxVtbl;
+    mockSysProp.lpVtbl = &sysVtbl;
+    mockHost.lpVtbl = &hostVtbl;
+    mockErrorInfo.lpVtbl = &errorVtbl;
+    mockEventSource.lpVtbl = &eventSourceVtbl;
+    mockCollector.lpVtbl = &collectorVtbl;
+
+    mockLatency = EnvNum("VMC_MOCK_LATENCY_US");
+    mockProgressMs = EnvNum("VMC_MOCK_PROGRESS_MS");
+    mockStats = EnvNum("VMC_MOCK_STATS") > 0;
+    mockEventsMs = EnvNum("VMC_MOCK_EVENTS_MS");
+    nextChurnAt = NowMs() + mockEventsMs;
+
+    // Host has one bridgeable NIC, and the default vmc HostOnly network
+    NewHostNIC("enp0s3", HostNetworkInterfaceType_Bridged, "192.168.1.10")->dhcp = TRUE;
+    NewHostNIC("vboxnet0", HostNetworkInterfaceType_HostOnly, "10.11.12.1");
+
+    // Pre-register VMs, each with the guest properties vmc would have set.
+    // VM i gets the i-th usable address counting up from 10.11.12.2, and
+    // every further /24 gets its own HostOnly network
+    long vmCount = EnvNum("VMC_MOCK_VMS");
+    long running = EnvNum("VMC_MOCK_RUNNING");
+    long saved = EnvNum("VMC_MOCK_SAVED");
+    const char *snapName = getenv("VMC_MOCK_SNAPSHOT");
+    for (long i = 0; i < vmCount; ++i) {
+        char name[64], ip[32], broadcast[32], hostOnly[32];
+        sprintf(name, "vm%ld", i + 1);
+        int third = 12 + i / 252, fourth = 2 + i % 252;
+        sprintf(ip, "10.11.%d.%d", third, fourth);
+        sprintf(broadcast, "10.11.%d.255", third);
+        sprintf(hostOnly, "vboxnet%d", third - 12);
+        if (fourth == 2 && third > 12) {
+            char gateway[32];
+            sprintf(gateway, "10.11.%d.1", third);
+            NewHostNIC(hostOnly, HostNetworkInterfaceType_HostOnly, gateway);
+        }
+        MockVM *vm = NewVM(name, 1, 1024);
+        PutProp(vm, "/vm/name", name);
+        PutProp(vm, "/vm/nettype", "ho");
+        PutProp(vm, "/vm/ip", ip);
+        PutProp(vm, "/vm/netmask", "255.255.255.0");
+        PutProp(vm, "/vm/broadcast", broadcast);
+        vm->nic[0].enabled = TRUE;
+        vm->nic[0].attachmentType = NetworkAttachmentType_NAT;
+        vm->nic[1].enabled = TRUE;
+        vm->nic[1].attachmentType = NetworkAttachmentType_HostOnly;
+        strcpy(vm->nic[1].hostOnly, hostOnly);
+        if (i < running) { vm->state = MachineState_Running; }
+        else if (i < running + saved) { vm->state = MachineState_Saved; }
+        if (snapName && snapName[0]) { NewSnapshot(vm, snapName); }
+    }
+
+    g_pfnGetFunctions = GetFunctions;
+    g_pVBoxFuncs = GetFunctions(VBOX_CAPI_VERSION);
+    return 0;
+}
+
+
+void VBoxCGlueTerm(void)
+{
+    if (mockStats) {
+        fprintf(stderr, "vboxmock: calls=%lu conversions=%lu propget=%lu propset=%lu "
+            "propenum=%lu saves=%lu events=%lu notimpl=%lu\n", statCalls, statConv,
+            statPropGet, statPropSet, statEnum, statSave, statEvents, statNotImpl);
+    }
+    g_pVBoxFuncs = NULL;
+    g_pfnGetFunctions = NULL;
+}
@@ -0,0 +1,79 @@
+// events.c
+
+#include "vmc.h"
+
+// Passive event listening. VirtualBox queues every event of the registered
+// types for the listener, and we pull them with NextEvent() whenever we're
+// ready, so there are no callbacks nor extra threads involved.
+
+
+// Register passive listener for given event types on the IVirtualBox event source
+IEventListener * ListenEvents(IEventSource **source, PRUint32 *types, ULONG count)
+{
+    TraceBegin("IVirtualBox_GetEventSource");
+    HRESULT rc = IVirtualBox_GetEventSource(vbox, source);
+    ExitIfFailure(rc, "IVirtualBox_GetEventSource", __FILE__, __LINE__);
+
+    IEventListener *listener = NULL;
+    TraceBegin("IEventSource_CreateListener");
+    rc = IEventSource_CreateListener(*source, &listener);
+    ExitIfFailure(rc, "IEventSource_CreateListener", __FILE__, __LINE__);
+
+    SAFEARRAY *SA = SACreateVector(VT_I4, 0, count);
+    SACopyInParamHelper(SA, types, count * sizeof(PRUint32));
+    TraceBegin("IEventSource_RegisterListener");
+    rc = IEventSource_RegisterListener(*source, listener,
+        ComSafeArrayAsInParam(SA),
+        FALSE);   // Passive, we fetch events ourselves
+    ExitIfFailure(rc, "IEventSource_RegisterListener", __FILE__, __LINE__);
+    SADestroy(SA);
+
+    return listener;
+}
+
+
+// Wait up to timeout milliseconds for next event. Returns NULL if none arrived
+IEvent * NextEvent(IEventSource *source, IEventListener *listener, PRInt32 timeout)
+{
+    IEvent *event = NULL;
+    HRESULT rc = IEventSource_GetEvent(source, listener, timeout, &event);
+    if (FAILED(rc)) { return NULL; }
+    // REMINDER: Caller must hand it back with DoneEvent
+    return event;
+}
+
+
+// Mark event as processed and release it
+void DoneEvent(IEventSource *source, IEventListener *listener, IEvent *event)
+{
+    IEventSource_EventProcessed(source, listener, event);
+    IEvent_Release(event);
+}
+
+
+// Unregister listener created with ListenEvents
+void StopEvents(IEventSource *source, IEventListener *listener)
+{
+    IEventSource_UnregisterListener(source, listener);
+    IEventListener_Release(listener);
+    IEventSource_Release(source);
+}
+
+
+// Copy UUID of the machine given machine event refers to into id buffer
+void EventMachineId(IEvent *event, char *id, int size)
+{
+    id[0] = '\0';
+    IMachineEvent *mevent = NULL;
+    HRESULT rc = IEvent_QueryInterface(event, &IID_IMachineEvent, (void **)&mevent);
+    if (FAILED(rc) || !mevent) { return; }
+
+    BSTR id_16 = NULL;
+    IMachineEvent_GetMachineId(mevent, &id_16);
+    char *tmp = NULL;
+    Convert16to8(id_16, &tmp);
+    FreeBSTR(id_16);
+    snprintf(id, size, "%s", tmp ? tmp : "");
+    free(tmp);
+    IMachineEvent_Release(mevent);
+}
@@ -0,0 +1,370 @@
+// guestctl.c
+
+#define _DEFAULT_SOURCE   // usleep under -std=c99
+
+#include "vmc.h"
+
+// Guest Control transport. Commands run and files are copied through the
+// VirtualBox guest additions, over a guest session logged on as vmuser, so
+// neither the guest network, sshd nor the SSH key need to be up. A VM's
+// transport is kept in its '/vm/transport' guest property: 'ssh', the default,
+// 'guest', or 'auto', which uses SSH when port 22 answers and guest control
+// otherwise. Guest sessions need vmuser's password, taken from the
+// VMC_GUEST_PASSWORD environment variable, since the additions can't use keys.
+
+// Open guest session on a running VM, and what it takes to hold it open
+typedef struct GuestCtl {
+    ISession *session;
+    IGuest *guest;
+    IGuestSession *gs;
+} GuestCtl;
+
+
+// Close guest session opened by guestOpen. Nothing changes the VM's settings,
+// so there's nothing to save
+static void guestClose(GuestCtl *g)
+{
+    if (g->gs) {
+        IGuestSession_Close(g->gs);
+        IGuestSession_Release(g->gs);
+    }
+    if (g->guest) { IGuest_Release(g->guest); }
+    if (g->session) {
+        ISession_UnlockMachine(g->session);
+        ISession_Release(g->session);
+    }
+    memset(g, 0, sizeof(*g));
+}
+
+
+// Open shared lock session on running VM, then a guest session as vmuser, and
+// wait up to GUEST_STARTWAIT seconds for it to start. Returns false, after
+// saying why, if either isn't possible
+static bool guestOpen(IMachine *vm, GuestCtl *g)
+{
+    memset(g, 0, sizeof(*g));
+    const char *password = getenv("VMC_GUEST_PASSWORD");
+    if (!password) {
+        fprintf(stderr, "Guest control needs the password of user '%s' in "
+            "VMC_GUEST_PASSWORD\n", vmuser);
+        return false;
+    }
+
+    TraceBegin("IVirtualBoxClient_GetSession");
+    HRESULT rc = IVirtualBoxClient_GetSession(vboxclient, &g->session);
+    ExitIfFailure(rc, "IVirtualBoxClient_GetSession", __FILE__, __LINE__);
+    TraceBegin("IMachine_LockMachine");
+    rc = IMachine_LockMachine(vm, g->session, LockType_Shared);
+    TraceEnd();
+    if (FAILED(rc)) {
+        ISession_Release(g->session);
+        g->session = NULL;
+        fprintf(stderr, "VM is not running\n");
+        return false;
+    }
+    IConsole *console = NULL;
+    ISession_GetConsole(g->session, &console);
+    if (console) {
+        IConsole_GetGuest(console, &g->guest);
+        IConsole_Release(console);
+    }
+    if (!g->guest) {
+        guestClose(g);
+        fprintf(stderr, "VM is not running\n");
+        return false;
+    }
+
+    BSTR user_16, password_16, domain_16, name_16;
+    Convert8to16(vmuser, &user_16);
+    Convert8to16(password, &password_16);
+    Convert8to16("", &domain_16);
+    Convert8to16(prgname, &name_16);
+    TraceBegin("IGuest_CreateSession");
+    rc = IGuest_CreateSession(g->guest, user_16, password_16, domain_16, name_16, &g->gs);
+    TraceEnd();
+    FreeBSTR(user_16);
+    FreeBSTR(password_16);
+    FreeBSTR(domain_16);
+    FreeBSTR(name_16);
+    if (FAILED(rc)) {
+        PrintVBoxException();
+        guestClose(g);
+        return false;
+    }
+
+    // The session starts in the guest a moment later, once the logon goes through
+    PRUint32 waitFor[] = { GuestSessionWaitForFlag_Start };
+    SAFEARRAY *SA = SACreateVector(VT_UI4, 0, 1);
+    SACopyInParamHelper(SA, waitFor, sizeof(waitFor));
+    PRUint32 reason = GuestSessionWaitResult_None;
+    TraceBegin("IGuestSession_WaitForArray");
+    rc = IGuestSession_WaitForArray(g->gs, ComSafeArrayAsInParam(SA), GUEST_STARTWAIT * 1000, &reason);
+    TraceEnd();
+    SADestroy(SA);
+    if (FAILED(rc) || reason != GuestSessionWaitResult_Start) {
+        fprintf(stderr, "Guest session for user '%s' didn't start. Wrong password?\n", vmuser);
+        guestClose(g);
+        return false;
+    }
+    return true;
+}
+
+
+// Copy whatever guest process has on given handle (1 = stdout, 2 = stderr) to fp
+static void guestDrain(IGuestProcess *process, PRUint32 handle, FILE *fp)
+{
+    for (;;) {
+        SAFEARRAY *SA = SAOutParamAlloc();
+        HRESULT rc = IGuestProcess_Read(process, handle, GUEST_READSIZE, 0,
+            ComSafeArrayAsOutTypeParam(SA, PRUint8));
+        PRUint8 *data = NULL;
+        ULONG size = 0;
+        if (SUCCEEDED(rc)) { SACopyOutParamHelper((void **)&data, &size, VT_UI1, SA); }
+        SADestroy(SA);
+        if (size) { fwrite(data, 1, size, fp); }
+        if (data) { ArrayOutFree(data); }
+        if (!size) { break; }
+    }
+    fflush(fp);
+}
+
+
+// Run cmd in VM through guest control, with /bin/sh as vmuser. Its output is
+// shown if verbose. Returns its exit code, so zero means success
+int GuestRunVM(IMachine *vm, char *cmd, bool verbose)
+{
+    GuestCtl g;
+    TraceBegin("GuestRunVM");
+    if (!guestOpen(vm, &g)) {
+        TraceEnd();
+        return 1;
+    }
+
+    // Arguments start with argv[0], as the guest's execve takes them
+    BSTR args_16[3];
+    Convert8to16("/bin/sh", &args_16[0]);
+    Convert8to16("-c", &args_16[1]);
+    Convert8to16(cmd, &args_16[2]);
+    SAFEARRAY *argsSA = SACreateVector(VT_BSTR, 0, 3);
+    SACopyInParamHelper(argsSA, args_16, sizeof(args_16));
+    SAFEARRAY *envSA = SACreateVector(VT_BSTR, 0, 0);
+    PRUint32 flags[] = { ProcessCreateFlag_WaitForStdOut, ProcessCreateFlag_WaitForStdErr };
+    SAFEARRAY *flagsSA = SACreateVector(VT_UI4, 0, verbose ? 2 : 0);
+    if (verbose) { SACopyInParamHelper(flagsSA, flags, sizeof(flags)); }
+
+    IGuestProcess *process = NULL;
+    TraceBegin("IGuestSession_ProcessCreate");
+    HRESULT rc = IGuestSession_ProcessCreate(g.gs, args_16[0], ComSafeArrayAsInParam(argsSA),
+        ComSafeArrayAsInParam(envSA), ComSafeArrayAsInParam(flagsSA), 0, &process);
+    TraceEnd();
+    SADestroy(argsSA);
+    SADestroy(envSA);
+    SADestroy(flagsSA);
+    for (int i = 0; i < 3; ++i) { FreeBSTR(args_16[i]); }
+    if (FAILED(rc)) {
+        PrintVBoxException();
+        guestClose(&g);
+        TraceEnd();
+        return 1;
+    }
+
+    // Show output as it comes, until the process ends
+    PRUint32 waitFor[] = { ProcessWaitForFlag_Terminate, ProcessWaitForFlag_StdOut,
+        ProcessWaitForFlag_StdErr };
+    SAFEARRAY *waitSA = SACreateVector(VT_UI4, 0, verbose ? 3 : 1);
+    SACopyInParamHelper(waitSA, waitFor, (verbose ? 3 : 1) * sizeof(PRUint32));
+    PRUint32 status = ProcessStatus_Undefined;
+    while (status < ProcessStatus_TerminatedNormally) {
+        PRUint32 reason = ProcessWaitResult_None;
+        rc = IGuestProcess_WaitForArray(process, ComSafeArrayAsInParam(waitSA), 500, &reason);
+        if (FAILED(rc)) { break; }
+        if (reason == ProcessWaitResult_StdOut) { guestDrain(process, 1, stdout); }
+        if (reason == ProcessWaitResult_StdErr) { guestDrain(process, 2, stderr); }
+        IGuestProcess_GetStatus(process, &status);
+    }
+    SADestroy(waitSA);
+    if (verbose) {
+        guestDrain(process, 1, stdout);
+        guestDrain(process, 2, stderr);
+    }
+
+    PRInt32 exitCode = 1;
+    if (status == ProcessStatus_TerminatedNormally) { IGuestProcess_GetExitCode(process, &exitCode); }
+    else { fprintf(stderr, "Guest process ended abnormally (status %u)\n", status); }
+    IGuestProcess_Release(process);
+    guestClose(&g);
+    TraceEnd();
+    return exitCode;
+}
+
+
+// Copy host file srcPath to dstPath in VM through guest control. Returns zero
+// on success, like SCPVM
+int GuestCopyToVM(IMachine *vm, char *srcPath, char *dstPath, bool verbose)
+{
+    GuestCtl g;
+    TraceBegin("GuestCopyToVM");
+    if (!guestOpen(vm, &g)) {
+        TraceEnd();
+        return 1;
+    }
+
+    // The guest side wants an absolute source path
+    char src[1024];
+    if (srcPath[0] == PATHCHAR || !getcwd(src, sizeof(src) - 256)) {
+        snprintf(src, sizeof(src), "%s", srcPath);
+    }
+    else {
+        size_t len = strlen(src);
+        snprintf(src + len, sizeof(src) - len, "%c%s", PATHCHAR, srcPath);
+    }
+    BSTR src_16, dst_16;
+    Convert8to16(src, &src_16);
+    Convert8to16(dstPath, &dst_16);
+    SAFEARRAY *flagsSA = SACreateVector(VT_UI4, 0, 0);
+    IProgress *progress = NULL;
+    TraceBegin("IGuestSession_FileCopyToGuest");
+    HRESULT rc = IGuestSession_FileCopyToGuest(g.gs, src_16, dst_16,
+        ComSafeArrayAsInParam(flagsSA), &progress);
+    TraceEnd();
+    SADestroy(flagsSA);
+    FreeBSTR(src_16);
+    FreeBSTR(dst_16);
+
+    // Unlike HandleProgress, the result decides the return code
+    LONG resultCode = rc;
+    if (SUCCEEDED(rc)) {
+        IProgress_WaitForCompletion(progress, -1);
+        IProgress_GetResultCode(progress, &resultCode);
+        if (FAILED(resultCode)) {
+            char *text = GetProgressError(progress);
+            fprintf(stderr, "%s\n", text);
+            free(text);
+        }
+        IProgress_Release(progress);
+    }
+    else {
+        PrintVBoxException();
+    }
+    guestClose(&g);
+    TraceEnd();
+    if (verbose && SUCCEEDED(resultCode)) { printf("Copied '%s' to '%s'\n", srcPath, dstPath); }
+    return SUCCEEDED(resultCode) ? 0 : 1;
+}
+
+
+// True if the guest additions in VM are up far enough to take guest sessions
+bool GuestReady(IMachine *vm)
+{
+    bool ready = false;
+    ISession *session = NULL;
+    TraceBegin("IVirtualBoxClient_GetSession");
+    HRESULT rc = IVirtualBoxClient_GetSession(vboxclient, &session);
+    ExitIfFailure(rc, "IVirtualBoxClient_GetSession", __FILE__, __LINE__);
+    if (SUCCEEDED(IMachine_LockMachine(vm, session, LockType_Shared))) {
+        IConsole *console = NULL;
+        IGuest *guest = NULL;
+        ISession_GetConsole(session, &console);
+        if (console) {
+            IConsole_GetGuest(console, &guest);
+            IConsole_Release(console);
+        }
+        if (guest) {
+            PRUint32 level = AdditionsRunLevelType_None;
+            IGuest_GetAdditionsRunLevel(guest, &level);
+            ready = level >= AdditionsRunLevelType_Userland;
+            IGuest_Release(guest);
+        }
+        ISession_UnlockMachine(session);
+    }
+    ISession_Release(session);
+    return ready;
+}
+
+
+// Check transport name
+bool ValidTransport(const char *transport)
+{
+    return Equal(transport, "ssh") || Equal(transport, "guest") || Equal(transport, "auto");
+}
+
+
+// Transport of given VM, as kept in its guest property
+// REMINDER: Caller must free allocated memory
+char * VMTransport(IMachine *vm)
+{
+    char *transport = GetVMProp(vm, "/vm/transport");
+    if (transport && ValidTransport(transport)) { return transport; }
+    if (transport) { free(transport); }
+    transport = NewString(8);
+    strcpy(transport, "ssh");
+    return transport;
+}
+
+
+// True if commands for VM should go through guest control rather than SSH
+bool UseGuestTransport(IMachine *vm)
+{
+    char *transport = VMTransport(vm);
+    bool guest = Equal(transport, "guest");
+    if (Equal(transport, "auto")) {
+        // Without an IP there's no SSH to reach
+        char *ip = GetVMProp(vm, "/vm/ip");
+        guest = true;
+        if (ip) {
+            TraceBeginDetail("SSHPortOpen", ip);
+            guest = !SSHPortOpen(ip);
+            TraceEnd();
+            free(ip);
+        }
+    }
+    free(transport);
+    return guest;
+}
+
+
+// Run cmd in VM over its transport. Returns zero on success
+int RunVM(IMachine *vm, char *cmd, bool verbose)
+{
+    if (UseGuestTransport(vm)) { return GuestRunVM(vm, cmd, verbose); }
+    return SSHVM(vm, cmd, verbose);
+}
+
+
+// Copy host file srcPath to dstPath in VM over its transport. Returns zero on success
+int CopyToVM(IMachine *vm, char *srcPath, char *dstPath, bool verbose)
+{
+    if (UseGuestTransport(vm)) { return GuestCopyToVM(vm, srcPath, dstPath, verbose); }
+    char *vmName = GetVMName(vm);
+    int rc = SCPVM(srcPath, vmName, dstPath, verbose);
+    free(vmName);
+    return rc;
+}
+
+
+// Wait up to secs seconds for VM's transport to be ready: SSH on ip, the guest
+// additions, or whichever comes first for 'auto'
+bool WaitVMTransport(IMachine *vm, char *ip, int secs)
+{
+    char *transport = VMTransport(vm);
+    bool ssh = !Equal(transport, "guest"), guest = !Equal(transport, "ssh");
+    free(transport);
+
+    TraceBegin("WaitVMTransport");
+    bool ready = false;
+    for (int delay = secs * 10; !ready && delay > 0; --delay) {
+        ready = (guest && GuestReady(vm)) || (ssh && SSHPortOpen(ip));
+        if (!ready) { usleep(100000); }   // Do nothing for .1 second
+    }
+    TraceEnd();
+    return ready;
+}
+
+
+// Set VM's transport, in a live transaction so it works on a running VM too
+bool SetVMTransport(IMachine *vm, const char *transport)
+{
+    VMTxn *txn = BeginLiveVMTxn(vm);
+    TxnSetProp(txn, "/vm/transport", transport);
+    return CommitVMTxn(txn);
+}
@@ -169,7 +169,7 @@ bool isTarFile(const char *path)
     }
     char cmd[1100];
     sprintf(cmd, "tar tf %s > /dev/null 2>&1", path);
-    int rc = system(cmd);
+    int rc = RunCmd(cmd);
     if (rc == 0) { return true; }
     else { return false; }
 }
@@ -216,11 +216,17 @@ int copyFile(const char *path1, const char *path2)
     // https://developer.apple.com/library/archive/documentation/System/Conceptual/ManPages_iPhoneOS/man3/fcopyfile.3.html
     int result = fcopyfile(source, target, 0, flag);
 #else
-    // For Linux use sendfile
+    // For Linux use sendfile, which moves at most ~2GB per call, so keep
+    // going until the whole file is across
     off_t bytesCopied = 0;
     struct stat fileinfo = {0};
     fstat(source, &fileinfo);
-    int result = sendfile(target, source, &bytesCopied, fileinfo.st_size);
+    int result = 0;
+    while (bytesCopied < fileinfo.st_size) {
+        ssize_t sent = sendfile(target, source, &bytesCopied,
+            fileinfo.st_size - bytesCopied);
+        if (sent <= 0) { result = -1; break; }
+    }
 #endif
 
     close(source);
@@ -245,6 +251,7 @@ void ExitIfNull(void *ptr, const char *path, int line)
 // Exit if return code shows failure
 void ExitIfFailure(HRESULT rc, const char *msg, const char *path, int line)
 {
+    TraceEnd();   // Close the span opened by TraceBegin just before the checked call
     if (SUCCEEDED(rc)) { return; }   // Return if it's good
     if (msg && path && line) {
         fprintf(stderr, "%s:%d %s error\n", path, line, msg);
@@ -301,3 +308,35 @@ char * NewString(int size)
     // REMINDER: Caller must free allocated memory
     return string;
 }
+
+
+// Run shell command with system(), tracing how long it takes
+int RunCmd(const char *cmd)
+{
+    TraceBeginDetail("system", cmd);
+    int rc = system(cmd);
+    TraceEnd();
+    return rc;
+}
+
+
+// Carry 64-bit FNV-1a hash h on over data. Start with FNV_INIT
+PRUint64 HashFNV(PRUint64 h, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; ++i) { h = (h ^ p[i]) * 0x100000001b3ULL; }
+    return h;
+}
+
+
+// Print string as a quoted JSON string, escaping what needs escaping
+void PrintJSONString(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; str && *str; ++str) {
+        if (*str == '"' || *str == '\\') { fprintf(fp, "\\%c", *str); }
+        else if ((unsigned char)*str < 0x20) { fprintf(fp, "\\u%04x", *str); }
+        else { fputc(*str, fp); }
+    }
+    fputc('"', fp);
+}
@@ -0,0 +1,259 @@
+// hostcap.c
+
+#include "vmc.h"
+
+// Admission control for provisioning. The demand of a whole plan, plus what
+// VMs outside of it already have committed, is checked against the host's
+// capacity before any VM is touched, so VMs that each fit on their own can't
+// oversubscribe the host together. Capacity is the host's CPUs and memory,
+// less a reserve kept for the host itself, times an overcommit ratio. When a
+// plan doesn't fit, the policy either refuses it, queues the VMs that don't
+// fit until others free up room, or shrinks them all until they do.
+
+
+// Set capacity from host totals and the global keys at the top of cfg, which
+// come before any section. A NULL cfg leaves all the defaults
+void InitHostCap(HostCap *cap, ini_t *cfg)
+{
+    cap->cpuRatio = 4.0;
+    cap->memRatio = 1.0;
+    cap->reserveCpus = 2;
+    cap->reserveMemory = 8192;
+    strcpy(cap->policy, "refuse");
+
+    const char *val;
+    if (cfg && (val = ini_get(cfg, "", "cpu_overcommit"))) { cap->cpuRatio = atof(val); }
+    if (cfg && (val = ini_get(cfg, "", "mem_overcommit"))) { cap->memRatio = atof(val); }
+    if (cfg && (val = ini_get(cfg, "", "reserve_cpus"))) { cap->reserveCpus = (ULONG)atoi(val); }
+    if (cfg && (val = ini_get(cfg, "", "reserve_memory"))) { cap->reserveMemory = (ULONG)atoi(val); }
+    if (cfg && (val = ini_get(cfg, "", "capacity"))) {
+        if (!Equal(val, "refuse") && !Equal(val, "queue") && !Equal(val, "shrink")) {
+            fprintf(stderr, "=> Capacity policy '%s' is invalid. Use 'refuse', 'queue' or 'shrink'\n", val);
+            Exit(EXIT_FAILURE);
+        }
+        strcpy(cap->policy, val);
+    }
+    if (cap->cpuRatio <= 0 || cap->memRatio <= 0) {
+        fprintf(stderr, "=> Overcommit ratios must be greater than 0\n");
+        Exit(EXIT_FAILURE);
+    }
+
+    PRUint32 hostCpus = 0, hostMem = 0;
+    TraceBegin("IHost_GetProcessorOnlineCount");
+    HRESULT rc = IHost_GetProcessorOnlineCount(ihost, &hostCpus);
+    ExitIfFailure(rc, "IHost_GetProcessorOnlineCount", __FILE__, __LINE__);
+    TraceBegin("IHost_GetMemorySize");
+    rc = IHost_GetMemorySize(ihost, &hostMem);
+    ExitIfFailure(rc, "IHost_GetMemorySize", __FILE__, __LINE__);
+
+    // No single VM can have more CPUs than the host can actually run at once
+    cap->maxCpus = hostCpus > cap->reserveCpus ? hostCpus - cap->reserveCpus : 0;
+    cap->cpus = (ULONG)(cap->maxCpus * cap->cpuRatio);
+    cap->memory = hostMem > cap->reserveMemory ?
+        (ULONG)((hostMem - cap->reserveMemory) * cap->memRatio) : 0;
+    cap->usedCpus = cap->usedMemory = 0;
+}
+
+
+// Plan entry of given VM name, if any
+static VMPlan * capPlanned(VMPlan *plan, int count, const char *name)
+{
+    for (int i = 0; i < count; i++) {
+        if (Equal(plan[i].name, name)) { return &plan[i]; }
+    }
+    return NULL;
+}
+
+
+// Add up what online VMs have committed. Queued plan VMs are left out, since
+// it's their plan values that will count once they're admitted
+static void capCommitted(HostCap *cap, VMPlan *plan, int count)
+{
+    VMSnap *s = InvSnap();
+    if (!s) { s = TakeVMSnap(); }
+
+    cap->usedCpus = cap->usedMemory = 0;
+    for (ULONG i = 0; i < s->count; ++i) {
+        if (!s->accessible[i]) { continue; }
+        if (s->state[i] < MachineState_FirstOnline || s->state[i] > MachineState_LastOnline) {
+            continue;
+        }
+        VMPlan *p = capPlanned(plan, count, s->name[i]);
+        if (p && p->queued) { continue; }
+        cap->usedCpus += s->cpus[i];
+        cap->usedMemory += s->memory[i];
+    }
+    FreeVMSnap(s);
+}
+
+
+// A plan VM that's already online and keeps its CPUs and memory holds on to
+// what it has, so it can't be queued nor shrunk
+static bool capFixed(VMPlan *p)
+{
+    return p->vm && !(p->changes & (PLAN_CPUS | PLAN_MEMORY)) &&
+        p->state >= MachineState_FirstOnline && p->state <= MachineState_LastOnline;
+}
+
+
+// Scale down every VM that isn't fixed by the same factor, so they all fit
+static bool capShrink(HostCap *cap, VMPlan *plan, int count)
+{
+    long freeCpus = (long)cap->cpus - cap->usedCpus;
+    long freeMem = (long)cap->memory - cap->usedMemory;
+    long flexCpus = 0, flexMem = 0;
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (capFixed(p)) {
+            freeCpus -= p->cpus;
+            freeMem -= p->memory;
+        }
+        else {
+            flexCpus += p->cpus;
+            flexMem += p->memory;
+        }
+    }
+    double cpuFactor = 1.0, memFactor = 1.0;
+    if (flexCpus > freeCpus) { cpuFactor = freeCpus > 0 ? (double)freeCpus / flexCpus : 0; }
+    if (flexMem > freeMem) { memFactor = freeMem > 0 ? (double)freeMem / flexMem : 0; }
+
+    long needCpus = 0, needMem = 0;
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (capFixed(p)) { continue; }
+        ULONG cpus = (ULONG)(p->cpus * cpuFactor);
+        if (cpus > cap->maxCpus) { cpus = cap->maxCpus; }
+        if (cpus < 1) { cpus = 1; }
+        ULONG memory = (ULONG)(p->memory * memFactor);
+        if (memory < CAP_MINMEMORY) { memory = p->memory < CAP_MINMEMORY ? p->memory : CAP_MINMEMORY; }
+        needCpus += cpus;
+        needMem += memory;
+        if (cpus == p->cpus && memory == p->memory) { continue; }
+
+        printf("[%s] Shrinking from %u CPU(s), %uMB to %u CPU(s), %uMB to fit host capacity\n",
+            p->name, p->cpus, p->memory, cpus, memory);
+        p->cpus = cpus;
+        p->memory = memory;
+        if (p->vm) { ReadVMPlanState(p); }   // Work out what's different now
+    }
+
+    if (needCpus > freeCpus || needMem > freeMem) {
+        fprintf(stderr, "=> Not enough host capacity, even with every VM shrunk to "
+            "1 CPU and %dMB. Not applying any changes\n", CAP_MINMEMORY);
+        return false;
+    }
+    return true;
+}
+
+
+// Admit VMs in plan order while they fit. The rest stay queued for WaitHostCap
+static void capQueue(HostCap *cap, VMPlan *plan, int count)
+{
+    long freeCpus = (long)cap->cpus - cap->usedCpus;
+    long freeMem = (long)cap->memory - cap->usedMemory;
+    for (int i = 0; i < count; i++) {
+        if (!capFixed(&plan[i])) { continue; }
+        plan[i].queued = false;
+        freeCpus -= plan[i].cpus;
+        freeMem -= plan[i].memory;
+    }
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (!p->queued) { continue; }
+        if ((long)p->cpus <= freeCpus && (long)p->memory <= freeMem) {
+            p->queued = false;
+            freeCpus -= p->cpus;
+            freeMem -= p->memory;
+        }
+    }
+}
+
+
+// Take every VM in plan off the queue
+static void capAdmitAll(VMPlan *plan, int count)
+{
+    for (int i = 0; i < count; i++) { plan[i].queued = false; }
+}
+
+
+// Check plan against host capacity and apply the capacity policy. Queued VMs
+// are flagged in the plan. Returns false if the plan can't go ahead at all
+bool AdmitProvPlan(HostCap *cap, VMPlan *plan, int count)
+{
+    for (int i = 0; i < count; i++) { plan[i].queued = true; }
+    capCommitted(cap, plan, count);
+
+    long needCpus = 0, needMem = 0;
+    bool tooBig = false;
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        tooBig = tooBig || p->cpus > cap->maxCpus;
+        if (p->cpus > cap->maxCpus && !Equal(cap->policy, "shrink")) {
+            fprintf(stderr, "[%s] %u CPU(s) is more than the %u this host can give a single VM\n",
+                p->name, p->cpus, cap->maxCpus);
+            capAdmitAll(plan, count);
+            return false;
+        }
+        needCpus += p->cpus;
+        needMem += p->memory;
+    }
+    long overCpus = (long)cap->usedCpus + needCpus - cap->cpus;
+    long overMem = (long)cap->usedMemory + needMem - cap->memory;
+    if (overCpus <= 0 && overMem <= 0 && !tooBig) {
+        capAdmitAll(plan, count);
+        return true;
+    }
+
+    if (Equal(cap->policy, "shrink")) {
+        capAdmitAll(plan, count);
+        return capShrink(cap, plan, count);
+    }
+    if (Equal(cap->policy, "queue")) {
+        capQueue(cap, plan, count);
+        return true;
+    }
+    capAdmitAll(plan, count);
+    fprintf(stderr, "=> Not enough host capacity: short by %ld CPU(s) and %ldMB. "
+        "Not applying any changes\n", overCpus > 0 ? overCpus : 0, overMem > 0 ? overMem : 0);
+    return false;
+}
+
+
+// Print capacity, what other VMs use, and what admitted plan VMs need
+void PrintHostCap(HostCap *cap, VMPlan *plan, int count)
+{
+    ULONG needCpus = 0, needMem = 0;
+    for (int i = 0; i < count; i++) {
+        if (plan[i].queued) { continue; }
+        needCpus += plan[i].cpus;
+        needMem += plan[i].memory;
+    }
+    printf("=> Host capacity %u CPU(s), %uMB (%.1fx, %.1fx overcommit). "
+        "Other VMs use %u, %uMB. Plan needs %u, %uMB\n",
+        cap->cpus, cap->memory, cap->cpuRatio, cap->memRatio,
+        cap->usedCpus, cap->usedMemory, needCpus, needMem);
+}
+
+
+// Wait for the host to have room for queued VM p, checking every CAP_QUEUEPOLL
+// seconds. Gives up after CAP_QUEUEWAIT seconds
+bool WaitHostCap(HostCap *cap, VMPlan *plan, int count, VMPlan *p)
+{
+    printf("[%s] Waiting for host capacity\n", p->name);
+    TraceBeginDetail("WaitHostCap", p->name);
+    for (int waited = 0; ; waited += CAP_QUEUEPOLL) {
+        UpdateVMList();   // Pick up VMs others created or deleted meanwhile
+        capCommitted(cap, plan, count);
+        if (cap->usedCpus + p->cpus <= cap->cpus && cap->usedMemory + p->memory <= cap->memory) {
+            TraceEnd();
+            p->queued = false;
+            return true;
+        }
+        if (waited >= CAP_QUEUEWAIT) { break; }
+        sleep(CAP_QUEUEPOLL);
+    }
+    TraceEnd();
+    fprintf(stderr, "[%s] Still not enough host capacity after %d seconds. Skipping this VM\n",
+        p->name, CAP_QUEUEWAIT);
+    return false;
+}
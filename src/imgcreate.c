@@ -6,12 +6,18 @@
 void imgCreate(int argc, char *argv[])
 {
     char imgName[64] = "", vmName[64] = "";
-    if (argc == 2) {
+    bool manifest = false, stripMACs = false;
+    for (int i = 2; i < argc; ++i) {
+        if (Equal(argv[i], "m")) { manifest = true; }
+        else if (Equal(argv[i], "s")) { stripMACs = true; }
+        else { argc = 0; }
+    }
+    if (argc >= 2 && argc <= 4) {
         argCopy(imgName, 64, argv[0]);
         argCopy(vmName, 64, argv[1]);
     }
     else {
-        printf("Usage: %s imgcreate <imgName> <vmName>\n", prgname);
+        printf("Usage: %s imgcreate <imgName> <vmName> [m] [s]\n", prgname);
         Exit(EXIT_FAILURE);
     }
 
@@ -47,6 +53,7 @@ void imgCreate(int argc, char *argv[])
 
     // Creating an OVA = Creating an empty IAppliance object and exporting VM to it
     IAppliance *appliance = NULL;
+    TraceBegin("IVirtualBox_CreateAppliance");
     HRESULT rc = IVirtualBox_CreateAppliance(vbox, &appliance);
     ExitIfFailure(rc, "IVirtualBox_CreateAppliance", __FILE__, __LINE__);
 
@@ -56,6 +63,7 @@ void imgCreate(int argc, char *argv[])
     // Each exportTo call can add another VM to sysDesc array, but we
     // only care to define one (1) VM in this program (sysDesc[0])
     IVirtualSystemDescription *sysDesc = NULL;
+    TraceBegin("IMachine_ExportTo");
     rc = IMachine_ExportTo(vm, appliance, imgFile_16, &sysDesc);
     ExitIfFailure(rc, "IMachine_ExportTo", __FILE__, __LINE__);
 
@@ -70,8 +78,17 @@ void imgCreate(int argc, char *argv[])
     //   StripAllMACs   = 3  StripAllNonNATMACs = 4
     // The API doesn't define the default ExportOptions_Null (0), is which simply
     // to ignore these options. That default option is achieved by setting the
-    // safe array to NULL 
+    // safe array to NULL. There's no option for the disks' compression: they're
+    // always written as streamOptimized VMDKs, at VirtualBox's own level
+    PRUint32 options[2];
+    ULONG optionCount = 0;
+    if (manifest) { options[optionCount++] = ExportOptions_CreateManifest; }
+    if (stripMACs) { options[optionCount++] = ExportOptions_StripAllMACs; }
     SAFEARRAY *OptionsSA = NULL;
+    if (optionCount) {
+        OptionsSA = SACreateVector(VT_UI4, 0, optionCount);
+        SACopyInParamHelper(OptionsSA, options, optionCount * sizeof(PRUint32));
+    }
 
     // Export appliance, invoking OVA creation, and handle the progress
     char *format = "ovf-2.0";
@@ -86,7 +103,12 @@ void imgCreate(int argc, char *argv[])
         &progress);
     printf("Creating OVA image ...\n");
     HandleProgress(progress, rc, -1);  // Timeout of -1 means wait indefinitely
+    if (OptionsSA) { SADestroy(OptionsSA); }
     // FreeBSTR(format_16); FreeBSTR(imgFile_16);
 
+    // The manifest VirtualBox just wrote gives the image's disk digest
+    char digest[IMG_DIGESTLEN];
+    if (manifest && ImageDigest(imgFile, digest)) { StoreImage(imgName, digest); }
+
     Exit(EXIT_SUCCESS);
 }
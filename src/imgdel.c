@@ -5,7 +5,7 @@
 // Delete given image
 void imgDelete(int argc, char *argv[])
 {
-    char imgName[64] = "", option[1] = "";
+    char imgName[64] = "", option[2] = "";
     if (argc == 2 && strlen(argv[1]) == 1) {
         argCopy(imgName, 64, argv[0]);
         argCopy(option, 1, argv[1]);
@@ -36,6 +36,7 @@ void imgDelete(int argc, char *argv[])
     int rc;
     rc = remove(imgFile);
     if (rc != 0) { fprintf(stderr, "Error deleting '%s'\n", imgFile); }
+    else { UnstoreImage(imgName); }
 
     Exit(EXIT_SUCCESS);
 }
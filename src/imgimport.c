@@ -43,5 +43,11 @@ void imgImport(int argc, char *argv[])
     int rc = copyFile(imgFile, targetFile);
     if (rc != 0) { fprintf(stderr, "Error copying '%s' to '%s'\n", imgFile, targetFile); }
 
+    // Images with a manifest go into the store under their disk digest
+    char digest[IMG_DIGESTLEN];
+    if (rc == 0 && ImageDigest(targetFile, digest)) {
+        StoreImage(imgFileBase, digest);
+    }
+
     Exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,268 @@
+// imgstore.c
+
+#define _DEFAULT_SOURCE   // symlink, readlink and fseeko under -std=c99
+
+#include "vmc.h"
+#include <dirent.h>
+
+// Image store, by disk content. An OVA exported with a manifest carries the
+// SHA256 of every file in it, the disks included, in a small .mf member that
+// comes right after the .ovf descriptor. The SHA256 of the disks' digests,
+// sorted, gives an ID of the image's disk content without reading the disks
+// again, since VirtualBox already hashed them while writing. The descriptor
+// is left out: it names the disk files after the image, so it differs for
+// the same disks under another image name. The ID therefore says nothing of
+// the hardware the descriptor sets up, CPUs, memory, NICs and MACs, only that
+// the disks are the same. ~/.vmc/store holds one symlink per disk digest,
+// named after it, pointing at the image in ~/.vmc, so the same disks imported
+// or created under another name are spotted at once. VirtualBox checks the
+// manifest itself when the image is imported into a VM, so it's verified
+// without hashing it here.
+
+typedef struct Sha256 {
+    PRUint32 h[8];
+    unsigned char block[64];
+    size_t used;          // Bytes in block
+    PRUint64 total;       // Bytes hashed so far
+} Sha256;
+
+static const PRUint32 sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA_ROR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+// Hash one full 64-byte block into sha
+static void sha256Block(Sha256 *sha, const unsigned char *block)
+{
+    PRUint32 w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (PRUint32)block[i * 4] << 24 | (PRUint32)block[i * 4 + 1] << 16 |
+            (PRUint32)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        PRUint32 s0 = SHA_ROR(w[i - 15], 7) ^ SHA_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        PRUint32 s1 = SHA_ROR(w[i - 2], 17) ^ SHA_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    PRUint32 a = sha->h[0], b = sha->h[1], c = sha->h[2], d = sha->h[3];
+    PRUint32 e = sha->h[4], f = sha->h[5], g = sha->h[6], h = sha->h[7];
+    for (int i = 0; i < 64; ++i) {
+        PRUint32 t1 = h + (SHA_ROR(e, 6) ^ SHA_ROR(e, 11) ^ SHA_ROR(e, 25)) +
+            ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        PRUint32 t2 = (SHA_ROR(a, 2) ^ SHA_ROR(a, 13) ^ SHA_ROR(a, 22)) +
+            ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    sha->h[0] += a; sha->h[1] += b; sha->h[2] += c; sha->h[3] += d;
+    sha->h[4] += e; sha->h[5] += f; sha->h[6] += g; sha->h[7] += h;
+}
+
+
+static void sha256Init(Sha256 *sha)
+{
+    static const PRUint32 init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->h, init, sizeof(init));
+    sha->used = 0;
+    sha->total = 0;
+}
+
+
+static void sha256Update(Sha256 *sha, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    sha->total += size;
+    while (size > 0) {
+        size_t n = 64 - sha->used < size ? 64 - sha->used : size;
+        memcpy(sha->block + sha->used, p, n);
+        sha->used += n;
+        p += n;
+        size -= n;
+        if (sha->used == 64) {
+            sha256Block(sha, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+
+// Finish hashing, and write the digest as 64 hex characters plus terminator
+static void sha256Hex(Sha256 *sha, char *hex)
+{
+    PRUint64 bits = sha->total * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t padLen = (sha->used < 56 ? 56 : 120) - sha->used;
+    for (int i = 0; i < 8; ++i) { pad[padLen + i] = (unsigned char)(bits >> (56 - i * 8)); }
+    sha256Update(sha, pad, padLen + 8);
+    for (int i = 0; i < 8; ++i) { sprintf(hex + i * 8, "%08x", sha->h[i]); }
+}
+
+
+// Size field of a tar header: octal text, or base-256 for large files
+static long long storeTarSize(const unsigned char *field)
+{
+    long long size = 0;
+    if (field[0] & 0x80) {
+        for (int i = 1; i < 12; ++i) { size = (size << 8) | field[i]; }
+        return size;
+    }
+    for (int i = 0; i < 12 && field[i] >= '0' && field[i] <= '7'; ++i) {
+        size = size * 8 + (field[i] - '0');
+    }
+    return size;
+}
+
+
+static int storeCompare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+// Work out the disk digest of manifest text, one 'SHA256(file)= hex' per line,
+// into hex. It's the SHA256 of the disks' 'algorithm=digest' lines, in sorted
+// order, so neither file names nor their order count. False if it lists no disk
+static bool storeHashManifest(char *text, char *hex)
+{
+    int lines = 1;
+    for (char *c = text; *c; ++c) { lines += *c == '\n'; }
+    char **disks = calloc(lines, sizeof(char *));
+    ExitIfNull(disks, __FILE__, __LINE__);
+
+    int count = 0;
+    char *line = strtok(text, "\n");
+    while (line) {
+        char *paren = strchr(line, '(');
+        char *value = strstr(line, ")= ");
+        bool disk = false;
+        if (paren && value > paren && value - paren < 256) {
+            char file[256];
+            memcpy(file, paren + 1, value - paren - 1);
+            file[value - paren - 1] = '\0';
+            Lower(file);
+            disk = !endsWith(file, ".ovf");
+        }
+        if (disk) {
+            // Rewritten in place as 'algorithm=digest', lower case
+            value += 3;
+            value[strcspn(value, "\r")] = '\0';
+            *paren = '=';
+            memmove(paren + 1, value, strlen(value) + 1);
+            Lower(line);
+            disks[count++] = line;
+        }
+        line = strtok(NULL, "\n");
+    }
+
+    qsort(disks, count, sizeof(char *), storeCompare);
+    Sha256 sha;
+    sha256Init(&sha);
+    for (int i = 0; i < count; ++i) {
+        sha256Update(&sha, disks[i], strlen(disks[i]));
+        sha256Update(&sha, "\n", 1);
+    }
+    sha256Hex(&sha, hex);
+    free(disks);
+    return count > 0;
+}
+
+
+// Work out the disk digest of given OVA into digest, of IMG_DIGESTLEN bytes,
+// from its manifest. False if it has none, or it lists no disk
+bool ImageDigest(const char *path, char *digest)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { return false; }
+
+    // Tar members in order, until the manifest. It's normally the second one
+    bool found = false;
+    unsigned char header[512];
+    while (!found && fread(header, 1, sizeof(header), fp) == sizeof(header) && header[0]) {
+        char name[101];
+        memcpy(name, header, 100);
+        name[100] = '\0';
+        long long len = storeTarSize(header + 124);
+        long long padded = (len + 511) / 512 * 512;
+
+        char lower[101];
+        strcpy(lower, name);
+        Lower(lower);
+        if (!endsWith(lower, ".mf") || len > IMG_MFMAX) {
+            if (fseeko(fp, padded, SEEK_CUR)) { break; }
+            continue;
+        }
+        char *text = malloc(len + 1);
+        ExitIfNull(text, __FILE__, __LINE__);
+        if (fread(text, 1, len, fp) == (size_t)len) {
+            text[len] = '\0';
+            found = storeHashManifest(text, digest);
+        }
+        free(text);
+        break;
+    }
+    fclose(fp);
+    return found;
+}
+
+
+// Record image of given name in ~/.vmc under its disk digest, saying so, or
+// which image already has the same disks
+void StoreImage(const char *imgName, const char *digest)
+{
+    char link[512], target[512], current[512];
+    snprintf(link, sizeof(link), "%s%cstore", vmhome, PATHCHAR);
+    if (!isDir(link)) { mkdir(link, 0755); }
+    snprintf(link + strlen(link), sizeof(link) - strlen(link), "%c%s.ova", PATHCHAR, digest);
+    snprintf(target, sizeof(target), "..%c%s", PATHCHAR, imgName);
+
+    // A link left by an image since deleted or renamed is taken over
+    ssize_t n = readlink(link, current, sizeof(current) - 1);
+    if (n > 0) {
+        current[n] = '\0';
+        if (Equal(current, target)) { return; }
+        if (isFile(link)) {
+            printf("Image '%s' has the same disks as '%s', disk digest %s\n", imgName,
+                baseName(current), digest);
+            return;
+        }
+        unlink(link);
+    }
+    if (symlink(target, link)) {
+        fprintf(stderr, "Error adding '%s' to image store\n", imgName);
+        return;
+    }
+    printf("Image '%s' disk digest %s\n", imgName, digest);
+}
+
+
+// Drop the image store entries of image of given name
+void UnstoreImage(const char *imgName)
+{
+    char dir[512], target[512];
+    snprintf(dir, sizeof(dir), "%s%cstore", vmhome, PATHCHAR);
+    snprintf(target, sizeof(target), "..%c%s", PATHCHAR, imgName);
+    DIR *d = opendir(dir);
+    if (!d) { return; }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        char link[1024], current[512];
+        snprintf(link, sizeof(link), "%s%c%s", dir, PATHCHAR, entry->d_name);
+        ssize_t n = readlink(link, current, sizeof(current) - 1);
+        if (n <= 0) { continue; }
+        current[n] = '\0';
+        if (Equal(current, target)) { unlink(link); }
+    }
+    closedir(d);
+}
@@ -67,6 +67,10 @@ char * GetIPNet(const char *ip)
 // Check if IP is already in use. Skip given vmName
 bool UsedIP(char *ip, char *vmName)
 {
+    // A live inventory answers without any API calls
+    int used = InvUsedIP(ip, vmName);
+    if (used >= 0) { return used; }
+
     // Update in-memory list of VM if it's empty
     if (!VMList) { UpdateVMList(); }
     // NOTE: UsedIP() gets called a lot, so above check optimizes this function
@@ -114,7 +118,7 @@ bool ActiveIP(char *ip)
     int rc;
     char cmd[256];
     sprintf(cmd, "ping -c 1 -W 300 %s >/dev/null 2>&1", ip);
-    rc = system(cmd);
+    rc = RunCmd(cmd);
     if (rc == -1) {
         fprintf(stderr, "Error running: %s\n", cmd);
         Exit(EXIT_FAILURE);
@@ -84,6 +84,7 @@ void GetNICList(IHostNetworkInterface ***List, ULONG *Count)
     // Temp safe array to get list of these objects
     SAFEARRAY *SA = SAOutParamAlloc();
 
+    TraceBegin("IHost_GetNetworkInterfaces");
     HRESULT rc = IHost_GetNetworkInterfaces(ihost,
         ComSafeArrayAsOutIfaceParam(SA, IHostNetworkInterface *));
     ExitIfFailure(rc, "GetNetworkInterfaces", __FILE__, __LINE__);
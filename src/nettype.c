@@ -44,17 +44,27 @@ void netType(int argc, char *argv[])
 // Set network type on this VM
 bool SetVMNetType(IMachine *vm, char *nettype)
 {
-    // Get new ISession object - Type2
-    IMachine *vmMuta = NULL;   // For temporary mutable VM object
-    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
-    if (!vmMuta) {
-        CloseSession(session);
+    VMTxn *txn = BeginVMTxn(vm);
+    if (!TxnSetNetType(txn, nettype)) {
+        AbortVMTxn(txn);
         return false;
     }
-    // Note: From here on we're modifying the writeable vmMuta object
+    // NICs follow the net type, so set them up again with the current IP
+    char *ip = TxnGetProp(txn, "/vm/ip");
+    if (ip && ValidIpStr(ip) && !TxnSetIP(txn, ip)) {
+        free(ip);
+        AbortVMTxn(txn);
+        return false;
+    }
+    if (ip) { free(ip); }
+    return CommitVMTxn(txn);
+}
 
-    SetVMProp(vmMuta, "/vm/nettype", nettype);
 
-    CloseSession(session);
-    return true; 
+// Set network type within given transaction
+bool TxnSetNetType(VMTxn *txn, char *nettype)
+{
+    if (!Equal(nettype, "ho") && !Equal(nettype, "bri")) { return false; }
+    TxnSetProp(txn, "/vm/nettype", nettype);
+    return true;
 }
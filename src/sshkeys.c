@@ -52,7 +52,7 @@ void CreateSSHKeys(void)
     char cmd[256];
     sprintf(vmsshpub, "%s%c%s", vmhome, PATHCHAR, sshpub);    // sshpub is global
     sprintf(cmd, "/usr/bin/ssh-keygen -f %s -y > %s", vmsshpri, vmsshpub);
-    int rc = system(cmd);
+    int rc = RunCmd(cmd);
     if (rc == -1) {
         fprintf(stderr, "Error running: %s\n", cmd);
         Exit(EXIT_FAILURE);
@@ -0,0 +1,114 @@
+// trace.c
+
+#include "vmc.h"
+#include <pthread.h>
+#include <sys/time.h>
+
+// Optional instrumentation, enabled by setting VMC_TRACE=<file.json>. It records
+// begin/end timestamps of every API call checked with ExitIfFailure, as well as
+// progress waits, sessions, shell-outs and SSH waits, in Chrome's trace-event
+// format. Open the file in chrome://tracing or https://ui.perfetto.dev to see
+// where a slow run spends its time.
+
+static FILE *traceFile = NULL;
+static bool traceFirst = true;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static int traceThreads = 0;
+static __thread int traceTid = 0;     // Small per-thread ID, for readability
+static __thread int traceDepth = 0;   // Open spans on this thread
+
+
+// Open trace file if VMC_TRACE is set
+void TraceInit(void)
+{
+    const char *path = getenv("VMC_TRACE");
+    if (!path || !*path) { return; }
+
+    traceFile = fopen(path, "w");
+    if (!traceFile) {
+        fprintf(stderr, "Error creating trace file '%s'\n", path);
+        return;
+    }
+    fprintf(traceFile, "[\n");
+}
+
+
+// Write one trace event of given phase ('B'egin or 'E'nd)
+static void traceEvent(char phase, const char *name, const char *detail)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    long long ts = (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    pthread_mutex_lock(&traceLock);
+    if (!traceTid) { traceTid = ++traceThreads; }
+    fprintf(traceFile, "%s{\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,\"cat\":\"%s\"",
+        traceFirst ? "" : ",\n", phase, ts, (int)getpid(), traceTid, prgname);
+    if (name) {
+        fprintf(traceFile, ",\"name\":");
+        PrintJSONString(traceFile, name);
+    }
+    if (detail) {
+        fprintf(traceFile, ",\"args\":{\"detail\":");
+        PrintJSONString(traceFile, detail);
+        fputc('}', traceFile);
+    }
+    fputc('}', traceFile);
+    traceFirst = false;
+    pthread_mutex_unlock(&traceLock);
+}
+
+
+// Open a new span on this thread
+void TraceBegin(const char *name)
+{
+    if (!traceFile) { return; }
+    traceEvent('B', name, NULL);
+    ++traceDepth;
+}
+
+
+// Open a new span, with extra detail shown in the viewer
+void TraceBeginDetail(const char *name, const char *detail)
+{
+    if (!traceFile) { return; }
+    traceEvent('B', name, detail);
+    ++traceDepth;
+}
+
+
+// Close the innermost span on this thread
+void TraceEnd(void)
+{
+    if (!traceFile || traceDepth < 1) { return; }
+    --traceDepth;
+    traceEvent('E', NULL, NULL);
+}
+
+
+// Number of spans open on this thread
+int TraceDepth(void)
+{
+    return traceDepth;
+}
+
+
+// Close the spans on this thread opened since it had depth of them open
+void TraceUnwind(int depth)
+{
+    while (traceFile && traceDepth > depth) { TraceEnd(); }
+}
+
+
+// Close trace file
+void TraceTerm(void)
+{
+    if (!traceFile) { return; }
+    // Close any span still open, e.g. when exiting on an error
+    TraceUnwind(0);
+    pthread_mutex_lock(&traceLock);
+    fprintf(traceFile, "\n]\n");
+    fclose(traceFile);
+    traceFile = NULL;
+    pthread_mutex_unlock(&traceLock);
+}
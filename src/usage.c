@@ -6,18 +6,33 @@ void PrintUsage(void)
 {
     const char *p = prgname;
     printf("Simple Linux VM Manager %s\n"
-        "%s list                                   List all VMs\n"
-        "%s create    <vmName> <ovaFile|imgName>   Create VM from given ovaFile, or imgName\n"
-        "%s del       <vmName> [f]                 Delete VM. Force option\n"
+        "%s list      [json|csv]                   List all VMs. JSON or CSV output option\n"
+        "%s create    <vmName> <ova|img> [fast]    Create VM from given ovaFile, or imgName. Fast-boot profile option\n"
+        "%s del       <vmName|glob ...> [f] [h]    Delete VMs, all at once. Force, hard power off options\n"
         "%s start     <vmName> [g]                 Start VM. GUI option\n"
         "%s stop      <vmName> [f]                 Stop VM. Force option\n"
+        "%s suspend   <vmName ...|all>             Save state of running VMs, to resume them instantly later\n"
+        "%s resume    <vmName ...|all>             Resume VMs from their saved state, all at once\n"
+        "%s snap      <vmName> [<snapName>]        Take snapshot, live if VM is running; List snapshots if no name\n"
+        "%s reset     <vmName> [<snapName>]        Reset VM to snapshot, or its current one, and start it\n"
+        "%s share     <vmName> [<host:guest>] [t]  Add shared folder mounted at guest path, read-only with :ro; Transient option; List shared folders if none\n"
+        "%s share     <vmName> <name> del          Remove shared folder\n"
         "%s ssh       <vmName> [<cmd arg>]         SSH into or optionally run command on VM\n"
-        "%s prov      [<vmConf>|c]                 Provision VMs in given vmConf file; Create skeleton file option\n"
+        "%s sync      <localPath> <vm>:<dir> [f]   Send only changed files, or changed blocks of large ones, over one SSH stream. Force full option\n"
+        "%s prov      [plan|apply] [<conf>|c] [f]  Provision VMs in given vmConf file; Show plan only; Create skeleton file; Rerun unchanged steps options\n"
+        "%s prov      resume [<vmConf>] [f]        Carry on with provisioning from where its last run stopped. Rerun unchanged steps option\n"
+        "%s prov      down [<vmConf>] [f] [h]      Delete all VMs in given vmConf file, all at once. Force, hard power off options\n"
+        "%s logs      <vmName>                     Page vmcopy and vmrun output of the last provisioning of VM\n"
         "%s info      <vmName>                     Dump extended VM details\n"
+        "%s top       [<secs> [<count>]] [json]    Live CPU, memory and network use of host and running VMs, every 2 or secs seconds. Stop after count refreshes, JSON lines options\n"
+        "%s top       [<secs>] cpu|mem|net [json]  Same, sorted by CPU (default), memory or network use\n"
+        "%s watch     [<vmName|glob>]              Stream VM state, registration, guest property and session changes as JSON lines\n"
         "%s mod       <vmName> <cpus> [<mem>]      Modify VM CPUs and memory. Memory defaults to 1024\n"
+        "%s mod       <vmName> cap|prio <val>      Set VM CPU cap percent, or priority low|normal|high. Applied live if running\n"
         "%s ip        <vmName> <ip>                Set VM IP address\n"
+        "%s density   [auto|<vmName> <MB|on|off>]  Show memory reclaimed from running VMs; Balloon idle VMs to keep host memory free; Set VM balloon size or page fusion\n"
         "%s imglist                                List all available images\n"
-        "%s imgcreate <imgName> <vmName>           Create imgName from existing VM\n"
+        "%s imgcreate <imgName> <vmName> [m] [s]   Create imgName from existing VM. Manifest and disk digest, strip MACs options\n"
         "%s imgpack                                How-to create brand new OVA image with Hashicorp packer\n"
         "%s imgimp    <imgFile>                    Import image. Make available to this program\n"
         "%s imgdel    <imgName> [f]                Delete image. Force option\n"
@@ -25,7 +40,8 @@ void PrintUsage(void)
         "%s netlist                                List available HostOnly networks\n"
         "%s netadd    <ip>                         Create new HostOnly network\n"
         "%s netdel    <vboxnetX>                   Delete given HostOnly network\n"
-        , prgver, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p);
+        "%s inv       [watch|drop]                 Show VM inventory status; Keep it current from VirtualBox events; Delete it\n"
+        , prgver, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p, p);
         
     Exit(EXIT_SUCCESS);
 }
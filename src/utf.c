@@ -0,0 +1,209 @@
+// utf.c
+
+#include "vmc.h"
+
+// UTF16 to UTF8 conversion without the API's allocator. The API hands back
+// every string as UTF16, and its own converter allocates a fresh UTF8 copy of
+// each one, which callers then mostly print and free, or copy elsewhere. Here
+// a string is converted straight into the caller's buffer, into one exactly
+// sized allocation, or into a scratch arena that a command empties once it's
+// done with what it printed. Almost everything VirtualBox returns is ASCII
+// (names, UUIDs, paths, IPs, MACs), so runs of 8 code units are tested at once,
+// as two 64-bit words, and copied as is while none has a bit above 0x7F set.
+// Only the rest is encoded one code point at a time. Input strings still go
+// through Convert8to16, since MSCOM marshals them as real BSTRs. The scratch
+// arena belongs to the main thread; other threads convert into their own buffers.
+
+typedef struct ScratchChunk {
+    struct ScratchChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ScratchChunk;
+
+static ScratchChunk *scratchFirst = NULL;   // Chunks are kept, and reused, across resets
+static ScratchChunk *scratchCur = NULL;
+
+static const PRUint64 utfNotASCII = 0xFF80FF80FF80FF80ULL;   // In any of 4 units
+
+
+// Next code point of str, of len units, from unit *i on. A lone surrogate
+// becomes U+FFFD
+static PRUint32 utfNext(CBSTR str, size_t len, size_t *i)
+{
+    PRUint32 c = str[(*i)++];
+    if (c < 0xD800 || c > 0xDFFF) { return c; }
+    if (c < 0xDC00 && *i < len && str[*i] >= 0xDC00 && str[*i] <= 0xDFFF) {
+        return 0x10000 + ((c - 0xD800) << 10) + (str[(*i)++] - 0xDC00);
+    }
+    return 0xFFFD;
+}
+
+
+// Bytes code point c takes in UTF8
+static int utfBytes(PRUint32 c)
+{
+    return c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+
+// Encode code point c into out, returning bytes written
+static int utfPut(PRUint32 c, char *out)
+{
+    int n = utfBytes(c);
+    if (n == 1) { out[0] = (char)c; return 1; }
+    for (int k = n - 1; k > 0; --k) {
+        out[k] = (char)(0x80 | (c & 0x3F));
+        c >>= 6;
+    }
+    out[0] = (char)(((0xFF00 >> n) & 0xFF) | c);   // 110xxxxx, 1110xxxx or 11110xxx
+    return n;
+}
+
+
+// Bytes str, of len units, takes in UTF8, without its terminator
+static size_t utfSize(CBSTR str, size_t len)
+{
+    size_t size = 0, i = 0;
+    while (i < len) {
+        PRUint64 w[2];
+        if (i + 8 <= len) {
+            memcpy(w, str + i, sizeof(w));
+            if (!((w[0] | w[1]) & utfNotASCII)) {
+                size += 8;
+                i += 8;
+                continue;
+            }
+        }
+        if (str[i] < 0x80) {
+            size++;
+            i++;
+            continue;
+        }
+        size += utfBytes(utfNext(str, len, &i));
+    }
+    return size;
+}
+
+
+// Convert str, of len units, into buf of size bytes, stopping short of a code
+// point that doesn't fit. Returns bytes written, without the terminator
+static size_t utfWrite(CBSTR str, size_t len, char *buf, size_t size)
+{
+    size_t n = 0, i = 0;
+    while (i < len) {
+        // 8 ASCII units at once, while there's room for them
+        PRUint64 w[2];
+        if (i + 8 <= len && n + 8 < size) {
+            memcpy(w, str + i, sizeof(w));
+            if (!((w[0] | w[1]) & utfNotASCII)) {
+                char *d = buf + n;
+                CBSTR u = str + i;
+                d[0] = (char)u[0]; d[1] = (char)u[1]; d[2] = (char)u[2]; d[3] = (char)u[3];
+                d[4] = (char)u[4]; d[5] = (char)u[5]; d[6] = (char)u[6]; d[7] = (char)u[7];
+                n += 8;
+                i += 8;
+                continue;
+            }
+        }
+        if (str[i] < 0x80 && n + 1 < size) {
+            buf[n++] = (char)str[i++];
+            continue;
+        }
+        char enc[4];
+        int bytes = utfPut(utfNext(str, len, &i), enc);
+        if (n + bytes >= size) { break; }
+        memcpy(buf + n, enc, bytes);
+        n += bytes;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+
+// Take size bytes from the scratch arena, moving on to a kept chunk or
+// adding one when the current one is full
+static char * scratchAlloc(size_t size)
+{
+    ScratchChunk *c = scratchCur;
+    if (!c || c->used + size > c->size) {
+        ScratchChunk *next = c ? c->next : scratchFirst;
+        if (!next || size > next->size) {
+            size_t room = size > SCRATCH_CHUNK ? size : SCRATCH_CHUNK;
+            ScratchChunk *fresh = malloc(sizeof(ScratchChunk) + room);
+            ExitIfNull(fresh, __FILE__, __LINE__);
+            fresh->size = room;
+            fresh->used = 0;
+            fresh->next = next;
+            if (c) { c->next = fresh; }
+            else   { scratchFirst = fresh; }
+            next = fresh;
+        }
+        c = scratchCur = next;
+    }
+    char *p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+
+// Number of UTF16 code units in str, without its terminator. 0 if str is NULL
+size_t Utf16Len(CBSTR str)
+{
+    size_t len = 0;
+    if (str) { while (str[len]) { len++; } }
+    return len;
+}
+
+
+// Convert str into buf of size bytes, like snprintf does, but never cutting a
+// character in two. A NULL str gives an empty string. Returns bytes written
+size_t Utf16To8(CBSTR str, char *buf, size_t size)
+{
+    if (size < 1) { return 0; }
+    return utfWrite(str, Utf16Len(str), buf, size);
+}
+
+
+// Convert str into a new string of exactly the size it needs, converting it
+// only once. A NULL str gives an empty string
+char * NewUtf8(CBSTR str)
+{
+    // Short ones go through a stack buffer, long ones are measured first
+    size_t len = Utf16Len(str);
+    char tmp[256];
+    char *s;
+    if (len * 3 < sizeof(tmp)) {
+        size_t n = utfWrite(str, len, tmp, sizeof(tmp));
+        s = NewString(n + 1);
+        memcpy(s, tmp, n + 1);
+    }
+    else {
+        size_t size = utfSize(str, len) + 1;
+        s = NewString(size);
+        utfWrite(str, len, s, size);
+    }
+    // REMINDER: Caller must free allocated memory
+    return s;
+}
+
+
+// Convert str into the scratch arena. What's returned is only good until the
+// next ScratchReset(), and must not be freed. A NULL str gives an empty string
+char * Scratch8(CBSTR str)
+{
+    // Take room for the worst case, 3 bytes a unit, and give back what's unused
+    size_t len = Utf16Len(str);
+    size_t room = len * 3 + 1;
+    char *s = scratchAlloc(room);
+    scratchCur->used -= room - (utfWrite(str, len, s, room) + 1);
+    return s;
+}
+
+
+// Give back everything taken from the scratch arena, keeping its memory for reuse
+void ScratchReset(void)
+{
+    for (ScratchChunk *c = scratchFirst; c; c = c->next) { c->used = 0; }
+    scratchCur = scratchFirst;
+}
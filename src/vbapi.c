@@ -1,6 +1,46 @@
 // vbapi.c
 
 #include "vmc.h"
+#include <pthread.h>
+
+// While set, a failing Exit() in the thread that set it jumps back to the
+// trap instead of ending the program. It first unlocks the sessions opened
+// since, frees the memory handed to TrapOwn, and closes the trace spans left
+// open, so whoever retries starts from where the trap was set
+typedef struct TrapItem {
+    void *ptr;
+    bool session;   // An ISession to unlock, else memory to free
+} TrapItem;
+
+static jmp_buf *exitTrap = NULL;
+static pthread_t exitTrapThread;
+static int exitTrapDepth = 0;
+static TrapItem *trapItems = NULL;
+static int trapItemCount = 0;
+static int trapItemRoom = 0;
+
+static bool trapActive(void)
+{
+    return exitTrap && pthread_equal(pthread_self(), exitTrapThread);
+}
+
+// Add ptr to what a trapped Exit() cleans up, growing the list as needed
+static void trapAdd(void *ptr, bool session)
+{
+    if (trapItemCount == trapItemRoom) {
+        TrapItem *items = realloc(trapItems, (trapItemRoom + TRAP_GROWBY) * sizeof(TrapItem));
+        if (!items) {
+            // Leaving it out would leave a VM locked, so don't go back to the trap
+            fprintf(stderr, "%s:%d realloc error\n", __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        trapItems = items;
+        trapItemRoom += TRAP_GROWBY;
+    }
+    trapItems[trapItemCount].ptr = ptr;
+    trapItems[trapItemCount].session = session;
+    trapItemCount++;
+}
 
 // Initialize all global API objects
 void InitGlobalObjects(void) {
@@ -24,6 +64,7 @@ void InitGlobalObjects(void) {
     }
 
     // Get and set IVirtualBoxClient global instance
+    TraceBegin("g_pVBoxFuncs->pfnClientInitialize");
     HRESULT rc = g_pVBoxFuncs->pfnClientInitialize(NULL, &vboxclient);
     // pfnClientInitialize does all the necessary startup action and should
     // provide above requested IVirtualBoxClient instance. When all is done
@@ -31,25 +72,32 @@ void InitGlobalObjects(void) {
     ExitIfFailure(rc, "g_pVBoxFuncs->pfnClientInitialize", __FILE__, __LINE__);
 
     // Get and set IVirtualBox global instance
+    TraceBegin("IVirtualBoxClient_GetVirtualBox");
     rc = IVirtualBoxClient_GetVirtualBox(vboxclient, &vbox);
     ExitIfFailure(rc, "IVirtualBoxClient_GetVirtualBox", __FILE__, __LINE__);
 
     // Get and set ISystemProperties global instance
+    TraceBegin("IVirtualBox_GetSystemProperties");
     rc = IVirtualBox_GetSystemProperties(vbox, &sysprop);
     ExitIfFailure(rc, "IVirtualBox_GetSystemProperties", __FILE__, __LINE__);
 
     // Get and set IHost global instance
+    TraceBegin("IVirtualBox_GetHost");
     rc = IVirtualBox_GetHost(vbox, &ihost);
     ExitIfFailure(rc, "IVirtualBox_GetHost", __FILE__, __LINE__);
 
     // Get and set default MachineFolder
     BSTR vbhome_16 = NULL;
     // Unfortunately, the API defaults to using UTF16 char encoding
+    TraceBegin("ISystemProperties_GetDefaultMachineFolder");
     rc = ISystemProperties_GetDefaultMachineFolder(sysprop, &vbhome_16);
     ExitIfFailure(rc, "ISystemProperties_GetDefaultMachineFolder", __FILE__, __LINE__);
     Convert16to8(vbhome_16, &vbhome);   // Transfer to UTF8 global variable
     FreeBSTR(vbhome_16);
 
+    // UTF16 keys of the guest properties kept on every VM, converted only once
+    InitPropKeys();
+
     // Ensure config directory exists.
     sprintf(vmhome, "%s%c%s", getenv("HOME"), PATHCHAR, vmdir);
     // Note that vmhome and vmdir are GLOBAL variables
@@ -141,7 +189,10 @@ void HandleProgress(IProgress *progress, HRESULT rc, PRInt32 Timeout)
         return;
     }
 
+    TraceBegin("HandleProgress");
+    TraceBegin("IProgress_WaitForCompletion");
     IProgress_WaitForCompletion(progress, Timeout);
+    TraceEnd();
 
     // Wait for about a minute, in .1 sec intervals, until it completes
     BOOL completed = FALSE;
@@ -149,6 +200,7 @@ void HandleProgress(IProgress *progress, HRESULT rc, PRInt32 Timeout)
     while (!completed && delay > 0) {
         usleep(100000);  // Do nothing for .1 second
         --delay;
+        TraceBegin("IProgress_GetCompleted");
         rc = IProgress_GetCompleted(progress, &completed);
         ExitIfFailure(rc, "IProgress_GetCompleted", __FILE__, __LINE__);
     }
@@ -172,6 +224,7 @@ void HandleProgress(IProgress *progress, HRESULT rc, PRInt32 Timeout)
     if (progress) { IProgress_Release(progress); }
     // NOTE: Not sure I like releasing the IProgress object pointer here,
     // instead of in the calling function where it was created.
+    TraceEnd();
 
     // // DEBUG
     // now = timenow();
@@ -200,25 +253,35 @@ ISession * GetSession(IMachine *vm, PRUint32 lockType, IMachine **vmMuta)
     //   NOTE: Given vm is just a copy pointer, but vmMuta pointer updates the
     //   the actual, usable handle 
 
+    TraceBegin("GetSession");
+
     // Allocate memory for a new Session pointer that will survive this function
     ISession *session = malloc(sizeof(ISession*));
     ExitIfNull(session, __FILE__, __LINE__);
     // REMINDER: Caller must free allocated memory
     
     // Get a new ISession object and store it in above pointer
+    TraceBegin("IVirtualBoxClient_GetSession");
     HRESULT rc = IVirtualBoxClient_GetSession(vboxclient, &session);
     ExitIfFailure(rc, "IVirtualBoxClient_GetSession", __FILE__, __LINE__);
 
-    if (lockType == LockType_Null) { return session; }  // Type1 request, we're done
+    if (lockType == LockType_Null) {   // Type1 request, we're done
+        TraceEnd();
+        return session;
+    }
 
     // Write lock the given VM
+    TraceBegin("IMachine_LockMachine");
     rc = IMachine_LockMachine(vm, session, lockType);
     ExitIfFailure(rc, "IMachine_LockMachine", __FILE__, __LINE__);
 
     // Get handle to the mutable copy
+    TraceBegin("ISession_GetMachine");
     rc = ISession_GetMachine(session, vmMuta);
     ExitIfFailure(rc, "ISession_GetMachine", __FILE__, __LINE__);
 
+    if (trapActive()) { trapAdd(session, true); }
+    TraceEnd();
     return session;
 }
 
@@ -226,6 +289,7 @@ ISession * GetSession(IMachine *vm, PRUint32 lockType, IMachine **vmMuta)
 // Save all settings and unlock session
 void CloseSession(ISession *session)
 {
+    TraceBegin("CloseSession");
     // If there's a VM associated with this session, save all settings
     IMachine *vmMuta = NULL;
     ISession_GetMachine(session, &vmMuta);
@@ -236,19 +300,65 @@ void CloseSession(ISession *session)
         //vmMuta = NULL;
     }
 
+    TrapDisown(session);
     ISession_UnlockMachine(session);
     if (session) {
         ISession_Release(session);
         session = NULL;
     }
+    TraceEnd();
+}
+
+
+// Set, or clear with NULL, the trap a failing Exit() jumps back to from the
+// calling thread. See ProvisionConfig
+void SetExitTrap(jmp_buf *trap)
+{
+    exitTrap = trap;
+    exitTrapThread = pthread_self();
+    exitTrapDepth = TraceDepth();
+    trapItemCount = 0;
+}
+
+
+// Have a trapped Exit() free given heap memory, unless it's disowned first
+void TrapOwn(void *mem)
+{
+    if (trapActive()) { trapAdd(mem, false); }
+}
+
+
+// Take given session or memory off what a trapped Exit() cleans up, once it's
+// been released the normal way
+void TrapDisown(void *ptr)
+{
+    for (int i = 0; i < trapItemCount; ++i) {
+        if (trapItems[i].ptr == ptr) { trapItems[i] = trapItems[--trapItemCount]; break; }
+    }
 }
 
 
 // Graceful exit, releasing any global VBOX API object
 void Exit(int rc)
 {
+    if (rc != EXIT_SUCCESS && trapActive()) {
+        // Leave nothing locked for whoever retries, then go back to the trap
+        for (int i = 0; i < trapItemCount; ++i) {
+            if (trapItems[i].session) {
+                ISession_UnlockMachine((ISession *)trapItems[i].ptr);
+                ISession_Release((ISession *)trapItems[i].ptr);
+            }
+            else { free(trapItems[i].ptr); }
+        }
+        TraceUnwind(exitTrapDepth);
+        jmp_buf *trap = exitTrap;
+        SetExitTrap(NULL);
+        longjmp(*trap, 1);
+    }
+
     // First, release any object dependant on the API
     if (vbhome) { Free8(vbhome); }
+    FreePropKeys();
     FreeVMList();
 
     // Finally, release all major API objects
@@ -261,5 +371,6 @@ void Exit(int rc)
         g_pVBoxFuncs->pfnClientUninitialize();
         VBoxCGlueTerm();
     }
+    TraceTerm();
     exit(rc);
 }
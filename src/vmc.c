@@ -89,6 +89,12 @@ int main(int argc, char *argv[])
     // If less than 2 arguments just print usage (and exit)
     if (argc < 2) { PrintUsage(); }
 
+    // Start tracing, if VMC_TRACE=<file.json> is set
+    TraceInit();
+
+    // A live inventory answers 'list' without touching the API at all
+    if (Equal(argv[1], "list") && InvLive()) { vmList(argc - 2, argv + 2); }
+
     // Initialize global objects: vboxclient, box, sysprop, vbhome, and vmhome
     InitGlobalObjects();
 
@@ -106,16 +112,26 @@ int main(int argc, char *argv[])
     // Shift arguments by 2, for better readability
     argc -= 2 ; argv += 2;
 
-    if (Equal(command, "list"))           { PrintVMList(); }          // vmlist.c
+    if (Equal(command, "list"))           { vmList(argc, argv); }     // vmlist.c
     else if (Equal(command, "create"))    { vmCreate(argc, argv); }   // vmcreate.c
     else if (Equal(command, "del"))       { vmDelete(argc, argv); }   // vmdel.c
     else if (Equal(command, "start"))     { vmStart(argc, argv); }    // vmstart.c
     else if (Equal(command, "stop"))      { vmStop(argc, argv); }     // vmstop.c
+    else if (Equal(command, "suspend"))   { vmSuspend(argc, argv); }  // vmsuspend.c
+    else if (Equal(command, "resume"))    { vmResume(argc, argv); }   // vmsuspend.c
+    else if (Equal(command, "snap"))      { vmSnapshot(argc, argv); } // vmsnapshot.c
+    else if (Equal(command, "reset"))     { vmReset(argc, argv); }    // vmsnapshot.c
+    else if (Equal(command, "share"))     { vmShare(argc, argv); }    // vmshare.c
     else if (Equal(command, "ssh"))       { vmSSH(argc, argv); }      // vmssh.c
+    else if (Equal(command, "sync"))      { vmSync(argc, argv); }     // vmsync.c
     else if (Equal(command, "prov"))      { vmProv(argc, argv); }     // vmprov.c
+    else if (Equal(command, "logs"))      { vmLogs(argc, argv); }     // vmlogs.c
     else if (Equal(command, "info"))      { vmInfo(argc, argv); }     // vminfo.c
+    else if (Equal(command, "top"))       { vmTop(argc, argv); }      // vmtop.c
+    else if (Equal(command, "watch"))     { vmWatch(argc, argv); }    // vmwatch.c
     else if (Equal(command, "mod"))       { vmMod(argc, argv); }      // vmmod.c
     else if (Equal(command, "ip"))        { vmIP(argc, argv); }       // vmip.c
+    else if (Equal(command, "density"))   { vmDensity(argc, argv); }  // vmdensity.c
     else if (Equal(command, "imglist"))   { imgList(); }              // imglist.c
     else if (Equal(command, "imgcreate")) { imgCreate(argc, argv); }  // imgcreate.c
     else if (Equal(command, "imgpack"))   { imgPack(); }              // imgpack.c
@@ -125,6 +141,7 @@ int main(int argc, char *argv[])
     else if (Equal(command, "netlist"))   { netList(); }              // netlist.c
     else if (Equal(command, "netadd"))    { netAdd(argc, argv); }     // netadd.c
     else if (Equal(command, "netdel"))    { netDel(argc, argv); }     // netdelete.c
+    else if (Equal(command, "inv"))       { vmInv(argc, argv); }      // vminv.c
     else { PrintUsage(); }                                            // usage.c
 
     Exit(EXIT_SUCCESS);
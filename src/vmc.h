@@ -8,6 +8,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <setjmp.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -23,6 +25,44 @@
 
 // DEFINES
 #define PATHCHAR    '/'
+#define FNV_INIT    0xcbf29ce484222325ULL   // Starting value for HashFNV
+#define TXN_MAXPROPS      8     // Max guest properties queued in one VMTxn
+#define SNAP_MAXTHREADS   4     // Max extra threads used to take a VMSnap
+#define SNAP_VMSPERTHREAD 32    // VMs per extra thread, so small lists stay single threaded
+#define INV_MAGIC   0x564e4956  // "VINV", identifies an inventory file
+#define INV_VERSION 1           // Bump whenever InvHeader or InvRecord change
+#define CAP_MINMEMORY     512   // Least memory (MB) a VM is shrunk to for host capacity
+#define CAP_QUEUEPOLL     10    // Seconds between host capacity checks for queued VMs
+#define CAP_QUEUEWAIT     600   // Seconds a queued VM waits for host capacity at most
+#define DENSITY_MINFREE   4096  // Host memory (MB) 'vmc density auto' keeps available by default
+#define DENSITY_INTERVAL  10    // Default seconds between 'vmc density auto' checks
+#define DENSITY_STATSECS  5     // Seconds between guest statistics reports
+#define DENSITY_IDLE      90    // Guest CPU idle percentage from which a VM counts as idle
+#define DENSITY_STEP      8     // Balloons change by 1/DENSITY_STEP of VM memory per check
+#define DENSITY_MAXPCT    50    // Most of a VM's memory its balloon is inflated to, in percent
+#define FAST_DISKCTL  "VirtIO"  // Storage controller the fast profile moves the boot disk to
+#define DEL_POOL          4     // VM deletes run at the same time
+#define DEL_STOPWAIT      20    // Seconds VMs get to shut down on ACPI power button before a hard power off
+#define GUEST_STARTWAIT   30    // Seconds a guest control session gets to log on
+#define GUEST_READSIZE    65536 // Most bytes of guest process output read at once
+#define SYNC_MAGIC  0x4e595356  // "VSYN", identifies a sync manifest file
+#define SYNC_VERSION 1          // Bump whenever SyncHeader, SyncEntry or SyncBlock change
+#define SYNC_DELTAMIN     65536 // Bytes from which a changed file is sent as a delta
+#define SYNC_BLOCKMIN     2048  // Smallest delta block size, in bytes
+#define SYNC_MAXBLOCKS    16384 // Delta blocks per file, beyond which blocks grow
+#define TRAP_GROWBY       8     // Entries a trap's cleanup list grows by
+#define PROV_RETRIES      2     // Default times a failed VM is provisioned again
+#define PROV_RETRYDELAY   5     // Default seconds before the first retry, doubled for each next one
+#define LOG_TAILLINES     10    // Last lines of a step's output kept, and shown if it fails
+#define LOG_LINEMAX       256   // Bytes of each of those lines kept
+#define LOG_READSIZE      8192  // Longest line read from a step's output before it's split
+#define LOG_REDRAWMS      100   // Milliseconds between redraws of the provisioning status line
+#define LOG_STATUSWIDTH   79    // Most bytes in the provisioning status line
+#define WATCH_WAITMS      1000  // Longest 'vmc watch' waits for an event before checking for Ctrl-C
+#define SCRATCH_CHUNK     65536 // Bytes the scratch arena grows by, unless a string needs more
+#define PROP_KEYSLOTS     16    // Slots in the interned property key table, a power of 2
+#define IMG_MFMAX         65536 // Largest OVA manifest read to work out an image's disk digest
+#define IMG_DIGESTLEN     65    // Hex SHA256 disk digest of an image, with terminator
 // Syntactic sugar for common API functions
 #define Convert16to8(u16,u8)     (g_pVBoxFuncs->pfnUtf16ToUtf8(u16,u8))
 #define Free8(a)                 (g_pVBoxFuncs->pfnUtf8Free(a))
@@ -39,6 +79,151 @@
 
 
 // TYPES
+// Provisioning plan change flags. See vmprov.c
+#define PLAN_CREATE   0x0001   // VM doesn't exist yet
+#define PLAN_START    0x0002   // VM is configured as per vmconf, but isn't running
+#define PLAN_IP       0x0004   // IP address differs
+#define PLAN_CPUS     0x0008   // CPU count differs
+#define PLAN_MEMORY   0x0010   // Memory size differs
+#define PLAN_NETTYPE  0x0020   // Network type differs
+#define PLAN_PAGEFUSION 0x0040 // Page fusion setting differs
+#define PLAN_BALLOON  0x0080   // Memory balloon size differs
+#define PLAN_CPUCAP   0x0100   // CPU execution cap differs
+#define PLAN_PRIORITY 0x0200   // VM process priority differs
+#define PLAN_RESET    0x0400   // Restore the reset_to snapshot before anything else
+#define PLAN_SNAPSHOT 0x0800   // Take the reset_to snapshot once provisioned
+#define PLAN_TRANSPORT 0x1000  // Command and file transport differs
+#define PLAN_SHARE    0x2000   // A shared folder is missing or differs
+// Changes that can only be applied to a powered off VM
+#define PLAN_OFFLINE  (PLAN_IP | PLAN_CPUS | PLAN_MEMORY | PLAN_NETTYPE | PLAN_PAGEFUSION)
+// Changes that can be applied to a running VM through a shared lock session
+#define PLAN_ONLINE   (PLAN_BALLOON | PLAN_CPUCAP | PLAN_PRIORITY | PLAN_TRANSPORT | PLAN_SHARE)
+
+// Shared folder, as given by 'hostpath:guestpath[:ro]'. See vmshare.c
+typedef struct VMShare {
+    char name[64];           // Last element of guestPath
+    char hostPath[1024];     // Absolute
+    char guestPath[256];     // Where the guest additions mount it
+    bool writable;
+} VMShare;
+
+// Desired (vmconf) versus actual values of one VM
+typedef struct VMPlan {
+    char name[64];           // Section name, which is also the VM name
+    char image[1024];        // Full path to image file
+    char ip[16];
+    ULONG cpus;
+    ULONG memory;
+    char nettype[4];
+    char vmcopy[1024];
+    char vmrun[1024];
+    char pagefusion[4];      // "on" or "off", or empty to leave as is
+    PRInt32 balloon;         // MB, or -1 to leave as is
+    ULONG cpucap;            // Percent, or 0 to leave as is
+    char priority[8];        // "low", "normal" or "high", or empty to leave as is
+    char profile[8];         // Hardware profile at creation, "default" or "fast"
+    char resetTo[64];        // Snapshot to reset to on every run, or empty
+    bool wasReset;           // Reset to resetTo during this run
+    char transport[8];       // "ssh", "guest" or "auto", or empty to leave as is
+    char share[1024];        // Comma separated 'hostpath:guestpath[:ro]' folders
+    bool vmcopySync;         // Send vmcopy as a delta sync. See vmsync.c
+    IMachine *vm;            // NULL until the VM exists
+    PRUint32 state;          // Current values, read from the VM itself
+    char curIp[16];
+    ULONG curCpus;
+    ULONG curMemory;
+    char curNettype[4];
+    char curPagefusion[4];
+    ULONG curBalloon;
+    ULONG curCpucap;
+    char curPriority[8];
+    char curTransport[8];
+    unsigned int changes;    // PLAN_* flags
+    bool queued;             // Waiting for host capacity. See hostcap.c
+} VMPlan;
+
+// Host capacity available to VMs, and overcommit policy. See hostcap.c
+typedef struct HostCap {
+    double cpuRatio;         // Virtual CPUs allowed per usable host CPU
+    double memRatio;         // VM memory allowed per usable MB of host memory
+    ULONG reserveCpus;       // CPUs and memory (MB) kept for the host itself
+    ULONG reserveMemory;
+    char policy[8];          // When a plan doesn't fit: refuse, queue or shrink
+    ULONG maxCpus;           // Most CPUs a single VM can have
+    ULONG cpus;              // Capacity, after reserve and overcommit
+    ULONG memory;
+    ULONG usedCpus;          // Committed to online VMs
+    ULONG usedMemory;
+} HostCap;
+
+// Reconfiguration transaction on one VM. See vmtxn.c
+typedef struct VMTxn {
+    IMachine *vm;            // Given VM object
+    IMachine *vmMuta;        // Mutable copy, usable while transaction is open
+    ISession *session;       // Write-locked session, or shared if the VM runs
+    bool dirty;              // Settings were modified and need saving
+    int propCount;           // Queued guest properties
+    char propPath[TXN_MAXPROPS][32];
+    char propValue[TXN_MAXPROPS][128];
+} VMTxn;
+
+// Sync manifest file: a SyncHeader, then one SyncEntry per file sent to the
+// VM, each followed by its blockCount SyncBlocks. See vmsync.c
+typedef struct SyncHeader {
+    PRUint32 magic;
+    PRUint32 version;
+    PRUint32 count;
+} SyncHeader;
+
+typedef struct SyncEntry {
+    char path[1024];         // Full path in the VM
+    PRInt64 size;
+    PRInt64 mtime;           // Of the host file it was sent from, in nanoseconds
+    PRUint64 hash;           // FNV-1a of the content
+    PRUint32 crc;            // POSIX cksum of the content, checked in the VM before a delta
+    PRUint32 mode;
+    PRUint32 blockSize;      // Zero for files under SYNC_DELTAMIN bytes, which have no blocks
+    PRUint32 blockCount;
+} SyncEntry;
+
+typedef struct SyncBlock {
+    PRUint32 weak;           // Rolling checksum
+    PRUint64 strong;         // FNV-1a
+} SyncBlock;
+
+// Snapshot of listing attributes of all VMs, as parallel arrays. See vmsnap.c
+typedef struct VMSnap {
+    ULONG count;
+    IMachine **vm;
+    BOOL *accessible;
+    ULONG *cpus;
+    ULONG *memory;
+    PRUint32 *state;
+    char (*name)[64];
+    char (*uuid)[40];
+    char (*osType)[32];
+    char (*ip)[16];
+} VMSnap;
+
+// On-disk inventory of all VMs, memory-mapped by readers. See vminv.c
+typedef struct InvHeader {
+    PRUint32 magic;
+    PRUint32 version;
+    PRUint32 gen;            // Even when stable, odd while a record is being updated
+    PRUint32 count;          // Records following this header
+    PRInt32 watcher;         // PID of 'vmc inv watch' keeping it current, 0 if none
+    PRInt64 updated;         // Time of last full rebuild
+} InvHeader;
+
+typedef struct InvRecord {
+    char name[64];
+    char uuid[40];
+    char osType[32];
+    char ip[16];
+    PRUint32 state;
+    ULONG cpus;
+    ULONG memory;
+} InvRecord;
 
 
 // GLOBAL CONSTANTS AND VARIABLES DECLARATION
@@ -82,6 +267,9 @@ char * GetProgressId(IProgress *progress);
 void HandleProgress(IProgress *progress, HRESULT rc, PRInt32 Timeout);
 ISession * GetSession(IMachine *vm, PRUint32 lockType, IMachine **vmMuta);
 void CloseSession(ISession *session);
+void SetExitTrap(jmp_buf *trap);
+void TrapOwn(void *mem);
+void TrapDisown(void *ptr);
 void Exit(int rc);
 
 // helper.c
@@ -101,9 +289,31 @@ void ExitIfFailure(HRESULT rc, const char *msg, const char *path, int line);
 char * TimeNow(void);
 void DEBUG(char *msg);
 char * NewString(int size);
+int RunCmd(const char *cmd);
+PRUint64 HashFNV(PRUint64 h, const void *data, size_t size);
+void PrintJSONString(FILE *fp, const char *str);
+
+// utf.c
+size_t Utf16Len(CBSTR str);
+size_t Utf16To8(CBSTR str, char *buf, size_t size);
+char * NewUtf8(CBSTR str);
+char * Scratch8(CBSTR str);
+void ScratchReset(void);
+
+// trace.c
+void TraceInit(void);
+void TraceBegin(const char *name);
+void TraceBeginDetail(const char *name, const char *detail);
+void TraceEnd(void);
+int TraceDepth(void);
+void TraceUnwind(int depth);
+void TraceTerm(void);
 
 // vmlist.c
-void PrintVMList(void);
+void vmList(int argc, char *argv[]);
+void PrintVMList(VMSnap *snap);
+void PrintVMListJSON(VMSnap *snap);
+void PrintVMListCSV(VMSnap *snap);
 void UpdateVMList(void);
 void FreeVMList(void);
 IMachine * GetVM(char *name);
@@ -111,6 +321,49 @@ PRUint32 VMState(IMachine *vm);
 char * GetVMName(IMachine *vm);
 char * GetVMProp(IMachine *vm, char *path);
 void SetVMProp(IMachine *vm, char *path, const char *value);
+ULONG GetVMProps(IMachine *vm, char *pattern, char ***names, char ***values);
+void FreeVMProps(char **names, char **values, ULONG count);
+
+// vmprops.c
+void InitPropKeys(void);
+void FreePropKeys(void);
+BSTR PropKey(const char *path);
+void GetVMPropValues(IMachine *vm, const char *paths[], char *values[], int count);
+
+// vmsnap.c
+VMSnap * NewVMSnap(ULONG count);
+VMSnap * TakeVMSnap(void);
+void FreeVMSnap(VMSnap *s);
+
+// vminv.c
+void vmInv(int argc, char *argv[]);
+bool InvLive(void);
+void InvStale(void);
+VMSnap * InvSnap(void);
+bool InvFindId(const char *name, char *uuid);
+int InvUsedIP(const char *ip, const char *vmName);
+void WatchInventory(void);
+
+// events.c
+IEventListener * ListenEvents(IEventSource **source, PRUint32 *types, ULONG count);
+IEvent * NextEvent(IEventSource *source, IEventListener *listener, PRInt32 timeout);
+void DoneEvent(IEventSource *source, IEventListener *listener, IEvent *event);
+void StopEvents(IEventSource *source, IEventListener *listener);
+void EventMachineId(IEvent *event, char *id, int size);
+
+// vmwatch.c
+void vmWatch(int argc, char *argv[]);
+
+// vmtop.c
+void vmTop(int argc, char *argv[]);
+
+// vmtxn.c
+VMTxn * BeginVMTxn(IMachine *vm);
+VMTxn * BeginLiveVMTxn(IMachine *vm);
+void TxnSetProp(VMTxn *txn, const char *path, const char *value);
+char * TxnGetProp(VMTxn *txn, const char *path);
+bool CommitVMTxn(VMTxn *txn);
+void AbortVMTxn(VMTxn *txn);
 
 // iplib.c
 char * NextUniqueIP(const char *ip);
@@ -134,6 +387,34 @@ int SSHVM(IMachine *vm, char *cmd, bool verbose);
 bool SSHPortOpen(char *ip);
 int SCPVM(char *srcPath, char *vmName, char *dstPath, bool verbose);
 
+// guestctl.c
+int GuestRunVM(IMachine *vm, char *cmd, bool verbose);
+int GuestCopyToVM(IMachine *vm, char *srcPath, char *dstPath, bool verbose);
+bool GuestReady(IMachine *vm);
+bool ValidTransport(const char *transport);
+char * VMTransport(IMachine *vm);
+int RunVM(IMachine *vm, char *cmd, bool verbose);
+int CopyToVM(IMachine *vm, char *srcPath, char *dstPath, bool verbose);
+bool WaitVMTransport(IMachine *vm, char *ip, int secs);
+bool SetVMTransport(IMachine *vm, const char *transport);
+bool UseGuestTransport(IMachine *vm);
+
+// vmsync.c
+void vmSync(int argc, char *argv[]);
+int SyncToVM(IMachine *vm, char *srcPath, char *dstPath, bool force, bool verbose);
+void DropSyncManifest(IMachine *vm);
+
+// vmshare.c
+void vmShare(int argc, char *argv[]);
+bool ParseShare(const char *spec, VMShare *share);
+bool VMHasShare(IMachine *vm, VMShare *share);
+bool TxnAddShare(VMTxn *txn, VMShare *share);
+int MissingVMShares(IMachine *vm, const char *specs);
+bool AddVMShares(IMachine *vm, const char *specs);
+bool AddVMTransientShare(IMachine *vm, VMShare *share);
+bool DelVMShare(IMachine *vm, const char *name);
+void PrintVMShares(IMachine *vm);
+
 // vmstop.c
 void vmStop(int argc, char *argv[]);
 bool StopVM(IMachine *vm);
@@ -152,10 +433,13 @@ int PrintGAProperties(IMachine *vm);
 // nettype.c
 void netType(int argc, char *argv[]);
 bool SetVMNetType(IMachine *vm, char *nettype);
+bool TxnSetNetType(VMTxn *txn, char *nettype);
 
 // vmcreate.c
 void vmCreate(int argc, char *argv[]);
-IMachine * CreateVM(char *vmName, char *imgFile);
+IMachine * CreateVM(char *vmName, char *imgFile, const char *profile);
+bool ValidProfile(const char *profile);
+bool TxnSetFastProfile(VMTxn *txn);
 BSTR * GetWarningsList(IAppliance *appliance, ULONG *Count);
 IVirtualSystemDescription ** GetSysVSDList(IAppliance *appliance, ULONG *Count);
 void GetVSDArrays(IVirtualSystemDescription *sysDesc, ULONG *Count, ULONG **List1,
@@ -166,19 +450,83 @@ void UpdateVSDArrays(IVirtualSystemDescription *sysDesc, ULONG Count,
 // vmprov.c
 void vmProv(int argc, char *argv[]);
 void CreateVMConf(void);
-void ProvisionConfig(char *provFile);
+void PlanConfig(char *provFile);
+void ProvisionConfig(char *provFile, bool force, bool resume);
+void ProvisionDown(char *provFile, bool force, bool hard);
+VMPlan * BuildProvPlan(char *provFile, int *count, HostCap *cap);
+void ReadVMPlanState(VMPlan *p);
+void PrintProvPlan(VMPlan *plan, int count);
+void ResumeProvPlan(VMPlan *plan, int count);
+bool ApplyVMPlan(VMPlan *p);
+bool ProvisionSteps(VMPlan *p, bool force);
+
+// vmlogs.c
+void vmLogs(int argc, char *argv[]);
+void BeginVMLog(const char *vmName);
+void CaptureVMLog(const char *step);
+void ReleaseVMLog(bool ok);
+void EndVMLog(void);
+
+// vmjournal.c
+bool OpenProvJournal(char *provFile, bool resume);
+bool ProvJournalHas(const char *vmName, const char *step);
+void ProvJournalMark(const char *vmName, const char *step);
+void CloseProvJournal(bool finished);
+
+// hostcap.c
+void InitHostCap(HostCap *cap, ini_t *cfg);
+bool AdmitProvPlan(HostCap *cap, VMPlan *plan, int count);
+void PrintHostCap(HostCap *cap, VMPlan *plan, int count);
+bool WaitHostCap(HostCap *cap, VMPlan *plan, int count, VMPlan *p);
+
+// vmdensity.c
+void vmDensity(int argc, char *argv[]);
+bool SetVMBalloon(IMachine *vm, ULONG size);
+bool TxnSetBalloon(VMTxn *txn, ULONG size);
+bool TxnSetPageFusion(VMTxn *txn, bool enabled);
 
 // vmstart.c
 void vmStart(int argc, char *argv[]);
 bool StartVM(IMachine *vm, char *option);
+int StartVMs(IMachine **vms, int count, char *option);
+
+// vmsuspend.c
+void vmSuspend(int argc, char *argv[]);
+void vmResume(int argc, char *argv[]);
+int SuspendVMs(IMachine **vms, int count);
+bool DiscardVMState(IMachine *vm);
+
+// vmsnapshot.c
+void vmSnapshot(int argc, char *argv[]);
+void vmReset(int argc, char *argv[]);
+ISnapshot * FindVMSnapshot(IMachine *vm, const char *snapName);
+bool TakeVMSnapshot(IMachine *vm, const char *snapName);
+bool ResetVM(IMachine *vm, const char *snapName);
+void PrintVMSnapshots(IMachine *vm);
+
+// vmdel.c
+IMachine ** MatchVMs(int argc, char *argv[], int *count);
+bool ConfirmDeleteVMs(IMachine **vms, int count);
+int DeleteVMs(IMachine **vms, int count, bool hard, PRInt64 *freed);
 
 // vmmod.c
 void vmMod(int argc, char *argv[]);
 bool ModVM(IMachine *vm, char *cpuCount, char *memSize);
+bool TxnSetCPUMem(VMTxn *txn, ULONG cpus, ULONG memory);
+bool ModVMLive(IMachine *vm, ULONG cpucap, const char *priority);
+bool TxnSetCPUCap(VMTxn *txn, ULONG cpucap);
+bool TxnSetPriority(VMTxn *txn, const char *priority);
+const char * PriorityName(PRUint32 priority);
 
 // vmip.c
 void vmIP(int argc, char *argv[]);
 bool SetVMIP(IMachine *vm, char *ip);
+bool TxnSetIP(VMTxn *txn, char *ip);
+
+// imgstore.c
+bool ImageDigest(const char *path, char *digest);
+void StoreImage(const char *imgName, const char *digest);
+void UnstoreImage(const char *imgName);
 
 // Own .c file
 void PrintUsage(void);
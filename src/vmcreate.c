@@ -5,13 +5,14 @@
 // Create VM
 void vmCreate(int argc, char *argv[])
 {
-    char vmName[64] = "", image[256] = "";
-    if (argc == 2) {
+    char vmName[64] = "", image[256] = "", profile[8] = "default";
+    if (argc == 2 || argc == 3) {
         argCopy(vmName, 64, argv[0]);
         argCopy(image, 256, argv[1]);
+        if (argc == 3) { argCopy(profile, 8, argv[2]); }
     }
-    else {
-        printf("Usage: %s create <vmName> <[ovaFile|imgName]>\n", prgname);
+    if (!vmName[0] || !ValidProfile(profile)) {
+        printf("Usage: %s create <vmName> <[ovaFile|imgName]> [fast]\n", prgname);
         Exit(EXIT_FAILURE);
     }
 
@@ -44,19 +45,39 @@ void vmCreate(int argc, char *argv[])
     }
 
     // Create the VM
-    vm = CreateVM(vmName, imgFile);
+    vm = CreateVM(vmName, imgFile, profile);
 
     Exit(EXIT_SUCCESS);
 }
 
 
-// Create VM with validated vmName and imgFile path arguments
-IMachine * CreateVM(char *vmName, char *imgFile)
+// Queue the settings every new VM gets: disk-only boot order, HostOnly
+// networking and given IP
+static void createDefaults(VMTxn *txn, const char *vmName, char *ip)
+{
+    // Ensure disk1 is the only bootable device on this VM
+    IMachine_SetBootOrder(txn->vmMuta, 1, DeviceType_HardDisk);
+    IMachine_SetBootOrder(txn->vmMuta, 2, DeviceType_Null);
+    // We don't bother with order 3, 4 or others, since they are hardly used
+    txn->dirty = true;
+
+    // Some default network settings
+    TxnSetNetType(txn, "ho");
+
+    if (!TxnSetIP(txn, ip)) {   // Set IP on new VM
+        fprintf(stderr, "Error setting IP '%s' on VM '%s'\n", ip, vmName);
+    }
+}
+
+
+// Create VM with validated vmName, imgFile path and hardware profile arguments
+IMachine * CreateVM(char *vmName, char *imgFile, const char *profile)
 {
     // FIRST, inspect the OVA before we import/create the new VM
     
     // Create an empty IAppliance object
     IAppliance *appliance = NULL;
+    TraceBegin("IVirtualBox_CreateAppliance");
     HRESULT rc = IVirtualBox_CreateAppliance(vbox, &appliance);
     ExitIfFailure(rc, "IVirtualBox_CreateAppliance", __FILE__, __LINE__);    
 
@@ -64,12 +85,14 @@ IMachine * CreateVM(char *vmName, char *imgFile)
     BSTR imgFile_16;
     Convert8to16(imgFile, &imgFile_16);  // Convert imgFile path to API UTF16
     IProgress *progress = NULL;
+    TraceBegin("IAppliance_Read");
     rc = IAppliance_Read(appliance, imgFile_16, &progress);
     ExitIfFailure(rc, "IAppliance_Read", __FILE__, __LINE__);    
     FreeBSTR(imgFile_16);
     HandleProgress(progress, rc, -1);  // Note, rc is used here
 
     // Populate the VirtualSystemDescriptions object within the appliance object
+    TraceBegin("IAppliance_Interpret");
     rc = IAppliance_Interpret(appliance);
     ExitIfFailure(rc, "IAppliance_Interpret", __FILE__, __LINE__);
 
@@ -136,6 +159,7 @@ IMachine * CreateVM(char *vmName, char *imgFile)
 
     // Before we even get started, let's remove any HardDiskControllerIDE types,
     // since we never use those for development VMs, just SATA ones.
+    TraceBegin("IVirtualSystemDescription_RemoveDescriptionByType");
     rc = IVirtualSystemDescription_RemoveDescriptionByType(sysVSDList[0],
         VirtualSystemDescriptionType_HardDiskControllerIDE);
     ExitIfFailure(rc, "IVirtualSystemDescription_RemoveDescriptionByType", __FILE__, __LINE__);
@@ -249,22 +273,22 @@ IMachine * CreateVM(char *vmName, char *imgFile)
         Exit(EXIT_FAILURE);
     }
 
-    // Ensure disk1 is the only bootable device on this VM
-    IMachine *vmMuta = NULL;
-    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
-    IMachine_SetBootOrder(vmMuta, 1, DeviceType_HardDisk);
-    IMachine_SetBootOrder(vmMuta, 2, DeviceType_Null);
-    // We don't bother with order 3, 4 or others, since they are hardly used
-    
-    // Some default network settings
-    SetVMProp(vmMuta, "/vm/nettype", "ho");
-
-    CloseSession(session);
-
-    // Finally, let's make sure VM is set up with next unique IP address
+    // Make sure VM is set up with next unique IP address
     char *ip = NextUniqueIP(vmdefip);
 
-    SetVMIP(vm, ip);   // Set IP on new VM
+    // Do all follow-up settings in one transaction, so they are saved only once
+    VMTxn *txn = BeginVMTxn(vm);
+    createDefaults(txn, vmName, ip);
+    if (Equal(profile, "fast") && !TxnSetFastProfile(txn)) {
+        // The profile may have stopped halfway, e.g. with the boot disk detached.
+        // Discard everything queued, and redo only the defaults
+        fprintf(stderr, "Error applying fast profile to VM '%s'. Creating it with the "
+            "default profile instead\n", vmName);
+        AbortVMTxn(txn);
+        txn = BeginVMTxn(vm);
+        createDefaults(txn, vmName, ip);
+    }
+    CommitVMTxn(txn);
 
     // Free memory
     free(ip);
@@ -290,12 +314,139 @@ IMachine * CreateVM(char *vmName, char *imgFile)
 }
 
 
+// Hardware profiles a VM can be created with
+bool ValidProfile(const char *profile)
+{
+    return Equal(profile, "default") || Equal(profile, "fast");
+}
+
+
+// Move the VM's boot disk to a new virtio-scsi controller using the host I/O
+// cache, and remove the controller it came on if nothing else is left on it
+static bool fastDiskController(IMachine *vm)
+{
+    ULONG maCount = 0;
+    IMediumAttachment **maList = GetMAList(vm, &maCount);
+    IMedium *disk = NULL;
+    char *ctlName = NULL;
+    PRInt32 port = 0, device = 0;
+    int others = 0;   // Other devices on the disk's controller
+    for (int i = 0; i < maCount; ++i) {
+        ULONG type = 0;
+        IMediumAttachment_GetType(maList[i], &type);
+        BSTR name_16 = NULL;
+        IMediumAttachment_GetController(maList[i], &name_16);
+        char *name = NULL;
+        Convert16to8(name_16, &name);
+        FreeBSTR(name_16);
+        if (type == DeviceType_HardDisk && !disk) {
+            IMediumAttachment_GetMedium(maList[i], &disk);
+            IMediumAttachment_GetPort(maList[i], &port);
+            IMediumAttachment_GetDevice(maList[i], &device);
+            ctlName = name;
+            continue;
+        }
+        if (ctlName && Equal(name, ctlName)) { others++; }
+        free(name);
+    }
+    for (int i = 0; i < maCount; ++i) {
+        if (maList[i]) { IMediumAttachment_Release(maList[i]); }
+    }
+    if (maList) { ArrayOutFree(maList); }
+    if (!disk) { return true; }   // Diskless VM, nothing to move
+    if (Equal(ctlName, FAST_DISKCTL)) {
+        free(ctlName);
+        IMedium_Release(disk);
+        return true;
+    }
+
+    BSTR ctlName_16, fastName_16;
+    Convert8to16(ctlName, &ctlName_16);
+    Convert8to16(FAST_DISKCTL, &fastName_16);
+    IStorageController *ctl = NULL;
+    const char *step = "IMachine_AddStorageController";
+    TraceBegin("fastDiskController");
+    HRESULT rc = IMachine_AddStorageController(vm, fastName_16, StorageBus_VirtioSCSI, &ctl);
+    if (SUCCEEDED(rc)) {
+        step = "IStorageController_SetUseHostIOCache";
+        rc = IStorageController_SetUseHostIOCache(ctl, TRUE);
+        IStorageController_Release(ctl);
+    }
+    if (SUCCEEDED(rc)) {
+        step = "IMachine_DetachDevice";
+        rc = IMachine_DetachDevice(vm, ctlName_16, port, device);
+    }
+    if (SUCCEEDED(rc)) {
+        step = "IMachine_AttachDevice";
+        rc = IMachine_AttachDevice(vm, fastName_16, 0, 0, DeviceType_HardDisk, disk);
+    }
+    if (SUCCEEDED(rc) && !others) {
+        step = "IMachine_RemoveStorageController";
+        rc = IMachine_RemoveStorageController(vm, ctlName_16);
+    }
+    TraceEnd();
+    FreeBSTR(ctlName_16);
+    FreeBSTR(fastName_16);
+    free(ctlName);
+    IMedium_Release(disk);
+
+    if (FAILED(rc)) {
+        fprintf(stderr, "%s:%d %s error\n", __FILE__, __LINE__, step);
+        PrintVBoxException();
+        return false;
+    }
+    return true;
+}
+
+
+// Fast-boot profile, for Linux guests: KVM paravirtualization, no BIOS logo
+// nor boot menu wait, I/O APIC, no VRDE server, and the boot disk on a
+// virtio-scsi controller that goes through the host I/O cache
+bool TxnSetFastProfile(VMTxn *txn)
+{
+    IMachine *vm = txn->vmMuta;
+    const char *step = "IMachine_SetParavirtProvider";
+    TraceBegin("TxnSetFastProfile");
+    HRESULT rc = IMachine_SetParavirtProvider(vm, ParavirtProvider_KVM);
+
+    IBIOSSettings *bios = NULL;
+    if (SUCCEEDED(rc)) { step = "IMachine_GetBIOSSettings"; rc = IMachine_GetBIOSSettings(vm, &bios); }
+    if (SUCCEEDED(rc)) {
+        step = "IBIOSSettings";
+        rc = IBIOSSettings_SetLogoFadeIn(bios, FALSE);
+        if (SUCCEEDED(rc)) { rc = IBIOSSettings_SetLogoFadeOut(bios, FALSE); }
+        if (SUCCEEDED(rc)) { rc = IBIOSSettings_SetLogoDisplayTime(bios, 0); }
+        if (SUCCEEDED(rc)) { rc = IBIOSSettings_SetBootMenuMode(bios, BIOSBootMenuMode_Disabled); }
+        if (SUCCEEDED(rc)) { rc = IBIOSSettings_SetIOAPICEnabled(bios, TRUE); }
+        IBIOSSettings_Release(bios);
+    }
+
+    IVRDEServer *vrde = NULL;
+    if (SUCCEEDED(rc)) { step = "IMachine_GetVRDEServer"; rc = IMachine_GetVRDEServer(vm, &vrde); }
+    if (SUCCEEDED(rc)) {
+        step = "IVRDEServer_SetEnabled";
+        rc = IVRDEServer_SetEnabled(vrde, FALSE);
+        IVRDEServer_Release(vrde);
+    }
+    TraceEnd();
+    txn->dirty = true;
+
+    if (FAILED(rc)) {
+        fprintf(stderr, "%s:%d %s error\n", __FILE__, __LINE__, step);
+        PrintVBoxException();
+        return false;
+    }
+    return fastDiskController(vm);
+}
+
+
 // Get list of warning messages from OVA interpretation appliance
 BSTR * GetWarningsList(IAppliance *appliance, ULONG *Count)
 {
     // Temp safe array to get list of these objects
     SAFEARRAY *SA = SAOutParamAlloc();
 
+    TraceBegin("IAppliance_GetWarnings");
     HRESULT rc = IAppliance_GetWarnings(appliance,
         ComSafeArrayAsOutIfaceParam(SA, PRUnichar *));
     ExitIfFailure(rc, "IAppliance_GetWarnings", __FILE__, __LINE__);    
@@ -316,6 +467,7 @@ IVirtualSystemDescription ** GetSysVSDList(IAppliance *appliance, ULONG *Count)
     // Temp safe array to get list of these objects
     SAFEARRAY *SA = SAOutParamAlloc();
 
+    TraceBegin("IAppliance_GetVirtualSystemDescriptions");
     HRESULT rc = IAppliance_GetVirtualSystemDescriptions(appliance,
         ComSafeArrayAsOutIfaceParam(SA, IVirtualSystemDescription *));
     ExitIfFailure(rc, "IAppliance_GetVirtualSystemDescriptions", __FILE__, __LINE__);   
@@ -345,6 +497,7 @@ void GetVSDArrays(IVirtualSystemDescription *sysDesc, ULONG *Count, ULONG **List
     IVirtualSystemDescription_GetCount(sysDesc, Count);
 
     // Get the the 5 description entries, store them in the each SA. See page 383/4 in SDK
+    TraceBegin("IVirtualSystemDescription_GetDescription");
     HRESULT rc = IVirtualSystemDescription_GetDescription(sysDesc,
         ComSafeArrayAsOutIfaceParam(SA1, ULONG),
         ComSafeArrayAsOutIfaceParam(SA2, BSTR),
@@ -398,6 +551,7 @@ void UpdateVSDArrays(IVirtualSystemDescription *sysDesc, ULONG Count,
     SACopyInParamHelper(SA3, List3, Size3);
 
     // Call setFinalValues to register update VSD values for this VM
+    TraceBegin("IVirtualSystemDescription_SetFinalValues");
     HRESULT rc = IVirtualSystemDescription_SetFinalValues(sysDesc,
         ComSafeArrayAsInParam(SA1),
         ComSafeArrayAsInParam(SA2),
@@ -1,43 +1,208 @@
 // vmdel.c
 
+#define _DEFAULT_SOURCE   // usleep under -std=c99
+
 #include "vmc.h"
 
-// Manually set VM IP address
+// Deleting VMs, any number at once. They can be named outright or with shell
+// wildcard patterns. All running ones are shut down together, with an ACPI
+// power button press, and whatever is still running after DEL_STOPWAIT
+// seconds is powered off. Their configurations and disks are then deleted in
+// parallel, DEL_POOL at a time, since each delete is mostly disk I/O.
+
+
+// Delete VMs
 void vmDelete(int argc, char *argv[])
 {
-    char vmName[64] = "", option[2] = "n";
-    if (argc == 2 && strlen(argv[1]) == 1) {
-        argCopy(vmName, 64, argv[0]);
-        argCopy(option, 1, argv[1]);
-    }
-    else if (argc == 1) {
-        argCopy(vmName, 64, argv[0]);
+    // Trailing single letter options: f = no confirmation, h = hard power off
+    bool force = false, hard = false;
+    while (argc > 1 && (Equal(argv[argc - 1], "f") || Equal(argv[argc - 1], "h"))) {
+        if (Equal(argv[argc - 1], "f")) { force = true; }
+        else { hard = true; }
+        argc--;
     }
-    else {
-        printf("Usage: %s del <vmName> [f]\n", prgname);
+    if (argc < 1) {
+        printf("Usage: %s del <vmName|glob ...> [f] [h]\n", prgname);
         Exit(EXIT_FAILURE);
     }
 
+    int count = 0;
+    IMachine **vms = MatchVMs(argc, argv, &count);
+    if (count == 0) {
+        printf("No VMs match\n");
+        Exit(EXIT_SUCCESS);
+    }
+
     // Get explicit confirmation
-    if (!Equal(option, "f")) {       
-        char response;
-        printf("Destroy VM '%s'? y/n ", vmName);
-        scanf("%c", &response);
-        if (response != 'y') { Exit(EXIT_SUCCESS); }
+    if (!force && !ConfirmDeleteVMs(vms, count)) { Exit(EXIT_SUCCESS); }
+
+    PRInt64 freed = 0;
+    int deleted = DeleteVMs(vms, count, hard, &freed);
+    free(vms);
+    printf("Deleted %d of %d VM(s), freeing %lldMB of disk space\n",
+        deleted, count, (long long)(freed / (1024 * 1024)));
+    Exit(deleted == count ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+// Registered VMs with given names, or with names matching given wildcard
+// patterns. Exits if a plain name isn't registered. Each VM is listed once
+// REMINDER: Caller must free allocated memory
+IMachine ** MatchVMs(int argc, char *argv[], int *count)
+{
+    *count = 0;
+    if (!VMListCount) { UpdateVMList(); }
+    IMachine **vms = calloc(VMListCount + 1, sizeof(IMachine *));
+    ExitIfNull(vms, __FILE__, __LINE__);
+    VMSnap *s = NULL;
+
+    for (int i = 0; i < argc; ++i) {
+        char vmName[64] = "";
+        argCopy(vmName, 64, argv[i]);
+        if (!strpbrk(vmName, "*?[")) {
+            IMachine *vm = GetVM(vmName);
+            if (!vm) {
+                printf("VM '%s' is not registered\n", vmName);
+                Exit(EXIT_FAILURE);
+            }
+            bool listed = false;
+            for (int j = 0; j < *count; ++j) { listed = listed || vms[j] == vm; }
+            if (!listed) { vms[(*count)++] = vm; }
+            continue;
+        }
+
+        // Names of all VMs are only needed once there's a pattern
+        if (!s) { s = TakeVMSnap(); }
+        for (ULONG k = 0; k < s->count; ++k) {
+            if (!s->accessible[k] || fnmatch(vmName, s->name[k], 0) != 0) { continue; }
+            bool listed = false;
+            for (int j = 0; j < *count; ++j) { listed = listed || vms[j] == s->vm[k]; }
+            if (!listed) { vms[(*count)++] = s->vm[k]; }
+        }
     }
+    FreeVMSnap(s);
+    return vms;
+}
 
-    // Get VM object
-    IMachine *vm = GetVM(vmName);
-    if (!vm) {
-        printf("VM '%s' is not registered\n", vmName);
-        Exit(EXIT_FAILURE);
+
+// Ask to go ahead with deleting given VMs
+bool ConfirmDeleteVMs(IMachine **vms, int count)
+{
+    if (count == 1) {
+        char *name = GetVMName(vms[0]);
+        printf("Destroy VM '%s'? y/n ", name);
+        free(name);
+    }
+    else {
+        printf("Destroy these %d VMs?", count);
+        for (int i = 0; i < count; ++i) {
+            char *name = GetVMName(vms[i]);
+            printf(" %s", name);
+            free(name);
+        }
+        printf("\ny/n ");
+    }
+    char response;
+    scanf("%c", &response);
+    return response == 'y';
+}
+
+
+// Power off every given VM that's online, all at the same time. Unless hard is
+// set, they first get an ACPI power button press and DEL_STOPWAIT seconds to
+// shut down by themselves. Returns false if any is still online
+static bool delPowerOff(IMachine **vms, int count, bool hard)
+{
+    ISession **sessions = calloc(count + 1, sizeof(ISession *));
+    IProgress **progress = calloc(count + 1, sizeof(IProgress *));
+    HRESULT *rcs = calloc(count + 1, sizeof(HRESULT));
+    ExitIfNull(sessions, __FILE__, __LINE__);
+    ExitIfNull(progress, __FILE__, __LINE__);
+    ExitIfNull(rcs, __FILE__, __LINE__);
+
+    TraceBegin("delPowerOff");
+    int online = 0;
+    for (int i = 0; i < count; ++i) {
+        PRUint32 state = VMState(vms[i]);
+        if (state < MachineState_FirstOnline || state > MachineState_LastOnline) { continue; }
+        online++;
+        if (hard) { continue; }
+        IMachine *vmMuta = NULL;
+        ISession *session = GetSession(vms[i], LockType_Shared, &vmMuta);
+        IConsole *console = NULL;
+        ISession_GetConsole(session, &console);
+        TraceBegin("IConsole_PowerButton");
+        IConsole_PowerButton(console);
+        TraceEnd();
+        CloseSession(session);
+    }
+    if (!online) {
+        TraceEnd();
+        free(sessions);
+        free(progress);
+        free(rcs);
+        return true;
     }
 
-    // Stop it if it is running
-    if (VMState(vm) == MachineState_Running) { StopVM(vm); }
+    // Poll them all, so each finished one takes no more waiting
+    for (int ticks = hard ? 0 : DEL_STOPWAIT * 4; ticks > 0; --ticks) {
+        int left = 0;
+        for (int i = 0; i < count; ++i) {
+            PRUint32 state = VMState(vms[i]);
+            if (state >= MachineState_FirstOnline && state <= MachineState_LastOnline) { left++; }
+        }
+        if (!left) { break; }
+        usleep(250000);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        PRUint32 state = VMState(vms[i]);
+        if (state < MachineState_FirstOnline || state > MachineState_LastOnline) { continue; }
+        IMachine *vmMuta = NULL;
+        sessions[i] = GetSession(vms[i], LockType_Shared, &vmMuta);
+        IConsole *console = NULL;
+        ISession_GetConsole(sessions[i], &console);
+        TraceBegin("IConsole_PowerDown");
+        rcs[i] = IConsole_PowerDown(console, &progress[i]);
+        TraceEnd();
+    }
+    bool ok = true;
+    for (int i = 0; i < count; ++i) {
+        if (!sessions[i]) { continue; }
+        HandleProgress(progress[i], rcs[i], -1);
+        CloseSession(sessions[i]);
+    }
+
+    // A VM's own session lets go of it a moment after it's powered off, and
+    // it can't be unregistered until then
+    for (int i = 0; i < count; ++i) {
+        PRUint32 sessionState = SessionState_Locked;
+        for (int ticks = DEL_STOPWAIT * 4; ticks > 0; --ticks) {
+            IMachine_GetSessionState(vms[i], &sessionState);
+            if (sessionState == SessionState_Unlocked) { break; }
+            usleep(250000);
+        }
+        PRUint32 state = VMState(vms[i]);
+        ok = ok && (state < MachineState_FirstOnline || state > MachineState_LastOnline);
+    }
+    TraceEnd();
+
+    free(sessions);
+    free(progress);
+    free(rcs);
+    return ok;
+}
+
+
+// Unregister VM and start deleting its configuration and disks. Sets *size
+// to the size of its disks. Returns NULL if it couldn't be started
+static IProgress * delStart(IMachine *vm, PRInt64 *size)
+{
+    DropSyncManifest(vm);
 
     // Unregister machine and get the list of media attached to it
     SAFEARRAY *SA = SAOutParamAlloc();  // Temp safe array to hold media list
+    TraceBegin("IMachine_Unregister");
     HRESULT rc = IMachine_Unregister(vm,
         CleanupMode_DetachAllReturnHardDisksOnly,
         // 0 = CleanupMode_UnregisterOnly
@@ -45,20 +210,96 @@ void vmDelete(int argc, char *argv[])
         // 3 = CleanupMode_DetachAllReturnHardDisksOnly
         // 4 = CleanupMode_Full
         ComSafeArrayAsOutIfaceParam(SA, IMedium *));
-    ExitIfFailure(rc, "IMachine_Unregister", __FILE__, __LINE__);  
+    TraceEnd();
+    if (FAILED(rc)) {
+        PrintVBoxException();
+        SADestroy(SA);
+        return NULL;
+    }
+    IMedium **media = NULL;
+    ULONG mediaCount = 0;
+    SACopyOutIfaceParamHelper((IUnknown ***)&media, &mediaCount, SA);
+    SADestroy(SA);
+
+    // What's freed is what the disks actually take up, not their logical size
+    PRInt64 mediaSize = 0;
+    for (ULONG i = 0; i < mediaCount; ++i) {
+        PRInt64 mediumSize = 0;
+        IMedium_GetSize(media[i], &mediumSize);
+        mediaSize += mediumSize;
+    }
+
+    // Delete VM configuration, handing the media list back in
+    SA = SACreateVector(VT_UNKNOWN, 0, mediaCount);
+    if (mediaCount) { SACopyInParamHelper(SA, media, mediaCount * sizeof(IMedium *)); }
+    IProgress *progress = NULL;
+    TraceBegin("IMachine_DeleteConfig");
+    rc = IMachine_DeleteConfig(vm, ComSafeArrayAsInParam(SA), &progress);
+    TraceEnd();
+    SADestroy(SA);
+    if (media) { ArrayOutFree(media); }
+    if (FAILED(rc)) {
+        PrintVBoxException();
+        return NULL;
+    }
+    *size = mediaSize;
+    return progress;
+}
+
+
+// Wait for a delete to finish, and release it. Unlike HandleProgress, the
+// result decides the return code
+static bool delWait(IProgress *progress)
+{
+    LONG resultCode = S_OK;
+    IProgress_WaitForCompletion(progress, -1);
+    IProgress_GetResultCode(progress, &resultCode);
+    if (FAILED(resultCode)) {
+        char *text = GetProgressError(progress);
+        fprintf(stderr, "%s\n", text);
+        free(text);
+    }
+    IProgress_Release(progress);
+    return SUCCEEDED(resultCode);
+}
+
 
-    // Delete VM configuration, using returned media list SafeArray
-    IProgress *progress;
-    rc = IMachine_DeleteConfig(vm,
-        ComSafeArrayAsInParam(SA),
-        &progress);
-    HandleProgress(progress, rc, -1);
-    // Timeout of -1 means wait indefinitely
+// Delete given VMs, with their disks. Online ones are powered off first, all
+// at once, with a hard power off right away if hard is set. The deletes then
+// run DEL_POOL at a time. Returns how many were deleted, and adds the disk
+// space they freed, in bytes, to *freed
+int DeleteVMs(IMachine **vms, int count, bool hard, PRInt64 *freed)
+{
+    if (!delPowerOff(vms, count, hard)) {
+        fprintf(stderr, "Some VMs could not be powered off, and won't be deleted\n");
+    }
+
+    IProgress **progress = calloc(count + 1, sizeof(IProgress *));
+    PRInt64 *sizes = calloc(count + 1, sizeof(PRInt64));
+    ExitIfNull(progress, __FILE__, __LINE__);
+    ExitIfNull(sizes, __FILE__, __LINE__);
+    TraceBegin("DeleteVMs");
+    int deleted = 0;
+    for (int i = 0; i < count + DEL_POOL; ++i) {
+        // Wait for the oldest delete before the pool takes another one
+        int oldest = i - DEL_POOL;
+        // A VM only counts, with its disks, once its delete has succeeded
+        if (oldest >= 0 && progress[oldest] && delWait(progress[oldest])) {
+            deleted++;
+            *freed += sizes[oldest];
+        }
+        if (i >= count) { continue; }
+        PRUint32 state = VMState(vms[i]);
+        if (state >= MachineState_FirstOnline && state <= MachineState_LastOnline) { continue; }
+        progress[i] = delStart(vms[i], &sizes[i]);
+    }
+    TraceEnd();
+    free(progress);
+    free(sizes);
 
     //BUG
     // Everything works fine when we call this function, but if running, the
     // VirtualBox GUI crashes. Maybe we need to register as De-Registion event?
 
-    SADestroy(SA);
-    Exit(EXIT_SUCCESS);
+    return deleted;
 }
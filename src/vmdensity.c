@@ -0,0 +1,330 @@
+// vmdensity.c
+
+#include "vmc.h"
+
+// Memory density, to fit more VMs in the host's memory. Page fusion has the
+// host share identical memory pages between VMs, and can only be switched on
+// or off while a VM is powered off. A memory balloon inflated inside a running
+// guest hands that much of the guest's memory back to the host, and can be
+// resized at any time. Both need the guest additions. The balloon size a VM is
+// configured with is kept in its '/vm/balloon' guest property, and automatic
+// mode never deflates a balloon below that.
+
+// Memory figures of one running VM, read through a shared lock session
+typedef struct GuestMem {
+    ISession *session;
+    IGuest *guest;
+    ULONG target;            // MB the balloon is set to
+    ULONG balloon;           // MB the guest has actually ballooned
+    ULONG shared;            // MB shared with other VMs by page fusion
+    ULONG idle;              // Percentage of guest CPU time idle
+    bool stats;              // Guest additions are reporting statistics
+} GuestMem;
+
+
+// Release session opened by densityOpen. Unlike CloseSession, there are no
+// settings to save, since IGuest saves a new balloon size itself
+static void densityClose(GuestMem *g)
+{
+    if (g->guest) { IGuest_Release(g->guest); }
+    if (g->session) {
+        ISession_UnlockMachine(g->session);
+        ISession_Release(g->session);
+    }
+    g->guest = NULL;
+    g->session = NULL;
+}
+
+
+// Open shared lock session on running VM, and read its memory figures. Returns
+// false if that's not possible, e.g. if the VM has been stopped meanwhile
+static bool densityOpen(IMachine *vm, GuestMem *g)
+{
+    memset(g, 0, sizeof(*g));
+    TraceBegin("IVirtualBoxClient_GetSession");
+    HRESULT rc = IVirtualBoxClient_GetSession(vboxclient, &g->session);
+    ExitIfFailure(rc, "IVirtualBoxClient_GetSession", __FILE__, __LINE__);
+
+    TraceBegin("IMachine_LockMachine");
+    rc = IMachine_LockMachine(vm, g->session, LockType_Shared);
+    TraceEnd();
+    if (FAILED(rc)) {
+        ISession_Release(g->session);
+        g->session = NULL;
+        return false;
+    }
+    IConsole *console = NULL;
+    ISession_GetConsole(g->session, &console);
+    if (console) {
+        IConsole_GetGuest(console, &g->guest);
+        IConsole_Release(console);
+    }
+    if (!g->guest) {
+        densityClose(g);
+        return false;
+    }
+
+    // Guests only report statistics once they're told how often to
+    ULONG interval = 0;
+    IGuest_GetStatisticsUpdateInterval(g->guest, &interval);
+    if (interval == 0) { IGuest_SetStatisticsUpdateInterval(g->guest, DENSITY_STATSECS); }
+
+    PRUint32 cpuUser = 0, cpuKernel = 0, cpuIdle = 0, memTotal = 0, memFree = 0;
+    PRUint32 memBalloon = 0, memShared = 0, memCache = 0, pagedTotal = 0;
+    PRUint32 allocTotal = 0, freeTotal = 0, balloonTotal = 0, sharedTotal = 0;
+    TraceBegin("IGuest_InternalGetStatistics");
+    rc = IGuest_InternalGetStatistics(g->guest, &cpuUser, &cpuKernel, &cpuIdle,
+        &memTotal, &memFree, &memBalloon, &memShared, &memCache, &pagedTotal,
+        &allocTotal, &freeTotal, &balloonTotal, &sharedTotal);
+    TraceEnd();
+
+    IGuest_GetMemoryBalloonSize(g->guest, &g->target);
+    g->stats = SUCCEEDED(rc) && memTotal > 0;   // All zeros until the first report
+    g->idle = cpuIdle;
+    g->balloon = g->stats ? memBalloon / 1024 : g->target;   // Reported in KB
+    g->shared = memShared / 1024;
+    return true;
+}
+
+
+// Resize balloon of VM opened with densityOpen, in MB
+static bool densityBalloon(GuestMem *g, ULONG size)
+{
+    TraceBegin("IGuest_SetMemoryBalloonSize");
+    HRESULT rc = IGuest_SetMemoryBalloonSize(g->guest, size);
+    TraceEnd();
+    if (SUCCEEDED(rc)) { g->target = size; }
+    return SUCCEEDED(rc);
+}
+
+
+// Configured balloon size of VM, which automatic mode leaves in place
+static ULONG densityFloor(IMachine *vm)
+{
+    char *value = GetVMProp(vm, "/vm/balloon");
+    ULONG size = value ? (ULONG)atoi(value) : 0;
+    if (value) { free(value); }
+    return size;
+}
+
+
+// Print memory reclaimed from every running VM
+static void densityReport(void)
+{
+    VMSnap *s = TakeVMSnap();
+    printf("%-34s%8s%9s%8s%8s%11s%7s\n",
+        "NAME", "MEMORY", "BALLOON", "SHARED", "FUSION", "RECLAIMED", "IDLE%");
+    ULONG total = 0;
+    int running = 0;
+    for (ULONG i = 0; i < s->count; ++i) {
+        if (!s->accessible[i] || s->state[i] != MachineState_Running) { continue; }
+        GuestMem g;
+        if (!densityOpen(s->vm[i], &g)) { continue; }
+        PRBool fusion = FALSE;
+        IMachine_GetPageFusionEnabled(s->vm[i], &fusion);
+        char idle[8] = "-";
+        if (g.stats) { sprintf(idle, "%u", g.idle); }
+        printf("%-34s%8u%9u%8u%8s%11u%7s\n", s->name[i], s->memory[i],
+            g.balloon, g.shared, fusion ? "on" : "off", g.balloon + g.shared, idle);
+        total += g.balloon + g.shared;
+        running++;
+        densityClose(&g);
+    }
+    FreeVMSnap(s);
+
+    PRUint32 avail = 0;
+    TraceBegin("IHost_GetMemoryAvailable");
+    HRESULT rc = IHost_GetMemoryAvailable(ihost, &avail);
+    ExitIfFailure(rc, "IHost_GetMemoryAvailable", __FILE__, __LINE__);
+    printf("=> %uMB reclaimed from %d running VM(s). Host has %uMB available\n",
+        total, running, avail);
+}
+
+
+// Keep at least minFree MB of host memory available, by inflating the balloons
+// of idle VMs a step at a time while it's short, and deflating them again once
+// the VM gets busy or the host has plenty to spare. Runs until interrupted
+static void densityAuto(ULONG minFree, int interval)
+{
+    printf("=> Keeping %uMB of host memory available, checking every %ds. Ctrl-C to stop\n",
+        minFree, interval);
+    while (true) {
+        char *now = TimeNow();
+        PRUint32 avail = 0;
+        TraceBegin("IHost_GetMemoryAvailable");
+        HRESULT rc = IHost_GetMemoryAvailable(ihost, &avail);
+        ExitIfFailure(rc, "IHost_GetMemoryAvailable", __FILE__, __LINE__);
+        long want = (long)minFree - avail;   // Still to reclaim. Negative if there's room to spare
+
+        UpdateVMList();   // Pick up VMs started meanwhile
+        VMSnap *s = TakeVMSnap();
+        ULONG total = 0;
+        int running = 0;
+        for (ULONG i = 0; i < s->count; ++i) {
+            if (!s->accessible[i] || s->state[i] != MachineState_Running) { continue; }
+            GuestMem g;
+            if (!densityOpen(s->vm[i], &g)) { continue; }
+
+            ULONG floor = densityFloor(s->vm[i]);
+            ULONG step = s->memory[i] / DENSITY_STEP;
+            ULONG most = s->memory[i] * DENSITY_MAXPCT / 100;
+            if (most < floor) { most = floor; }
+            bool idle = g.stats && g.idle >= DENSITY_IDLE;
+
+            ULONG size = g.target;
+            const char *why = NULL;
+            if (want > 0 && idle && size < most) {
+                size = size + step < most ? size + step : most;
+                want -= size - g.target;
+                why = "idle";
+            }
+            else if (size > floor && want < 0 && (!idle || want < -(long)minFree)) {
+                size = size > floor + step ? size - step : floor;
+                want += g.target - size;
+                why = idle ? "host has room" : "busy";
+            }
+            if (why) {
+                ULONG old = g.target;
+                if (densityBalloon(&g, size)) {
+                    printf("%s [%s] Balloon %uMB -> %uMB (%s)\n", now,
+                        s->name[i], old, size, why);
+                }
+            }
+            total += g.balloon + g.shared;
+            running++;
+            densityClose(&g);
+        }
+        FreeVMSnap(s);
+
+        printf("%s Host has %uMB available. %uMB reclaimed from %d running VM(s)\n",
+            now, avail, total, running);
+        fflush(stdout);
+        free(now);
+        sleep(interval);
+    }
+}
+
+
+// Show or manage memory density of VMs
+void vmDensity(int argc, char *argv[])
+{
+    if (argc == 0) {
+        densityReport();
+        Exit(EXIT_SUCCESS);
+    }
+
+    if (Equal(argv[0], "auto") && argc <= 3) {
+        ULONG minFree = argc > 1 ? (ULONG)atoi(argv[1]) : DENSITY_MINFREE;
+        int interval = argc > 2 ? atoi(argv[2]) : DENSITY_INTERVAL;
+        if (minFree < 1 || interval < 1) {
+            printf("Usage: %s density auto [<minFreeMB> [<secs>]]\n", prgname);
+            Exit(EXIT_FAILURE);
+        }
+        densityAuto(minFree, interval);
+        Exit(EXIT_SUCCESS);
+    }
+
+    char vmName[64] = "", value[8] = "";
+    if (argc == 2) {
+        argCopy(vmName, 64, argv[0]);
+        argCopy(value, 8, argv[1]);
+    }
+    else {
+        printf("Usage: %s density [auto [<minFreeMB> [<secs>]]|<vmName> <balloonMB|on|off>]\n",
+            prgname);
+        Exit(EXIT_FAILURE);
+    }
+
+    IMachine *vm = GetVM(vmName);
+    if (!vm) {
+        printf("VM '%s' is not registered\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+
+    // Page fusion
+    if (Equal(value, "on") || Equal(value, "off")) {
+        if (VMState(vm) == MachineState_Running) {
+            printf("VM '%s' needs to be powered off for this\n", vmName);
+            Exit(EXIT_FAILURE);
+        }
+        VMTxn *txn = BeginVMTxn(vm);
+        if (!TxnSetPageFusion(txn, Equal(value, "on"))) {
+            AbortVMTxn(txn);
+            Exit(EXIT_FAILURE);
+        }
+        Exit(CommitVMTxn(txn) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Balloon size
+    ULONG memory = 0;
+    IMachine_GetMemorySize(vm, &memory);
+    int size = atoi(value);
+    if (!isdigit(value[0]) || size > (int)memory) {
+        printf("Balloon size needs to be a number of MB, up to the VM's %uMB\n", memory);
+        Exit(EXIT_FAILURE);
+    }
+    if (!SetVMBalloon(vm, (ULONG)size)) {
+        fprintf(stderr, "Error setting memory balloon of VM '%s'\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    Exit(EXIT_SUCCESS);
+}
+
+
+// Set configured balloon size of VM in MB. A running VM's balloon is resized
+// right away, while a powered off VM's is inflated when it next starts
+bool SetVMBalloon(IMachine *vm, ULONG size)
+{
+    if (VMState(vm) != MachineState_Running) {
+        VMTxn *txn = BeginVMTxn(vm);
+        if (!TxnSetBalloon(txn, size)) {
+            AbortVMTxn(txn);
+            return false;
+        }
+        return CommitVMTxn(txn);
+    }
+
+    GuestMem g;
+    bool ok = densityOpen(vm, &g) && densityBalloon(&g, size);
+    densityClose(&g);
+    if (ok) {
+        char value[16];
+        sprintf(value, "%u", size);
+        SetVMProp(vm, "/vm/balloon", value);
+    }
+    return ok;
+}
+
+
+// Set configured balloon size of powered off VM within given transaction
+bool TxnSetBalloon(VMTxn *txn, ULONG size)
+{
+    TraceBegin("IMachine_SetMemoryBalloonSize");
+    HRESULT rc = IMachine_SetMemoryBalloonSize(txn->vmMuta, size);
+    TraceEnd();
+    if (FAILED(rc)) { return false; }
+    char value[16];
+    sprintf(value, "%u", size);
+    TxnSetProp(txn, "/vm/balloon", value);
+    txn->dirty = true;
+    return true;
+}
+
+
+// Switch page fusion of powered off VM within given transaction
+bool TxnSetPageFusion(VMTxn *txn, bool enabled)
+{
+    PRBool current = FALSE;
+    IMachine_GetPageFusionEnabled(txn->vmMuta, &current);
+    if (!current == !enabled) { return true; }
+
+    TraceBegin("IMachine_SetPageFusionEnabled");
+    HRESULT rc = IMachine_SetPageFusionEnabled(txn->vmMuta, enabled ? TRUE : FALSE);
+    TraceEnd();
+    if (FAILED(rc)) {
+        fprintf(stderr, "Error setting page fusion. This host may not support it\n");
+        return false;
+    }
+    txn->dirty = true;
+    return true;
+}
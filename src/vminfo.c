@@ -24,11 +24,9 @@ int vmInfo(int argc, char *argv[])
 
     // ID
     BSTR vmID_16 = NULL;
-    char *vmID = NULL;
     IMachine_GetId(vm, &vmID_16);
-    Convert16to8(vmID_16, &vmID);
+    printf("%-40s  %s\n", "ID", Scratch8(vmID_16));
     FreeBSTR(vmID_16);
-    printf("%-40s  %s\n", "ID", vmID);
 
     // Session Status
     PRUint32 sessionState;
@@ -40,6 +38,7 @@ int vmInfo(int argc, char *argv[])
     PrintSharedFolders(vm);       // Shared Folders
     PrintNetworkAdapters(vm);     // Network Adapters
     PrintGAProperties(vm);        // Guest Addition Properties
+    ScratchReset();               // Drop every string printed above
     return 0;
 }
 
@@ -53,8 +52,7 @@ int PrintStorageControllers(IMachine *vm)
 
         BSTR name_16;
         IStorageController_GetName(ctrl, &name_16);
-        char *name;
-        Convert16to8(name_16, &name);
+        char *name = Scratch8(name_16);
         FreeBSTR(name_16);
 
         ULONG bus;
@@ -64,7 +62,6 @@ int PrintStorageControllers(IMachine *vm)
         IStorageController_GetControllerType(ctrl, &type);
 
         printf("%-40s  %-16s: bus=%u type=%s\n", "StorageControllers", name, bus, CtrlType[type]);
-        free(name);
     }
     // Free mem
     for (int i = 0; i < ctlrCount; ++i) {
@@ -81,6 +78,7 @@ IStorageController ** GetCtlrList(IMachine *vm, ULONG *Count)
     // Temp safe array to get list of these objects
     SAFEARRAY *SA = SAOutParamAlloc();
 
+    TraceBegin("IMachine_GetStorageControllers");
     HRESULT rc = IMachine_GetStorageControllers(vm,
         ComSafeArrayAsOutIfaceParam(SA, IStorageController *));
     ExitIfFailure(rc, "IMachine_GetStorageControllers", __FILE__, __LINE__);
@@ -105,8 +103,7 @@ int PrintMediaAttachments(IMachine *vm)
 
         BSTR ctrl_16;
         IMediumAttachment_GetController(ma, &ctrl_16);
-        char *ctrl;
-        Convert16to8(ctrl_16, &ctrl);
+        char *ctrl = Scratch8(ctrl_16);
         FreeBSTR(ctrl_16);
 
         PRInt32 port;
@@ -120,7 +117,6 @@ int PrintMediaAttachments(IMachine *vm)
 
         printf("%-40s  controller=%-16s: port/dev=%u/%u type=%s\n",
             "MEDIA", ctrl, port, dev, DevType[type]);
-        free(ctrl);
 
         BOOL passthrough;
         IMediumAttachment_GetPassthrough(ma, &passthrough);
@@ -132,14 +128,12 @@ int PrintMediaAttachments(IMachine *vm)
 
         BSTR id_16 = NULL;
         IMedium_GetId(m, &id_16);
-        char *id = NULL;
-        Convert16to8(id_16, &id);
+        char *id = Scratch8(id_16);
         FreeBSTR(id_16);
 
         BSTR location_16 = NULL;
         IMedium_GetLocation(m, &location_16);
-        char *location = NULL;
-        Convert16to8(location_16, &location);
+        char *location = Scratch8(location_16);
         FreeBSTR(location_16);
 
         BOOL hostDrive;
@@ -181,6 +175,7 @@ IMediumAttachment ** GetMAList(IMachine *vm, ULONG *Count)
     // Temp safe array for the media attachment list
     SAFEARRAY *ListSA = SAOutParamAlloc();
 
+    TraceBegin("IMachine_GetMediumAttachments");
     HRESULT rc = IMachine_GetMediumAttachments(vm,
         ComSafeArrayAsOutIfaceParam(ListSA, IMediumAttachment *));
     ExitIfFailure(rc, "IMachine_GetMediumAttachments", __FILE__, __LINE__); 
@@ -206,23 +201,16 @@ int PrintSharedFolders(IMachine *vm)
 
         BSTR buf_16;
         ISharedFolder_GetName(sf, &buf_16);
-        char *buf;
-        Convert16to8(buf_16, &buf);
+        printf("%-40s  %s\n", "  Name", Scratch8(buf_16));
         FreeBSTR(buf_16);
-        printf("%-40s  %s\n", "  Name", buf);
-        free(buf);
 
         ISharedFolder_GetHostPath(sf, &buf_16);
-        Convert16to8(buf_16, &buf);
+        printf("%-40s  %s\n", "    HostPath", Scratch8(buf_16));
         FreeBSTR(buf_16);
-        printf("%-40s  %s\n", "    HostPath", buf);
-        free(buf);
 
         ISharedFolder_GetAutoMountPoint(sf, &buf_16);
-        Convert16to8(buf_16, &buf);
+        printf("%-40s  %s\n", "    AutoMountPoint", Scratch8(buf_16));
         FreeBSTR(buf_16);
-        printf("%-40s  %s\n", "    AutoMountPoint", buf);
-        free(buf);
 
         BOOL stat;
         ISharedFolder_GetAccessible(sf, &stat);
@@ -235,10 +223,8 @@ int PrintSharedFolders(IMachine *vm)
         printf("%-40s  %s\n", "    AutoMount", BoolStr[stat]);
 
         ISharedFolder_GetLastAccessError(sf, &buf_16);
-        Convert16to8(buf_16, &buf);
+        printf("%-40s  %s\n", "    LastAccessErr", Scratch8(buf_16));
         FreeBSTR(buf_16);
-        printf("%-40s  %s\n", "    LastAccessErr", buf);
-        free(buf);
     }
     // Free mem
     for (int i = 0; i < sfCount; ++i) {
@@ -255,6 +241,7 @@ ISharedFolder **GetSFList(IMachine *vm, ULONG *Count)
     // Temp safe array to get list of these objects
     SAFEARRAY *ListSA = SAOutParamAlloc();
 
+    TraceBegin("IMachine_GetSharedFolders");
     HRESULT rc = IMachine_GetSharedFolders(vm,
         ComSafeArrayAsOutIfaceParam(ListSA, ISharedFolder *));
     ExitIfFailure(rc, "IMachine_GetSharedFolders", __FILE__, __LINE__);
@@ -294,11 +281,8 @@ int PrintNetworkAdapters(IMachine *vm)
 
         BSTR mac_16;
         INetworkAdapter_GetMACAddress(nic, &mac_16);
-        char *mac;
-        Convert16to8(mac_16, &mac);
+        printf("    %-38s%s\n", "MAC", Scratch8(mac_16));
         FreeBSTR(mac_16);
-        printf("    %-38s%s\n", "MAC", mac);
-        free(mac);
 
         INetworkAdapter_GetCableConnected(nic, &status);
         strcpy(stat, "False");
@@ -311,20 +295,14 @@ int PrintNetworkAdapters(IMachine *vm)
         if (attachType == NetworkAttachmentType_Bridged) {
             BSTR bri_16;
             INetworkAdapter_GetBridgedInterface(nic, &bri_16);
+            printf("    %-38s%s\n", "Bridged_Interface", Scratch8(bri_16));
             FreeBSTR(bri_16);
-            char *bri;
-            Convert16to8(bri_16, &bri);
-            printf("    %-38s%s\n", "Bridged_Interface", bri);
-            free(bri);
         }
         else if (attachType == NetworkAttachmentType_HostOnly) {
             BSTR ho_16;
             INetworkAdapter_GetHostOnlyInterface(nic, &ho_16);
+            printf("    %-38s%s\n", "HostOnly_Interface", Scratch8(ho_16));
             FreeBSTR(ho_16);
-            char *ho;
-            Convert16to8(ho_16, &ho);
-            printf("    %-38s%s\n", "HostOnly_Interface", ho);
-            free(ho);
         }
         else if (attachType == NetworkAttachmentType_NAT) {
             printf("    %-38s%s\n", "NAT_Interface", "N/A");
@@ -334,6 +312,7 @@ int PrintNetworkAdapters(IMachine *vm)
 
             // Temp safe array for the port-pwd list
             SAFEARRAY *pfRulesSA = SAOutParamAlloc();
+            TraceBegin("INATEngine_GetRedirects");
             HRESULT rc = INATEngine_GetRedirects(natEng,
                 ComSafeArrayAsOutTypeParam(pfRulesSA, BSTR));
             ExitIfFailure(rc, "INATEngine_GetRedirects", __FILE__, __LINE__);
@@ -350,8 +329,7 @@ int PrintNetworkAdapters(IMachine *vm)
             if (pfCount) {
                 printf("    NATEngine\n");
                 for (i = 0; i < pfCount; i++) {
-                    char *rule = NULL;
-                    Convert16to8(pfRules[i], &rule);
+                    char *rule = Scratch8(pfRules[i]);
 
                     int Count = 0;
                     char **List = strSplit(rule, ',', &Count);
@@ -364,10 +342,9 @@ int PrintNetworkAdapters(IMachine *vm)
                     sprintf(rules, "%s,%s,%s,%s,%s,%s", List[0], prot, List[2], List[3], List[4], List[5]);
                     printf("      %-36s%s\n", "PortFwdRule", rules);
 
-                    // Free elements and array; and rule string
+                    // Free elements and array
                     for (int j = 0; j < Count; j++) { free(List[j]); }
                     free(List);
-                    free(rule);
                 }
             }
             // Release all objects
@@ -405,10 +382,8 @@ int PrintGAProperties(IMachine *vm)
     // Do the ISO path manually (from ISystemProperties, not IMachine)
     BSTR gaISO_16 = NULL;
     ISystemProperties_GetDefaultAdditionsISO(sysprop, &gaISO_16);
-    char *gaISO = NULL;
-    Convert16to8(gaISO_16, &gaISO);
+    printf("%-40s  %s\n", "/VirtualBox/GuestAdd/ISOFile", Scratch8(gaISO_16));
     FreeBSTR(gaISO_16);
-    printf("%-40s  %s\n", "/VirtualBox/GuestAdd/ISOFile", gaISO);
 
     // Below mess is only to print all IMachine GA properties.
 
@@ -418,6 +393,7 @@ int PrintGAProperties(IMachine *vm)
     SAFEARRAY *timeSA  = SAOutParamAlloc();
     SAFEARRAY *flagSA  = SAOutParamAlloc();
 
+    TraceBegin("IMachine_EnumerateGuestProperties");
     HRESULT rc = IMachine_EnumerateGuestProperties(vm,
         NULL,    // A NULL filter returns all properties
         ComSafeArrayAsOutTypeParam(nameSA, BSTR),
@@ -446,11 +422,7 @@ int PrintGAProperties(IMachine *vm)
 
     // Print the Value and Name of each property. Remember: We're disregarding TimeStamp and Flag.
     for (int i = 0; i < gpCount; ++i) {
-        char *name, *value;
-        Convert16to8(nameList[i], &name);
-        Convert16to8(valueList[i], &value);
-        printf("%-40s  %s\n", name, value);
-        free(name); free(value);
+        printf("%-40s  %s\n", Scratch8(nameList[i]), Scratch8(valueList[i]));
     }
 
     // Release all objects
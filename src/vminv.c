@@ -0,0 +1,475 @@
+// vminv.c
+
+#define _DEFAULT_SOURCE   // kill and flock under -std=c99
+
+#include "vmc.h"
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+// The inventory is a small file in ~/.vmc holding just what listing and IP
+// allocation need for every VM: an InvHeader followed by one fixed-width
+// InvRecord per VM. 'vmc inv watch' keeps it current from VirtualBox events,
+// and while it runs every other vmc process maps the file and reads it
+// directly, instead of asking VBoxSVC for the same values one call at a time.
+//
+// Readers never lock. A change of membership is written to a new file that
+// replaces the old one with rename(), so no mapping is ever resized under a
+// reader. Single record updates are done in place, between two increments
+// of the header generation counter, and readers retry if it moved meanwhile.
+
+#define INV_TRIES 1000             // Times a reader waits out an update in progress
+
+static InvHeader *invMap = NULL;   // Current mapping, writable only while watching
+static size_t invMapSize = 0;
+static bool invTried = false;      // Already tried mapping it in this process
+static bool invStale = false;      // This process changed something the file may not show yet
+static volatile sig_atomic_t invStop = 0;
+
+
+// Build full path of inventory file, with optional suffix
+static void invPath(char *path, int size, const char *suffix)
+{
+    snprintf(path, size, "%s%c%s%cinventory%s", getenv("HOME"), PATHCHAR, vmdir,
+        PATHCHAR, suffix);
+}
+
+
+static InvRecord * invRecords(void)
+{
+    return (InvRecord *)(invMap + 1);
+}
+
+
+// Map inventory file, replacing any current mapping
+static bool invMapFile(bool writable)
+{
+    if (invMap) { munmap(invMap, invMapSize); }
+    invMap = NULL;
+    invMapSize = 0;
+
+    char path[512];
+    invPath(path, sizeof(path), "");
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < sizeof(InvHeader)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { return false; }
+
+    // Ignore files from other versions, or cut short
+    InvHeader *h = map;
+    if (h->magic != INV_MAGIC || h->version != INV_VERSION ||
+        sizeof(InvHeader) + (size_t)h->count * sizeof(InvRecord) > st.st_size) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    invMap = h;
+    invMapSize = st.st_size;
+    return true;
+}
+
+
+// Check if there's an inventory that a running watcher keeps current
+bool InvLive(void)
+{
+    if (invStale) { return false; }
+    if (!invTried) {
+        invTried = true;
+        invMapFile(false);
+    }
+    if (!invMap) { return false; }
+
+    // A watcher that died without clearing its PID leaves a stale inventory
+    pid_t pid = invMap->watcher;
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+
+// Stop trusting the inventory in this process, which has just changed a VM
+// and can't tell when the watcher will have caught up with that
+void InvStale(void)
+{
+    invStale = true;
+}
+
+
+// Get stable generation to read against, waiting out an update in progress
+static bool invReadBegin(PRUint32 *gen)
+{
+    for (int i = 0; i < INV_TRIES; ++i) {
+        *gen = __atomic_load_n(&invMap->gen, __ATOMIC_ACQUIRE);
+        if (!(*gen & 1)) { return true; }
+        sched_yield();
+    }
+    return false;   // Watcher likely died halfway through an update
+}
+
+
+// Check nothing was updated since invReadBegin returned gen
+static bool invReadValid(PRUint32 gen)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&invMap->gen, __ATOMIC_RELAXED) == gen;
+}
+
+
+// Copy fixed-width string field that may have been torn by a concurrent update
+static void invCopy(char *dst, const char *src, int size)
+{
+    memcpy(dst, src, size);
+    dst[size - 1] = '\0';
+}
+
+
+// Take snapshot of all VMs from the inventory. Returns NULL if it isn't live
+VMSnap * InvSnap(void)
+{
+    if (!InvLive()) { return NULL; }
+
+    TraceBegin("InvSnap");
+    InvRecord *r = invRecords();
+    VMSnap *s = NewVMSnap(invMap->count);
+    PRUint32 gen;
+    do {
+        if (!invReadBegin(&gen)) {
+            FreeVMSnap(s);
+            TraceEnd();
+            return NULL;
+        }
+        for (ULONG i = 0; i < s->count; ++i) {
+            s->accessible[i] = TRUE;   // Inaccessible VMs aren't stored
+            s->state[i] = r[i].state;
+            s->cpus[i] = r[i].cpus;
+            s->memory[i] = r[i].memory;
+            invCopy(s->name[i], r[i].name, sizeof(s->name[i]));
+            invCopy(s->uuid[i], r[i].uuid, sizeof(s->uuid[i]));
+            invCopy(s->osType[i], r[i].osType, sizeof(s->osType[i]));
+            invCopy(s->ip[i], r[i].ip, sizeof(s->ip[i]));
+        }
+    } while (!invReadValid(gen));
+    TraceEnd();
+
+    // REMINDER: Caller must free with FreeVMSnap
+    return s;
+}
+
+
+// Look up UUID of named VM in the inventory, into 40 byte uuid buffer
+bool InvFindId(const char *name, char *uuid)
+{
+    if (!InvLive()) { return false; }
+
+    InvRecord *r = invRecords();
+    PRUint32 gen;
+    bool found;
+    do {
+        if (!invReadBegin(&gen)) { return false; }
+        found = false;
+        for (ULONG i = 0; i < invMap->count; ++i) {
+            if (strncmp(r[i].name, name, sizeof(r[i].name)) == 0) {
+                invCopy(uuid, r[i].uuid, sizeof(r[i].uuid));
+                found = true;
+                break;
+            }
+        }
+    } while (!invReadValid(gen));
+    return found;
+}
+
+
+// Check inventory for a VM other than vmName using ip. Returns 1 if there is
+// one, 0 if not, or -1 if the inventory can't tell
+int InvUsedIP(const char *ip, const char *vmName)
+{
+    if (!InvLive()) { return -1; }
+
+    InvRecord *r = invRecords();
+    PRUint32 gen;
+    int used;
+    do {
+        if (!invReadBegin(&gen)) { return -1; }
+        used = 0;
+        for (ULONG i = 0; i < invMap->count; ++i) {
+            if (strncmp(r[i].ip, ip, sizeof(r[i].ip)) == 0 &&
+                strncmp(r[i].name, vmName, sizeof(r[i].name)) != 0) {
+                used = 1;
+                break;
+            }
+        }
+    } while (!invReadValid(gen));
+    return used;
+}
+
+
+// Open in-place update of the inventory. Only the watcher writes
+static void invWriteBegin(void)
+{
+    __atomic_store_n(&invMap->gen, invMap->gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void invWriteEnd(void)
+{
+    __atomic_store_n(&invMap->gen, invMap->gen + 1, __ATOMIC_RELEASE);
+}
+
+
+// Rewrite whole inventory from a fresh snapshot of all VMs
+static void invRebuild(void)
+{
+    UpdateVMList();
+    VMSnap *s = TakeVMSnap();
+
+    ULONG count = 0;
+    for (ULONG i = 0; i < s->count; ++i) {
+        if (s->accessible[i]) { ++count; }
+    }
+    size_t size = sizeof(InvHeader) + count * sizeof(InvRecord);
+    InvHeader *h = calloc(1, size);
+    ExitIfNull(h, __FILE__, __LINE__);
+    h->magic = INV_MAGIC;
+    h->version = INV_VERSION;
+    // Keep counting up from the file being replaced, so readers can compare
+    h->gen = invMap ? (invMap->gen + 2) & ~1u : 0;
+    h->count = count;
+    h->watcher = getpid();
+    h->updated = time(NULL);
+
+    InvRecord *r = (InvRecord *)(h + 1);
+    for (ULONG i = 0, j = 0; i < s->count; ++i) {
+        if (!s->accessible[i]) { continue; }
+        strcpy(r[j].name, s->name[i]);
+        strcpy(r[j].uuid, s->uuid[i]);
+        strcpy(r[j].osType, s->osType[i]);
+        strcpy(r[j].ip, s->ip[i]);
+        r[j].state = s->state[i];
+        r[j].cpus = s->cpus[i];
+        r[j].memory = s->memory[i];
+        ++j;
+    }
+    FreeVMSnap(s);
+
+    // Write it next to the current one, then swap it in
+    char path[512], tmpPath[512];
+    invPath(path, sizeof(path), "");
+    invPath(tmpPath, sizeof(tmpPath), ".tmp");
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, h, size) != size || close(fd) || rename(tmpPath, path)) {
+        fprintf(stderr, "Error writing inventory '%s'\n", path);
+        Exit(EXIT_FAILURE);
+    }
+    free(h);
+
+    if (!invMapFile(true)) {
+        fprintf(stderr, "Error mapping inventory '%s'\n", path);
+        Exit(EXIT_FAILURE);
+    }
+}
+
+
+// Find record of VM with given UUID
+static InvRecord * invFind(const char *uuid)
+{
+    InvRecord *r = invRecords();
+    for (ULONG i = 0; i < invMap->count; ++i) {
+        if (Equal(r[i].uuid, uuid)) { return &r[i]; }
+    }
+    return NULL;
+}
+
+
+// Re-read settings of VM behind record r, after a data change event
+static void invReload(InvRecord *r)
+{
+    BSTR uuid_16 = NULL;
+    Convert8to16(r->uuid, &uuid_16);
+    IMachine *vm = NULL;
+    HRESULT rc = IVirtualBox_FindMachine(vbox, uuid_16, &vm);
+    FreeBSTR(uuid_16);
+    if (FAILED(rc) || !vm) { return; }
+
+    char *name = GetVMName(vm);
+    BSTR osType_16 = NULL;
+    IMachine_GetOSTypeId(vm, &osType_16);
+    char *osType = NULL;
+    Convert16to8(osType_16, &osType);
+    FreeBSTR(osType_16);
+    ULONG cpus = 0, memory = 0;
+    IMachine_GetCPUCount(vm, &cpus);
+    IMachine_GetMemorySize(vm, &memory);
+
+    invWriteBegin();
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->osType, sizeof(r->osType), "%s", osType ? osType : "");
+    r->cpus = cpus;
+    r->memory = memory;
+    invWriteEnd();
+
+    free(name);
+    free(osType);
+}
+
+
+// Bring inventory up to date with given event
+static void invApply(IEvent *event)
+{
+    PRUint32 type = 0;
+    IEvent_GetType(event, &type);
+    char uuid[40];
+    EventMachineId(event, uuid, sizeof(uuid));
+
+    // New, removed, or so far unknown VM. Rebuilding is simplest
+    InvRecord *r = invFind(uuid);
+    if (type == VBoxEventType_OnMachineRegistered || !r) {
+        invRebuild();
+        return;
+    }
+
+    if (type == VBoxEventType_OnMachineStateChanged) {
+        IMachineStateChangedEvent *sevent = NULL;
+        IEvent_QueryInterface(event, &IID_IMachineStateChangedEvent, (void **)&sevent);
+        if (!sevent) { return; }
+        PRUint32 state = MachineState_Null;
+        IMachineStateChangedEvent_GetState(sevent, &state);
+        IMachineStateChangedEvent_Release(sevent);
+        invWriteBegin();
+        r->state = state;
+        invWriteEnd();
+    }
+    else if (type == VBoxEventType_OnGuestPropertyChanged) {
+        IGuestPropertyChangedEvent *pevent = NULL;
+        IEvent_QueryInterface(event, &IID_IGuestPropertyChangedEvent, (void **)&pevent);
+        if (!pevent) { return; }
+        BSTR name_16 = NULL, value_16 = NULL;
+        IGuestPropertyChangedEvent_GetName(pevent, &name_16);
+        char *name = NULL;
+        Convert16to8(name_16, &name);
+        if (Equal(name, "/vm/ip")) {
+            IGuestPropertyChangedEvent_GetValue(pevent, &value_16);
+            char *value = NULL;
+            Convert16to8(value_16, &value);
+            invWriteBegin();
+            snprintf(r->ip, sizeof(r->ip), "%s", value ? value : "");
+            invWriteEnd();
+            free(value);
+            FreeBSTR(value_16);
+        }
+        free(name);
+        FreeBSTR(name_16);
+        IGuestPropertyChangedEvent_Release(pevent);
+    }
+    else if (type == VBoxEventType_OnMachineDataChanged) {
+        invReload(r);
+    }
+}
+
+
+static void invSignal(int sig)
+{
+    invStop = 1;
+}
+
+
+// Keep inventory current from VirtualBox events, until interrupted
+void WatchInventory(void)
+{
+    // Only one watcher at a time
+    char path[512], lockPath[512];
+    invPath(path, sizeof(path), "");
+    invPath(lockPath, sizeof(lockPath), ".lock");
+    int lock = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB)) {
+        printf("Inventory '%s' is already being watched\n", path);
+        Exit(EXIT_FAILURE);
+    }
+
+    // Start listening before the first rebuild, so no change can fall in between
+    PRUint32 types[] = {
+        VBoxEventType_OnMachineRegistered,
+        VBoxEventType_OnMachineStateChanged,
+        VBoxEventType_OnMachineDataChanged,
+        VBoxEventType_OnGuestPropertyChanged,
+    };
+    IEventSource *source = NULL;
+    IEventListener *listener = ListenEvents(&source, types, sizeof(types) / sizeof(types[0]));
+    invRebuild();
+
+    signal(SIGINT, invSignal);
+    signal(SIGTERM, invSignal);
+    printf("Watching inventory of %u VMs in '%s'. Press Ctrl-C to stop\n",
+        invMap->count, path);
+    fflush(stdout);
+
+    while (!invStop) {
+        IEvent *event = NextEvent(source, listener, 500);
+        if (!event) { continue; }
+        invApply(event);
+        DoneEvent(source, listener, event);
+    }
+
+    // Hand readers back to the API
+    invWriteBegin();
+    invMap->watcher = 0;
+    invWriteEnd();
+    StopEvents(source, listener);
+    close(lock);
+}
+
+
+// Print inventory status
+static void invStatus(void)
+{
+    char path[512];
+    invPath(path, sizeof(path), "");
+    if (!invMapFile(false)) {
+        printf("No inventory at '%s'. Run '%s inv watch' to keep one\n", path, prgname);
+        return;
+    }
+
+    char updated[32];
+    time_t t = invMap->updated;
+    strftime(updated, sizeof(updated), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("%-12s%s\n", "Path", path);
+    printf("%-12s%u\n", "VMs", invMap->count);
+    printf("%-12s%u\n", "Generation", invMap->gen);
+    printf("%-12s%s\n", "Rebuilt", updated);
+    if (InvLive()) {
+        printf("%-12s%d\n", "Watcher", invMap->watcher);
+    }
+    else {
+        printf("%-12s%s\n", "Watcher", "None, so commands query VirtualBox directly");
+    }
+}
+
+
+// Manage on-disk inventory
+void vmInv(int argc, char *argv[])
+{
+    if (argc == 0) {
+        invStatus();
+    }
+    else if (argc == 1 && Equal(argv[0], "watch")) {
+        WatchInventory();
+    }
+    else if (argc == 1 && Equal(argv[0], "drop")) {
+        char path[512];
+        invPath(path, sizeof(path), "");
+        if (unlink(path) && errno != ENOENT) {
+            fprintf(stderr, "Error removing inventory '%s'\n", path);
+            Exit(EXIT_FAILURE);
+        }
+    }
+    else {
+        printf("Usage: %s inv [watch|drop]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    Exit(EXIT_SUCCESS);
+}
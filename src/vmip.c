@@ -38,6 +38,18 @@ void vmIP(int argc, char *argv[])
 
 // Set up IP and network devices, and store details in VM property area
 bool SetVMIP(IMachine *vm, char *ip)
+{
+    VMTxn *txn = BeginVMTxn(vm);
+    if (!TxnSetIP(txn, ip)) {
+        AbortVMTxn(txn);
+        return false;
+    }
+    return CommitVMTxn(txn);
+}
+
+
+// Set up IP and network devices within given transaction
+bool TxnSetIP(VMTxn *txn, char *ip)
 {
     if (!ValidIpStr(ip)) {
         printf("'%s' is not a valid IP.\n", ip);
@@ -49,35 +61,41 @@ bool SetVMIP(IMachine *vm, char *ip)
         return false;
     }
 
-    char *vmName = GetVMName(vm);
+    char *vmName = GetVMName(txn->vm);
 
     // Abort if IP is already taken
     if (UsedIP(ip, vmName)) {
         printf("IP '%s' is already in used by another VM,"
             "or a host in same network.\n", ip);
+        free(vmName);
         return false;
     }
 
-    // Get new ISession object - Type2
-    IMachine *vmMuta = NULL;   // For temporary mutable VM object
-    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
     // Note: From here on we're modifying the writeable vmMuta object
+    IMachine *vmMuta = txn->vmMuta;
+    txn->dirty = true;
 
     // Get /24 network address (first 3 octets)
     char *ipNet = GetIPNet(ip);
 
-    // Set up networking based on netType
-    char *netType = GetVMProp(vmMuta, "/vm/nettype");
+    // Set up networking based on netType, as this same transaction may have just set it
+    char *netType = TxnGetProp(txn, "/vm/nettype");
+    if (!netType) {
+        netType = NewString(3);
+        strcpy(netType, "ho");   // Same default as CreateVM
+    }
     if (Equal(netType, "bri")) {
         // BRIDGED NETWORKING
         // DISABLE enp0s3 w/ Null. No networking
         INetworkAdapter *nic0 = NULL;
+        TraceBegin("IMachine_GetNetworkAdapter");
         HRESULT rc = IMachine_GetNetworkAdapter(vmMuta, 0, &nic0);
         ExitIfFailure(rc, "IMachine_GetNetworkAdapter", __FILE__, __LINE__);
         INetworkAdapter_SetEnabled(nic0, FALSE);
 
         // ENABLE enp0s8 w/ Bridge networking. Real-world access (assumes local admin privs)
         INetworkAdapter *nic1 = NULL;
+        TraceBegin("IMachine_GetNetworkAdapter");
         rc = IMachine_GetNetworkAdapter(vmMuta, 1, &nic1);
         ExitIfFailure(rc, "IMachine_GetNetworkAdapter", __FILE__, __LINE__);
         INetworkAdapter_SetEnabled(nic1, TRUE);
@@ -89,6 +107,7 @@ bool SetVMIP(IMachine *vm, char *ip)
         BSTR mainNIC_16;
         Convert8to16(mainNIC, &mainNIC_16);
 
+        TraceBegin("INetworkAdapter_SetBridgedInterface");
         rc = INetworkAdapter_SetBridgedInterface(nic1, mainNIC_16);
         ExitIfFailure(rc, "INetworkAdapter_SetBridgedInterface", __FILE__, __LINE__);
         FreeBSTR(mainNIC_16);
@@ -98,12 +117,14 @@ bool SetVMIP(IMachine *vm, char *ip)
         // HOSTONLY NETWORKING
         // ENABLE enp0s3 w/ NAT networking, to access external world, and no SSH port forwarding
         INetworkAdapter *nic0 = NULL;
+        TraceBegin("IMachine_GetNetworkAdapter");
         HRESULT rc = IMachine_GetNetworkAdapter(vmMuta, 0, &nic0);
         ExitIfFailure(rc, "IMachine_GetNetworkAdapter", __FILE__, __LINE__);
         INetworkAdapter_SetEnabled(nic0, TRUE);
         INetworkAdapter_SetAdapterType(nic0, NetworkAdapterType_Virtio);
         INetworkAdapter_SetAttachmentType(nic0, NetworkAttachmentType_NAT);
         INATEngine *natEng = NULL;
+        TraceBegin("INetworkAdapter_GetNATEngine");
         rc = INetworkAdapter_GetNATEngine(nic0, &natEng);
         ExitIfFailure(rc, "INetworkAdapter_GetNATEngine", __FILE__, __LINE__);
         INATEngine_SetDNSPassDomain(natEng, TRUE);
@@ -111,6 +132,7 @@ bool SetVMIP(IMachine *vm, char *ip)
 
         // ENABLE enp0s8 w/ HostOnly networking. Network connectivity between VMs only
         INetworkAdapter *nic1 = NULL;
+        TraceBegin("IMachine_GetNetworkAdapter");
         rc = IMachine_GetNetworkAdapter(vmMuta, 1, &nic1);
         ExitIfFailure(rc, "IMachine_GetNetworkAdapter", __FILE__, __LINE__);
         INetworkAdapter_SetEnabled(nic1, TRUE);
@@ -181,6 +203,7 @@ bool SetVMIP(IMachine *vm, char *ip)
             fprintf(stderr, "%s:%d INetworkAdapter_SetHostOnlyInterface error\n",
                 __FILE__, __LINE__);
             PrintVBoxException();
+            free(vmName); free(netType); free(ipNet);
             return false;
         }
         FreeBSTR(newHOName_16);
@@ -189,18 +212,19 @@ bool SetVMIP(IMachine *vm, char *ip)
     // Let's store these essential details in the Guest Additions property area of
     // the VM, under path '/vm/*'. VMs using this program need to set up the
     // /usr/local/bin/vmnet utility to query this area using GuestAdditions tool,
-    // to properly set up networking on the VM during boot up.
-    SetVMProp(vmMuta, "/vm/name", vmName);
-    SetVMProp(vmMuta, "/vm/nettype", netType);
-    SetVMProp(vmMuta, "/vm/ip", ip);
-    SetVMProp(vmMuta, "/vm/netmask", "255.255.255.0");
+    // to properly set up networking on the VM during boot up. They are written
+    // when the transaction is committed, and only if they've changed.
+    TxnSetProp(txn, "/vm/name", vmName);
+    TxnSetProp(txn, "/vm/nettype", netType);
+    TxnSetProp(txn, "/vm/ip", ip);
+    TxnSetProp(txn, "/vm/netmask", "255.255.255.0");
     char broadcast[32];
     sprintf(broadcast, "%s.255", ipNet);
-    SetVMProp(vmMuta, "/vm/broadcast", broadcast);
-
-    CloseSession(session);
+    TxnSetProp(txn, "/vm/broadcast", broadcast);
 
     free(vmName);
+    free(netType);
+    free(ipNet);
 
     return true;
 }
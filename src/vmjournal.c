@@ -0,0 +1,151 @@
+// vmjournal.c
+
+#define _DEFAULT_SOURCE   // realpath and fsync under -std=c99
+
+#include "vmc.h"
+#include <stdarg.h>
+
+// Provisioning journal. A 'vmc prov' run appends one line to a journal in
+// ~/.vmc/journal, named after a hash of the vmconf file's full path, for each
+// step it completes on a VM: the step, then the VM name. Every line goes to
+// disk as it's written, so even a run that was killed leaves an accurate
+// account of what it got done. The first line holds a hash of the vmconf
+// content. A run that provisions every VM removes its journal, and one that
+// doesn't leaves it for 'vmc prov resume', which skips what it records as
+// long as the vmconf file hasn't changed since.
+
+static FILE *journalFile = NULL;
+static char journalPath[512];
+static char **journalLines = NULL;   // Steps recorded by the run being resumed
+static int journalCount = 0;
+
+
+// Hash of the content of given file
+static PRUint64 journalHashFile(const char *path)
+{
+    PRUint64 h = FNV_INIT;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { return h; }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) { h = HashFNV(h, buf, n); }
+    fclose(fp);
+    return h;
+}
+
+
+// Append a line to the journal, making sure it reaches the disk
+static void journalWrite(const char *fmt, ...)
+{
+    if (!journalFile) { return; }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(journalFile, fmt, ap);
+    va_end(ap);
+    fflush(journalFile);
+    fsync(fileno(journalFile));
+}
+
+
+// Append line to those ProvJournalHas looks at
+static void journalAdd(const char *line)
+{
+    char **lines = realloc(journalLines, (journalCount + 1) * sizeof(char *));
+    ExitIfNull(lines, __FILE__, __LINE__);
+    journalLines = lines;
+    journalLines[journalCount] = strdup(line);
+    ExitIfNull(journalLines[journalCount++], __FILE__, __LINE__);
+}
+
+
+// Read the steps recorded in the journal at journalPath, if it was written
+// for content hash sum. False if it doesn't exist, exit if it's for other content
+static bool journalLoad(const char *sum)
+{
+    FILE *fp = fopen(journalPath, "r");
+    if (!fp) { return false; }
+    char line[256];
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, "vmc-journal ", 12) ||
+        strncmp(line + 12, sum, 16)) {
+        fclose(fp);
+        fprintf(stderr, "=> The vmconf file changed since the run to resume. "
+            "Provision it anew instead\n");
+        Exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] != '\0') { journalAdd(line); }   // A killed run may leave it empty
+    }
+    fclose(fp);
+    return true;
+}
+
+
+// Start the journal of provisioning given vmconf file. With resume, carry on
+// with the one left by the last run, and return false if there's none
+bool OpenProvJournal(char *provFile, bool resume)
+{
+    // Resolved to any length first, and refused if it doesn't fit
+    char full[1024];
+    char *resolved = realpath(provFile, NULL);
+    if (resolved && strlen(resolved) >= sizeof(full)) {
+        fprintf(stderr, "=> Path of '%s' is too long to journal\n", provFile);
+        free(resolved);
+        Exit(EXIT_FAILURE);
+    }
+    argCopy(full, 1023, resolved ? resolved : provFile);
+    if (resolved) { free(resolved); }
+    char sum[17];
+    sprintf(sum, "%016llx", (unsigned long long)journalHashFile(full));
+
+    snprintf(journalPath, sizeof(journalPath), "%s%cjournal", vmhome, PATHCHAR);
+    if (!isDir(journalPath)) { mkdir(journalPath, 0755); }
+    snprintf(journalPath + strlen(journalPath), sizeof(journalPath) - strlen(journalPath),
+        "%c%016llx", PATHCHAR, (unsigned long long)HashFNV(FNV_INIT, full, strlen(full)));
+
+    if (resume && !journalLoad(sum)) { return false; }
+    journalFile = fopen(journalPath, resume ? "a" : "w");
+    if (!journalFile) {
+        fprintf(stderr, "=> Error writing journal '%s'\n", journalPath);
+        Exit(EXIT_FAILURE);
+    }
+    if (!resume) { journalWrite("vmc-journal %s %s\n", sum, full); }
+    return true;
+}
+
+
+// True if given step completed on given VM, in this run or the one it resumes
+bool ProvJournalHas(const char *vmName, const char *step)
+{
+    size_t len = strlen(step);
+    for (int i = 0; i < journalCount; ++i) {
+        if (!strncmp(journalLines[i], step, len) && journalLines[i][len] == ' ' &&
+            Equal(journalLines[i] + len + 1, vmName)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Record that given step completed on given VM
+void ProvJournalMark(const char *vmName, const char *step)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%s %s", step, vmName);
+    journalAdd(line);
+    journalWrite("%s\n", line);
+}
+
+
+// Close the journal, and drop it if the run provisioned every VM
+void CloseProvJournal(bool finished)
+{
+    if (journalFile) { fclose(journalFile); }
+    journalFile = NULL;
+    if (finished) { unlink(journalPath); }
+    for (int i = 0; i < journalCount; ++i) { free(journalLines[i]); }
+    free(journalLines);
+    journalLines = NULL;
+    journalCount = 0;
+}
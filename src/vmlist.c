@@ -2,62 +2,110 @@
 
 #include "vmc.h"
 
-// Print list of all VMs on this host
-void PrintVMList(void)
+// List all VMs on this host, as a table, JSON or CSV
+void vmList(int argc, char *argv[])
 {
-    // Exit if there are no VMs
-    if (!VMListCount) { Exit(EXIT_SUCCESS); }
+    char format[8] = "";
+    if (argc == 1 && (Equal(argv[0], "json") || Equal(argv[0], "csv"))) {
+        argCopy(format, 7, argv[0]);
+    }
+    else if (argc != 0) {
+        printf("Usage: %s list [json|csv]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+
+    // Fetch everything first, then print it all in one go. A live inventory
+    // has it all already, else ask the API, which may not be initialized yet
+    VMSnap *snap = InvSnap();
+    if (!snap) {
+        if (!vbox) { InitGlobalObjects(); }
+        snap = TakeVMSnap();
+    }
+    if (Equal(format, "json")) { PrintVMListJSON(snap); }
+    else if (Equal(format, "csv")) { PrintVMListCSV(snap); }
+    else { PrintVMList(snap); }
+    FreeVMSnap(snap);
+
+    Exit(EXIT_SUCCESS);   // Will also release VMList
+}
+
+
+// Print VM snapshot as a table
+void PrintVMList(VMSnap *snap)
+{
+    // Nothing to print if there are no VMs
+    if (!snap->count) { return; }
 
     // Header
     printf("%-34s%-16s%-5s%-7s%-12s%s\n",
         "NAME", "OS", "CPU", "MEM", "STATE", "SSH");
 
-    // Now parse every VM object in array
-    for (int i = 0; i < VMListCount; ++i) {
-        IMachine *vm = VMList[i];
+    for (ULONG i = 0; i < snap->count; ++i) {
+        if (!snap->accessible[i]) { continue; }
 
-        BOOL accessible = FALSE;
-        IMachine_GetAccessible(vm, &accessible);
-        if (!accessible) { continue; }
+        // Add a trailing space to make a long name readable
+        const char *gap = strlen(snap->name[i]) >= 34 ? " " : "";
 
-        // Get VM name
-        char *name = GetVMName(VMList[i]);
-        int l = strlen(name);
-        // Add a trailing space to make name more readable when printed below
-        if (l > 34) { name[l] = ' '; name[l+1] = '\0'; }
-        
-        // OS Type ID
-        BSTR ostypeid_16;
-        IMachine_GetOSTypeId(vm, &ostypeid_16);
-        char *ostypeid;
-        Convert16to8(ostypeid_16, &ostypeid);
-        FreeBSTR(ostypeid_16);
-
-        // CPU count
-        ULONG cpucnt;
-        IMachine_GetCPUCount(vm, &cpucnt);
-
-        // Memory size
-        ULONG memsize;
-        IMachine_GetMemorySize(vm, &memsize);
-
-        // VM state
-        char state[32];
-        strcpy(state, VMStateStr[VMState(vm)]);
-
-        // SSH coonection string
-        char *ip = GetVMProp(vm, "/vm/ip");
-        char sshconn[32] = "";
-        sprintf(sshconn, "%s@%s", vmuser, ip);
-
-        // Print 'em out
-        printf("%-34s%-16s%-5u%-7u%-12s%s\n",
-            name, ostypeid, cpucnt, memsize, state, sshconn);
-        // Free some memory
-        free(name);
-        free(ostypeid);
+        // SSH connection string
+        char sshconn[96] = "";
+        sprintf(sshconn, "%s@%s", vmuser, snap->ip[i]);
+
+        printf("%-34s%s%-16s%-5u%-7u%-12s%s\n", snap->name[i], gap, snap->osType[i],
+            snap->cpus[i], snap->memory[i], VMStateStr[snap->state[i]], sshconn);
+    }
+}
+
+
+// Print VM snapshot as a JSON array of objects
+void PrintVMListJSON(VMSnap *snap)
+{
+    bool first = true;
+    printf("[");
+    for (ULONG i = 0; i < snap->count; ++i) {
+        if (!snap->accessible[i]) { continue; }
+        printf("%s\n  {\"name\": ", first ? "" : ",");
+        PrintJSONString(stdout, snap->name[i]);
+        printf(", \"os\": ");
+        PrintJSONString(stdout, snap->osType[i]);
+        printf(", \"cpus\": %u, \"memory\": %u, \"state\": \"%s\", \"ip\": ",
+            snap->cpus[i], snap->memory[i], VMStateStr[snap->state[i]]);
+        PrintJSONString(stdout, snap->ip[i]);
+        printf("}");
+        first = false;
+    }
+    printf("%s]\n", first ? "" : "\n");
+}
+
+
+// Print CSV field, quoting it if needed
+static void printCSVField(const char *str)
+{
+    if (!strpbrk(str, ",\"\r\n")) {
+        fputs(str, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *str; ++str) {
+        if (*str == '"') { putchar('"'); }   // Quotes are escaped by doubling
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+
+// Print VM snapshot as CSV, with a header line
+void PrintVMListCSV(VMSnap *snap)
+{
+    printf("name,os,cpus,memory,state,ip\n");
+    for (ULONG i = 0; i < snap->count; ++i) {
+        if (!snap->accessible[i]) { continue; }
+        printCSVField(snap->name[i]);
+        putchar(',');
+        printCSVField(snap->osType[i]);
+        printf(",%u,%u,%s,", snap->cpus[i], snap->memory[i], VMStateStr[snap->state[i]]);
+        printCSVField(snap->ip[i]);
+        putchar('\n');
     }
-    Exit(EXIT_SUCCESS);   // Will also release VMList   
 }
 
 
@@ -71,6 +119,7 @@ void UpdateVMList(void)
     SAFEARRAY *SA = SAOutParamAlloc();
 
     // Get list and store in SA
+    TraceBegin("IVirtualBox_GetMachines");
     HRESULT rc = IVirtualBox_GetMachines(vbox,
         ComSafeArrayAsOutIfaceParam(SA, IMachine *));
     ExitIfFailure(rc, "VMList SA", __FILE__, __LINE__);
@@ -78,6 +127,7 @@ void UpdateVMList(void)
     FreeVMList();  // Release existing one in memory
 
     // Transfer from safe array to regular array, updating counter 
+    TraceBegin("SACopyOutIfaceParamHelper");
     rc = SACopyOutIfaceParamHelper((IUnknown ***)&VMList, &VMListCount, SA);
     ExitIfFailure(rc, "VMList array", __FILE__, __LINE__);
     SADestroy(SA);
@@ -111,6 +161,17 @@ IMachine * GetVM(char *vmName)
     // We'll return NULL if we cannot find it
     IMachine *vm = NULL;
 
+    // A live inventory knows the UUID, which saves asking every VM for its name
+    char uuid[40];
+    if (InvFindId(vmName, uuid)) {
+        BSTR uuid_16;
+        Convert8to16(uuid, &uuid_16);
+        HRESULT rc = IVirtualBox_FindMachine(vbox, uuid_16, &vm);
+        FreeBSTR(uuid_16);
+        if (SUCCEEDED(rc) && vm) { return vm; }
+        vm = NULL;   // Gone since, so fall back to the list
+    }
+
     // Locate and return given VM object in memory
     for (int i = 0; i < VMListCount; ++i) {
         char *name = GetVMName(VMList[i]);
@@ -137,24 +198,10 @@ PRUint32 VMState(IMachine *vm)
 // Get VM name
 char * GetVMName(IMachine *vm)
 {
-    // Lookup VM UTF16 name
-    BSTR name_16;
+    // Lookup VM UTF16 name, and convert it once, into exactly the memory it needs
+    BSTR name_16 = NULL;
     IMachine_GetName(vm, &name_16);
-
-    // Lack of UTF16 strlen forces more cumbersome temp circumventions
-    char *tempName;
-    Convert16to8(name_16, &tempName);
-    int l = strlen(tempName);
-    free(tempName);
-
-    // NOTE: We're allocating new memory because otherwise tempName
-    // wouldn't survive after this function exits
-
-    // Allocate only required memory for length of UTF8 name
-    char *name = NewString(l);
-
-    // Transfer UTF16 name to UTF8 name
-    Convert16to8(name_16, &name);
+    char *name = NewUtf8(name_16);
     FreeBSTR(name_16);  // Free UTF16 one
 
     // REMINDER: Caller must free allocated memory
@@ -165,28 +212,15 @@ char * GetVMName(IMachine *vm)
 // Get VM Guest Property value
 char * GetVMProp(IMachine *vm, char *path)
 {
-    // Unfortunately API only works with UTF16 (BSTR) and not UTF8 (char *),
-    // so this involves some cumbersome temp allocations and conversions of
-    // the property path we ask for, and the value we get back 
-    BSTR path_16, value_16;
-    Convert8to16(path, &path_16);
-    IMachine_GetGuestPropertyValue(vm, path_16, &value_16);
-    FreeBSTR(path_16);   // Free UTF16
-
-    // Lack of UTF16 strlen forces more cumbersome temp circumventions
-    char *tempValue;
-    Convert16to8(value_16, &tempValue);
-    int l = strlen(tempValue);
-    free(tempValue);
-
-    // Return NULL if there is no value
-    if (l < 1) { return NULL; } 
-
-    // Allocate only required memory for length of UTF8 value
-    char *value = NewString(l);
-
-    // Transfer UTF16 name to UTF8 name
-    Convert16to8(value_16, &value);
+    // Unfortunately API only takes UTF16 (BSTR) and not UTF8 (char *), so
+    // the property path we ask for needs converting, unless it's interned
+    BSTR key_16 = PropKey(path), path_16 = NULL, value_16 = NULL;
+    if (!key_16) { Convert8to16(path, &path_16); }
+    IMachine_GetGuestPropertyValue(vm, key_16 ? key_16 : path_16, &value_16);
+    if (path_16) { FreeBSTR(path_16); }   // Free UTF16
+
+    // Return NULL if there is no value, else convert it once
+    char *value = Utf16Len(value_16) ? NewUtf8(value_16) : NULL;
     FreeBSTR(value_16);  // Free UTF16
 
     // REMINDER: Caller must free allocated memory
@@ -198,19 +232,86 @@ char * GetVMProp(IMachine *vm, char *path)
 void SetVMProp(IMachine *vm, char *path, const char *value)
 {
     // Unfortunately API only works with UTF16 (BSTR) and not UTF8 (char *),
-    // so this involves some cumbersome temp allocations and conversions of
-    // the property path and values we are asking to update 
-    BSTR path_16, value_16;
-    Convert8to16(path, &path_16);   // Conversion macro
+    // so the value we are asking to update needs converting, and so does
+    // the property path, unless it's interned
+    BSTR key_16 = PropKey(path), path_16 = NULL, value_16;
+    if (!key_16) { Convert8to16(path, &path_16); }   // Conversion macro
     Convert8to16(value, &value_16);
 
-    HRESULT rc = IMachine_SetGuestPropertyValue(vm, path_16, value_16);
+    HRESULT rc = IMachine_SetGuestPropertyValue(vm, key_16 ? key_16 : path_16, value_16);
     if (FAILED(rc)) {
         fprintf(stderr, "%s:%d IMachine_SetGuestPropertyValue error\n", __FILE__, __LINE__);
         PrintVBoxException();
         Exit(EXIT_FAILURE);
     }
     
-    FreeBSTR(path_16);   // Free UTF16 vars
+    if (path_16) { FreeBSTR(path_16); }   // Free UTF16 vars
     FreeBSTR(value_16);
+
+    // Inventory won't show this until its watcher gets the event
+    InvStale();
+}
+
+
+// Get names and values of all VM Guest Properties matching pattern, in one call
+ULONG GetVMProps(IMachine *vm, char *pattern, char ***names, char ***values)
+{
+    BSTR pattern_16;
+    Convert8to16(pattern, &pattern_16);
+
+    // Temp safe arrays to get list of these objects
+    SAFEARRAY *nameSA  = SAOutParamAlloc();
+    SAFEARRAY *valueSA = SAOutParamAlloc();
+    SAFEARRAY *timeSA  = SAOutParamAlloc();
+    SAFEARRAY *flagSA  = SAOutParamAlloc();
+
+    TraceBegin("IMachine_EnumerateGuestProperties");
+    HRESULT rc = IMachine_EnumerateGuestProperties(vm,
+        pattern_16,
+        ComSafeArrayAsOutTypeParam(nameSA, BSTR),
+        ComSafeArrayAsOutTypeParam(valueSA, BSTR),
+        ComSafeArrayAsOutTypeParam(timeSA, PRInt64),
+        ComSafeArrayAsOutTypeParam(flagSA, BSTR));
+    ExitIfFailure(rc, "IMachine_EnumerateGuestProperties", __FILE__, __LINE__);
+    FreeBSTR(pattern_16);
+
+    // We only care about name/value pair, so destroy timestamp and flag SAs now
+    SADestroy(timeSA);
+    SADestroy(flagSA);
+
+    // Transfer safe arrays to regular C arrays. See PrintGAProperties in vminfo.c
+    ULONG count_16 = 0;
+    BSTR *nameList = NULL, *valueList = NULL;
+    SACopyOutParamHelper((void **)&nameList, &count_16, VT_BSTR, nameSA);
+    SACopyOutParamHelper((void **)&valueList, &count_16, VT_BSTR, valueSA);
+    SADestroy(nameSA);
+    SADestroy(valueSA);
+    ULONG count = count_16 / sizeof(nameList[0]);
+
+    // REMINDER: Caller must free allocated memory with FreeVMProps
+    *names = malloc(sizeof(char *) * (count + 1));
+    *values = malloc(sizeof(char *) * (count + 1));
+    ExitIfNull(*names, __FILE__, __LINE__);
+    ExitIfNull(*values, __FILE__, __LINE__);
+    for (int i = 0; i < count; ++i) {
+        (*names)[i] = NewUtf8(nameList[i]);
+        (*values)[i] = NewUtf8(valueList[i]);
+        if (nameList[i]) { FreeBSTR(nameList[i]); }
+        if (valueList[i]) { FreeBSTR(valueList[i]); }
+    }
+    if (nameList) { ArrayOutFree(nameList); }
+    if (valueList) { ArrayOutFree(valueList); }
+    return count;
+}
+
+
+// Free lists returned by GetVMProps
+void FreeVMProps(char **names, char **values, ULONG count)
+{
+    for (int i = 0; i < count; ++i) {
+        free(names[i]);
+        free(values[i]);
+    }
+    free(names);
+    free(values);
 }
@@ -0,0 +1,253 @@
+// vmlogs.c
+
+#define _DEFAULT_SOURCE   // dup2 and localtime under -std=c99
+
+#include "vmc.h"
+#include <pthread.h>
+#include <sys/time.h>
+
+// Per-VM provisioning logs. While a VM's vmcopy and vmrun steps run, this
+// program's stdout and stderr, which whatever they run inherits, go into two
+// pipes instead of the terminal. A thread reads both, writes each line to the
+// VM's log in ~/.vmc/logs with a timestamp and which stream it came from,
+// and keeps the last LOG_TAILLINES lines in a ring. On a terminal, a single
+// status line shows the step's latest output, redrawn at most every
+// LOG_REDRAWMS, however fast lines come. A failed step shows its ring, and
+// 'vmc logs <vmName>' pages the whole log of the VM's last provisioning.
+
+static FILE *logFile = NULL;           // Log of the VM being provisioned
+static char logVM[64], logStep[16];
+static int logConsole = -1;            // Where stdout went before capture
+static int logSavedErr = -1;
+static int logPipe[2] = { -1, -1 };    // Read ends of stdout and stderr pipes
+static pthread_t logThread;
+static char logTail[LOG_TAILLINES][LOG_LINEMAX];
+static int logTailNext = 0, logTailCount = 0;
+static long logLines = 0;
+static bool logTTY = false;
+
+
+// Build path of log file of given VM, creating its directory
+static void logPath(const char *vmName, char *path, int size)
+{
+    snprintf(path, size, "%s%clogs", vmhome, PATHCHAR);
+    if (!isDir(path)) { mkdir(path, 0755); }
+    snprintf(path + strlen(path), size - strlen(path), "%c%s.log", PATHCHAR, vmName);
+}
+
+
+// Milliseconds since the epoch
+static long long logNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+// Redraw the status line, on the terminal stdout was on
+static void logStatus(const char *last)
+{
+    char line[LOG_STATUSWIDTH + 16];
+    int n = snprintf(line, sizeof(line), "\r\033[K[%s] %s: %ld line(s) | %s", logVM, logStep,
+        logLines, last);
+    if (n > LOG_STATUSWIDTH) { n = LOG_STATUSWIDTH; }
+    if (write(logConsole, line, n) < 0) { logTTY = false; }
+}
+
+
+// Record one line of output: into the log file and the ring
+static void logLine(const char *text, size_t len, int stream)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&tv.tv_sec));
+    fprintf(logFile, "%s.%03ld %s| %.*s\n", stamp, (long)tv.tv_usec / 1000,
+        stream ? "err" : "out", (int)len, text);
+
+    if (len >= LOG_LINEMAX) { len = LOG_LINEMAX - 1; }
+    memcpy(logTail[logTailNext], text, len);
+    logTail[logTailNext][len] = '\0';
+    logTailNext = (logTailNext + 1) % LOG_TAILLINES;
+    if (logTailCount < LOG_TAILLINES) { logTailCount++; }
+    logLines++;
+}
+
+
+// Read both pipes until the capture ends, splitting what comes into lines
+static void * logReader(void *arg)
+{
+    char buf[2][LOG_READSIZE];
+    size_t used[2] = { 0, 0 };
+    bool open[2] = { true, true };
+    long long drawn = 0;
+    while (open[0] || open[1]) {
+        struct pollfd fds[2];
+        for (int s = 0; s < 2; ++s) {
+            fds[s].fd = open[s] ? logPipe[s] : -1;
+            fds[s].events = POLLIN;
+        }
+        if (poll(fds, 2, LOG_REDRAWMS) < 0 && errno != EINTR) { break; }
+        for (int s = 0; s < 2; ++s) {
+            if (!open[s] || !(fds[s].revents & (POLLIN | POLLHUP))) { continue; }
+            ssize_t n = read(logPipe[s], buf[s] + used[s], sizeof(buf[s]) - used[s]);
+            if (n <= 0) {
+                if (used[s]) { logLine(buf[s], used[s], s); }
+                used[s] = 0;
+                open[s] = false;
+                continue;
+            }
+            used[s] += n;
+            // Every complete line, then whatever fills the whole buffer
+            size_t start = 0;
+            for (size_t i = 0; i < used[s]; ++i) {
+                if (buf[s][i] != '\n') { continue; }
+                size_t len = i - start;
+                if (len && buf[s][start + len - 1] == '\r') { len--; }
+                logLine(buf[s] + start, len, s);
+                start = i + 1;
+            }
+            if (start == 0 && used[s] == sizeof(buf[s])) {
+                logLine(buf[s], used[s], s);
+                start = used[s];
+            }
+            memmove(buf[s], buf[s] + start, used[s] - start);
+            used[s] -= start;
+        }
+        long long now = logNow();
+        if (logTTY && logTailCount && now - drawn >= LOG_REDRAWMS) {
+            logStatus(logTail[(logTailNext + LOG_TAILLINES - 1) % LOG_TAILLINES]);
+            drawn = now;
+        }
+    }
+    fflush(logFile);
+    return arg;
+}
+
+
+// Start the log of provisioning given VM, dropping that of its last provisioning
+void BeginVMLog(const char *vmName)
+{
+    char path[512];
+    logPath(vmName, path, sizeof(path));
+    logFile = fopen(path, "w");
+    if (!logFile) {
+        fprintf(stderr, "[%s] Error writing log '%s'\n", vmName, path);
+        return;
+    }
+    argCopy(logVM, 63, (char *)vmName);
+    time_t now = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(logFile, "# %s provisioning of '%s', started %s\n", prgname, vmName, stamp);
+    fflush(logFile);
+}
+
+
+// Send stdout and stderr to the log of the VM being provisioned, as given step
+void CaptureVMLog(const char *step)
+{
+    if (!logFile || logConsole >= 0) { return; }
+    int out[2], err[2];
+    if (pipe(out)) { return; }
+    if (pipe(err)) {
+        close(out[0]);
+        close(out[1]);
+        return;
+    }
+    argCopy(logStep, 15, (char *)step);
+    fprintf(logFile, "# %s\n", step);
+    fflush(logFile);
+    logTailNext = logTailCount = 0;
+    logLines = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    logConsole = dup(STDOUT_FILENO);
+    logSavedErr = dup(STDERR_FILENO);
+    logTTY = isatty(logConsole);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(out[1]);
+    close(err[1]);
+    logPipe[0] = out[0];
+    logPipe[1] = err[0];
+    pthread_create(&logThread, NULL, logReader, NULL);
+}
+
+
+// Put stdout and stderr back, once the step is done. If it failed, show the
+// last lines it output
+void ReleaseVMLog(bool ok)
+{
+    if (logConsole < 0) { return; }
+    fflush(stdout);
+    fflush(stderr);
+    dup2(logConsole, STDOUT_FILENO);
+    dup2(logSavedErr, STDERR_FILENO);
+    pthread_join(logThread, NULL);   // Reads what's left, until both pipes close
+    close(logPipe[0]);
+    close(logPipe[1]);
+    close(logConsole);
+    close(logSavedErr);
+    logConsole = logSavedErr = logPipe[0] = logPipe[1] = -1;
+
+    if (logTTY) { printf("\r\033[K"); }
+    printf("[%s] %s %s, %ld line(s) of output logged\n", logVM, logStep,
+        ok ? "done" : "failed", logLines);
+    if (!ok) {
+        for (int i = 0; i < logTailCount; ++i) {
+            int j = (logTailNext + LOG_TAILLINES - logTailCount + i) % LOG_TAILLINES;
+            fprintf(stderr, "[%s] | %s\n", logVM, logTail[j]);
+        }
+        if (logLines > logTailCount) {
+            fprintf(stderr, "[%s] See '%s logs %s' for all of it\n", logVM, prgname, logVM);
+        }
+    }
+}
+
+
+// Finish the log of the VM being provisioned
+void EndVMLog(void)
+{
+    ReleaseVMLog(false);
+    if (logFile) { fclose(logFile); }
+    logFile = NULL;
+}
+
+
+// Page the log of the last provisioning of given VM
+void vmLogs(int argc, char *argv[])
+{
+    if (argc != 1) {
+        printf("Usage: %s logs <vmName>\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    char vmName[64];
+    argCopy(vmName, 63, argv[0]);
+    char path[512];
+    logPath(vmName, path, sizeof(path));
+    if (!isFile(path)) {
+        fprintf(stderr, "No provisioning log for VM '%s'\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+
+    // Through the pager on a terminal, or as is into a pipe or file
+    if (isatty(STDOUT_FILENO)) {
+        const char *pager = getenv("PAGER");
+        char cmd[1024];
+        snprintf(cmd, sizeof(cmd), "%s '%s'", pager && *pager ? pager : "less", path);
+        Exit(RunCmd(cmd) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error reading '%s'\n", path);
+        Exit(EXIT_FAILURE);
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) { fwrite(buf, 1, n, stdout); }
+    fclose(fp);
+    Exit(EXIT_SUCCESS);
+}
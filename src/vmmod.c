@@ -2,9 +2,33 @@
 
 #include "vmc.h"
 
-// Modify VM's CPU and memory setting
+// VMProcPriority names, for the ones vmconf and 'vmc mod' take
+static const char *priorityNames[] = {
+    "invalid", "default", "flat", "low", "", "normal", "high"
+};
+
+
+// Modify VM's CPU and memory setting, or CPU cap or priority
 void vmMod(int argc, char *argv[])
 {
+    // CPU cap and priority can be changed while the VM runs
+    if (argc == 3 && (Equal(argv[1], "cap") || Equal(argv[1], "prio"))) {
+        char vmName[64] = "";
+        argCopy(vmName, 64, argv[0]);
+        IMachine *vm = GetVM(vmName);
+        if (!vm) {
+            printf("VM '%s' is not registered\n", vmName);
+            Exit(EXIT_FAILURE);
+        }
+        if (Equal(argv[1], "cap") && (atoi(argv[2]) < 1 || atoi(argv[2]) > 100)) {
+            printf("CPU cap '%s' is invalid. Use a percentage from 1 to 100\n", argv[2]);
+            Exit(EXIT_FAILURE);
+        }
+        bool ok = Equal(argv[1], "cap") ?
+            ModVMLive(vm, (ULONG)atoi(argv[2]), NULL) : ModVMLive(vm, 0, argv[2]);
+        Exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     char vmName[64] = "", cpu[] = "01", mem[] = "01024";
     if (argc == 3) {
         argCopy(vmName, 64, argv[0]);
@@ -16,7 +40,9 @@ void vmMod(int argc, char *argv[])
         argCopy(cpu, 2, argv[1]);
     }
     else {
-        printf("Usage: %s mod <vmName> <cpus> [<memory>]\n", prgname);
+        printf("Usage: %s mod <vmName> <cpus> [<memory>]\n"
+            "       %s mod <vmName> cap <percent>\n"
+            "       %s mod <vmName> prio <low|normal|high>\n", prgname, prgname, prgname);
         Exit(EXIT_FAILURE);
     }
 
@@ -33,6 +59,16 @@ void vmMod(int argc, char *argv[])
         Exit(EXIT_FAILURE);
     }
 
+    // Check it against the host's capacity, as a plan of one VM
+    VMPlan plan = { .vm = vm, .cpus = (ULONG)atoi(cpu), .memory = (ULONG)atoi(mem),
+        .state = MachineState_PoweredOff, .changes = PLAN_CPUS | PLAN_MEMORY };
+    argCopy(plan.name, 63, vmName);
+    HostCap cap;
+    InitHostCap(&cap, NULL);
+    if (!AdmitProvPlan(&cap, &plan, 1)) {
+        Exit(EXIT_FAILURE);
+    }
+
     if (!ModVM(vm, cpu, mem)) {
         Exit(EXIT_FAILURE);
     }
@@ -44,31 +80,110 @@ void vmMod(int argc, char *argv[])
 // Mod VM cpu count and memory size
 bool ModVM(IMachine *vm, char *cpuCount, char *memSize)
 {
-    int vmCpu = (int)atoi(cpuCount);
-    int vmMem = (int)atoi(memSize);
-
-    PRUint32 hostCpu;
-    IHost_GetProcessorOnlineCount(ihost, &hostCpu);
-    if (hostCpu - vmCpu < 2) {
-        fprintf(stderr, "This host only has %u CPUs. Assigning %u will oversubscribe it\n",
-            hostCpu, vmCpu);
+    VMTxn *txn = BeginVMTxn(vm);
+    if (!TxnSetCPUMem(txn, (ULONG)atoi(cpuCount), (ULONG)atoi(memSize))) {
+        AbortVMTxn(txn);
+        return false;
+    }
+    return CommitVMTxn(txn);
+}
+
+
+// Set VM cpu count and memory size within given transaction
+bool TxnSetCPUMem(VMTxn *txn, ULONG cpus, ULONG memory)
+{
+    // NOTE: Whether the host can take this is up to the caller, with AdmitProvPlan.
+    // It weighs all VMs being provisioned together, not just this one in isolation
+    int vmCpu = (int)cpus;
+    int vmMem = (int)memory;
+
+    // Only touch what's different, so an unchanged VM needs no saving
+    ULONG curCpu, curMem;
+    IMachine_GetCPUCount(txn->vmMuta, &curCpu);
+    IMachine_GetMemorySize(txn->vmMuta, &curMem);
+    if (curCpu != cpus) {
+        IMachine_SetCPUCount(txn->vmMuta, vmCpu);
+        txn->dirty = true;
+    }
+    if (curMem != memory) {
+        IMachine_SetMemorySize(txn->vmMuta, vmMem);
+        txn->dirty = true;
+    }
+    return true;
+}
+
+
+// Set VM's CPU execution cap and/or process priority, leaving alone whichever
+// is 0 or NULL. A running VM takes both right away, with no restart
+bool ModVMLive(IMachine *vm, ULONG cpucap, const char *priority)
+{
+    VMTxn *txn = BeginLiveVMTxn(vm);
+    bool ok = true;
+    if (ok && cpucap) { ok = TxnSetCPUCap(txn, cpucap); }
+    if (ok && priority) { ok = TxnSetPriority(txn, priority); }
+    if (!ok) {
+        AbortVMTxn(txn);
+        return false;
+    }
+    return CommitVMTxn(txn);
+}
+
+
+// Set VM CPU execution cap, in percent of each host CPU, within given transaction
+bool TxnSetCPUCap(VMTxn *txn, ULONG cpucap)
+{
+    if (cpucap < 1 || cpucap > 100) {
+        fprintf(stderr, "CPU cap '%u' is invalid. Use a percentage from 1 to 100\n", cpucap);
         return false;
     }
+    ULONG curCap;
+    IMachine_GetCPUExecutionCap(txn->vmMuta, &curCap);
+    if (curCap == cpucap) { return true; }
 
-    PRUint32 hostMem;
-    IHost_GetMemoryAvailable(ihost, &hostMem);
-    if (hostMem - vmMem < 8192) {
-        fprintf(stderr, "This host only has %uMB of RAM. Assigning %u will oversubscribe it\n",
-            hostMem, vmMem);
+    TraceBegin("IMachine_SetCPUExecutionCap");
+    HRESULT rc = IMachine_SetCPUExecutionCap(txn->vmMuta, cpucap);
+    TraceEnd();
+    if (FAILED(rc)) {
+        fprintf(stderr, "Error setting CPU execution cap\n");
+        PrintVBoxException();
         return false;
     }
+    txn->dirty = true;
+    return true;
+}
 
-    IMachine *vmMuta = NULL;
-    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
 
-    IMachine_SetCPUCount(vmMuta, vmCpu);
-    IMachine_SetMemorySize(vmMuta, vmMem);
+// Set VM process priority (low, normal or high) within given transaction
+bool TxnSetPriority(VMTxn *txn, const char *priority)
+{
+    PRUint32 value = VMProcPriority_Invalid;
+    if (Equal(priority, "low")) { value = VMProcPriority_Low; }
+    else if (Equal(priority, "normal")) { value = VMProcPriority_Normal; }
+    else if (Equal(priority, "high")) { value = VMProcPriority_High; }
+    else {
+        fprintf(stderr, "Priority '%s' is invalid. Use 'low', 'normal' or 'high'\n", priority);
+        return false;
+    }
+    PRUint32 curValue;
+    IMachine_GetVMProcessPriority(txn->vmMuta, &curValue);
+    if (curValue == value) { return true; }
 
-    CloseSession(session);
+    TraceBegin("IMachine_SetVMProcessPriority");
+    HRESULT rc = IMachine_SetVMProcessPriority(txn->vmMuta, value);
+    TraceEnd();
+    if (FAILED(rc)) {
+        fprintf(stderr, "Error setting process priority\n");
+        PrintVBoxException();
+        return false;
+    }
+    txn->dirty = true;
     return true;
 }
+
+
+// Name of given VMProcPriority value
+const char * PriorityName(PRUint32 priority)
+{
+    if (priority > VMProcPriority_High || !priorityNames[priority][0]) { return "invalid"; }
+    return priorityNames[priority];
+}
@@ -0,0 +1,89 @@
+// vmprops.c
+
+#include "vmc.h"
+
+// Interned guest property keys. The handful of /vm/* properties this program
+// keeps on every VM are read and written over and over, and the API only takes
+// their paths as UTF16. So they're converted once, at startup, into a small
+// hash table keyed by the FNV hash of the UTF8 path, and GetVMProp, SetVMProp
+// and friends look them up there instead of converting and freeing the path
+// on every call. Any other path is still converted as before. The table is
+// only written at startup and on exit, so threads can share it.
+
+typedef struct PropKeySlot {
+    const char *path;
+    BSTR path_16;
+} PropKeySlot;
+
+static const char *propKeyPaths[] = {
+    "/vm/ip", "/vm/nettype", "/vm/name", "/vm/netmask", "/vm/broadcast",
+    "/vm/balloon", "/vm/transport", "/vm/step/vmcopy", "/vm/step/vmrun",
+};
+
+static PropKeySlot propKeys[PROP_KEYSLOTS];
+
+
+// Slot of given path: where it's kept, or the empty one it would go in
+static PropKeySlot * propKeySlot(const char *path)
+{
+    PRUint64 h = HashFNV(FNV_INIT, path, strlen(path));
+    for (int n = 0; n < PROP_KEYSLOTS; ++n) {
+        PropKeySlot *slot = &propKeys[(h + n) & (PROP_KEYSLOTS - 1)];
+        if (!slot->path || Equal(slot->path, path)) { return slot; }
+    }
+    return NULL;
+}
+
+
+// Convert every interned path to UTF16, once. Needs the API initialized
+void InitPropKeys(void)
+{
+    for (int i = 0; i < sizeof(propKeyPaths) / sizeof(propKeyPaths[0]); ++i) {
+        PropKeySlot *slot = propKeySlot(propKeyPaths[i]);
+        if (!slot || slot->path) { continue; }
+        slot->path = propKeyPaths[i];
+        Convert8to16(slot->path, &slot->path_16);
+    }
+}
+
+
+// Free what InitPropKeys converted
+void FreePropKeys(void)
+{
+    for (int i = 0; i < PROP_KEYSLOTS; ++i) {
+        if (propKeys[i].path_16) { FreeBSTR(propKeys[i].path_16); }
+        propKeys[i].path = NULL;
+        propKeys[i].path_16 = NULL;
+    }
+}
+
+
+// UTF16 form of given property path if it's interned, else NULL. What's
+// returned belongs to the table and must not be freed
+BSTR PropKey(const char *path)
+{
+    PropKeySlot *slot = propKeySlot(path);
+    return slot && slot->path ? slot->path_16 : NULL;
+}
+
+
+// Get the values of count /vm/* guest properties of VM with one API call
+// instead of one each. Every values[i] is set to a newly allocated string, or
+// to NULL where paths[i] has no value, same as GetVMProp would
+void GetVMPropValues(IMachine *vm, const char *paths[], char *values[], int count)
+{
+    char **names = NULL, **all = NULL;
+    ULONG total = GetVMProps(vm, "/vm/*", &names, &all);
+    for (int i = 0; i < count; ++i) {
+        values[i] = NULL;
+        for (ULONG j = 0; j < total; ++j) {
+            if (all[j] && Equal(names[j], paths[i])) {
+                // Hand over the value, so FreeVMProps leaves it be
+                if (all[j][0] != '\0') { values[i] = all[j]; all[j] = NULL; }
+                break;
+            }
+        }
+    }
+    // REMINDER: Caller must free each of values
+    FreeVMProps(names, all, total);
+}
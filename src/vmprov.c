@@ -1,6 +1,12 @@
 // vmprov.c
 
+#define _DEFAULT_SOURCE   // scandir and alphasort under -std=c99
+
 #include "vmc.h"
+#include <dirent.h>
+
+static int provRetries = PROV_RETRIES;         // From optional global keys
+static int provRetryDelay = PROV_RETRYDELAY;
 
 // Provision VMs
 void vmProv(int argc, char *argv[])
@@ -17,20 +23,64 @@ void vmProv(int argc, char *argv[])
         Exit(EXIT_SUCCESS);
     }
 
+    // Tear down all VMs in the file, with trailing options f = no confirmation
+    // and h = hard power off, same as 'vmc del'
+    if (argc > 0 && Equal(argv[0], "down")) {
+        argc--; argv++;
+        bool force = false, hard = false;
+        while (argc > 0 && (Equal(argv[argc - 1], "f") || Equal(argv[argc - 1], "h"))) {
+            if (Equal(argv[argc - 1], "f")) { force = true; }
+            else { hard = true; }
+            argc--;
+        }
+        char *downFile = NewString(257);
+        if (argc == 1 && isFile(argv[0])) { argCopy(downFile, 256, argv[0]); }
+        else if (argc == 0 && isFile(vmconf)) { strcpy(downFile, vmconf); }
+        else {
+            printf("Usage: %s prov down [<vmConf>] [f] [h]\n", prgname);
+            Exit(EXIT_FAILURE);
+        }
+        ProvisionDown(downFile, force, hard);
+        Exit(EXIT_SUCCESS);
+    }
+
+    // Optional 'plan', 'apply' or 'resume' action. Plain 'prov' is the same as 'apply'
+    bool planOnly = false, resume = false;
+    if (argc > 0 && (Equal(argv[0], "plan") || Equal(argv[0], "apply") ||
+        Equal(argv[0], "resume"))) {
+        planOnly = Equal(argv[0], "plan");
+        resume = Equal(argv[0], "resume");
+        argc--; argv++;
+    }
+    // Trailing f = run vmcopy and vmrun even if their inputs haven't changed
+    bool force = false;
+    if (argc > 0 && Equal(argv[argc - 1], "f")) {
+        force = true;
+        argc--;
+    }
+
     char *provFile = NewString(257);
     if (argc == 1 && isFile(argv[0])) {
         // Provision with given existing file as requested
         argCopy(provFile, 256, argv[0]);
     }
-    else if (isFile(vmconf)) {
+    else if (argc == 0 && isFile(vmconf)) {
         // Provision with default vmconf file, existing in CWD
         strcpy(provFile, vmconf);
     }
     else {
-        printf("Usage: %s prov [<vmConf>|c]\n", prgname);
+        printf("Usage: %s prov [plan|apply] [<conf>|c] [f]\n"
+            "       %s prov resume [<vmConf>] [f]\n"
+            "       %s prov down [<vmConf>] [f] [h]\n", prgname, prgname, prgname);
         Exit(EXIT_FAILURE);
     }
 
+    // A plan only reads things, so it's safe to run from anywhere
+    if (planOnly) {
+        PlanConfig(provFile);
+        Exit(EXIT_SUCCESS);
+    }
+
     // Prohibit running this command from user's HOME directory
     char *cwd = NewString(1024);
     if (getcwd(cwd, 1024) == NULL) {
@@ -51,235 +101,886 @@ void vmProv(int argc, char *argv[])
     // if (cwd) { free(cwd); }
     // if (homedir) { free(homedir); }
 
-    ProvisionConfig(provFile);
+    ProvisionConfig(provFile, force, resume);
 
     Exit(EXIT_SUCCESS);
 }
 
 
-// Provision VM(s) as defined in given INI configuration file
-void ProvisionConfig(char *provFile)
+// Print what provisioning the given INI configuration file would do, without doing it
+void PlanConfig(char *provFile)
+{
+    int count;
+    HostCap cap;
+    VMPlan *plan = BuildProvPlan(provFile, &count, &cap);
+    printf("=> Plan for %d VM(s) defined in file '%s'\n", count, provFile);
+    bool admitted = AdmitProvPlan(&cap, plan, count);
+    PrintHostCap(&cap, plan, count);
+    PrintProvPlan(plan, count);
+    free(plan);
+    if (!admitted) { Exit(EXIT_FAILURE); }
+}
+
+
+// One attempt at provisioning this VM. False if it failed, including by any
+// helper exiting, in which case Exit() jumps back here. A retry first reads
+// the VM afresh, so what the failed attempt got done isn't done again
+static bool provAttempt(VMPlan *p, bool force, bool retry)
+{
+    jmp_buf trap;
+    if (setjmp(trap)) {   // SetExitTrap(NULL) was done by Exit()
+        ReleaseVMLog(false);
+        return false;
+    }
+    SetExitTrap(&trap);
+
+    if (retry && !p->vm) {
+        BSTR name_16;
+        Convert8to16(p->name, &name_16);
+        IVirtualBox_FindMachine(vbox, name_16, &p->vm);   // Created before failing
+        FreeBSTR(name_16);
+    }
+    if (retry && p->vm) { ReadVMPlanState(p); }
+    bool ok = ApplyVMPlan(p) && ProvisionSteps(p, force);
+
+    SetExitTrap(NULL);
+    return ok;
+}
+
+
+// Provision this VM, retrying up to provRetries times after a failure, since
+// its cause may be passing: a busy VirtualBox service, or SSH not up yet. The
+// delay before each retry doubles. Every VM done is recorded in the journal,
+// and the output of all its attempts goes to its log
+static bool provisionVM(VMPlan *p, bool force)
+{
+    if (ProvJournalHas(p->name, "done")) {
+        printf("[%s] Provisioned by the run being resumed. Done.\n", p->name);
+        return true;
+    }
+    BeginVMLog(p->name);
+    for (int attempt = 0; attempt <= provRetries; attempt++) {
+        if (attempt > 0) {
+            int delay = provRetryDelay << (attempt - 1);
+            printf("[%s] Retrying in %ds, %d of %d\n", p->name, delay, attempt, provRetries);
+            sleep(delay);
+        }
+        if (provAttempt(p, force, attempt > 0)) {
+            ProvJournalMark(p->name, "done");
+            EndVMLog();
+            return true;
+        }
+    }
+    EndVMLog();
+    fprintf(stderr, "[%s] Not provisioned\n", p->name);
+    return false;
+}
+
+
+// Provision VM(s) as defined in given INI configuration file. With force, the
+// vmcopy and vmrun steps run even if their inputs are unchanged. With resume,
+// what the last run of this file got done before it stopped is skipped
+void ProvisionConfig(char *provFile, bool force, bool resume)
+{
+    // NOTE: We leave an existing VM running if it is both named and configured exactly as
+    // defined in vmconf. If it's configured differently, then we'll only apply what's
+    // different: settings that require it powered off get a stop/modify/restart, and
+    // everything else is left alone. If the VM doesn't exist then the process is to
+    // simply create a new one. Nothing is done at all if the whole plan doesn't fit
+    // the host's capacity, unless its policy says to queue or shrink VMs. A VM that
+    // fails is retried, then left to 'vmc prov resume' while the others carry on.
+    int count;
+    HostCap cap;
+    VMPlan *plan = BuildProvPlan(provFile, &count, &cap);
+    if (!AdmitProvPlan(&cap, plan, count)) { Exit(EXIT_FAILURE); }
+    if (!OpenProvJournal(provFile, resume)) {
+        printf("=> No unfinished run of file '%s' to resume\n", provFile);
+        free(plan);
+        return;
+    }
+    printf("=> %s %d VM(s) defined in file '%s'\n", resume ? "Resuming provisioning of" :
+        "Provisioning", count, provFile);
+    PrintHostCap(&cap, plan, count);
+    PrintProvPlan(plan, count);
+    ResumeProvPlan(plan, count);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (plan[i].queued) { continue; }
+        if (!provisionVM(&plan[i], force)) { failed++; }
+    }
+    // Then the queued ones, as the host frees up room for each
+    for (int i = 0; i < count; i++) {
+        if (!plan[i].queued) { continue; }
+        if (!WaitHostCap(&cap, plan, count, &plan[i]) || !provisionVM(&plan[i], force)) {
+            failed++;
+        }
+    }
+
+    free(plan);
+    CloseProvJournal(failed == 0);
+    if (failed) {
+        fprintf(stderr, "=> %d VM(s) not provisioned. Run '%s prov resume %s' to carry on "
+            "from where this run stopped\n", failed, prgname, provFile);
+        Exit(EXIT_FAILURE);
+    }
+}
+
+
+// Resume all saved VMs that need no settings changed, at once. Their OS picks
+// up where it was, instead of booting from scratch
+void ResumeProvPlan(VMPlan *plan, int count)
+{
+    IMachine **vms = calloc(count + 1, sizeof(IMachine *));
+    ExitIfNull(vms, __FILE__, __LINE__);
+    int saved = 0;
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (p->queued || !p->vm || (p->changes & (PLAN_OFFLINE | PLAN_RESET))) { continue; }
+        if (p->state == MachineState_Saved) { vms[saved++] = p->vm; }
+    }
+    if (saved) {
+        printf("=> Resuming %d VM(s) from saved state\n", saved);
+        StartVMs(vms, saved, "headless");
+    }
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (p->vm && p->state == MachineState_Saved && VMState(p->vm) == MachineState_Running) {
+            printf("[%s] Resumed\n", p->name);
+            p->state = MachineState_Running;
+            p->changes &= ~PLAN_START;
+        }
+    }
+    free(vms);
+}
+
+
+// Delete every existing VM defined in given INI configuration file, all at once
+void ProvisionDown(char *provFile, bool force, bool hard)
 {
-    // Check INI config file for inconsistencies
     struct ini_t *cfg = ini_load(provFile);
     if (!cfg) {
         fprintf(stderr, "=> Couldn't load file '%s'\n", provFile);
         Exit(EXIT_FAILURE);
     }
+    int sectionCount;
+    const char **sections = ini_GetSections(cfg, &sectionCount);
+    IMachine **vms = calloc(sectionCount + 1, sizeof(IMachine *));
+    ExitIfNull(vms, __FILE__, __LINE__);
+    int count = 0;
+    for (int i = 0; i < sectionCount; i++) {
+        IMachine *vm = GetVM((char *)sections[i]);
+        if (vm) { vms[count++] = vm; }
+    }
+    free(sections);
+    ini_free(cfg);
 
-    // Get the sections (VMs) defined
-    int count;
-    const char **sections = ini_GetSections(cfg, &count);
-    if (count < 1) {
-        fprintf(stderr, "=> No VM sections defined\n");
-        Exit(EXIT_FAILURE);
+    printf("=> Tearing down %d VM(s) defined in file '%s'", count, provFile);
+    if (count < sectionCount) { printf(", skipping %d that don't exist", sectionCount - count); }
+    printf("\n");
+    if (count == 0 || (!force && !ConfirmDeleteVMs(vms, count))) {
+        free(vms);
+        return;
     }
+    PRInt64 freed = 0;
+    int deleted = DeleteVMs(vms, count, hard, &freed);
+    free(vms);
+    printf("=> Deleted %d of %d VM(s), freeing %lldMB of disk space\n",
+        deleted, count, (long long)(freed / (1024 * 1024)));
+    if (deleted != count) { Exit(EXIT_FAILURE); }
+}
 
-    printf("=> Provisioning %d VM(s) defined in file '%s'\n", count, provFile);
 
-    for (int i = 0; i < count; i++) {
-        // printf("[%p]%02d|%s|\n", sections[i], i, sections[i]);
-        const char *image = ini_get(cfg, sections[i], "image");
-        const char *netip = ini_get(cfg, sections[i], "netip");
-        // printf("vm=%s image=%s netip=%s\n", sections[i], image, netip);
-        if (image && netip) { continue; }
-        fprintf(stderr, "=> Error. Each section (VM) requires at least 'image' and 'netip' defined\n");
+// Read given INI configuration file, and compare it to existing VMs
+VMPlan * BuildProvPlan(char *provFile, int *count, HostCap *cap)
+{
+    // Check INI config file for inconsistencies
+    struct ini_t *cfg = ini_load(provFile);
+    if (!cfg) {
+        fprintf(stderr, "=> Couldn't load file '%s'\n", provFile);
         Exit(EXIT_FAILURE);
     }
 
-    // Provision each VM as per its parameters defined in its vmconf section
-    for (int i = 0; i < count; i++) {
-        // NOTE: We leave an existing VM running if it is both named and configured exactly as
-        // defined in vmconf. If it's configured differently, then we'll stop it, modify it
-        // according to vmconf, then restart it. If the VM doesn't exist then the process is
-        // to simply create a new one.
+    // Get the sections (VMs) defined
+    const char **sections = ini_GetSections(cfg, count);
+    if (*count < 1) {
+        fprintf(stderr, "=> No VM sections defined\n");
+        Exit(EXIT_FAILURE);
+    }
+
+    VMPlan *plan = calloc(*count, sizeof(VMPlan));
+    ExitIfNull(plan, __FILE__, __LINE__);
+    // REMINDER: Caller must free allocated memory
 
-        // READ VMCONF FILE
-        // Get the 8 possible config entries for this VM from the vmconf file
+    // READ VMCONF FILE
+    // Get the 17 possible config entries for each VM from the vmconf file
+    for (int i = 0; i < *count; i++) {
+        VMPlan *p = &plan[i];
 
         // #1 name (Mandatory). Same as the section name
-        char *vmName = malloc(sizeof(char) * strlen(sections[i]) + 1);
-        ExitIfNull(vmName, __FILE__, __LINE__);
-        strcpy(vmName, sections[i]);
-        printf("[%s] Provisioning this VM\n", vmName);
+        argCopy(p->name, 63, (char *)sections[i]);
 
         // #2 image (Mandatory)
         const char *image = ini_get(cfg, sections[i], "image");
-        char *vmImg = malloc(sizeof(char) * strlen(image) + 1);
-        ExitIfNull(vmImg, __FILE__, __LINE__);
-        strcpy(vmImg, image);
-        char vmImgPath[1024] = "";
-        sprintf(vmImgPath, "%s%c%s", vmhome, PATHCHAR, vmImg);
-        if (!isFile(vmImgPath)) {
+        // #3 netip (Mandatory)
+        const char *netip = ini_get(cfg, sections[i], "netip");
+        if (!image || !netip) {
+            fprintf(stderr, "=> Error. Each section (VM) requires at least 'image' and 'netip' defined\n");
+            Exit(EXIT_FAILURE);
+        }
+        if (strlen(vmhome) + strlen(image) > 1000) {
+            fprintf(stderr, "[%s] Image name '%s' is too long\n", p->name, image);
+            Exit(EXIT_FAILURE);
+        }
+        sprintf(p->image, "%s%c%s", vmhome, PATHCHAR, image);
+        if (!isFile(p->image)) {
             fprintf(stderr, "[%s] Image '%s' doesn't exist. Please specify an available image\n",
-                vmName, vmImg);
+                p->name, image);
             Exit(EXIT_FAILURE);
         }
-
-        // #3 netip (Mandatory)
-        const char *netip = ini_get(cfg, sections[i], "netip");
         if (!ValidIpStr(netip) || endsWith(netip, ".1")) {
-            printf("[%s] IP address '%s' is invalid", vmName, netip);
+            printf("[%s] IP address '%s' is invalid\n", p->name, netip);
             Exit(EXIT_FAILURE);
         }
-        char vmNetIp[16] = "";
-        strcpy(vmNetIp, netip);
+        strcpy(p->ip, netip);
 
         // #4 cpus
         const char *cpus = ini_get(cfg, sections[i], "cpus");
-        char vmCpus[3] = "1";
-        if (cpus) { strcpy(vmCpus, cpus); }
+        p->cpus = cpus ? (ULONG)atoi(cpus) : 1;
 
         // #5 memory
         const char *memory = ini_get(cfg, sections[i], "memory");
-        char vmMemory[6] = "1024";
-        if (memory) { strcpy(vmMemory, memory); }
+        p->memory = memory ? (ULONG)atoi(memory) : 1024;
 
         // #6 vmcopy
         const char *vmcopy = ini_get(cfg, sections[i], "vmcopy");
-        char vmCopy[1024] = "";
-        if (vmcopy) { strcpy(vmCopy, vmcopy); }
+        if (vmcopy) { argCopy(p->vmcopy, 1023, (char *)vmcopy); }
 
         // #7 vmrun
         const char *vmrun = ini_get(cfg, sections[i], "vmrun");
-        char vmRun[1024] = "";
-        if (vmrun) { strcpy(vmRun, vmrun); }
+        if (vmrun) { argCopy(p->vmrun, 1023, (char *)vmrun); }
 
         // #8 nettype
         const char *nettype = ini_get(cfg, sections[i], "nettype");
-        char vmNettype[4] = "ho";
-        if (nettype) { strcpy(vmNettype, nettype); }
+        strcpy(p->nettype, "ho");
+        if (nettype) {
+            if (!Equal(nettype, "ho") && !Equal(nettype, "bri")) {
+                fprintf(stderr, "[%s] Net type '%s' is invalid. Use 'ho' or 'bri'\n",
+                    p->name, nettype);
+                Exit(EXIT_FAILURE);
+            }
+            strcpy(p->nettype, nettype);
+        }
 
-        // Note, basic parameters updates can only be applied when the VM is powered off,
-        // which is why we're doing the checks/updates here. If the VM is running and it's
-        // already configured as per vmconf then we want to leave it alone
+        // #9 pagefusion
+        const char *pagefusion = ini_get(cfg, sections[i], "pagefusion");
+        if (pagefusion) {
+            if (!Equal(pagefusion, "on") && !Equal(pagefusion, "off")) {
+                fprintf(stderr, "[%s] Page fusion '%s' is invalid. Use 'on' or 'off'\n",
+                    p->name, pagefusion);
+                Exit(EXIT_FAILURE);
+            }
+            strcpy(p->pagefusion, pagefusion);
+        }
 
-        // Does the VM exist already?
-        IMachine *vm = GetVM(vmName);
-        if (vm) {
-            // Yes, it does. We'll ensure its configured as per vmconf 
-            printf("[%s] This VM already exists\n", vmName);
+        // #10 balloon
+        const char *balloon = ini_get(cfg, sections[i], "balloon");
+        p->balloon = balloon ? atoi(balloon) : -1;
+        if (p->balloon > (PRInt32)p->memory) {
+            fprintf(stderr, "[%s] Balloon of %dMB is more than the VM's %uMB of memory\n",
+                p->name, p->balloon, p->memory);
+            Exit(EXIT_FAILURE);
         }
-        else {
-            // No, it does not. Let's create it
-            vm = CreateVM(vmName, vmImgPath);
-            if (!vm) {
-                fprintf(stderr, "[%s] Error creating this VM\n", vmName);
+
+        // #11 cpucap
+        const char *cpucap = ini_get(cfg, sections[i], "cpucap");
+        if (cpucap) {
+            p->cpucap = (ULONG)atoi(cpucap);
+            if (p->cpucap < 1 || p->cpucap > 100) {
+                fprintf(stderr, "[%s] CPU cap '%s' is invalid. Use a percentage from 1 to 100\n",
+                    p->name, cpucap);
                 Exit(EXIT_FAILURE);
             }
         }
-        // By now 'vm' is a handle to the VM being update/created
 
-        // COMPARE TO EXISTING VM VALUES
-        // Next, let's assume VM is already configured as per vmconf, by checking
-        // each of the 8 parameters on the VM itself, to see if any of them is false.
-        bool sameConfig = true;
+        // #12 priority
+        const char *priority = ini_get(cfg, sections[i], "priority");
+        if (priority) {
+            if (!Equal(priority, "low") && !Equal(priority, "normal") && !Equal(priority, "high")) {
+                fprintf(stderr, "[%s] Priority '%s' is invalid. Use 'low', 'normal' or 'high'\n",
+                    p->name, priority);
+                Exit(EXIT_FAILURE);
+            }
+            strcpy(p->priority, priority);
+        }
 
-        // Compare IP Address
-        char *currentVmNetIp = GetVMProp(vm, "/vm/ip");
-        if (!Equal(currentVmNetIp, vmNetIp)) {
-            // Check if proposed IP is already taken by another VM
-            if (UsedIP(vmNetIp, vmName)) {
-                fprintf(stderr, "[%s] IP '%s' is already taken by another VM\n", vmName, vmNetIp);
+        // #13 profile
+        const char *profile = ini_get(cfg, sections[i], "profile");
+        strcpy(p->profile, "default");
+        if (profile) {
+            if (!ValidProfile(profile)) {
+                fprintf(stderr, "[%s] Profile '%s' is invalid. Use 'default' or 'fast'\n",
+                    p->name, profile);
                 Exit(EXIT_FAILURE);
             }
-            sameConfig = false;
-            printf("[%s] Setting IP address to '%s'\n", vmName, vmNetIp);
+            strcpy(p->profile, profile);
         }
 
-        // Compare CPU count
-        ULONG cpuCount;
-        IMachine_GetCPUCount(vm, &cpuCount);
-        if (cpuCount != (ULONG)atoi(vmCpus)) {
-            sameConfig = false;
-            printf("[%s] Setting CPU count to '%s'\n", vmName, vmCpus);
+        // #14 reset_to
+        const char *resetTo = ini_get(cfg, sections[i], "reset_to");
+        if (resetTo) { argCopy(p->resetTo, 63, (char *)resetTo); }
+
+        // #15 transport
+        const char *transport = ini_get(cfg, sections[i], "transport");
+        if (transport) {
+            if (!ValidTransport(transport)) {
+                fprintf(stderr, "[%s] Transport '%s' is invalid. Use 'ssh', 'guest' or 'auto'\n",
+                    p->name, transport);
+                Exit(EXIT_FAILURE);
+            }
+            strcpy(p->transport, transport);
         }
 
-        // Compare Memory setting
-        ULONG memsize;
-        IMachine_GetMemorySize(vm, &memsize);
-        if (memsize != (ULONG)atoi(vmMemory)) {
-            sameConfig = false;
-            printf("[%s] Setting memory to '%s'\n", vmName, vmMemory);
+        // #16 share
+        const char *share = ini_get(cfg, sections[i], "share");
+        if (share) {
+            argCopy(p->share, 1023, (char *)share);
+            if (MissingVMShares(NULL, p->share) < 0) {
+                fprintf(stderr, "[%s] Shared folders '%s' are invalid\n", p->name, p->share);
+                Exit(EXIT_FAILURE);
+            }
         }
 
-        // Now perform updates, if any one parameter was different
-        if (sameConfig) {
-            printf("[%s] VM already configured as per vmconf. Done.\n", vmName);
-            // Start machine if not already running
-            if (VMState(vm) != MachineState_Running) {
-                if (!StartVM(vm, "headless")) {
-                    fprintf(stderr, "[%s] Error starting this VM\n", vmName);
-                    Exit(EXIT_FAILURE);
-                }
+        // #17 vmcopy_mode
+        const char *vmcopyMode = ini_get(cfg, sections[i], "vmcopy_mode");
+        if (vmcopyMode && !Equal(vmcopyMode, "copy") && !Equal(vmcopyMode, "sync")) {
+            fprintf(stderr, "[%s] vmcopy_mode '%s' is invalid. Use 'copy' or 'sync'\n",
+                p->name, vmcopyMode);
+            Exit(EXIT_FAILURE);
+        }
+        p->vmcopySync = Equal(vmcopyMode, "sync");
+
+        // Two sections can't ask for the same IP address
+        for (int j = 0; j < i; j++) {
+            if (Equal(plan[j].ip, p->ip)) {
+                fprintf(stderr, "[%s] IP '%s' is also defined for '%s'\n",
+                    p->name, p->ip, plan[j].name);
+                Exit(EXIT_FAILURE);
             }
         }
+        p->changes = PLAN_CREATE;   // Until we find it below
+    }
+    free(sections);
+    InitHostCap(cap, cfg);   // From optional global keys, before any section
+    const char *val;
+    if ((val = ini_get(cfg, "", "retries"))) { provRetries = atoi(val); }
+    if ((val = ini_get(cfg, "", "retry_delay"))) { provRetryDelay = atoi(val); }
+    if (provRetries < 0 || provRetryDelay < 0) {
+        fprintf(stderr, "=> Retries and retry delay can't be negative\n");
+        Exit(EXIT_FAILURE);
+    }
+    ini_free(cfg);
+
+    // COMPARE TO EXISTING VM VALUES
+    // Walk the VM list only once, reading the current values of every VM named in
+    // vmconf, and checking the IP addresses of all other VMs against vmconf's
+    if (!VMListCount) { UpdateVMList(); }
+    for (int i = 0; i < VMListCount; ++i) {
+        BOOL accessible = FALSE;
+        IMachine_GetAccessible(VMList[i], &accessible);
+        if (!accessible) { continue; }
+
+        char *name = GetVMName(VMList[i]);
+        VMPlan *p = NULL;
+        for (int j = 0; j < *count; j++) {
+            if (Equal(plan[j].name, name)) { p = &plan[j]; break; }
+        }
+
+        if (p) {
+            // This VM is defined in vmconf
+            p->vm = VMList[i];
+            ReadVMPlanState(p);
+        }
         else {
-            printf("[%s] Applying configurations\n", vmName);
-            // Stop machine if already running
-            if (VMState(vm) == MachineState_Running) {
-                if (!StopVM(vm)) {
-                    fprintf(stderr, "[%s] Error stopping this VM\n", vmName);
+            // Some other VM. Ensure it's not using any of the IPs we want
+            char *ip = GetVMProp(VMList[i], "/vm/ip");
+            for (int j = 0; ip && j < *count; j++) {
+                if (Equal(plan[j].ip, ip)) {
+                    fprintf(stderr, "[%s] IP '%s' is already taken by VM '%s'\n",
+                        plan[j].name, ip, name);
                     Exit(EXIT_FAILURE);
                 }
             }
+            if (ip) { free(ip); }
+        }
+        free(name);
+    }
+    return plan;
+}
 
-            // Let's not exit on any of these errors, so we continue with other VMs 
-            if (!SetVMIP(vm, vmNetIp)) {
-                fprintf(stderr, "[%s] Error updating IP address!\n", vmName);
-            }
 
-            if (!ModVM(vm, vmCpus, vmMemory)) {
-                fprintf(stderr, "[%s] Error updating CPU count and/or memory size!\n", vmName);
+// Read current values of an existing VM into its plan, and work out what's different
+void ReadVMPlanState(VMPlan *p)
+{
+    p->changes = 0;
+    p->state = VMState(p->vm);
+
+    // All the guest properties compared, in one round trip
+    const char *paths[] = { "/vm/ip", "/vm/nettype", "/vm/balloon", "/vm/transport" };
+    char *props[4];
+    GetVMPropValues(p->vm, paths, props, 4);
+
+    char *ip = props[0];
+    strcpy(p->curIp, "");
+    if (ip) { argCopy(p->curIp, 15, ip); free(ip); }
+    if (!Equal(p->curIp, p->ip)) { p->changes |= PLAN_IP; }
+
+    IMachine_GetCPUCount(p->vm, &p->curCpus);
+    if (p->curCpus != p->cpus) { p->changes |= PLAN_CPUS; }
+
+    IMachine_GetMemorySize(p->vm, &p->curMemory);
+    if (p->curMemory != p->memory) { p->changes |= PLAN_MEMORY; }
+
+    char *nettype = props[1];
+    strcpy(p->curNettype, "ho");   // Same default as CreateVM
+    if (nettype) { argCopy(p->curNettype, 3, nettype); free(nettype); }
+    if (!Equal(p->curNettype, p->nettype)) { p->changes |= PLAN_NETTYPE; }
+
+    PRBool fusion = FALSE;
+    IMachine_GetPageFusionEnabled(p->vm, &fusion);
+    strcpy(p->curPagefusion, fusion ? "on" : "off");
+    if (p->pagefusion[0] && !Equal(p->curPagefusion, p->pagefusion)) {
+        p->changes |= PLAN_PAGEFUSION;
+    }
+
+    // The configured size, not what 'vmc density auto' may have inflated it to
+    char *balloon = props[2];
+    p->curBalloon = balloon ? (ULONG)atoi(balloon) : 0;
+    if (balloon) { free(balloon); }
+    if (p->balloon >= 0 && p->curBalloon != (ULONG)p->balloon) { p->changes |= PLAN_BALLOON; }
+
+    IMachine_GetCPUExecutionCap(p->vm, &p->curCpucap);
+    if (p->cpucap && p->curCpucap != p->cpucap) { p->changes |= PLAN_CPUCAP; }
+
+    PRUint32 priority = VMProcPriority_Default;
+    IMachine_GetVMProcessPriority(p->vm, &priority);
+    strcpy(p->curPriority, PriorityName(priority));
+    if (p->priority[0] && !Equal(p->curPriority, p->priority)) { p->changes |= PLAN_PRIORITY; }
+
+    // Same default as VMTransport
+    char *transport = props[3];
+    strcpy(p->curTransport, "ssh");
+    if (transport && ValidTransport(transport)) { argCopy(p->curTransport, 7, transport); }
+    if (transport) { free(transport); }
+    if (p->transport[0] && !Equal(p->curTransport, p->transport)) { p->changes |= PLAN_TRANSPORT; }
+
+    if (p->share[0] && MissingVMShares(p->vm, p->share) > 0) { p->changes |= PLAN_SHARE; }
+
+    // Once reset to its snapshot, the VM is compared as is
+    if (p->resetTo[0] && !p->wasReset) {
+        ISnapshot *snapshot = FindVMSnapshot(p->vm, p->resetTo);
+        if (snapshot) {
+            p->changes |= PLAN_RESET;
+            ISnapshot_Release(snapshot);
+        }
+        else { p->changes |= PLAN_SNAPSHOT; }
+    }
+
+    if (!(p->changes & PLAN_OFFLINE) && p->state != MachineState_Running) {
+        p->changes |= PLAN_START;
+    }
+}
+
+
+// Print the differences between vmconf and existing VMs
+void PrintProvPlan(VMPlan *plan, int count)
+{
+    int create = 0, change = 0, start = 0, reset = 0, same = 0, queued = 0;
+    for (int i = 0; i < count; i++) {
+        VMPlan *p = &plan[i];
+        if (p->queued) {
+            printf("[%s] Queued until the host has %u CPU(s) and %uMB free for it\n",
+                p->name, p->cpus, p->memory);
+            queued++;
+            continue;
+        }
+        if (p->changes & PLAN_CREATE) {
+            printf("[%s] Create from image '%s', with IP '%s', %u CPU(s), %uMB, nettype '%s', "
+                "profile '%s'\n", p->name, baseName(p->image), p->ip, p->cpus, p->memory,
+                p->nettype, p->profile);
+            if (p->resetTo[0]) {
+                printf("[%s] Take snapshot '%s' once provisioned\n", p->name, p->resetTo);
+            }
+            create++;
+            continue;
+        }
+        if (p->changes & PLAN_RESET) {
+            // What else changes depends on the snapshot's settings
+            printf("[%s] Reset to snapshot '%s', then apply any vmconf differences\n",
+                p->name, p->resetTo);
+            reset++;
+            continue;
+        }
+        if (p->changes & PLAN_SNAPSHOT) {
+            printf("[%s] Take snapshot '%s' once provisioned\n", p->name, p->resetTo);
+        }
+        if (p->changes & (PLAN_OFFLINE | PLAN_ONLINE)) {
+            const char *how = (p->changes & PLAN_OFFLINE) ? " (requires restart)" : "";
+            if (p->changes & PLAN_IP) {
+                printf("[%s] Change IP address '%s' -> '%s'%s\n", p->name, p->curIp, p->ip, how);
+            }
+            if (p->changes & PLAN_CPUS) {
+                printf("[%s] Change CPU count %u -> %u%s\n", p->name, p->curCpus, p->cpus, how);
+            }
+            if (p->changes & PLAN_MEMORY) {
+                printf("[%s] Change memory %u -> %u%s\n", p->name, p->curMemory, p->memory, how);
+            }
+            if (p->changes & PLAN_NETTYPE) {
+                printf("[%s] Change net type '%s' -> '%s'%s\n",
+                    p->name, p->curNettype, p->nettype, how);
+            }
+            if (p->changes & PLAN_PAGEFUSION) {
+                printf("[%s] Change page fusion '%s' -> '%s'%s\n",
+                    p->name, p->curPagefusion, p->pagefusion, how);
+            }
+            if (p->changes & PLAN_BALLOON) {
+                printf("[%s] Change memory balloon %uMB -> %dMB\n",
+                    p->name, p->curBalloon, p->balloon);
             }
+            if (p->changes & PLAN_CPUCAP) {
+                printf("[%s] Change CPU cap %u%% -> %u%%\n", p->name, p->curCpucap, p->cpucap);
+            }
+            if (p->changes & PLAN_PRIORITY) {
+                printf("[%s] Change priority '%s' -> '%s'\n",
+                    p->name, p->curPriority, p->priority);
+            }
+            if (p->changes & PLAN_TRANSPORT) {
+                printf("[%s] Change transport '%s' -> '%s'\n",
+                    p->name, p->curTransport, p->transport);
+            }
+            if (p->changes & PLAN_SHARE) {
+                printf("[%s] Add shared folders '%s'\n", p->name, p->share);
+            }
+            change++;
+        }
+        else if ((p->changes & PLAN_START) && p->state == MachineState_Saved) {
+            printf("[%s] Configured as per vmconf, resumes from saved state\n", p->name);
+            start++;
+        }
+        else if (p->changes & PLAN_START) {
+            printf("[%s] Configured as per vmconf, but needs starting (%s)\n",
+                p->name, VMStateStr[p->state]);
+            start++;
+        }
+        else {
+            printf("[%s] Already configured as per vmconf\n", p->name);
+            same++;
+        }
+    }
+    printf("=> %d to create, %d to change, %d to start, %d to reset, %d unchanged, %d queued\n",
+        create, change, start, reset, same, queued);
+}
+
+
+// Apply only the changes that the plan found for this VM. False if any failed
+bool ApplyVMPlan(VMPlan *p)
+{
+    bool ok = true;
+    if (p->changes & PLAN_CREATE) {
+        printf("[%s] Creating this VM\n", p->name);
+        p->vm = CreateVM(p->name, p->image, p->profile);
+        if (!p->vm) {
+            fprintf(stderr, "[%s] Error creating this VM\n", p->name);
+            return false;
+        }
+        // CreateVM applies its own defaults, so compare against those now
+        ReadVMPlanState(p);
+    }
 
-            if (!SetVMNetType(vm, vmNettype)) {
-                fprintf(stderr, "[%s] Error updating net type!\n", vmName);
+    // Back to the known-good state first. It may have other settings than vmconf
+    if (p->changes & PLAN_RESET) {
+        printf("[%s] Resetting to snapshot '%s'\n", p->name, p->resetTo);
+        if (!ResetVM(p->vm, p->resetTo)) {
+            fprintf(stderr, "[%s] Error resetting this VM\n", p->name);
+            return false;
+        }
+        p->wasReset = true;
+        ReadVMPlanState(p);
+    }
+
+    // Note, basic parameters updates can only be applied when the VM is powered off.
+    // If the VM is running and it's already configured as per vmconf then we don't
+    // touch it at all.
+    if (p->changes & PLAN_OFFLINE) {
+        printf("[%s] Applying configurations\n", p->name);
+        // Stop machine if already running
+        if (VMState(p->vm) == MachineState_Running) {
+            if (!StopVM(p->vm)) {
+                fprintf(stderr, "[%s] Error stopping this VM\n", p->name);
+                return false;
             }
+        }
+        // Settings can't change under a saved state, so this one boots afresh
+        else if (VMState(p->vm) == MachineState_Saved) {
+            printf("[%s] Discarding saved state\n", p->name);
+            if (!DiscardVMState(p->vm)) {
+                fprintf(stderr, "[%s] Error discarding saved state of this VM\n", p->name);
+                return false;
+            }
+        }
 
-            if (!StartVM(vm, "headless")) {
-                fprintf(stderr, "[%s] Error starting this VM!\n", vmName);
+        // Apply all changes in one transaction: one lock, and one settings save.
+        // The net type goes first, since TxnSetIP sets up the NICs according to it
+        VMTxn *txn = BeginVMTxn(p->vm);
+        if (ok && (p->changes & PLAN_NETTYPE)) {
+            ok = TxnSetNetType(txn, p->nettype);
+            if (!ok) { fprintf(stderr, "[%s] Error updating net type!\n", p->name); }
+        }
+        if (ok && (p->changes & (PLAN_IP | PLAN_NETTYPE))) {
+            ok = TxnSetIP(txn, p->ip);
+            if (!ok) { fprintf(stderr, "[%s] Error updating IP address!\n", p->name); }
+        }
+        if (ok && (p->changes & PLAN_PAGEFUSION)) {
+            ok = TxnSetPageFusion(txn, Equal(p->pagefusion, "on"));
+            if (!ok) { fprintf(stderr, "[%s] Error updating page fusion!\n", p->name); }
+        }
+        if (ok && (p->changes & (PLAN_CPUS | PLAN_MEMORY))) {
+            ok = TxnSetCPUMem(txn, p->cpus, p->memory);
+            if (!ok) {
+                fprintf(stderr, "[%s] Error updating CPU count and/or memory size!\n", p->name);
             }
         }
-    
-        // Run VMCOPY COMMAND
-        if (vmCopy[0] != '\0') {
-            int i = 0;
-            char **vmCopyList = strSplit(vmCopy, ' ', &i);
-
-            if (i != 2) {
-                fprintf(stderr, "[%s] Error with 'vmcopy' entry:\n"
-                    "It should be a SOURCE local file, separated by a single space,\n"
-                    "then the full path destination of the TARGET file within the VM,\n"
-                    "surrounded by double-quote. See example in skeleton file.\n", vmName);
-                Exit(EXIT_FAILURE);
+
+        // Let's not stop on any of these errors, so the rest still gets done
+        if (ok) { ok = CommitVMTxn(txn); }
+        else { AbortVMTxn(txn); }
+        if (!ok) {
+            fprintf(stderr, "[%s] Configurations not applied\n", p->name);
+        }
+    }
+
+    // Before starting, so the guest additions mount them as it boots
+    if (p->changes & PLAN_SHARE) {
+        printf("[%s] Adding shared folders\n", p->name);
+        if (!AddVMShares(p->vm, p->share)) {
+            fprintf(stderr, "[%s] Error adding shared folders!\n", p->name);
+            ok = false;
+        }
+    }
+
+    // Start machine if not already running
+    if (VMState(p->vm) != MachineState_Running) {
+        if (!StartVM(p->vm, "headless")) {
+            fprintf(stderr, "[%s] Error starting this VM!\n", p->name);
+            ok = false;
+        }
+    }
+    else if (!p->changes) {
+        printf("[%s] VM already configured as per vmconf. Done.\n", p->name);
+    }
+
+    // Changes that go to the running VM, through a shared lock
+    if (p->changes & (PLAN_CPUCAP | PLAN_PRIORITY)) {
+        printf("[%s] Setting CPU cap and priority\n", p->name);
+        if (!ModVMLive(p->vm, (p->changes & PLAN_CPUCAP) ? p->cpucap : 0,
+            (p->changes & PLAN_PRIORITY) ? p->priority : NULL)) {
+            fprintf(stderr, "[%s] Error setting CPU cap and/or priority!\n", p->name);
+            ok = false;
+        }
+    }
+    if (p->changes & PLAN_BALLOON) {
+        printf("[%s] Setting memory balloon to %dMB\n", p->name, p->balloon);
+        if (!SetVMBalloon(p->vm, (ULONG)p->balloon)) {
+            fprintf(stderr, "[%s] Error setting memory balloon!\n", p->name);
+            ok = false;
+        }
+    }
+    if (p->changes & PLAN_TRANSPORT) {
+        printf("[%s] Setting transport to '%s'\n", p->name, p->transport);
+        if (!SetVMTransport(p->vm, p->transport)) {
+            fprintf(stderr, "[%s] Error setting transport!\n", p->name);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+// Carry hash h on over the content and mode of host file or directory path,
+// with the names of a directory's entries, in sorted order
+static PRUint64 stepHashPath(PRUint64 h, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st)) { return HashFNV(h, "?", 1); }
+    h = HashFNV(h, &st.st_mode, sizeof(st.st_mode));
+    if (S_ISDIR(st.st_mode)) {
+        struct dirent **list = NULL;
+        int count = scandir(path, &list, NULL, alphasort);
+        for (int i = 0; i < count; ++i) {
+            char sub[2048];
+            if (!Equal(list[i]->d_name, ".") && !Equal(list[i]->d_name, "..") &&
+                snprintf(sub, sizeof(sub), "%s/%s", path, list[i]->d_name) < sizeof(sub)) {
+                h = HashFNV(h, list[i]->d_name, strlen(list[i]->d_name) + 1);
+                h = stepHashPath(h, sub);
             }
-            printf("%s: VMCOPY: '%s'\n", vmName, vmCopy);
-            char *source = vmCopyList[0];
-            char *destination = vmCopyList[1];
-
-            // Since the VM may only have started a moment ago, let's give SSH time to be ready
-            int delay = 600;
-            while (!SSHPortOpen(vmNetIp) && delay > 0) {
-                usleep(100000);  // Do nothing for .1 second
-                --delay;
+            free(list[i]);
+        }
+        free(list);
+        return h;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { return HashFNV(h, "?", 1); }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) { h = HashFNV(h, buf, n); }
+    fclose(fp);
+    return h;
+}
+
+
+// Hash of what the steps of this VM depend on in any case: the VM itself, by
+// UUID, and its vmconf settings
+static PRUint64 stepHashVM(VMPlan *p)
+{
+    BSTR id_16 = NULL;
+    IMachine_GetId(p->vm, &id_16);
+    char *id = NULL;
+    Convert16to8(id_16, &id);
+    FreeBSTR(id_16);
+    PRUint64 h = HashFNV(FNV_INIT, id, strlen(id) + 1);
+    free(id);
+    char config[1200];
+    snprintf(config, sizeof(config), "%s|%s|%u|%u|%s", p->image, p->ip, p->cpus, p->memory,
+        p->nettype);
+    return HashFNV(h, config, strlen(config) + 1);
+}
+
+
+// True if the step that last succeeded on this VM, as per given guest
+// property, had the same input hash
+static bool stepDone(VMPlan *p, char *path, const char *hash)
+{
+    char *done = GetVMProp(p->vm, path);
+    bool same = Equal(done, hash);
+    if (done) { free(done); }
+    return same;
+}
+
+
+// Run the vmcopy and vmrun steps on this VM, then take its reset_to snapshot
+// if it has none yet. A VM that was reset to it already went through them.
+// Each step is skipped if it already succeeded with the same inputs, unless
+// force is set: vmcopy with the same source content and destination, vmrun
+// with the same command line after the same vmcopy. Their input hashes are
+// kept in the VM's /vm/step guest properties, which snapshots keep as well.
+// Steps the provisioning journal has done are skipped in any case. False if
+// any step failed
+bool ProvisionSteps(VMPlan *p, bool force)
+{
+    if (p->wasReset) {
+        printf("[%s] Skipping vmcopy and vmrun, snapshot '%s' has them done\n",
+            p->name, p->resetTo);
+        return true;
+    }
+
+    PRUint64 h = stepHashVM(p);
+    char copyHash[17] = "", runHash[17] = "";
+    bool copied = false, ran = false, ready = false, ok = true;
+
+    // Run VMCOPY COMMAND
+    if (p->vmcopy[0] != '\0') {
+        int i = 0;
+        char **vmCopyList = strSplit(p->vmcopy, ' ', &i);
+
+        if (i != 2) {
+            fprintf(stderr, "[%s] Error with 'vmcopy' entry:\n"
+                "It should be a SOURCE local file, separated by a single space,\n"
+                "then the full path destination of the TARGET file within the VM,\n"
+                "surrounded by double-quote. See example in skeleton file.\n", p->name);
+            Exit(EXIT_FAILURE);
+        }
+        char *source = vmCopyList[0];
+        char *destination = vmCopyList[1];
+        h = HashFNV(h, p->vmcopy, strlen(p->vmcopy) + 1);
+        h = stepHashPath(h, source);
+        sprintf(copyHash, "%016llx", (unsigned long long)h);
+
+        if (ProvJournalHas(p->name, "vmcopy")) {
+            printf("%s: VMCOPY: '%s' done already, skipping\n", p->name, p->vmcopy);
+        }
+        else if (!force && stepDone(p, "/vm/step/vmcopy", copyHash)) {
+            printf("%s: VMCOPY: '%s' unchanged since it last succeeded, skipping\n",
+                p->name, p->vmcopy);
+        }
+        else {
+            printf("%s: VMCOPY: '%s'\n", p->name, p->vmcopy);
+            CaptureVMLog("vmcopy");
+            // Since the VM may only have started a moment ago, let's give SSH, or the
+            // guest additions, time to be ready
+            WaitVMTransport(p->vm, p->ip, 60);
+            ready = true;
+            int rc = p->vmcopySync ? SyncToVM(p->vm, source, destination, false, true) :
+                CopyToVM(p->vm, source, destination, true);
+            ReleaseVMLog(rc == 0);
+            if (rc) {
+                fprintf(stderr, "%s: Error with VMCOPY!\n", p->name);
+                ok = false;
             }
-            if (SCPVM(source, vmName, destination, true)) {
-                fprintf(stderr, "%s: Error with VMCOPY!\n", vmName);
+            else {
+                ProvJournalMark(p->name, "vmcopy");
+                copied = true;
             }
         }
+    }
 
-        // Run VMRUN COMMAND
-        if (vmRun[0] != '\0') {
-            printf("%s: VMRUN: '%s'\n", vmName, vmRun);
-            if (SSHVM(vm, vmRun, true)) {
-                fprintf(stderr, "%s: Error with VMRUN!\n", vmName);
+    // Run VMRUN COMMAND
+    if (p->vmrun[0] != '\0') {
+        h = HashFNV(h, p->vmrun, strlen(p->vmrun) + 1);
+        sprintf(runHash, "%016llx", (unsigned long long)h);
+        if (ProvJournalHas(p->name, "vmrun")) {
+            printf("%s: VMRUN: '%s' done already, skipping\n", p->name, p->vmrun);
+        }
+        else if (!ok) {
+            printf("%s: VMRUN: '%s' skipped, since VMCOPY failed\n", p->name, p->vmrun);
+        }
+        else if (!force && stepDone(p, "/vm/step/vmrun", runHash)) {
+            printf("%s: VMRUN: '%s' unchanged since it last succeeded, skipping\n",
+                p->name, p->vmrun);
+        }
+        else {
+            printf("%s: VMRUN: '%s'\n", p->name, p->vmrun);
+            CaptureVMLog("vmrun");
+            if (!ready) { WaitVMTransport(p->vm, p->ip, 60); }
+            int rc = RunVM(p->vm, p->vmrun, true);
+            ReleaseVMLog(rc == 0);
+            if (rc) {
+                fprintf(stderr, "%s: Error with VMRUN!\n", p->name);
+                ok = false;
+            }
+            else {
+                ProvJournalMark(p->name, "vmrun");
+                ran = true;
             }
         }
     }
 
-    free(sections);
-    ini_free(cfg);
+    // Record the steps that succeeded, in one go
+    if (copied || ran) {
+        VMTxn *txn = BeginLiveVMTxn(p->vm);
+        if (copied) { TxnSetProp(txn, "/vm/step/vmcopy", copyHash); }
+        if (ran) { TxnSetProp(txn, "/vm/step/vmrun", runHash); }
+        CommitVMTxn(txn);
+    }
+
+    // Only of a VM the steps all went well on, as it's what it gets reset to
+    if (ok && (p->changes & PLAN_SNAPSHOT)) {
+        printf("[%s] Taking snapshot '%s'\n", p->name, p->resetTo);
+        if (!TakeVMSnapshot(p->vm, p->resetTo)) {
+            fprintf(stderr, "[%s] Error taking snapshot '%s'!\n", p->name, p->resetTo);
+            ok = false;
+        }
+    }
+    return ok;
 }
 
 
@@ -293,27 +994,67 @@ void CreateVMConf(void)
     }
     fprintf(fp, "# vm.conf\n"
         "# Running '%s prov' in a directory with this file in it will automatically\n"
-        "# provision the VMs defined here. Each VM requires its own section name,\n"
-        "# which becomes the VM name. Then there are 7 other possible keys you can\n"
-        "# define. Two of which are mandatory (image and netip). The other 5 (cpus,\n"
-        "# memory, vmcopy, vmrun, and nettype) are optional. Lines starting with a\n"
-        "# hash(#) are treated as comments. Spaces can only be used within double\n"
-        "# quotes (\"). vmcopy and vmrun are perfect for copying/running bootstrapping\n"
-        "# scripts. Note these last 2 can only appear once a piece, as duplicate keys\n"
-        "# are not yet allowed. It is best to put everything inside just one bootstrapping\n"
-        "# script. You can also name this file anything you want and provision with\n"
-        "# '%s prov MYFILE'.\n\n"
+        "# provision the VMs defined here. Each VM requires its own section name, which\n"
+        "# becomes the VM name. Then there are 16 other possible keys you can define.\n"
+        "# Two of which are mandatory (image and netip). The other 14 (cpus, memory,\n"
+        "# vmcopy, vmcopy_mode, vmrun, nettype, pagefusion, balloon, cpucap, priority,\n"
+        "# profile, reset_to, transport and share) are optional. Page fusion (on/off)\n"
+        "# and a memory balloon size in MB let the host reclaim some of the VM's\n"
+        "# memory, with the guest additions installed. A CPU cap (percent of each host\n"
+        "# CPU) and a low priority keep busy VMs from starving others, and change\n"
+        "# without a restart. 'profile = fast' creates the VM with fast-boot hardware\n"
+        "# settings, for Linux guests; it has no effect on VMs that already exist.\n"
+        "# 'reset_to = NAME' makes every run reset the VM to snapshot NAME, taken once\n"
+        "# the VM is first provisioned, for a clean VM in seconds; vmcopy and vmrun are\n"
+        "# skipped after a reset. 'transport = guest' runs vmcopy and vmrun through the\n"
+        "# guest additions instead of SSH, logged on with the password in\n"
+        "# VMC_GUEST_PASSWORD, and 'auto' only when SSH doesn't answer. 'share' lists\n"
+        "# host directories, as hostpath:guestpath[:ro] separated by commas, that the\n"
+        "# guest additions mount in place, so large inputs needn't be copied with\n"
+        "# vmcopy. 'vmcopy_mode = sync' sends vmcopy, a file or a directory, as a\n"
+        "# delta sync over SSH, with only what changed since the last run. Lines\n"
+        "# starting with a hash(#) are treated as comments. Spaces can only be used\n"
+        "# within double quotes (\").\n"
+        "# vmcopy and vmrun are perfect for copying/running bootstrapping scripts. Note\n"
+        "# these last 2 can only appear once a piece, as duplicate keys are not yet\n"
+        "# allowed. It is best to put everything inside just one bootstrapping script.\n"
+        "# You can also name this file anything you want and provision with\n"
+        "# '%s prov MYFILE'.\n"
+        "# Optional keys above all sections limit how much of this host the VMs can\n"
+        "# take altogether: CPUs and memory (MB) left for the host, and how many times\n"
+        "# over the rest can be handed out. A plan that doesn't fit is refused, has\n"
+        "# the VMs that don't fit queued until others free up room, or has them all\n"
+        "# shrunk, as per 'capacity'. Defaults are shown.\n\n"
+        "#cpu_overcommit = 4.0\n"
+        "#mem_overcommit = 1.0\n"
+        "#reserve_cpus   = 2\n"
+        "#reserve_memory = 8192\n"
+        "#capacity       = refuse\n"
+        "# A VM that fails to provision is tried again, up to 'retries' times, first\n"
+        "# 'retry_delay' seconds later then twice as late each time. If it still\n"
+        "# fails, '%s prov resume' later carries on from where that run stopped.\n"
+        "#retries        = 2\n"
+        "#retry_delay    = 5\n\n"
         "#[dev1]\n"
         "#image   = centos72003.ova\n"
         "#netip   = 10.11.12.2\n"
         "#cpus    = 1\n"
         "#memory  = 1024\n"
         "#vmcopy  = \"./bootstrap.sh /tmp/bootstrap.sh\"\n"
-        "#vmrun   = \"/tmp/bootstrap.sh\"\n\n"
+        "#vmcopy_mode = sync\n"
+        "#vmrun   = \"/tmp/bootstrap.sh\"\n"
+        "#share   = ./data:/mnt/data:ro\n"
+        "#cpucap  = 50\n"
+        "#priority = low\n\n"
         "#[dev2]\n"
         "#image   = ubuntu1804.ova\n"
         "#netip   = 10.11.12.3\n"
-        "#nettype = bri\n", prgname, prgname);
+        "#nettype = bri\n"
+        "#profile = fast\n"
+        "#reset_to = clean\n"
+        "#transport = auto\n"
+        "#pagefusion = on\n"
+        "#balloon = 256\n", prgname, prgname, prgname);
     fclose(fp);
     // Not entirely clear to me why this conversion is needed
     int mode = strtol("0644", 0, 8);
@@ -0,0 +1,327 @@
+// vmshare.c
+
+#define _DEFAULT_SOURCE   // realpath and strtok_r under -std=c99
+
+#include "vmc.h"
+
+// Shared folders, so large inputs like toolchains and datasets are served to
+// VMs in place, from the host, instead of being copied into each of them. A
+// folder is given as 'hostpath:guestpath[:ro]'. It's named after the last
+// element of the guest path, and the guest additions mount it at the guest
+// path. Permanent folders are part of the VM's settings. Transient ones are
+// only added to a running VM, and are gone once it powers off.
+
+
+// List shared folders of a VM, add one, or delete one
+void vmShare(int argc, char *argv[])
+{
+    char vmName[64] = "";
+    if (argc < 1 || argc > 3) {
+        printf("Usage: %s share <vmName> [<hostPath:guestPath[:ro]> [t]]\n"
+            "       %s share <vmName> <name> del\n", prgname, prgname);
+        Exit(EXIT_FAILURE);
+    }
+    argCopy(vmName, 64, argv[0]);
+    IMachine *vm = GetVM(vmName);
+    if (!vm) {
+        printf("VM '%s' is not registered\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    if (argc == 1) {
+        PrintVMShares(vm);
+        Exit(EXIT_SUCCESS);
+    }
+
+    if (argc == 3 && Equal(argv[2], "del")) {
+        char name[64] = "";
+        argCopy(name, 64, argv[1]);
+        Exit(DelVMShare(vm, name) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    VMShare share;
+    if (!ParseShare(argv[1], &share)) { Exit(EXIT_FAILURE); }
+    bool transient = argc == 3 && Equal(argv[2], "t");
+    if (argc == 3 && !transient) {
+        printf("Option '%s' is invalid. Use 't' for a transient folder\n", argv[2]);
+        Exit(EXIT_FAILURE);
+    }
+    bool ok = false;
+    if (transient) { ok = AddVMTransientShare(vm, &share); }
+    else {
+        VMTxn *txn = BeginLiveVMTxn(vm);
+        ok = TxnAddShare(txn, &share);
+        if (ok) { ok = CommitVMTxn(txn); }
+        else { AbortVMTxn(txn); }
+    }
+    if (!ok) { Exit(EXIT_FAILURE); }
+    printf("Shared folder '%s' mounts '%s' at '%s'%s\n", share.name, share.hostPath,
+        share.guestPath, share.writable ? "" : ", read-only");
+    Exit(EXIT_SUCCESS);
+}
+
+
+// Parse 'hostpath:guestpath[:ro]' into share. A relative host path is taken
+// from the current directory, and must exist. Returns false after saying why
+bool ParseShare(const char *spec, VMShare *share)
+{
+    memset(share, 0, sizeof(*share));
+    char buf[1024];
+    argCopy(buf, sizeof(buf) - 1, (char *)spec);
+    share->writable = true;
+    size_t len = strlen(buf);
+    if (len > 3 && Equal(buf + len - 3, ":ro")) {
+        buf[len - 3] = '\0';
+        share->writable = false;
+    }
+    char *colon = strrchr(buf, ':');
+    if (!colon || colon == buf || colon[1] != '/') {
+        fprintf(stderr, "Shared folder '%s' is invalid. Use 'hostpath:guestpath[:ro]', "
+            "with an absolute guest path\n", spec);
+        return false;
+    }
+    *colon = '\0';
+    argCopy(share->guestPath, sizeof(share->guestPath) - 1, colon + 1);
+
+    char *hostPath = realpath(buf, NULL);   // Resolved to any length
+    if (!hostPath || !isDir(hostPath)) {
+        fprintf(stderr, "Shared folder host path '%s' is not a directory\n", buf);
+        if (hostPath) { free(hostPath); }
+        return false;
+    }
+    if (strlen(hostPath) >= sizeof(share->hostPath)) {
+        fprintf(stderr, "Shared folder host path '%s' is too long\n", hostPath);
+        free(hostPath);
+        return false;
+    }
+    strcpy(share->hostPath, hostPath);
+    free(hostPath);
+
+    // Named after the last guest path element, which must be a valid name
+    char guestPath[256];
+    strcpy(guestPath, share->guestPath);
+    while (strlen(guestPath) > 1 && guestPath[strlen(guestPath) - 1] == '/') {
+        guestPath[strlen(guestPath) - 1] = '\0';
+    }
+    argCopy(share->name, sizeof(share->name) - 1, strrchr(guestPath, '/') + 1);
+    if (!share->name[0]) {
+        fprintf(stderr, "Shared folder guest path '%s' needs a last element to name "
+            "the folder after\n", share->guestPath);
+        return false;
+    }
+    return true;
+}
+
+
+// Copy UTF-8 string attribute value_16 into buf of given size, and free it
+static void shareCopy(BSTR value_16, char *buf, size_t size)
+{
+    char *value = NULL;
+    Convert16to8(value_16, &value);
+    FreeBSTR(value_16);
+    snprintf(buf, size, "%s", value ? value : "");
+    free(value);
+}
+
+
+// Read name, host path, mount point and writable flag of given shared folder
+static void shareRead(ISharedFolder *sf, VMShare *share)
+{
+    memset(share, 0, sizeof(*share));
+    BSTR value_16 = NULL;
+    ISharedFolder_GetName(sf, &value_16);
+    shareCopy(value_16, share->name, sizeof(share->name));
+    ISharedFolder_GetHostPath(sf, &value_16);
+    shareCopy(value_16, share->hostPath, sizeof(share->hostPath));
+    ISharedFolder_GetAutoMountPoint(sf, &value_16);
+    shareCopy(value_16, share->guestPath, sizeof(share->guestPath));
+    BOOL writable = FALSE;
+    ISharedFolder_GetWritable(sf, &writable);
+    share->writable = writable;
+}
+
+
+// True if VM already has given permanent shared folder, exactly as given
+bool VMHasShare(IMachine *vm, VMShare *share)
+{
+    ULONG count = 0;
+    ISharedFolder **list = GetSFList(vm, &count);
+    bool found = false;
+    for (ULONG i = 0; i < count; ++i) {
+        VMShare have;
+        shareRead(list[i], &have);
+        found = found || (Equal(have.name, share->name) && Equal(have.hostPath, share->hostPath) &&
+            Equal(have.guestPath, share->guestPath) && have.writable == share->writable);
+        ISharedFolder_Release(list[i]);
+    }
+    if (list) { ArrayOutFree(list); }
+    return found;
+}
+
+
+// Add permanent shared folder to VM within given transaction, replacing one
+// of the same name. A running VM takes it right away
+bool TxnAddShare(VMTxn *txn, VMShare *share)
+{
+    BSTR name_16, hostPath_16, guestPath_16;
+    Convert8to16(share->name, &name_16);
+    Convert8to16(share->hostPath, &hostPath_16);
+    Convert8to16(share->guestPath, &guestPath_16);
+
+    // Fails harmlessly if there's no such folder yet
+    IMachine_RemoveSharedFolder(txn->vmMuta, name_16);
+    TraceBegin("IMachine_CreateSharedFolder");
+    HRESULT rc = IMachine_CreateSharedFolder(txn->vmMuta, name_16, hostPath_16,
+        share->writable, TRUE, guestPath_16);
+    TraceEnd();
+    FreeBSTR(name_16);
+    FreeBSTR(hostPath_16);
+    FreeBSTR(guestPath_16);
+    if (FAILED(rc)) {
+        fprintf(stderr, "Error adding shared folder '%s'\n", share->name);
+        PrintVBoxException();
+        return false;
+    }
+    txn->dirty = true;
+    return true;
+}
+
+
+// Number of shared folders in comma separated specs that VM doesn't have
+// exactly as given, or all of them if vm is NULL. Returns -1 if one is invalid
+int MissingVMShares(IMachine *vm, const char *specs)
+{
+    char buf[1024], *save = NULL;
+    argCopy(buf, sizeof(buf) - 1, (char *)specs);
+    int missing = 0;
+    for (char *spec = strtok_r(buf, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+        VMShare share;
+        if (!ParseShare(spec, &share)) { return -1; }
+        if (!vm || !VMHasShare(vm, &share)) { missing++; }
+    }
+    return missing;
+}
+
+
+// Add every shared folder in comma separated specs that VM doesn't have yet,
+// all in one transaction. Other folders the VM has are left alone
+bool AddVMShares(IMachine *vm, const char *specs)
+{
+    char buf[1024], *save = NULL;
+    argCopy(buf, sizeof(buf) - 1, (char *)specs);
+    VMTxn *txn = BeginLiveVMTxn(vm);
+    for (char *spec = strtok_r(buf, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+        VMShare share;
+        if (!ParseShare(spec, &share)) {
+            AbortVMTxn(txn);
+            return false;
+        }
+        if (VMHasShare(vm, &share)) { continue; }
+        if (!TxnAddShare(txn, &share)) {
+            AbortVMTxn(txn);
+            return false;
+        }
+    }
+    return CommitVMTxn(txn);
+}
+
+
+// Add transient shared folder to running VM. It's gone once the VM powers off
+bool AddVMTransientShare(IMachine *vm, VMShare *share)
+{
+    if (VMState(vm) != MachineState_Running) {
+        fprintf(stderr, "Transient shared folders need the VM running\n");
+        return false;
+    }
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Shared, &vmMuta);
+    IConsole *console = NULL;
+    ISession_GetConsole(session, &console);
+
+    BSTR name_16, hostPath_16, guestPath_16;
+    Convert8to16(share->name, &name_16);
+    Convert8to16(share->hostPath, &hostPath_16);
+    Convert8to16(share->guestPath, &guestPath_16);
+    TraceBegin("IConsole_CreateSharedFolder");
+    HRESULT rc = IConsole_CreateSharedFolder(console, name_16, hostPath_16,
+        share->writable, TRUE, guestPath_16);
+    TraceEnd();
+    FreeBSTR(name_16);
+    FreeBSTR(hostPath_16);
+    FreeBSTR(guestPath_16);
+    if (FAILED(rc)) {
+        fprintf(stderr, "Error adding transient shared folder '%s'\n", share->name);
+        PrintVBoxException();
+    }
+    CloseSession(session);
+    return SUCCEEDED(rc);
+}
+
+
+// Delete shared folder with given name from VM, be it permanent or transient
+bool DelVMShare(IMachine *vm, const char *name)
+{
+    BSTR name_16;
+    Convert8to16(name, &name_16);
+    VMTxn *txn = BeginLiveVMTxn(vm);
+    TraceBegin("IMachine_RemoveSharedFolder");
+    HRESULT rc = IMachine_RemoveSharedFolder(txn->vmMuta, name_16);
+    TraceEnd();
+    if (SUCCEEDED(rc)) { txn->dirty = true; }
+    bool ok = CommitVMTxn(txn) && SUCCEEDED(rc);
+
+    if (!ok && VMState(vm) == MachineState_Running) {
+        IMachine *vmMuta = NULL;
+        ISession *session = GetSession(vm, LockType_Shared, &vmMuta);
+        IConsole *console = NULL;
+        ISession_GetConsole(session, &console);
+        TraceBegin("IConsole_RemoveSharedFolder");
+        ok = SUCCEEDED(IConsole_RemoveSharedFolder(console, name_16));
+        TraceEnd();
+        CloseSession(session);
+    }
+    FreeBSTR(name_16);
+    if (!ok) { fprintf(stderr, "VM has no shared folder named '%s'\n", name); }
+    return ok;
+}
+
+
+// Print one line per shared folder in list
+static void printShares(ISharedFolder **list, ULONG count, const char *kind)
+{
+    for (ULONG i = 0; i < count; ++i) {
+        VMShare share;
+        shareRead(list[i], &share);
+        printf("%-20s  %-40s  %-24s  %-2s  %s\n", share.name, share.hostPath,
+            share.guestPath, share.writable ? "rw" : "ro", kind);
+        ISharedFolder_Release(list[i]);
+    }
+    if (list) { ArrayOutFree(list); }
+}
+
+
+// Print permanent shared folders of VM, and transient ones if it's running
+void PrintVMShares(IMachine *vm)
+{
+    printf("%-20s  %-40s  %-24s  %-2s  %s\n", "NAME", "HOSTPATH", "GUESTPATH", "", "KIND");
+    ULONG count = 0;
+    ISharedFolder **list = GetSFList(vm, &count);
+    printShares(list, count, "permanent");
+
+    if (VMState(vm) != MachineState_Running) { return; }
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Shared, &vmMuta);
+    IConsole *console = NULL;
+    ISession_GetConsole(session, &console);
+    SAFEARRAY *SA = SAOutParamAlloc();
+    TraceBegin("IConsole_GetSharedFolders");
+    HRESULT rc = IConsole_GetSharedFolders(console, ComSafeArrayAsOutIfaceParam(SA, ISharedFolder *));
+    TraceEnd();
+    list = NULL;
+    count = 0;
+    if (SUCCEEDED(rc)) { SACopyOutIfaceParamHelper((IUnknown ***)&list, &count, SA); }
+    SADestroy(SA);
+    printShares(list, count, "transient");
+    TrapDisown(session);
+    ISession_UnlockMachine(session);
+    ISession_Release(session);
+}
@@ -0,0 +1,151 @@
+// vmsnap.c
+
+#include "vmc.h"
+#include <pthread.h>
+
+// A VMSnap is a point-in-time copy of the attributes listing commands need,
+// for every VM in VMList, fetched in one pass before anything is printed.
+// Attributes are kept as parallel fixed-width arrays, one entry per VM, so
+// there's no per-string allocation left once the snapshot is taken. Large
+// lists are fetched by a few threads at once, to overlap API round trips.
+
+// Per-snapshot state shared by the fetching threads
+typedef struct SnapJob {
+    VMSnap *snap;
+    BSTR ipPath_16;          // "/vm/ip", interned, shared by all threads
+    ULONG next;              // Next VM index to fetch, taken atomically
+} SnapJob;
+
+
+// Convert UTF16 API string straight into fixed-width UTF8 buffer, and free it
+static void snapCopy16(BSTR str_16, char *buf, int size)
+{
+    Utf16To8(str_16, buf, size);
+    FreeBSTR(str_16);
+}
+
+
+// Fetch all attributes of VM at index i
+static void snapFetch(SnapJob *job, ULONG i)
+{
+    VMSnap *s = job->snap;
+    IMachine *vm = s->vm[i];
+
+    BOOL accessible = FALSE;
+    IMachine_GetAccessible(vm, &accessible);
+    s->accessible[i] = accessible;
+    if (!accessible) { return; }
+
+    BSTR str_16 = NULL;
+    IMachine_GetName(vm, &str_16);
+    snapCopy16(str_16, s->name[i], sizeof(s->name[i]));
+
+    str_16 = NULL;
+    IMachine_GetId(vm, &str_16);
+    snapCopy16(str_16, s->uuid[i], sizeof(s->uuid[i]));
+
+    str_16 = NULL;
+    IMachine_GetOSTypeId(vm, &str_16);
+    snapCopy16(str_16, s->osType[i], sizeof(s->osType[i]));
+
+    IMachine_GetCPUCount(vm, &s->cpus[i]);
+    IMachine_GetMemorySize(vm, &s->memory[i]);
+    IMachine_GetState(vm, &s->state[i]);
+
+    str_16 = NULL;
+    IMachine_GetGuestPropertyValue(vm, job->ipPath_16, &str_16);
+    snapCopy16(str_16, s->ip[i], sizeof(s->ip[i]));
+}
+
+
+// Keep fetching the next unclaimed VM until there are none left
+static void snapDrain(SnapJob *job)
+{
+    ULONG i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->snap->count) {
+        snapFetch(job, i);
+    }
+}
+
+
+// Worker thread body. Every thread calling the API must register with it first
+static void * snapWorker(void *arg)
+{
+    g_pVBoxFuncs->pfnClientThreadInitialize();
+    TraceBegin("VMSnap worker");
+    snapDrain((SnapJob *)arg);
+    TraceEnd();
+    g_pVBoxFuncs->pfnClientThreadUninitialize();
+    return NULL;
+}
+
+
+// Allocate empty snapshot with room for count VMs
+VMSnap * NewVMSnap(ULONG count)
+{
+    VMSnap *s = calloc(1, sizeof(VMSnap));
+    ExitIfNull(s, __FILE__, __LINE__);
+    ULONG n = count ? count : 1;   // Never ask calloc for 0
+    s->count      = count;
+    s->vm         = calloc(n, sizeof(*s->vm));
+    s->accessible = calloc(n, sizeof(*s->accessible));
+    s->cpus       = calloc(n, sizeof(*s->cpus));
+    s->memory     = calloc(n, sizeof(*s->memory));
+    s->state      = calloc(n, sizeof(*s->state));
+    s->name       = calloc(n, sizeof(*s->name));
+    s->uuid       = calloc(n, sizeof(*s->uuid));
+    s->osType     = calloc(n, sizeof(*s->osType));
+    s->ip         = calloc(n, sizeof(*s->ip));
+    if (!s->vm || !s->accessible || !s->cpus || !s->memory || !s->state ||
+        !s->name || !s->uuid || !s->osType || !s->ip) {
+        ExitIfNull(NULL, __FILE__, __LINE__);
+    }
+    // REMINDER: Caller must free with FreeVMSnap
+    return s;
+}
+
+
+// Take snapshot of all VMs in global VMList
+VMSnap * TakeVMSnap(void)
+{
+    if (!VMList) { UpdateVMList(); }
+
+    VMSnap *s = NewVMSnap(VMListCount);
+    memcpy(s->vm, VMList, sizeof(*s->vm) * s->count);
+
+    SnapJob job = { s, PropKey("/vm/ip"), 0 };
+
+    TraceBegin("TakeVMSnap");
+    // One extra thread per SNAP_VMSPERTHREAD VMs, with this thread also fetching
+    int threads = s->count / SNAP_VMSPERTHREAD;
+    if (threads > SNAP_MAXTHREADS) { threads = SNAP_MAXTHREADS; }
+    pthread_t tid[SNAP_MAXTHREADS];
+    int started = 0;
+    for (int t = 0; t < threads; ++t) {
+        // Running short of threads is fine, this one will just do more of the work
+        if (pthread_create(&tid[started], NULL, snapWorker, &job) == 0) { ++started; }
+    }
+    snapDrain(&job);
+    for (int t = 0; t < started; ++t) { pthread_join(tid[t], NULL); }
+    TraceEnd();
+
+    // REMINDER: Caller must free with FreeVMSnap
+    return s;
+}
+
+
+// Free snapshot taken with TakeVMSnap
+void FreeVMSnap(VMSnap *s)
+{
+    if (!s) { return; }
+    free(s->vm);
+    free(s->accessible);
+    free(s->cpus);
+    free(s->memory);
+    free(s->state);
+    free(s->name);
+    free(s->uuid);
+    free(s->osType);
+    free(s->ip);
+    free(s);
+}
@@ -0,0 +1,262 @@
+// vmsnapshot.c
+
+#include "vmc.h"
+
+// Snapshots for disposable VMs. A snapshot of a running VM also keeps its
+// memory, so resetting to it brings the VM back already booted. Resetting only
+// throws away what was written to the differencing disk since the snapshot, so
+// it takes seconds and writes next to nothing, unlike re-creating the VM.
+
+
+// Take a snapshot of a VM, or list its snapshots
+void vmSnapshot(int argc, char *argv[])
+{
+    char vmName[64] = "", snapName[64] = "";
+    if (argc == 1 || argc == 2) {
+        argCopy(vmName, 64, argv[0]);
+        if (argc == 2) { argCopy(snapName, 64, argv[1]); }
+    }
+    else {
+        printf("Usage: %s snap <vmName> [<snapName>]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+
+    IMachine *vm = GetVM(vmName);
+    if (!vm) {
+        printf("VM '%s' is not registered\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    if (!snapName[0]) {
+        PrintVMSnapshots(vm);
+        Exit(EXIT_SUCCESS);
+    }
+
+    // Names are what 'vmc reset' and reset_to go by, so keep them unique
+    ISnapshot *snapshot = FindVMSnapshot(vm, snapName);
+    if (snapshot) {
+        ISnapshot_Release(snapshot);
+        printf("VM '%s' already has a snapshot named '%s'\n", vmName, snapName);
+        Exit(EXIT_FAILURE);
+    }
+    bool live = VMState(vm) == MachineState_Running;
+    if (!TakeVMSnapshot(vm, snapName)) {
+        printf("Error taking snapshot '%s' of VM '%s'\n", snapName, vmName);
+        Exit(EXIT_FAILURE);
+    }
+    printf("Took %s snapshot '%s' of VM '%s'\n", live ? "live" : "offline", snapName, vmName);
+    Exit(EXIT_SUCCESS);
+}
+
+
+// Reset a VM to given snapshot, or to its current one, and start it
+void vmReset(int argc, char *argv[])
+{
+    char vmName[64] = "", snapName[64] = "";
+    if (argc == 1 || argc == 2) {
+        argCopy(vmName, 64, argv[0]);
+        if (argc == 2) { argCopy(snapName, 64, argv[1]); }
+    }
+    else {
+        printf("Usage: %s reset <vmName> [<snapName>]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+
+    IMachine *vm = GetVM(vmName);
+    if (!vm) {
+        printf("VM '%s' is not registered\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    if (!ResetVM(vm, snapName[0] ? snapName : NULL)) {
+        printf("Error resetting VM '%s'\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    // A live snapshot leaves the VM saved, and starting it resumes from there
+    if (!StartVM(vm, "headless")) {
+        printf("Error starting VM '%s'\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    Exit(EXIT_SUCCESS);
+}
+
+
+// Snapshot of VM with given name or UUID, or NULL if there's none
+// REMINDER: Caller must release returned object
+ISnapshot * FindVMSnapshot(IMachine *vm, const char *snapName)
+{
+    BSTR name_16;
+    Convert8to16(snapName, &name_16);
+    ISnapshot *snapshot = NULL;
+    TraceBegin("IMachine_FindSnapshot");
+    HRESULT rc = IMachine_FindSnapshot(vm, name_16, &snapshot);
+    TraceEnd();
+    FreeBSTR(name_16);
+    return SUCCEEDED(rc) ? snapshot : NULL;
+}
+
+
+// Wait for a snapshot operation started with return code rc to finish, and
+// release it. Unlike HandleProgress, the result decides the return code
+static bool snapshotWait(IProgress *progress, HRESULT rc)
+{
+    if (FAILED(rc)) {
+        PrintVBoxException();
+        return false;
+    }
+    LONG resultCode = S_OK;
+    TraceBegin("IProgress_WaitForCompletion");
+    IProgress_WaitForCompletion(progress, -1);
+    TraceEnd();
+    IProgress_GetResultCode(progress, &resultCode);
+    if (FAILED(resultCode)) {
+        char *text = GetProgressError(progress);
+        fprintf(stderr, "%s\n", text);
+        free(text);
+    }
+    IProgress_Release(progress);
+    return SUCCEEDED(resultCode);
+}
+
+
+// Take a snapshot of VM. It's a live one, memory included, if the VM is running
+bool TakeVMSnapshot(IMachine *vm, const char *snapName)
+{
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Shared, &vmMuta);
+    BSTR name_16, desc_16, id_16 = NULL;
+    Convert8to16(snapName, &name_16);
+    Convert8to16("", &desc_16);
+    IProgress *progress = NULL;
+    TraceBegin("IMachine_TakeSnapshot");
+    HRESULT rc = IMachine_TakeSnapshot(vmMuta, name_16, desc_16, FALSE, &id_16, &progress);
+    TraceEnd();
+    bool ok = snapshotWait(progress, rc);
+    FreeBSTR(name_16);
+    FreeBSTR(desc_16);
+    if (id_16) { FreeBSTR(id_16); }
+    CloseSession(session);
+    return ok;
+}
+
+
+// Power off VM right away. A disposable VM has nothing worth a clean shutdown
+static bool snapshotPowerOff(IMachine *vm)
+{
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Shared, &vmMuta);
+    IConsole *console = NULL;
+    ISession_GetConsole(session, &console);
+    IProgress *progress = NULL;
+    HRESULT rc = IConsole_PowerDown(console, &progress);
+    HandleProgress(progress, rc, -1);
+    CloseSession(session);
+    return VMState(vm) != MachineState_Running;
+}
+
+
+// Restore VM to given snapshot, or to its current one if snapName is NULL.
+// The VM is left saved if it was a live snapshot, or powered off otherwise
+bool ResetVM(IMachine *vm, const char *snapName)
+{
+    ISnapshot *snapshot = NULL;
+    if (snapName) { snapshot = FindVMSnapshot(vm, snapName); }
+    else { IMachine_GetCurrentSnapshot(vm, &snapshot); }
+    if (!snapshot) {
+        if (snapName) { fprintf(stderr, "There's no snapshot named '%s'\n", snapName); }
+        else { fprintf(stderr, "This VM has no snapshots\n"); }
+        return false;
+    }
+
+    if (VMState(vm) == MachineState_Running && !snapshotPowerOff(vm)) {
+        ISnapshot_Release(snapshot);
+        return false;
+    }
+
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
+    IProgress *progress = NULL;
+    TraceBegin("IMachine_RestoreSnapshot");
+    HRESULT rc = IMachine_RestoreSnapshot(vmMuta, snapshot, &progress);
+    TraceEnd();
+    bool ok = snapshotWait(progress, rc);
+    CloseSession(session);
+    ISnapshot_Release(snapshot);
+    // Files synced since the snapshot are gone from the VM's disk
+    if (ok) { DropSyncManifest(vm); }
+    return ok;
+}
+
+
+// UTF-8 UUID of given snapshot
+// REMINDER: Caller must free allocated memory
+static char * snapshotId(ISnapshot *snapshot)
+{
+    BSTR id_16 = NULL;
+    ISnapshot_GetId(snapshot, &id_16);
+    char *id = NULL;
+    Convert16to8(id_16, &id);
+    FreeBSTR(id_16);
+    return id;
+}
+
+
+// Print given snapshot and its children, indented by depth
+static void printSnapshotTree(ISnapshot *snapshot, const char *currentId, int depth)
+{
+    BSTR name_16 = NULL;
+    ISnapshot_GetName(snapshot, &name_16);
+    char *name = NULL;
+    Convert16to8(name_16, &name);
+    FreeBSTR(name_16);
+    char *id = snapshotId(snapshot);
+    PRInt64 stamp = 0;
+    ISnapshot_GetTimeStamp(snapshot, &stamp);
+    BOOL online = FALSE;
+    ISnapshot_GetOnline(snapshot, &online);
+
+    char taken[32];
+    time_t secs = (time_t)(stamp / 1000);
+    strftime(taken, sizeof(taken), "%Y-%m-%d %H:%M:%S", localtime(&secs));
+    printf("%*s%-*s  %-19s  %-7s  %s\n", depth * 2, "", 40 - depth * 2, name, taken,
+        online ? "live" : "offline", Equal(id, currentId) ? "current" : "");
+    free(name);
+    free(id);
+
+    SAFEARRAY *SA = SAOutParamAlloc();
+    ISnapshot_GetChildren(snapshot, ComSafeArrayAsOutIfaceParam(SA, ISnapshot *));
+    ISnapshot **children = NULL;
+    ULONG count = 0;
+    SACopyOutIfaceParamHelper((IUnknown ***)&children, &count, SA);
+    SADestroy(SA);
+    for (ULONG i = 0; i < count; ++i) {
+        printSnapshotTree(children[i], currentId, depth + 1);
+        ISnapshot_Release(children[i]);
+    }
+    if (children) { ArrayOutFree(children); }
+}
+
+
+// Print the snapshot tree of given VM
+void PrintVMSnapshots(IMachine *vm)
+{
+    ISnapshot *current = NULL;
+    IMachine_GetCurrentSnapshot(vm, &current);
+    if (!current) {
+        printf("No snapshots\n");
+        return;
+    }
+
+    // The tree is only reachable through the current snapshot, so climb to its root
+    ISnapshot *root = current, *parent = NULL;
+    ISnapshot_AddRef(root);
+    while (SUCCEEDED(ISnapshot_GetParent(root, &parent)) && parent) {
+        ISnapshot_Release(root);
+        root = parent;
+        parent = NULL;
+    }
+    char *currentId = snapshotId(current);
+    printf("%-40s  %-19s  %-7s\n", "NAME", "TAKEN", "STATE");
+    printSnapshotTree(root, currentId, 0);
+    free(currentId);
+    ISnapshot_Release(root);
+    ISnapshot_Release(current);
+}
@@ -31,6 +31,8 @@ int vmSSH(int argc, char *argv[])
         Exit(EXIT_FAILURE);
     }
 
+    // A command goes over the VM's transport. Logons need a terminal, so always SSH
+    if (*cmd) { return RunVM(vm, cmd, true); }
     return SSHVM(vm, cmd, TRUE);
 }
 
@@ -43,7 +45,10 @@ int SSHVM(IMachine *vm, char *cmd, bool verbose)
 
     char *ip = GetVMProp(vm, "/vm/ip");
 
-    if (!SSHPortOpen(ip)) {
+    TraceBeginDetail("SSHPortOpen", ip);
+    bool reachable = SSHPortOpen(ip);
+    TraceEnd();
+    if (!reachable) {
         fprintf(stderr, "VM not reachable over %s:22\n", ip);
         return 1;
     }
@@ -55,7 +60,7 @@ int SSHVM(IMachine *vm, char *cmd, bool verbose)
 
     if (!verbose) { sprintf(sshRun, "%s > /dev/null 2>&1", sshRun); }
 
-    int rc = system(sshRun);
+    int rc = RunCmd(sshRun);
     if (rc < -1) {
         fprintf(stderr, "Error running: %s\n", cmd);
         return 1;    // Some other failure
@@ -146,7 +151,10 @@ int SCPVM(char *srcPath, char *vmName, char *dstPath, bool verbose)
     sprintf(scp, "%s -o UserKnownHostsFile=/dev/null -i %s", scp, vmsshpri);
 
     char *ip = GetVMProp(vm, "/vm/ip");
-    if (!SSHPortOpen(ip)) {
+    TraceBeginDetail("SSHPortOpen", ip);
+    bool reachable = SSHPortOpen(ip);
+    TraceEnd();
+    if (!reachable) {
         fprintf(stderr, "Cannot SCP to VM IP '%s' over port 22\n", ip);
         return 1;
     }
@@ -158,7 +166,7 @@ int SCPVM(char *srcPath, char *vmName, char *dstPath, bool verbose)
     if (!verbose) { sprintf(sshCopy, "%s > /dev/null 2>&1", sshCopy); }
 
     // Do SSH Copy
-    int rc = system(sshCopy);
+    int rc = RunCmd(sshCopy);
     if (rc == -1) {
         fprintf(stderr, "Error running:\n  %s\n", sshCopy);
         return 1;
@@ -33,6 +33,16 @@ void vmStart(int argc, char *argv[])
         Exit(EXIT_FAILURE);
     }
 
+    // A saved VM resumes as it was, IP included, and can't have it changed anyway
+    if (VMState(vm) == MachineState_Saved) {
+        printf("Resuming VM '%s' from its saved state\n", vmName);
+        if (!StartVM(vm, option)) {
+            printf("Error resuming VM\n");
+            Exit(EXIT_FAILURE);
+        }
+        Exit(EXIT_SUCCESS);
+    }
+
     // Don't start VM unless the IP has been properly defined and is valid
     char *ip = GetVMProp(vm, "/vm/ip");
     if (Equal(ip, "<undefined>") || !ValidIpStr(ip)) {
@@ -55,32 +65,47 @@ void vmStart(int argc, char *argv[])
 }
 
 
-// Start VM. Assumes name & ip have been validated 
+// Start VM. Assumes name & ip have been validated. A VM with a saved state
+// resumes from it
 bool StartVM(IMachine *vm, char *option)
 {
-    // Get new ISession object - Type1
-    ISession *session = GetSession(NULL, LockType_Null, NULL);
+    return StartVMs(&vm, 1, option) == 1;
+}
+
+
+// Launch all given VMs at once, then wait for all of them, so their boots or
+// resumes overlap. Returns how many are running
+int StartVMs(IMachine **vms, int count, char *option)
+{
+    ISession **sessions = calloc(count + 1, sizeof(ISession *));
+    IProgress **progress = calloc(count + 1, sizeof(IProgress *));
+    HRESULT *rcs = calloc(count + 1, sizeof(HRESULT));
+    ExitIfNull(sessions, __FILE__, __LINE__);
+    ExitIfNull(progress, __FILE__, __LINE__);
+    ExitIfNull(rcs, __FILE__, __LINE__);
 
-    IProgress *progress = NULL;
     SAFEARRAY *env = NULL;        // Environment string
     BSTR fetype_16;
     Convert8to16(option, &fetype_16);  // Front-End Type [gui, headless, sdl, '']
-    
-    // Start the VM and hangle progress
-    HRESULT rc = IMachine_LaunchVMProcess(vm,
-        session,
-        fetype_16,
-        ComSafeArrayAsInParam(env),
-        &progress);
+    for (int i = 0; i < count; ++i) {
+        // Get new ISession object - Type1
+        sessions[i] = GetSession(NULL, LockType_Null, NULL);
+        rcs[i] = IMachine_LaunchVMProcess(vms[i],
+            sessions[i],
+            fetype_16,
+            ComSafeArrayAsInParam(env),
+            &progress[i]);
+    }
     FreeBSTR(fetype_16);
-    HandleProgress(progress, rc, -1);  // Timeout of -1 means wait indefinitely
-
-    CloseSession(session);
 
-    if (VMState(vm) == MachineState_Running) { 
-        return true;
-    }
-    else {
-        return false;
+    int running = 0;
+    for (int i = 0; i < count; ++i) {
+        HandleProgress(progress[i], rcs[i], -1);  // Timeout of -1 means wait indefinitely
+        CloseSession(sessions[i]);
+        if (VMState(vms[i]) == MachineState_Running) { running++; }
     }
+    free(sessions);
+    free(progress);
+    free(rcs);
+    return running;
 }
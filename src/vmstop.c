@@ -57,6 +57,7 @@ bool StopVM(IMachine *vm)
     }
     if (rc == 0) {   // If SSH shutdown command succeeded
         // Give it about 3 seconds to finish
+        TraceBegin("StopVM poweroff wait");
         int timeout = 12;
         while (timeout > 0 || VMState(vm) == MachineState_Running) {
             // Do nothing for .25 seconds. This granularity allows us
@@ -64,6 +65,7 @@ bool StopVM(IMachine *vm)
             usleep(250000);
             --timeout;
         }
+        TraceEnd();
     }
 
     // Finally, try normal powerDown API call
@@ -83,11 +85,13 @@ bool StopVM(IMachine *vm)
     }
 
     // Give last try about 3 seconds to finish also
+    TraceBegin("StopVM powerdown wait");
     int timeout = 12;
     while (timeout > 0 || VMState(vm) == MachineState_Running) {
         usleep(250000);
         --timeout;
     }
+    TraceEnd();
 
     if (VMState(vm) == MachineState_Running) {
         fprintf(stderr, "Future bug has arrived. Couldn't stop VM.\n"
@@ -0,0 +1,127 @@
+// vmsuspend.c
+
+#include "vmc.h"
+
+// Suspend and resume VMs through VirtualBox saved state. Suspending writes the
+// VM's memory out to disk and powers it off. Resuming reads it back in, so the
+// guest carries on right where it was, instead of booting its OS all over
+// again. Both work on many VMs at once, with all of their VirtualBox operations
+// running side by side, so a whole lab is back in about the time of one VM.
+
+
+// VMs named in argv that are in given state, or all VMs in that state if the
+// only argument is 'all'. Returns NULL after printing usage if argv is empty
+// REMINDER: Caller must free allocated memory
+static IMachine ** suspendTargets(int argc, char *argv[], PRUint32 state, int *count)
+{
+    *count = 0;
+    if (argc < 1) { return NULL; }
+    bool all = argc == 1 && Equal(argv[0], "all");
+    IMachine **vms = calloc(all ? VMListCount + 1 : argc, sizeof(IMachine *));
+    ExitIfNull(vms, __FILE__, __LINE__);
+
+    if (all) {
+        for (int i = 0; i < VMListCount; ++i) {
+            BOOL accessible = FALSE;
+            IMachine_GetAccessible(VMList[i], &accessible);
+            if (accessible && VMState(VMList[i]) == state) { vms[(*count)++] = VMList[i]; }
+        }
+        return vms;
+    }
+    for (int i = 0; i < argc; ++i) {
+        char vmName[64] = "";
+        argCopy(vmName, 64, argv[i]);
+        IMachine *vm = GetVM(vmName);
+        if (!vm) {
+            printf("VM '%s' is not registered\n", vmName);
+            Exit(EXIT_FAILURE);
+        }
+        if (VMState(vm) != state) {
+            printf("VM '%s' is %s, skipping it\n", vmName, VMStateStr[VMState(vm)]);
+            continue;
+        }
+        vms[(*count)++] = vm;
+    }
+    return vms;
+}
+
+
+// Save the state of the given running VMs
+void vmSuspend(int argc, char *argv[])
+{
+    int count = 0;
+    IMachine **vms = suspendTargets(argc, argv, MachineState_Running, &count);
+    if (!vms) {
+        printf("Usage: %s suspend <vmName ...|all>\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    int done = SuspendVMs(vms, count);
+    free(vms);
+    printf("Suspended %d of %d VM(s)\n", done, count);
+    Exit(done == count ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+// Resume the given VMs from their saved state
+void vmResume(int argc, char *argv[])
+{
+    int count = 0;
+    IMachine **vms = suspendTargets(argc, argv, MachineState_Saved, &count);
+    if (!vms) {
+        printf("Usage: %s resume <vmName ...|all>\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    int done = StartVMs(vms, count, "headless");
+    free(vms);
+    printf("Resumed %d of %d VM(s)\n", done, count);
+    Exit(done == count ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+// Save the state of all given running VMs at once, and wait for all of them.
+// Returns how many were saved
+int SuspendVMs(IMachine **vms, int count)
+{
+    ISession **sessions = calloc(count + 1, sizeof(ISession *));
+    IProgress **progress = calloc(count + 1, sizeof(IProgress *));
+    HRESULT *rcs = calloc(count + 1, sizeof(HRESULT));
+    ExitIfNull(sessions, __FILE__, __LINE__);
+    ExitIfNull(progress, __FILE__, __LINE__);
+    ExitIfNull(rcs, __FILE__, __LINE__);
+
+    TraceBegin("SuspendVMs");
+    for (int i = 0; i < count; ++i) {
+        IMachine *vmMuta = NULL;
+        sessions[i] = GetSession(vms[i], LockType_Shared, &vmMuta);
+        TraceBegin("IMachine_SaveState");
+        rcs[i] = IMachine_SaveState(vmMuta, &progress[i]);
+        TraceEnd();
+    }
+    int saved = 0;
+    for (int i = 0; i < count; ++i) {
+        HandleProgress(progress[i], rcs[i], -1);
+        CloseSession(sessions[i]);
+        if (VMState(vms[i]) == MachineState_Saved) { saved++; }
+    }
+    TraceEnd();
+
+    free(sessions);
+    free(progress);
+    free(rcs);
+    return saved;
+}
+
+
+// Throw away the saved state of given VM, leaving it powered off. Settings
+// can't be changed while a VM has a saved state
+bool DiscardVMState(IMachine *vm)
+{
+    IMachine *vmMuta = NULL;
+    ISession *session = GetSession(vm, LockType_Write, &vmMuta);
+    TraceBegin("IMachine_DiscardSavedState");
+    HRESULT rc = IMachine_DiscardSavedState(vmMuta, TRUE);
+    TraceEnd();
+    if (FAILED(rc)) { PrintVBoxException(); }
+    CloseSession(session);
+    return VMState(vm) == MachineState_PoweredOff;
+}
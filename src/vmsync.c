@@ -0,0 +1,745 @@
+// vmsync.c
+
+#define _DEFAULT_SOURCE   // popen and mmap under -std=c99
+
+#include "vmc.h"
+#include <dirent.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Delta sync of host files to a VM. Every file sent to a VM is recorded in a
+// manifest in ~/.vmc/sync, named after the VM's UUID: its size, modification
+// time, a hash of its content and, for files of SYNC_DELTAMIN bytes or more,
+// a weak rolling checksum and a strong hash of each of its blocks. A file is
+// only read again if its size or time changed, and only sent if its content
+// did. A changed large file is matched against the block checksums of the
+// version the VM already has, the way rsync does it, and only the blocks
+// that don't match travel. The VM rebuilds the file from the unchanged
+// blocks of its own copy plus the new ones, with nothing but sh, head and dd.
+//
+// All changes go over one SSH stream: a script, followed by the data it reads
+// from its standard input. Before applying a delta, the VM checks its copy
+// still has the POSIX cksum the manifest says. If it doesn't, the file is
+// sent again in full, over a second stream.
+
+static SyncEntry *syncEntries = NULL;   // Manifest of the VM being synced
+static SyncBlock **syncBlocks = NULL;   // Block signatures of each entry, or NULL
+static bool *syncSeen = NULL;           // Entry still has a source file on the host
+static int syncCount = 0, syncCap = 0;
+
+// Growing text buffer, for the script the VM runs
+typedef struct SyncBuf {
+    char *s;
+    size_t len, cap;
+} SyncBuf;
+
+// One part of a delta: a run of blocks the VM already has, or new data
+typedef struct SyncOp {
+    bool copy;
+    size_t start;      // First block, or first byte of new data
+    size_t count;      // Blocks, or bytes
+} SyncOp;
+
+// What one sync did, and what it has left to send
+typedef struct SyncWork {
+    bool force;        // Ignore the manifest, and send everything in full
+    bool verbose;
+    SyncBuf script;
+    FILE *data;        // Bytes the script reads, in order
+    char lastDir[1024];
+    int files, unchanged, full, delta, deleted;
+    PRInt64 sent, changed;
+} SyncWork;
+
+
+// Sync a host file or directory to a VM
+void vmSync(int argc, char *argv[])
+{
+    bool force = argc == 3 && Equal(argv[2], "f");
+    char *colon = argc >= 2 ? strchr(argv[1], ':') : NULL;
+    if ((argc != 2 && !force) || !colon || colon == argv[1] || colon[1] != '/') {
+        printf("Usage: %s sync <localPath> <vmName>:<dir> [f]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    char srcPath[1024] = "", vmName[64] = "", dstPath[1024] = "";
+    argCopy(srcPath, 1023, argv[0]);
+    *colon = '\0';
+    argCopy(vmName, 63, argv[1]);
+    argCopy(dstPath, 1023, colon + 1);
+
+    // A single file goes into the directory, under its own name. SyncToVM takes
+    // the full destination path of a file, as vmcopy gives it
+    if (isFile(srcPath) && !isDir(srcPath)) {
+        size_t len = strlen(dstPath);
+        while (len > 1 && dstPath[len - 1] == '/') { dstPath[--len] = '\0'; }
+        char *name = baseName(srcPath);   // Careful, just a pointer, not a new string
+        if (len + 1 + strlen(name) >= sizeof(dstPath)) {
+            printf("Destination path '%s/%s' is too long\n", dstPath, name);
+            Exit(EXIT_FAILURE);
+        }
+        snprintf(dstPath + len, sizeof(dstPath) - len, "%s%s", len > 1 ? "/" : "", name);
+    }
+
+    IMachine *vm = GetVM(vmName);
+    if (!vm) {
+        printf("VM '%s' is not registered\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    if (VMState(vm) != MachineState_Running) {
+        printf("VM '%s' is not running\n", vmName);
+        Exit(EXIT_FAILURE);
+    }
+    Exit(SyncToVM(vm, srcPath, dstPath, force, true) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+// Print into buffer, growing it as needed
+static void syncPrintf(SyncBuf *b, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (b->len + len + 1 > b->cap) {
+        b->cap = (b->len + len + 1) * 2;
+        b->s = realloc(b->s, b->cap);
+        ExitIfNull(b->s, __FILE__, __LINE__);
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->s + b->len, len + 1, fmt, ap);
+    va_end(ap);
+    b->len += len;
+}
+
+
+// Quote string for sh, within single quotes
+static void syncQuote(char *dst, size_t size, const char *src)
+{
+    size_t j = 0;
+    dst[j++] = '\'';
+    for (; *src && j + 6 < size; ++src) {
+        if (*src == '\'') {
+            memcpy(dst + j, "'\\''", 4);
+            j += 4;
+        }
+        else { dst[j++] = *src; }
+    }
+    dst[j++] = '\'';
+    dst[j] = '\0';
+}
+
+
+// POSIX cksum CRC of data, the same as the VM's cksum command prints for it
+static PRUint32 syncCRC(const unsigned char *data, size_t size)
+{
+    static PRUint32 table[256];
+    if (!table[1]) {
+        for (PRUint32 i = 0; i < 256; ++i) {
+            PRUint32 c = i << 24;
+            for (int k = 0; k < 8; ++k) { c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : c << 1; }
+            table[i] = c;
+        }
+    }
+    PRUint32 crc = 0;
+    for (size_t i = 0; i < size; ++i) { crc = (crc << 8) ^ table[(crc >> 24) ^ data[i]]; }
+    for (size_t len = size; len; len >>= 8) {
+        crc = (crc << 8) ^ table[((crc >> 24) ^ len) & 0xFF];
+    }
+    return ~crc;
+}
+
+
+// Weak checksum of block, as two 16-bit sums that can be rolled along a byte
+// at a time
+static PRUint32 syncWeak(const unsigned char *data, size_t len)
+{
+    PRUint32 a = 0, b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += (PRUint32)(len - i) * data[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+
+// Block size for a file of given size, so that no file has more than
+// SYNC_MAXBLOCKS blocks
+static PRUint32 syncBlockSize(PRInt64 size)
+{
+    PRInt64 bs = (size / SYNC_MAXBLOCKS + 1023) / 1024 * 1024;
+    return bs < SYNC_BLOCKMIN ? SYNC_BLOCKMIN : (PRUint32)bs;
+}
+
+
+// Build path of manifest file of given VM, creating its directory
+static void syncPath(IMachine *vm, char *path, int size)
+{
+    snprintf(path, size, "%s%csync", vmhome, PATHCHAR);
+    if (!isDir(path)) { mkdir(path, 0755); }
+    BSTR id_16 = NULL;
+    IMachine_GetId(vm, &id_16);
+    char *id = NULL;
+    Convert16to8(id_16, &id);
+    FreeBSTR(id_16);
+    snprintf(path + strlen(path), size - strlen(path), "%c%s", PATHCHAR, id);
+    free(id);
+}
+
+
+static void syncFree(void)
+{
+    for (int i = 0; i < syncCount; ++i) { free(syncBlocks[i]); }
+    free(syncEntries);
+    free(syncBlocks);
+    free(syncSeen);
+    syncEntries = NULL;
+    syncBlocks = NULL;
+    syncSeen = NULL;
+    syncCount = syncCap = 0;
+}
+
+
+// Add entry for given VM path, returning its index
+static int syncAdd(const char *path)
+{
+    if (syncCount == syncCap) {
+        syncCap = syncCap ? syncCap * 2 : 64;
+        syncEntries = realloc(syncEntries, syncCap * sizeof(SyncEntry));
+        syncBlocks = realloc(syncBlocks, syncCap * sizeof(SyncBlock *));
+        syncSeen = realloc(syncSeen, syncCap * sizeof(bool));
+        ExitIfNull(syncEntries, __FILE__, __LINE__);
+        ExitIfNull(syncBlocks, __FILE__, __LINE__);
+        ExitIfNull(syncSeen, __FILE__, __LINE__);
+    }
+    int i = syncCount++;
+    memset(&syncEntries[i], 0, sizeof(SyncEntry));
+    strcpy(syncEntries[i].path, path);
+    syncBlocks[i] = NULL;
+    syncSeen[i] = false;
+    return i;
+}
+
+
+// Index of entry for given VM path, or -1
+static int syncFind(const char *path)
+{
+    for (int i = 0; i < syncCount; ++i) {
+        if (Equal(syncEntries[i].path, path)) { return i; }
+    }
+    return -1;
+}
+
+
+// Remove entry, moving the last one in its place
+static void syncDrop(int i)
+{
+    free(syncBlocks[i]);
+    --syncCount;
+    syncEntries[i] = syncEntries[syncCount];
+    syncBlocks[i] = syncBlocks[syncCount];
+    syncSeen[i] = syncSeen[syncCount];
+}
+
+
+// Load manifest of given VM. A missing or unreadable one is just empty
+static void syncLoad(IMachine *vm)
+{
+    syncFree();
+    char path[512];
+    syncPath(vm, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { return; }
+    SyncHeader h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || h.magic != SYNC_MAGIC || h.version != SYNC_VERSION) {
+        fclose(fp);
+        return;
+    }
+    for (PRUint32 n = 0; n < h.count; ++n) {
+        SyncEntry e;
+        if (fread(&e, sizeof(e), 1, fp) != 1) { break; }
+        e.path[sizeof(e.path) - 1] = '\0';
+        int i = syncAdd(e.path);
+        syncEntries[i] = e;
+        if (!e.blockCount) { continue; }
+        syncBlocks[i] = calloc(e.blockCount, sizeof(SyncBlock));
+        ExitIfNull(syncBlocks[i], __FILE__, __LINE__);
+        if (fread(syncBlocks[i], sizeof(SyncBlock), e.blockCount, fp) != e.blockCount) {
+            syncDrop(i);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+
+// Write manifest of given VM next to the current one, then swap it in
+static bool syncSave(IMachine *vm)
+{
+    char path[512], tmpPath[520];
+    syncPath(vm, path, sizeof(path));
+    sprintf(tmpPath, "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error writing sync manifest '%s'\n", tmpPath);
+        return false;
+    }
+    SyncHeader h = { SYNC_MAGIC, SYNC_VERSION, syncCount };
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (int i = 0; ok && i < syncCount; ++i) {
+        ok = fwrite(&syncEntries[i], sizeof(SyncEntry), 1, fp) == 1;
+        if (ok && syncEntries[i].blockCount) {
+            ok = fwrite(syncBlocks[i], sizeof(SyncBlock), syncEntries[i].blockCount, fp) ==
+                syncEntries[i].blockCount;
+        }
+    }
+    ok = (fclose(fp) == 0) && ok && rename(tmpPath, path) == 0;
+    if (!ok) { fprintf(stderr, "Error writing sync manifest '%s'\n", path); }
+    return ok;
+}
+
+
+// Forget what was sent to given VM, for when its disk no longer has it
+void DropSyncManifest(IMachine *vm)
+{
+    char path[512];
+    syncPath(vm, path, sizeof(path));
+    unlink(path);
+}
+
+
+// Record block signatures of content now in entry i
+static void syncSign(int i, const unsigned char *data, PRInt64 size)
+{
+    SyncEntry *e = &syncEntries[i];
+    free(syncBlocks[i]);
+    syncBlocks[i] = NULL;
+    e->blockSize = e->blockCount = 0;
+    if (size < SYNC_DELTAMIN) { return; }
+
+    e->blockSize = syncBlockSize(size);
+    e->blockCount = (size + e->blockSize - 1) / e->blockSize;
+    syncBlocks[i] = calloc(e->blockCount, sizeof(SyncBlock));
+    ExitIfNull(syncBlocks[i], __FILE__, __LINE__);
+    for (PRUint32 k = 0; k < e->blockCount; ++k) {
+        size_t off = (size_t)k * e->blockSize;
+        size_t len = size - off < e->blockSize ? size - off : e->blockSize;
+        syncBlocks[i][k].weak = syncWeak(data + off, len);
+        syncBlocks[i][k].strong = HashFNV(FNV_INIT, data + off, len);
+    }
+}
+
+
+// Add op to list, merging it into the last one when it carries on from it
+static void syncOp(SyncOp **ops, int *count, int *cap, bool copy, size_t start, size_t n)
+{
+    SyncOp *last = *count ? &(*ops)[*count - 1] : NULL;
+    if (last && last->copy == copy && last->start + last->count == start) {
+        last->count += n;
+        return;
+    }
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *ops = realloc(*ops, *cap * sizeof(SyncOp));
+        ExitIfNull(*ops, __FILE__, __LINE__);
+    }
+    (*ops)[(*count)++] = (SyncOp){ copy, start, n };
+}
+
+
+// Split new content of entry i into runs of blocks of the VM's current copy,
+// as the manifest has it, and new data in between. Only whole blocks match
+// REMINDER: Caller must free allocated memory
+static SyncOp * syncMatch(int i, const unsigned char *data, size_t size, int *count)
+{
+    SyncEntry *e = &syncEntries[i];
+    SyncBlock *blocks = syncBlocks[i];
+    size_t bs = e->blockSize;
+    size_t whole = e->size / bs;   // The last block only matches if it's whole
+
+    // Chain blocks by weak checksum, in a table at least twice their number
+    size_t mask = 1;
+    while (mask < whole * 2) { mask <<= 1; }
+    int *head = malloc(mask * sizeof(int));
+    int *next = malloc((whole + 1) * sizeof(int));
+    ExitIfNull(head, __FILE__, __LINE__);
+    ExitIfNull(next, __FILE__, __LINE__);
+    mask--;
+    memset(head, -1, (mask + 1) * sizeof(int));
+    for (size_t k = whole; k-- > 0; ) {
+        size_t h = (blocks[k].weak ^ (blocks[k].weak >> 16)) & mask;
+        next[k] = head[h];
+        head[h] = (int)k;
+    }
+
+    SyncOp *ops = NULL;
+    int cap = 0;
+    *count = 0;
+    size_t pos = 0, lit = 0;
+    PRUint32 a = 0, b = 0;
+    bool fresh = true;   // Sums need computing anew at pos
+    while (whole && pos + bs <= size) {
+        if (fresh) {
+            PRUint32 weak = syncWeak(data + pos, bs);
+            a = weak & 0xFFFF;
+            b = weak >> 16;
+            fresh = false;
+        }
+        PRUint32 weak = (a & 0xFFFF) | (b << 16);
+        int match = -1;
+        bool hashed = false;
+        PRUint64 strong = 0;
+        for (int k = head[(weak ^ (weak >> 16)) & mask]; k >= 0; k = next[k]) {
+            if (blocks[k].weak != weak) { continue; }
+            if (!hashed) {
+                strong = HashFNV(FNV_INIT, data + pos, bs);
+                hashed = true;
+            }
+            if (blocks[k].strong == strong) {
+                match = k;
+                break;
+            }
+        }
+        if (match >= 0) {
+            if (pos > lit) { syncOp(&ops, count, &cap, false, lit, pos - lit); }
+            syncOp(&ops, count, &cap, true, match, 1);
+            pos += bs;
+            lit = pos;
+            fresh = true;
+            continue;
+        }
+        if (pos + bs == size) { break; }
+        // Roll the sums one byte along
+        a = (a - data[pos] + data[pos + bs]) & 0xFFFF;
+        b = (b - (PRUint32)bs * data[pos] + a) & 0xFFFF;
+        pos++;
+    }
+    if (size > lit) { syncOp(&ops, count, &cap, false, lit, size - lit); }
+    free(head);
+    free(next);
+    return ops;
+}
+
+
+// Script line that makes the directory of VM path exist, once per directory
+static void syncMkdir(SyncWork *w, const char *path)
+{
+    char dir[1024], q[4200];
+    strcpy(dir, path);
+    char *slash = strrchr(dir, '/');
+    if (!slash || slash == dir) { return; }
+    *slash = '\0';
+    if (Equal(dir, w->lastDir)) { return; }
+    strcpy(w->lastDir, dir);
+    syncQuote(q, sizeof(q), dir);
+    syncPrintf(&w->script, "mkdir -p %s || e=1\n", q);
+}
+
+
+// Queue entry i's new content to be sent in full
+static void syncFull(SyncWork *w, int i, const unsigned char *data, size_t size)
+{
+    char q[4200], tq[4220];
+    syncQuote(q, sizeof(q), syncEntries[i].path);
+    char tmp[1100];
+    snprintf(tmp, sizeof(tmp), "%s.vmcsync", syncEntries[i].path);
+    syncQuote(tq, sizeof(tq), tmp);
+    syncMkdir(w, syncEntries[i].path);
+    syncPrintf(&w->script, "head -c %zu > %s && chmod %o %s && mv -f %s %s || e=1\n",
+        size, tq, syncEntries[i].mode, tq, tq, q);
+    if (size) { fwrite(data, 1, size, w->data); }
+    w->full++;
+    w->sent += size;
+    if (w->verbose) { printf("  full   %s (%zu bytes)\n", syncEntries[i].path, size); }
+}
+
+
+// Queue entry i's new content to be sent as a delta against what the VM has,
+// or in full if hardly any of it matches
+static void syncDelta(SyncWork *w, int i, const unsigned char *data, size_t size)
+{
+    int count = 0;
+    SyncOp *ops = syncMatch(i, data, size, &count);
+    size_t literal = 0;
+    for (int k = 0; k < count; ++k) { literal += ops[k].copy ? 0 : ops[k].count; }
+    if (literal > size / 4 * 3) {
+        free(ops);
+        syncFull(w, i, data, size);
+        return;
+    }
+
+    SyncEntry *e = &syncEntries[i];
+    char q[4200], tq[4220], tmp[1100];
+    syncQuote(q, sizeof(q), e->path);
+    snprintf(tmp, sizeof(tmp), "%s.vmcsync", e->path);
+    syncQuote(tq, sizeof(tq), tmp);
+
+    // The VM's copy has to be the one the block signatures are from
+    syncPrintf(&w->script, "if [ \"$(cksum < %s 2>/dev/null)\" = \"%u %lld\" ]; then {\n",
+        q, e->crc, (long long)e->size);
+    for (int k = 0; k < count; ++k) {
+        if (ops[k].copy) {
+            syncPrintf(&w->script, "dd if=%s bs=%u skip=%zu count=%zu 2>/dev/null\n",
+                q, e->blockSize, ops[k].start, ops[k].count);
+        }
+        else {
+            syncPrintf(&w->script, "head -c %zu\n", ops[k].count);
+            fwrite(data + ops[k].start, 1, ops[k].count, w->data);
+        }
+    }
+    syncPrintf(&w->script, "} > %s && chmod %o %s && mv -f %s %s || e=1\n"
+        "else head -c %zu > /dev/null; echo stale %s; fi\n", tq, e->mode, tq, tq, q, literal, q);
+    free(ops);
+    w->delta++;
+    w->sent += literal;
+    if (w->verbose) {
+        printf("  delta  %s (%zu of %zu bytes)\n", e->path, literal, size);
+    }
+}
+
+
+// Compare host file with what the manifest says the VM has, and queue what
+// needs sending
+static void syncFile(SyncWork *w, const char *local, const char *remote, struct stat *st)
+{
+    w->files++;
+    int i = syncFind(remote);
+    if (i >= 0) { syncSeen[i] = true; }
+    PRUint32 mode = st->st_mode & 07777;
+    PRInt64 mtime = (PRInt64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    if (i >= 0 && !w->force && syncEntries[i].size == st->st_size &&
+        syncEntries[i].mtime == mtime && syncEntries[i].mode == mode) {
+        w->unchanged++;
+        return;
+    }
+
+    int fd = open(local, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error reading '%s'\n", local);
+        return;
+    }
+    size_t size = st->st_size;
+    unsigned char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error reading '%s'\n", local);
+        return;
+    }
+    PRUint64 hash = HashFNV(FNV_INIT, data, size);
+
+    // Only touched, or only its mode changed
+    if (i >= 0 && !w->force && syncEntries[i].size == st->st_size && syncEntries[i].hash == hash) {
+        if (syncEntries[i].mode != mode) {
+            char q[4200];
+            syncQuote(q, sizeof(q), remote);
+            syncPrintf(&w->script, "chmod %o %s || e=1\n", mode, q);
+        }
+        syncEntries[i].mtime = mtime;
+        syncEntries[i].mode = mode;
+        w->unchanged++;
+        if (data) { munmap(data, size); }
+        return;
+    }
+
+    w->changed += size;
+    bool delta = i >= 0 && !w->force && syncEntries[i].blockCount && size >= SYNC_DELTAMIN;
+    if (i < 0) {
+        i = syncAdd(remote);
+        syncSeen[i] = true;
+    }
+    syncEntries[i].mode = mode;
+    if (delta) { syncDelta(w, i, data, size); }
+    else { syncFull(w, i, data, size); }
+
+    // The manifest now describes the new content
+    syncEntries[i].size = st->st_size;
+    syncEntries[i].mtime = mtime;
+    syncEntries[i].hash = hash;
+    syncEntries[i].crc = syncCRC(data, size);
+    syncSign(i, data, size);
+    if (data) { munmap(data, size); }
+}
+
+
+// Queue every regular file under host path local, as VM path remote
+static void syncWalk(SyncWork *w, const char *local, const char *remote)
+{
+    struct stat st;
+    if (stat(local, &st)) {
+        fprintf(stderr, "Error reading '%s'\n", local);
+        return;
+    }
+    if (S_ISREG(st.st_mode)) {
+        syncFile(w, local, remote, &st);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) { return; }
+
+    DIR *d = opendir(local);
+    if (!d) {
+        fprintf(stderr, "Error reading '%s'\n", local);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (Equal(ent->d_name, ".") || Equal(ent->d_name, "..")) { continue; }
+        char subLocal[2048], subRemote[1024];
+        int ll = snprintf(subLocal, sizeof(subLocal), "%s/%s", local, ent->d_name);
+        int rl = snprintf(subRemote, sizeof(subRemote), "%s/%s", remote, ent->d_name);
+        if (ll >= sizeof(subLocal) || rl >= sizeof(subRemote)) {
+            fprintf(stderr, "Skipping '%s/%s', its path is too long\n", local, ent->d_name);
+            continue;
+        }
+        syncWalk(w, subLocal, subRemote);
+    }
+    closedir(d);
+}
+
+
+// Stream script and its data to the VM over SSH, with the VM's output going
+// to file out. Returns the script's exit code
+static int syncSend(IMachine *vm, SyncWork *w, const char *out)
+{
+    char *ip = GetVMProp(vm, "/vm/ip");
+    if (!ip) {
+        fprintf(stderr, "VM has no IP address to sync over\n");
+        return 1;
+    }
+    TraceBeginDetail("SSHPortOpen", ip);
+    bool reachable = SSHPortOpen(ip);
+    TraceEnd();
+    if (!reachable) {
+        fprintf(stderr, "VM not reachable over %s:22\n", ip);
+        free(ip);
+        return 1;
+    }
+
+    // The VM saves the script first, so the data after it is left for the script
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd), "ssh -o ConnectTimeout=2 -o StrictHostKeyChecking=no "
+        "-o UserKnownHostsFile=/dev/null -i %s %s@%s "
+        "'f=$(mktemp) && head -c %zu > \"$f\" && sh \"$f\"; r=$?; rm -f \"$f\"; exit $r' > %s",
+        vmsshpri, vmuser, ip, w->script.len, out);
+    free(ip);
+
+    TraceBeginDetail("popen", cmd);
+    FILE *ssh = popen(cmd, "w");
+    if (!ssh) {
+        TraceEnd();
+        fprintf(stderr, "Error running: %s\n", cmd);
+        return 1;
+    }
+    fwrite(w->script.s, 1, w->script.len, ssh);
+    rewind(w->data);
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), w->data)) > 0) {
+        if (fwrite(buf, 1, n, ssh) != n) { break; }
+    }
+    int status = pclose(ssh);
+    TraceEnd();
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : 1;
+}
+
+
+// Sync host file or directory srcPath to dstPath in running VM, sending only
+// what changed since the last sync, as per the VM's manifest. With force, the
+// manifest is ignored and everything is sent in full. Files the VM got from
+// an earlier sync of the same path, and that the host no longer has, are
+// deleted. Returns zero on success
+int SyncToVM(IMachine *vm, char *srcPath, char *dstPath, bool force, bool verbose)
+{
+    if (UseGuestTransport(vm)) {
+        fprintf(stderr, "Sync needs the SSH transport, copying '%s' in full\n", srcPath);
+        return CopyToVM(vm, srcPath, dstPath, verbose);
+    }
+    char dst[1024];
+    argCopy(dst, 1022, dstPath);
+    while (strlen(dst) > 1 && dst[strlen(dst) - 1] == '/') { dst[strlen(dst) - 1] = '\0'; }
+    if (!isFile(srcPath)) {
+        fprintf(stderr, "'%s' doesn't exist\n", srcPath);
+        return 1;
+    }
+
+    TraceBegin("SyncToVM");
+    syncLoad(vm);
+    SyncWork w = { .force = force, .verbose = verbose };
+    int rc = 0;
+    // A second pass resends in full whatever the VM's copy of was stale
+    for (int pass = 0; pass < 2; ++pass) {
+        PRInt64 changed = w.changed;
+        w.script.len = 0;
+        w.lastDir[0] = '\0';
+        w.files = w.unchanged = 0;
+        w.data = tmpfile();
+        ExitIfNull(w.data, __FILE__, __LINE__);
+        syncPrintf(&w.script, "e=0\n");
+        size_t empty = w.script.len;
+        for (int i = 0; i < syncCount; ++i) { syncSeen[i] = false; }
+        syncWalk(&w, srcPath, dst);
+        if (pass) { w.changed = changed; }   // Already counted
+
+        // Whatever this path sent before, and the host no longer has
+        char under[1030];
+        sprintf(under, "%s/", dst);
+        for (int i = syncCount - 1; i >= 0; --i) {
+            if (syncSeen[i]) { continue; }
+            if (!Equal(syncEntries[i].path, dst) &&
+                strncmp(syncEntries[i].path, under, strlen(under))) { continue; }
+            char q[4200];
+            syncQuote(q, sizeof(q), syncEntries[i].path);
+            syncPrintf(&w.script, "rm -f %s || e=1\n", q);
+            if (verbose) { printf("  delete %s\n", syncEntries[i].path); }
+            w.deleted++;
+            syncDrop(i);
+        }
+        if (w.script.len == empty) {
+            fclose(w.data);
+            break;
+        }
+        syncPrintf(&w.script, "exit $e\n");
+
+        char out[64];
+        strcpy(out, "/tmp/vmcsyncXXXXXX");
+        int fd = mkstemp(out);
+        if (fd < 0) {
+            fprintf(stderr, "Error creating temporary file\n");
+            rc = 1;
+            fclose(w.data);
+            break;
+        }
+        close(fd);
+        rc = syncSend(vm, &w, out);
+        fclose(w.data);
+
+        // Copies in the VM that weren't as the manifest said lose their entry
+        int stale = 0;
+        FILE *fp = fopen(out, "r");
+        char line[1100];
+        while (fp && fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (strncmp(line, "stale ", 6)) { continue; }
+            int i = syncFind(line + 6);
+            if (i >= 0) {
+                syncDrop(i);
+                w.delta--;
+                stale++;
+            }
+        }
+        if (fp) { fclose(fp); }
+        unlink(out);
+        if (rc || !stale) { break; }
+        if (verbose) { printf("  %d file(s) in the VM differed from the last sync, resending\n", stale); }
+    }
+
+    if (rc) { fprintf(stderr, "Error syncing '%s' to '%s'\n", srcPath, dst); }
+    else if (syncSave(vm) && verbose) {
+        printf("Synced %d file(s): %d unchanged, %d in full, %d as delta, %d deleted. "
+            "Sent %lldKB for %lldKB of changed files\n", w.files, w.unchanged, w.full, w.delta,
+            w.deleted, (long long)(w.sent + 1023) / 1024, (long long)(w.changed + 1023) / 1024);
+    }
+    free(w.script.s);
+    syncFree();
+    TraceEnd();
+    return rc;
+}
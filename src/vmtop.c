@@ -0,0 +1,362 @@
+// vmtop.c
+
+#include "vmc.h"
+
+// Live resource view of the host and its running VMs, from VirtualBox's own
+// performance collector. Metrics are set up once per object, then all of them
+// are read back with a single QueryMetricsData call on every tick.
+
+#define TOP_RESCAN    10   // Ticks between looking for newly started VMs
+#define TOP_MAXCACHE  512  // Returned objects remembered, see topRowOf
+
+// Metrics read on every tick, indexed by the TOP_* enum below. Not every
+// object has all of them, e.g. RAM/Usage/Total only exists for the host
+static const char *topMetrics[] = {
+    "CPU/Load/User", "CPU/Load/Kernel", "RAM/Usage/Used", "RAM/Usage/Total",
+    "Guest/RAM/Usage/Total", "Guest/RAM/Usage/Free", "Net/Rate/Rx", "Net/Rate/Tx",
+};
+enum { TOP_CPUUSER, TOP_CPUKERNEL, TOP_RAMUSED, TOP_RAMTOTAL, TOP_GUESTTOTAL,
+    TOP_GUESTFREE, TOP_NETRX, TOP_NETTX, TOP_METRICS };
+
+// Base metrics to collect, which cover all of the above
+static const char *topBaseMetrics[] = { "CPU/Load", "RAM/Usage", "Guest/RAM/Usage", "Net/Rate" };
+
+// One line of the view. Row 0 is always the host
+typedef struct TopRow {
+    char name[64];
+    nsISupports *obj;
+    double value[TOP_METRICS];
+} TopRow;
+
+static TopRow *topRows = NULL;
+static int topCount = 0;
+static char topSort[4] = "cpu";
+
+// Returned objects already matched to a row. Each holds a reference until the
+// next topScan, so its address can't be reused for another object meanwhile
+static nsISupports *cacheObj[TOP_MAXCACHE];
+static int cacheRow[TOP_MAXCACHE];
+static int cacheCount = 0;
+
+
+// UTF16 copies of above names, converted once
+static BSTR topMetrics_16[TOP_METRICS];
+static BSTR topBaseMetrics_16[sizeof(topBaseMetrics) / sizeof(topBaseMetrics[0])];
+
+
+// Build a safe array of given UTF16 strings
+static SAFEARRAY * topNameSA(BSTR *names_16, ULONG count)
+{
+    SAFEARRAY *SA = SACreateVector(VT_BSTR, 0, count);
+    SACopyInParamHelper(SA, names_16, sizeof(BSTR) * count);
+    return SA;
+}
+
+
+// Build a safe array of all current row objects
+static SAFEARRAY * topObjectSA(void)
+{
+    nsISupports **objs = malloc(sizeof(nsISupports *) * topCount);
+    ExitIfNull(objs, __FILE__, __LINE__);
+    for (int i = 0; i < topCount; ++i) { objs[i] = topRows[i].obj; }
+    SAFEARRAY *SA = SACreateVector(VT_UNKNOWN, 0, topCount);
+    SACopyInParamHelper(SA, objs, sizeof(nsISupports *) * topCount);
+    free(objs);
+    return SA;
+}
+
+
+// Let go of the returned objects remembered by topRowOf
+static void topClearCache(void)
+{
+    for (int i = 0; i < cacheCount; ++i) { nsISupports_Release(cacheObj[i]); }
+    cacheCount = 0;
+}
+
+
+// Rebuild rows from the host plus every running VM, and start collecting for them
+static void topScan(IPerformanceCollector *collector, ULONG interval)
+{
+    free(topRows);
+    topClearCache();
+
+    UpdateVMList();
+    VMSnap *snap = TakeVMSnap();
+    topRows = calloc(snap->count + 1, sizeof(TopRow));
+    ExitIfNull(topRows, __FILE__, __LINE__);
+    strcpy(topRows[0].name, "Host");
+    topRows[0].obj = (nsISupports *)ihost;
+    topCount = 1;
+    for (ULONG i = 0; i < snap->count; ++i) {
+        if (!snap->accessible[i] || snap->state[i] != MachineState_Running) { continue; }
+        strcpy(topRows[topCount].name, snap->name[i]);
+        topRows[topCount].obj = (nsISupports *)snap->vm[i];
+        ++topCount;
+    }
+    FreeVMSnap(snap);
+
+    // Only the latest sample is kept, so every query returns one value per metric
+    SAFEARRAY *nameSA = topNameSA(topBaseMetrics_16,
+        sizeof(topBaseMetrics_16) / sizeof(topBaseMetrics_16[0]));
+    SAFEARRAY *objSA = topObjectSA();
+    SAFEARRAY *affectedSA = SAOutParamAlloc();
+    TraceBegin("IPerformanceCollector_SetupMetrics");
+    HRESULT rc = IPerformanceCollector_SetupMetrics(collector,
+        ComSafeArrayAsInParam(nameSA),
+        ComSafeArrayAsInParam(objSA),
+        interval, 1,
+        ComSafeArrayAsOutIfaceParam(affectedSA, IPerformanceMetric *));
+    ExitIfFailure(rc, "IPerformanceCollector_SetupMetrics", __FILE__, __LINE__);
+    SADestroy(nameSA);
+    SADestroy(objSA);
+    SADestroy(affectedSA);
+}
+
+
+// Find row of object returned by the collector. The API may hand back a
+// different interface pointer to the same object than the one we passed in,
+// so fall back to asking for the IMachine/IHost one, and remember the answer
+static int topRowOf(nsISupports *obj)
+{
+    for (int i = 0; i < cacheCount; ++i) {
+        if (cacheObj[i] == obj) { return cacheRow[i]; }
+    }
+
+    int row = -1;
+    for (int i = 0; i < topCount && row < 0; ++i) {
+        if (topRows[i].obj == obj) { row = i; }
+    }
+    nsISupports *iface = NULL;
+    if (row < 0 && SUCCEEDED(nsISupports_QueryInterface(obj, &IID_IMachine, (void **)&iface))) {
+        for (int i = 1; i < topCount && row < 0; ++i) {
+            if (topRows[i].obj == iface) { row = i; }
+        }
+        nsISupports_Release(iface);
+    }
+    else if (row < 0 && SUCCEEDED(nsISupports_QueryInterface(obj, &IID_IHost, (void **)&iface))) {
+        row = 0;
+        nsISupports_Release(iface);
+    }
+
+    if (cacheCount < TOP_MAXCACHE) {
+        nsISupports_AddRef(obj);
+        cacheObj[cacheCount] = obj;
+        cacheRow[cacheCount] = row;
+        ++cacheCount;
+    }
+    return row;
+}
+
+
+// Read latest value of every metric of every row, in one call
+static void topQuery(IPerformanceCollector *collector)
+{
+    for (int i = 0; i < topCount; ++i) {
+        memset(topRows[i].value, 0, sizeof(topRows[i].value));
+    }
+
+    SAFEARRAY *nameSA = topNameSA(topMetrics_16, TOP_METRICS);
+    SAFEARRAY *objSA = topObjectSA();
+    SAFEARRAY *retNameSA = SAOutParamAlloc();
+    SAFEARRAY *retObjSA = SAOutParamAlloc();
+    SAFEARRAY *unitSA = SAOutParamAlloc();
+    SAFEARRAY *scaleSA = SAOutParamAlloc();
+    SAFEARRAY *seqSA = SAOutParamAlloc();
+    SAFEARRAY *indexSA = SAOutParamAlloc();
+    SAFEARRAY *lengthSA = SAOutParamAlloc();
+    SAFEARRAY *dataSA = SAOutParamAlloc();
+    TraceBegin("IPerformanceCollector_QueryMetricsData");
+    HRESULT rc = IPerformanceCollector_QueryMetricsData(collector,
+        ComSafeArrayAsInParam(nameSA),
+        ComSafeArrayAsInParam(objSA),
+        ComSafeArrayAsOutTypeParam(retNameSA, BSTR),
+        ComSafeArrayAsOutIfaceParam(retObjSA, nsISupports *),
+        ComSafeArrayAsOutTypeParam(unitSA, BSTR),
+        ComSafeArrayAsOutTypeParam(scaleSA, PRUint32),
+        ComSafeArrayAsOutTypeParam(seqSA, PRUint32),
+        ComSafeArrayAsOutTypeParam(indexSA, PRUint32),
+        ComSafeArrayAsOutTypeParam(lengthSA, PRUint32),
+        ComSafeArrayAsOutTypeParam(dataSA, PRInt32));
+    ExitIfFailure(rc, "IPerformanceCollector_QueryMetricsData", __FILE__, __LINE__);
+    SADestroy(nameSA);
+    SADestroy(objSA);
+
+    // Transfer safe arrays to regular C arrays
+    BSTR *names = NULL, *units = NULL;
+    nsISupports **objs = NULL;
+    PRUint32 *scales = NULL, *seqs = NULL, *indices = NULL, *lengths = NULL;
+    PRInt32 *data = NULL;
+    ULONG count = 0, bytes = 0;
+    SACopyOutParamHelper((void **)&names, &bytes, VT_BSTR, retNameSA);
+    SACopyOutIfaceParamHelper((IUnknown ***)&objs, &count, retObjSA);
+    SACopyOutParamHelper((void **)&units, &bytes, VT_BSTR, unitSA);
+    SACopyOutParamHelper((void **)&scales, &bytes, VT_UI4, scaleSA);
+    SACopyOutParamHelper((void **)&seqs, &bytes, VT_UI4, seqSA);
+    SACopyOutParamHelper((void **)&indices, &bytes, VT_UI4, indexSA);
+    SACopyOutParamHelper((void **)&lengths, &bytes, VT_UI4, lengthSA);
+    SACopyOutParamHelper((void **)&data, &bytes, VT_I4, dataSA);
+    SADestroy(retNameSA);
+    SADestroy(retObjSA);
+    SADestroy(unitSA);
+    SADestroy(scaleSA);
+    SADestroy(seqSA);
+    SADestroy(indexSA);
+    SADestroy(lengthSA);
+    SADestroy(dataSA);
+
+    for (ULONG i = 0; i < count; ++i) {
+        char *name = NULL;
+        Convert16to8(names[i], &name);
+        int metric = 0;
+        while (metric < TOP_METRICS && !Equal(name, topMetrics[metric])) { ++metric; }
+        int row = topRowOf(objs[i]);
+        // The one sample kept is the last of the returned series
+        if (metric < TOP_METRICS && row >= 0 && lengths[i] > 0) {
+            topRows[row].value[metric] =
+                (double)data[indices[i] + lengths[i] - 1] / (scales[i] ? scales[i] : 1);
+        }
+        free(name);
+        FreeBSTR(names[i]);
+        FreeBSTR(units[i]);
+        if (objs[i]) { nsISupports_Release(objs[i]); }
+    }
+    if (names) { ArrayOutFree(names); }
+    if (objs) { ArrayOutFree(objs); }
+    if (units) { ArrayOutFree(units); }
+    if (scales) { ArrayOutFree(scales); }
+    if (seqs) { ArrayOutFree(seqs); }
+    if (indices) { ArrayOutFree(indices); }
+    if (lengths) { ArrayOutFree(lengths); }
+    if (data) { ArrayOutFree(data); }
+}
+
+
+// Sort key of a VM row, per the chosen sort column
+static double topKey(const TopRow *r)
+{
+    if (Equal(topSort, "mem")) { return r->value[TOP_RAMUSED]; }
+    if (Equal(topSort, "net")) { return r->value[TOP_NETRX] + r->value[TOP_NETTX]; }
+    return r->value[TOP_CPUUSER] + r->value[TOP_CPUKERNEL];
+}
+
+
+// Busiest first, then by name
+static int topCompare(const void *a, const void *b)
+{
+    const TopRow *r1 = *(TopRow * const *)a, *r2 = *(TopRow * const *)b;
+    double x = topKey(r1), y = topKey(r2);
+    if (x != y) { return x < y ? 1 : -1; }
+    return strcmp(r1->name, r2->name);
+}
+
+
+// Get VM rows in display order. Rows themselves stay put, since topRowOf
+// remembers their positions
+static TopRow ** topSorted(void)
+{
+    TopRow **view = malloc(sizeof(TopRow *) * topCount);
+    ExitIfNull(view, __FILE__, __LINE__);
+    for (int i = 1; i < topCount; ++i) { view[i - 1] = &topRows[i]; }
+    qsort(view, topCount - 1, sizeof(TopRow *), topCompare);
+    // REMINDER: Caller must free allocated memory
+    return view;
+}
+
+
+// Print one refresh of the table. Memory is in MB and network in KB/s
+static void topPrint(TopRow **view, ULONG interval)
+{
+    // Start from the top of a cleared screen, unless output is redirected
+    if (isatty(STDOUT_FILENO)) { printf("\033[H\033[2J"); }
+
+    TopRow *h = &topRows[0];
+    printf("Host  CPU %.1f%%  RAM %.0f/%.0f MB  %d VMs running  (every %us, by %s)\n\n",
+        h->value[TOP_CPUUSER] + h->value[TOP_CPUKERNEL], h->value[TOP_RAMUSED] / 1024,
+        h->value[TOP_RAMTOTAL] / 1024, topCount - 1, interval, topSort);
+    printf("%-34s%7s%9s%15s%10s%10s\n", "NAME", "CPU%", "MEM", "GUEST MEM", "RX KB/s", "TX KB/s");
+    for (int i = 0; i < topCount - 1; ++i) {
+        TopRow *r = view[i];
+        char guest[32];
+        sprintf(guest, "%.0f/%.0f", (r->value[TOP_GUESTTOTAL] - r->value[TOP_GUESTFREE]) / 1024,
+            r->value[TOP_GUESTTOTAL] / 1024);
+        printf("%-34s%7.1f%9.0f%15s%10.1f%10.1f\n", r->name,
+            r->value[TOP_CPUUSER] + r->value[TOP_CPUKERNEL], r->value[TOP_RAMUSED] / 1024,
+            guest, r->value[TOP_NETRX] / 1024, r->value[TOP_NETTX] / 1024);
+    }
+    fflush(stdout);
+}
+
+
+// Print one refresh as a single line JSON object. Memory is in KB and network in B/s
+static void topPrintJSON(TopRow **view)
+{
+    TopRow *h = &topRows[0];
+    printf("{\"time\": %ld, \"host\": {\"cpu\": %.2f, \"ramUsed\": %.0f, \"ramTotal\": %.0f}, "
+        "\"vms\": [", (long)time(NULL), h->value[TOP_CPUUSER] + h->value[TOP_CPUKERNEL],
+        h->value[TOP_RAMUSED], h->value[TOP_RAMTOTAL]);
+    for (int i = 0; i < topCount - 1; ++i) {
+        TopRow *r = view[i];
+        printf("%s{\"name\": ", i > 0 ? ", " : "");
+        PrintJSONString(stdout, r->name);
+        printf(", \"cpu\": %.2f, \"ram\": %.0f, \"guestRamUsed\": %.0f, \"guestRamTotal\": %.0f, "
+            "\"rx\": %.0f, \"tx\": %.0f}", r->value[TOP_CPUUSER] + r->value[TOP_CPUKERNEL],
+            r->value[TOP_RAMUSED], r->value[TOP_GUESTTOTAL] - r->value[TOP_GUESTFREE],
+            r->value[TOP_GUESTTOTAL], r->value[TOP_NETRX], r->value[TOP_NETTX]);
+    }
+    printf("]}\n");
+    fflush(stdout);
+}
+
+
+// Show live resource usage of host and running VMs
+void vmTop(int argc, char *argv[])
+{
+    ULONG interval = 2;
+    long ticks = -1;   // Forever
+    bool json = false;
+    bool gotInterval = false;
+    for (int i = 0; i < argc; ++i) {
+        if (Equal(argv[i], "json")) { json = true; }
+        else if (Equal(argv[i], "cpu") || Equal(argv[i], "mem") || Equal(argv[i], "net")) {
+            argCopy(topSort, 3, argv[i]);
+        }
+        else if (atoi(argv[i]) > 0 && !gotInterval) {
+            interval = atoi(argv[i]);
+            gotInterval = true;
+        }
+        else if (atoi(argv[i]) > 0 && ticks < 0) { ticks = atoi(argv[i]); }
+        else {
+            printf("Usage: %s top [<secs> [<count>]] [json]\n"
+                   "       %s top [<secs>] cpu|mem|net [json]\n", prgname, prgname);
+            Exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < TOP_METRICS; ++i) { Convert8to16(topMetrics[i], &topMetrics_16[i]); }
+    for (int i = 0; i < sizeof(topBaseMetrics) / sizeof(topBaseMetrics[0]); ++i) {
+        Convert8to16(topBaseMetrics[i], &topBaseMetrics_16[i]);
+    }
+
+    IPerformanceCollector *collector = NULL;
+    TraceBegin("IVirtualBox_GetPerformanceCollector");
+    HRESULT rc = IVirtualBox_GetPerformanceCollector(vbox, &collector);
+    ExitIfFailure(rc, "IVirtualBox_GetPerformanceCollector", __FILE__, __LINE__);
+
+    for (long tick = 0; ticks < 0 || tick < ticks; ++tick) {
+        if (tick % TOP_RESCAN == 0) { topScan(collector, interval); }
+        sleep(interval);   // First samples take one full period
+        topQuery(collector);
+        TopRow **view = topSorted();
+        if (json) { topPrintJSON(view); } else { topPrint(view, interval); }
+        free(view);
+    }
+
+    IPerformanceCollector_Release(collector);
+    topClearCache();
+    free(topRows);
+    for (int i = 0; i < TOP_METRICS; ++i) { FreeBSTR(topMetrics_16[i]); }
+    for (int i = 0; i < sizeof(topBaseMetrics) / sizeof(topBaseMetrics[0]); ++i) {
+        FreeBSTR(topBaseMetrics_16[i]);
+    }
+    Exit(EXIT_SUCCESS);
+}
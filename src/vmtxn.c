@@ -0,0 +1,140 @@
+// vmtxn.c
+
+#include "vmc.h"
+
+// A reconfiguration transaction holds one write lock on a VM while any number of
+// hardware and guest property changes are applied to it, and then saves all of
+// them with a single IMachine_SaveSettings. Separate GetSession/CloseSession pairs
+// would instead re-write the VM's .vbox XML file once per change. The typical use:
+//   VMTxn *txn = BeginVMTxn(vm);
+//   bool ok = TxnSetNetType(txn, "ho") && TxnSetIP(txn, ip);
+//   if (ok) { CommitVMTxn(txn); } else { AbortVMTxn(txn); }
+
+// Unlock the VM and free the transaction, taking both off what a trapped
+// Exit() would clean up
+static void vmTxnFree(VMTxn *txn)
+{
+    TrapDisown(txn->session);
+    TrapDisown(txn);
+    ISession_UnlockMachine(txn->session);
+    ISession_Release(txn->session);
+    free(txn);
+}
+
+
+// Open a new transaction on given VM
+VMTxn * BeginVMTxn(IMachine *vm)
+{
+    VMTxn *txn = calloc(1, sizeof(VMTxn));
+    ExitIfNull(txn, __FILE__, __LINE__);
+    // REMINDER: Freed by CommitVMTxn or AbortVMTxn
+
+    txn->vm = vm;
+    txn->session = GetSession(vm, LockType_Write, &txn->vmMuta);
+    TrapOwn(txn);
+    return txn;
+}
+
+
+// Queue a guest property update, to be written by CommitVMTxn
+void TxnSetProp(VMTxn *txn, const char *path, const char *value)
+{
+    if (strlen(path) >= sizeof(txn->propPath[0]) || strlen(value) >= sizeof(txn->propValue[0])) {
+        fprintf(stderr, "%s:%d property '%s' too long\n", __FILE__, __LINE__, path);
+        Exit(EXIT_FAILURE);
+    }
+
+    // Replace value if this property is already queued
+    int i;
+    for (i = 0; i < txn->propCount; ++i) {
+        if (Equal(txn->propPath[i], path)) { break; }
+    }
+    if (i == TXN_MAXPROPS) {
+        fprintf(stderr, "%s:%d more than %d properties\n", __FILE__, __LINE__, TXN_MAXPROPS);
+        Exit(EXIT_FAILURE);
+    }
+    if (i == txn->propCount) { ++txn->propCount; }
+    strcpy(txn->propPath[i], path);
+    strcpy(txn->propValue[i], value);
+}
+
+
+// Get guest property value as this transaction would leave it
+char * TxnGetProp(VMTxn *txn, const char *path)
+{
+    for (int i = 0; i < txn->propCount; ++i) {
+        if (Equal(txn->propPath[i], path)) {
+            char *value = NewString(strlen(txn->propValue[i]) + 1);
+            strcpy(value, txn->propValue[i]);
+            // REMINDER: Caller must free allocated memory
+            return value;
+        }
+    }
+    return GetVMProp(txn->vmMuta, (char *)path);
+}
+
+
+// Open a new transaction on given VM, even if it's running. A running VM can
+// only be locked shared, through which VirtualBox only takes the settings it
+// can change at runtime, such as the CPU execution cap
+VMTxn * BeginLiveVMTxn(IMachine *vm)
+{
+    if (VMState(vm) != MachineState_Running) { return BeginVMTxn(vm); }
+
+    VMTxn *txn = calloc(1, sizeof(VMTxn));
+    ExitIfNull(txn, __FILE__, __LINE__);
+    // REMINDER: Freed by CommitVMTxn or AbortVMTxn
+
+    txn->vm = vm;
+    txn->session = GetSession(vm, LockType_Shared, &txn->vmMuta);
+    TrapOwn(txn);
+    return txn;
+}
+
+
+// Write queued properties, save all settings once, and unlock the VM
+bool CommitVMTxn(VMTxn *txn)
+{
+    TraceBegin("CommitVMTxn");
+    // The API can only set one property per call, so at least skip the ones that
+    // already have the wanted value, by reading them all in one single call first
+    if (txn->propCount) {
+        char **names = NULL, **values = NULL;
+        ULONG count = GetVMProps(txn->vmMuta, "/vm/*", &names, &values);
+        for (int i = 0; i < txn->propCount; ++i) {
+            bool same = false;
+            for (int j = 0; j < count; ++j) {
+                if (Equal(names[j], txn->propPath[i])) {
+                    same = Equal(values[j], txn->propValue[i]);
+                    break;
+                }
+            }
+            if (same) { continue; }
+            SetVMProp(txn->vmMuta, txn->propPath[i], txn->propValue[i]);
+            txn->dirty = true;
+        }
+        FreeVMProps(names, values, count);
+    }
+
+    bool ok = true;
+    if (txn->dirty) {
+        HRESULT rc = IMachine_SaveSettings(txn->vmMuta);
+        if (FAILED(rc)) {
+            fprintf(stderr, "%s:%d IMachine_SaveSettings error\n", __FILE__, __LINE__);
+            PrintVBoxException();
+            ok = false;
+        }
+    }
+
+    vmTxnFree(txn);
+    TraceEnd();
+    return ok;
+}
+
+
+// Unlock the VM without saving, which discards all changes made so far
+void AbortVMTxn(VMTxn *txn)
+{
+    if (txn->dirty) { IMachine_DiscardSettings(txn->vmMuta); }
+    vmTxnFree(txn);
+}
@@ -0,0 +1,208 @@
+// vmwatch.c
+
+#define _DEFAULT_SOURCE   // gmtime_r under -std=c99
+
+#include "vmc.h"
+#include <sys/time.h>
+
+// Stream of VM lifecycle changes, as newline-delimited JSON on stdout, one
+// object per event: state changes, registrations, guest property changes and
+// session state changes. It comes from a passive listener on the IVirtualBox
+// event source, so VirtualBox pushes changes as they happen and nothing polls
+// VBoxSVC. Events only carry the VM's UUID, so names are looked up once per VM
+// and kept, which also names a VM in the event that unregisters it.
+
+static volatile sig_atomic_t watchStop = 0;
+
+typedef struct WatchName {
+    char id[40];
+    char name[64];
+} WatchName;
+
+static WatchName *watchNames = NULL;
+static int watchNameCount = 0;
+
+
+static void watchSignal(int sig)
+{
+    watchStop = 1;
+}
+
+
+// Remember name of VM with given UUID, returning where it's kept
+static char * watchKeep(const char *id, const char *name)
+{
+    int i = 0;
+    while (i < watchNameCount && !Equal(watchNames[i].id, id)) { i++; }
+    if (i == watchNameCount) {
+        WatchName *names = realloc(watchNames, (i + 1) * sizeof(WatchName));
+        ExitIfNull(names, __FILE__, __LINE__);
+        watchNames = names;
+        snprintf(watchNames[i].id, sizeof(watchNames[i].id), "%s", id);
+        watchNames[i].name[0] = '\0';
+        watchNameCount++;
+    }
+    if (name) { snprintf(watchNames[i].name, sizeof(watchNames[i].name), "%s", name); }
+    return watchNames[i].name;
+}
+
+
+// Name of VM with given UUID, as kept, or else from VirtualBox. Empty if it's
+// neither. With refresh, it's always asked for
+static const char * watchName(const char *id, bool refresh)
+{
+    for (int i = 0; i < watchNameCount && !refresh; ++i) {
+        if (Equal(watchNames[i].id, id)) { return watchNames[i].name; }
+    }
+    IMachine *vm = NULL;
+    BSTR id_16;
+    Convert8to16(id, &id_16);
+    IVirtualBox_FindMachine(vbox, id_16, &vm);
+    FreeBSTR(id_16);
+    char *name = vm ? GetVMName(vm) : NULL;
+    if (vm) { IMachine_Release(vm); }
+    char *kept = watchKeep(id, name ? name : (refresh ? NULL : ""));
+    if (name) { free(name); }
+    return kept;
+}
+
+
+// Print given 16-bit string as a JSON string, then free it
+static void watchString(BSTR str_16)
+{
+    char *str = NULL;
+    Convert16to8(str_16, &str);
+    FreeBSTR(str_16);
+    PrintJSONString(stdout, str ? str : "");
+    free(str);
+}
+
+
+// Print event as one line of JSON. False if it's for a VM not being watched
+static bool watchPrint(IEvent *event, const char *pattern)
+{
+    PRUint32 type = 0;
+    IEvent_GetType(event, &type);
+    char id[40];
+    EventMachineId(event, id, sizeof(id));
+
+    // A VM registering anew may have a name that was another's
+    PRBool registered = FALSE;
+    if (type == VBoxEventType_OnMachineRegistered) {
+        IMachineRegisteredEvent *revent = NULL;
+        IEvent_QueryInterface(event, &IID_IMachineRegisteredEvent, (void **)&revent);
+        if (revent) {
+            IMachineRegisteredEvent_GetRegistered(revent, &registered);
+            IMachineRegisteredEvent_Release(revent);
+        }
+    }
+    const char *name = watchName(id, registered);
+    if (pattern && fnmatch(pattern, name, 0)) { return false; }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    struct tm tm;
+    gmtime_r(&tv.tv_sec, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("{\"time\":\"%s.%03ldZ\",\"vm\":", stamp, (long)tv.tv_usec / 1000);
+    PrintJSONString(stdout, name);
+    printf(",\"id\":\"%s\"", id);
+
+    if (type == VBoxEventType_OnMachineStateChanged) {
+        IMachineStateChangedEvent *sevent = NULL;
+        IEvent_QueryInterface(event, &IID_IMachineStateChangedEvent, (void **)&sevent);
+        PRUint32 state = MachineState_Null;
+        if (sevent) {
+            IMachineStateChangedEvent_GetState(sevent, &state);
+            IMachineStateChangedEvent_Release(sevent);
+        }
+        printf(",\"event\":\"state\",\"state\":\"%s\"", VMStateStr[state]);
+    }
+    else if (type == VBoxEventType_OnMachineRegistered) {
+        printf(",\"event\":\"registered\",\"registered\":%s", registered ? "true" : "false");
+    }
+    else if (type == VBoxEventType_OnGuestPropertyChanged) {
+        IGuestPropertyChangedEvent *pevent = NULL;
+        IEvent_QueryInterface(event, &IID_IGuestPropertyChangedEvent, (void **)&pevent);
+        printf(",\"event\":\"property\"");
+        if (pevent) {
+            BSTR name_16 = NULL, value_16 = NULL, flags_16 = NULL;
+            IGuestPropertyChangedEvent_GetName(pevent, &name_16);
+            IGuestPropertyChangedEvent_GetValue(pevent, &value_16);
+            IGuestPropertyChangedEvent_GetFlags(pevent, &flags_16);
+            IGuestPropertyChangedEvent_Release(pevent);
+            printf(",\"name\":");
+            watchString(name_16);
+            printf(",\"value\":");
+            watchString(value_16);
+            printf(",\"flags\":");
+            watchString(flags_16);
+        }
+    }
+    else if (type == VBoxEventType_OnSessionStateChanged) {
+        ISessionStateChangedEvent *sevent = NULL;
+        IEvent_QueryInterface(event, &IID_ISessionStateChangedEvent, (void **)&sevent);
+        PRUint32 state = SessionState_Null;
+        if (sevent) {
+            ISessionStateChangedEvent_GetState(sevent, &state);
+            ISessionStateChangedEvent_Release(sevent);
+        }
+        printf(",\"event\":\"session\",\"state\":\"%s\"", SessState[state]);
+    }
+    printf("}\n");
+    return true;
+}
+
+
+// Stream VM lifecycle changes as newline-delimited JSON, until interrupted
+void vmWatch(int argc, char *argv[])
+{
+    if (argc > 1) {
+        printf("Usage: %s watch [<vmName|glob>]\n", prgname);
+        Exit(EXIT_FAILURE);
+    }
+    char pattern[64];
+    if (argc == 1) { argCopy(pattern, 63, argv[0]); }
+
+    PRUint32 types[] = {
+        VBoxEventType_OnMachineStateChanged,
+        VBoxEventType_OnMachineRegistered,
+        VBoxEventType_OnGuestPropertyChanged,
+        VBoxEventType_OnSessionStateChanged,
+    };
+    IEventSource *source = NULL;
+    IEventListener *listener = ListenEvents(&source, types, sizeof(types) / sizeof(types[0]));
+
+    // Name the VMs there are now, while nothing is happening
+    for (ULONG i = 0; i < VMListCount; ++i) {
+        BSTR id_16 = NULL;
+        IMachine_GetId(VMList[i], &id_16);
+        char *id = NULL;
+        Convert16to8(id_16, &id);
+        FreeBSTR(id_16);
+        char *name = GetVMName(VMList[i]);
+        if (id && name) { watchKeep(id, name); }
+        free(id);
+        free(name);
+    }
+
+    // A reader that goes away ends the stream, as does Ctrl-C
+    signal(SIGINT, watchSignal);
+    signal(SIGTERM, watchSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Block in VirtualBox until an event comes. The timeout only bounds how
+    // long a signal takes to be noticed
+    while (!watchStop) {
+        IEvent *event = NextEvent(source, listener, WATCH_WAITMS);
+        if (!event) { continue; }
+        bool printed = watchPrint(event, argc == 1 ? pattern : NULL);
+        DoneEvent(source, listener, event);
+        if (printed && (fflush(stdout) == EOF || ferror(stdout))) { break; }
+    }
+
+    StopEvents(source, listener);
+    free(watchNames);
+    Exit(EXIT_SUCCESS);
+}